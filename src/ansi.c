@@ -0,0 +1,164 @@
+#include "ansi.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ESC '\x1B'
+#define BEL '\x07'
+
+enum {
+    ANSI_GROUND = 0,
+    ANSI_ESC,
+    ANSI_ESC_INTERMEDIATE,
+    ANSI_CSI,
+    ANSI_STRING,
+    ANSI_STRING_ESC,
+};
+
+static const char *find_esc(const char *ptr, const char *end) {
+#ifdef __SSE2__
+    const __m128i esc = _mm_set1_epi8(ESC);
+    while (end - ptr >= 16) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i*)ptr);
+        const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, esc));
+        if (mask != 0) {
+            return ptr + __builtin_ctz(mask);
+        }
+        ptr += 16;
+    }
+#endif
+    const char *found = memchr(ptr, ESC, end - ptr);
+    return found == NULL ? end : found;
+}
+
+const char *strip_ansi(struct Pipelog_Strip_Ansi *filter, const char *data, size_t *size) {
+    const char *ptr = data;
+    const char *end = data + *size;
+    int state = filter->state;
+
+    if (state == ANSI_GROUND) {
+        ptr = find_esc(data, end);
+        if (ptr == end) {
+            // clean chunk, pass through as is
+            return data;
+        }
+    }
+
+    if (filter->capacity < *size) {
+        char *buf = realloc(filter->buf, *size);
+        if (buf == NULL) {
+            return NULL;
+        }
+        filter->buf = buf;
+        filter->capacity = *size;
+    }
+
+    char *out = filter->buf;
+    const size_t prefix = ptr - data;
+    memcpy(out, data, prefix);
+    out += prefix;
+
+    while (ptr < end) {
+        if (state == ANSI_GROUND) {
+            const char *esc = find_esc(ptr, end);
+            const size_t len = esc - ptr;
+            memcpy(out, ptr, len);
+            out += len;
+            ptr = esc;
+            if (ptr == end) {
+                break;
+            }
+            state = ANSI_ESC;
+            ++ ptr;
+            continue;
+        }
+
+        const unsigned char ch = *ptr;
+
+        // A newline always terminates a pending sequence. This way a
+        // truncated escape sequence can never swallow whole log lines and
+        // every line starts in the ground state.
+        if (ch == '\n') {
+            *out ++ = '\n';
+            state = ANSI_GROUND;
+            ++ ptr;
+            continue;
+        }
+
+        switch (state) {
+            case ANSI_ESC:
+                if (ch == '[') {
+                    state = ANSI_CSI;
+                } else if (ch == ']' || ch == 'P' || ch == 'X' || ch == '^' || ch == '_') {
+                    state = ANSI_STRING;
+                } else if (ch >= 0x20 && ch <= 0x2F) {
+                    state = ANSI_ESC_INTERMEDIATE;
+                } else if (ch >= 0x30 && ch <= 0x7E) {
+                    state = ANSI_GROUND;
+                } else if (ch != ESC) {
+                    // malformed, drop the ESC but keep this byte
+                    state = ANSI_GROUND;
+                    continue;
+                }
+                break;
+
+            case ANSI_ESC_INTERMEDIATE:
+                if (ch >= 0x30 && ch <= 0x7E) {
+                    state = ANSI_GROUND;
+                } else if (ch == ESC) {
+                    state = ANSI_ESC;
+                } else if (ch < 0x20 || ch > 0x2F) {
+                    state = ANSI_GROUND;
+                    continue;
+                }
+                break;
+
+            case ANSI_CSI:
+                if (ch >= 0x40 && ch <= 0x7E) {
+                    state = ANSI_GROUND;
+                } else if (ch == ESC) {
+                    state = ANSI_ESC;
+                } else if (ch < 0x20 || ch > 0x3F) {
+                    state = ANSI_GROUND;
+                    continue;
+                }
+                break;
+
+            case ANSI_STRING:
+                if (ch == BEL) {
+                    state = ANSI_GROUND;
+                } else if (ch == ESC) {
+                    state = ANSI_STRING_ESC;
+                }
+                break;
+
+            case ANSI_STRING_ESC:
+                if (ch == '\\') {
+                    state = ANSI_GROUND;
+                } else {
+                    // not a string terminator, but the start of a new sequence
+                    state = ANSI_ESC;
+                    continue;
+                }
+                break;
+        }
+        ++ ptr;
+    }
+
+    filter->state = state;
+    *size = out - filter->buf;
+
+    return filter->buf;
+}
+
+void strip_ansi_free(struct Pipelog_Strip_Ansi *filter) {
+    free(filter->buf);
+    filter->buf = NULL;
+    filter->capacity = 0;
+    filter->state = ANSI_GROUND;
+}
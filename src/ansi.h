@@ -0,0 +1,33 @@
+#ifndef PIPELOG_ANSI_H
+#define PIPELOG_ANSI_H
+#pragma once
+
+#include "pipelog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct Pipelog_Strip_Ansi {
+    int    state;    //!< parser state, carried over between chunks
+    char  *buf;      //!< output buffer (only used if a chunk contains escapes)
+    size_t capacity; //!< allocated size of buf
+};
+
+/**
+ * Remove ANSI escape sequences (CSI, OSC/DCS/... strings and plain ESC
+ * sequences) from data. Sequences may be split across calls.
+ *
+ * Returns data itself if nothing had to be removed, otherwise a pointer to
+ * an internal buffer that is valid until the next call. *size is updated to
+ * the size of the returned data. Returns NULL and sets errno on error.
+ */
+const char *strip_ansi(struct Pipelog_Strip_Ansi *filter, const char *data, size_t *size);
+
+void strip_ansi_free(struct Pipelog_Strip_Ansi *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,509 @@
+#include "bloom.h"
+#include "scan.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static uint64_t hash_token(const char *token, size_t size) {
+    // 8 bytes at a time, with the finalizer of MurmurHash3
+    uint64_t hash = 0x9e3779b97f4a7c15 ^ size;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, token, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccd;
+        hash ^= hash >> 32;
+        token += 8;
+        size  -= 8;
+    }
+
+    if (size > 0) {
+        uint64_t word = 0;
+        memcpy(&word, token, size);
+        hash = (hash ^ word) * 0xff51afd7ed558ccd;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+// all bits of a token are in the same 64 bit word, i.e. in one cache line
+static inline size_t hash_word(uint64_t hash, size_t filter_size) {
+    return (hash >> 36) & (filter_size / 8 - 1);
+}
+
+static inline unsigned int hash_bit(uint64_t hash, size_t index) {
+    return (hash >> (index * 6)) & 63;
+}
+
+static inline void set_bits(unsigned char *filter, size_t filter_size, uint64_t hash) {
+    unsigned char *word = filter + hash_word(hash, filter_size) * 8;
+    for (size_t index = 0; index < PIPELOG_BLOOM_HASHES; ++ index) {
+        const unsigned int bit = hash_bit(hash, index);
+        word[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+static inline bool test_bits(const unsigned char *filter, size_t filter_size, uint64_t hash) {
+    const unsigned char *word = filter + hash_word(hash, filter_size) * 8;
+    for (size_t index = 0; index < PIPELOG_BLOOM_HASHES; ++ index) {
+        const unsigned int bit = hash_bit(hash, index);
+        if (!(word[bit / 8] & (1 << (bit % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t filter_size_for(uint64_t block_size) {
+    const uint64_t bits = block_size * PIPELOG_BLOOM_BITS_PER_BYTE;
+    size_t size = 64;
+    while (size * 8 < bits) {
+        size *= 2;
+    }
+    return size;
+}
+
+static int bloom_filename(const char *filename, char *buf, size_t size) {
+    if (snprintf(buf, size, "%s%s", filename, PIPELOG_BLOOM_SUFFIX) >= (int)size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t filter_offset(const struct Pipelog_Bloom *bloom, uint64_t block) {
+    return PIPELOG_BLOOM_HEADER_SIZE + block * bloom->filter_size;
+}
+
+// reads and checks the header, *count is set to the number of filters in the file
+static int read_header(int fd, uint64_t *block_size, size_t *filter_size, uint64_t *count) {
+    unsigned char header[PIPELOG_BLOOM_HEADER_SIZE];
+    struct stat meta;
+
+    if (fstat(fd, &meta) != 0 || pread_all(fd, header, sizeof(header), 0) != 0) {
+        return -1;
+    }
+
+    if (memcmp(header, PIPELOG_BLOOM_MAGIC, PIPELOG_BLOOM_MAGIC_SIZE) != 0 ||
+        get_uint64(header + 24) != PIPELOG_BLOOM_HASHES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *block_size  = get_uint64(header + 8);
+    *filter_size = get_uint64(header + 16);
+    if (*block_size == 0 || *filter_size == 0 || (*filter_size & (*filter_size - 1)) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *count = (meta.st_size - PIPELOG_BLOOM_HEADER_SIZE) / *filter_size;
+
+    return 0;
+}
+
+int bloom_open(struct Pipelog_Bloom *bloom, const char *filename, uint64_t block_size, uint64_t size) {
+    char buf[PATH_MAX];
+    struct stat meta;
+
+    memset(bloom, 0, sizeof(*bloom));
+    bloom->fd = -1;
+    bloom->block_size  = block_size;
+    bloom->filter_size = filter_size_for(block_size);
+
+    if (bloom_filename(filename, buf, sizeof(buf)) != 0) {
+        return -1;
+    }
+
+    bloom->filter = calloc(1, bloom->filter_size);
+    if (bloom->filter == NULL) {
+        return -1;
+    }
+
+    // filters of an empty log file belong to a file that was rotated away
+    bloom->fd = open(buf, O_CREAT | O_RDWR | O_CLOEXEC | (size == 0 ? O_TRUNC : 0), 0644);
+    if (bloom->fd < 0) {
+        goto error;
+    }
+
+    if (fstat(bloom->fd, &meta) != 0) {
+        goto error;
+    }
+
+    // lines of the existing file are expected to be complete
+    bloom->block = bloom->line_block = size / block_size;
+
+    if (meta.st_size == 0) {
+        unsigned char header[PIPELOG_BLOOM_HEADER_SIZE];
+        memcpy(header, PIPELOG_BLOOM_MAGIC, PIPELOG_BLOOM_MAGIC_SIZE);
+        put_uint64(header + 8,  block_size);
+        put_uint64(header + 16, bloom->filter_size);
+        put_uint64(header + 24, PIPELOG_BLOOM_HASHES);
+
+        if (pwrite_all(bloom->fd, header, sizeof(header), 0) != 0) {
+            goto error;
+        }
+    } else {
+        uint64_t file_block_size, count;
+        size_t file_filter_size;
+        if (read_header(bloom->fd, &file_block_size, &file_filter_size, &count) != 0) {
+            goto error;
+        }
+
+        if (file_block_size != block_size || file_filter_size != bloom->filter_size) {
+            errno = EINVAL;
+            goto error;
+        }
+
+        if (count > bloom->block) {
+            // continue the filter of the last block of an earlier run
+            if (pread_all(bloom->fd, bloom->filter, bloom->filter_size, filter_offset(bloom, bloom->block)) != 0 ||
+                ftruncate(bloom->fd, filter_offset(bloom, bloom->block)) != 0) {
+                goto error;
+            }
+        } else if (count < bloom->block) {
+            // blocks that were written without filters may contain anything
+            memset(bloom->filter, 0xff, bloom->filter_size);
+            for (uint64_t block = count; block < bloom->block; ++ block) {
+                if (pwrite_all(bloom->fd, bloom->filter, bloom->filter_size, filter_offset(bloom, block)) != 0) {
+                    goto error;
+                }
+            }
+            memset(bloom->filter, 0, bloom->filter_size);
+        }
+    }
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        if (bloom->fd >= 0) {
+            close(bloom->fd);
+        }
+        free(bloom->filter);
+        memset(bloom, 0, sizeof(*bloom));
+        bloom->fd = -1;
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+static int add_token(struct Pipelog_Bloom *bloom, const char *token, size_t size) {
+    if (bloom->line_block != bloom->block) {
+        // blocks without any line start have empty filters
+        if (pwrite_all(bloom->fd, bloom->filter, bloom->filter_size, filter_offset(bloom, bloom->block)) != 0) {
+            return -1;
+        }
+        memset(bloom->filter, 0, bloom->filter_size);
+        memset(bloom->recent, 0, sizeof(bloom->recent));
+        for (uint64_t block = bloom->block + 1; block < bloom->line_block; ++ block) {
+            if (pwrite_all(bloom->fd, bloom->filter, bloom->filter_size, filter_offset(bloom, block)) != 0) {
+                return -1;
+            }
+        }
+        bloom->block = bloom->line_block;
+    }
+
+    const uint64_t hash = hash_token(token, size);
+
+    // most tokens of a log repeat all the time
+    uint64_t *cached = &bloom->recent[hash % PIPELOG_BLOOM_RECENT];
+    if (*cached == hash) {
+        return 0;
+    }
+    *cached = hash;
+
+    set_bits(bloom->filter, bloom->filter_size, hash);
+
+    return 0;
+}
+
+static int end_token(struct Pipelog_Bloom *bloom, const char *token, size_t size) {
+    if (size >= PIPELOG_BLOOM_MIN_TOKEN && size <= PIPELOG_BLOOM_MAX_TOKEN) {
+        return add_token(bloom, token, size);
+    }
+    return 0;
+}
+
+int bloom_add(struct Pipelog_Bloom *bloom, uint64_t offset, const char *data, size_t size) {
+    size_t pos = 0;
+
+    if (bloom->token_size > 0) {
+        // complete the token from the end of the last write
+        while (pos < size && is_token_char(data[pos])) {
+            if (bloom->token_size < PIPELOG_BLOOM_MAX_TOKEN) {
+                bloom->token[bloom->token_size] = data[pos];
+            }
+            ++ bloom->token_size;
+            ++ pos;
+        }
+
+        if (pos == size) {
+            return 0;
+        }
+
+        if (end_token(bloom, bloom->token, bloom->token_size) != 0) {
+            return -1;
+        }
+        bloom->token_size = 0;
+    }
+
+    while (pos < size) {
+        const unsigned char ch = data[pos];
+
+        if (!is_token_char(ch)) {
+            if (ch == '\n') {
+                bloom->line_block = (offset + pos + 1) / bloom->block_size;
+            }
+            ++ pos;
+            continue;
+        }
+
+        const size_t start = pos;
+        do {
+            ++ pos;
+        } while (pos < size && is_token_char(data[pos]));
+
+        const size_t token_size = pos - start;
+        if (pos == size) {
+            // may continue in the next write
+            memcpy(bloom->token, data + start, token_size < PIPELOG_BLOOM_MAX_TOKEN ? token_size : PIPELOG_BLOOM_MAX_TOKEN);
+            bloom->token_size = token_size;
+            break;
+        }
+
+        if (end_token(bloom, data + start, token_size) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int bloom_close(struct Pipelog_Bloom *bloom) {
+    int status = 0;
+
+    if (bloom->fd >= 0) {
+        if (end_token(bloom, bloom->token, bloom->token_size) != 0) {
+            status = -1;
+        }
+
+        if (pwrite_all(bloom->fd, bloom->filter, bloom->filter_size, filter_offset(bloom, bloom->block)) != 0) {
+            status = -1;
+        }
+
+        const int errnum = errno;
+        if (close(bloom->fd) != 0) {
+            status = -1;
+        } else {
+            errno = errnum;
+        }
+    }
+
+    free(bloom->filter);
+    memset(bloom, 0, sizeof(*bloom));
+    bloom->fd = -1;
+
+    return status;
+}
+
+int bloom_candidates(const char *filename, const char *text, size_t text_size, bool word, uint64_t size, uint64_t *block_size, bool **maybe) {
+    char buf[PATH_MAX];
+    uint64_t hashes[PIPELOG_BLOOM_MAX_TOKEN];
+    size_t hash_count = 0;
+    unsigned char *filter = NULL;
+    size_t filter_size = 0;
+    uint64_t filter_count = 0;
+    int bloomfd = -1;
+    int status = -1;
+
+    *block_size = PIPELOG_BLOOM_BLOCK_SIZE;
+    *maybe = NULL;
+
+    // collect the tokens of text that the filters have to contain
+    for (size_t pos = 0; pos < text_size;) {
+        if (!is_token_char(text[pos])) {
+            ++ pos;
+            continue;
+        }
+        const size_t token_start = pos;
+        while (pos < text_size && is_token_char(text[pos])) {
+            ++ pos;
+        }
+        const size_t token_size = pos - token_start;
+        // without word the first and last token can be part of longer tokens
+        const bool whole = word || (token_start > 0 && pos < text_size);
+        // testing some of the tokens is enough
+        if (whole && token_size >= PIPELOG_BLOOM_MIN_TOKEN && token_size <= PIPELOG_BLOOM_MAX_TOKEN && hash_count < PIPELOG_BLOOM_MAX_TOKEN) {
+            hashes[hash_count ++] = hash_token(text + token_start, token_size);
+        }
+    }
+
+    if (hash_count > 0 && bloom_filename(filename, buf, sizeof(buf)) == 0) {
+        bloomfd = open(buf, O_RDONLY | O_CLOEXEC);
+        if (bloomfd >= 0 && read_header(bloomfd, block_size, &filter_size, &filter_count) != 0) {
+            // not usable, search everything
+            close(bloomfd);
+            bloomfd = -1;
+            *block_size = PIPELOG_BLOOM_BLOCK_SIZE;
+        }
+    }
+
+    const uint64_t block_count = (size + *block_size - 1) / *block_size;
+    *maybe = malloc(block_count + 1);
+    if (*maybe == NULL) {
+        goto cleanup;
+    }
+    memset(*maybe, true, block_count + 1);
+
+    if (bloomfd >= 0) {
+        filter = malloc(filter_size);
+        if (filter == NULL) {
+            goto cleanup;
+        }
+
+        for (uint64_t block = 0; block < block_count && block < filter_count; ++ block) {
+            if (pread_all(bloomfd, filter, filter_size, PIPELOG_BLOOM_HEADER_SIZE + block * filter_size) != 0) {
+                goto cleanup;
+            }
+
+            for (size_t index = 0; index < hash_count; ++ index) {
+                if (!test_bits(filter, filter_size, hashes[index])) {
+                    (*maybe)[block] = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        if (bloomfd >= 0) {
+            close(bloomfd);
+        }
+        if (status != 0) {
+            free(*maybe);
+            *maybe = NULL;
+        }
+        free(filter);
+        errno = errnum;
+    }
+
+    return status;
+}
+
+static int64_t search_region(const char *data, size_t size, size_t start, size_t end, const struct Pipelog_Needle *needle, const char *prefix, struct Pipelog_Output_Buffer *out) {
+    int64_t found = 0;
+    size_t pos = start;
+
+    while (pos < end) {
+        const char *match = needle_find(needle, data + pos, end - pos);
+        if (match == NULL) {
+            break;
+        }
+
+        const size_t match_start = match - data;
+        const size_t match_end   = match_start + needle->size;
+        if ((match_start > 0 && is_token_char(data[match_start - 1])) ||
+            (match_end < size && is_token_char(data[match_end]))) {
+            pos = match_start + 1;
+            continue;
+        }
+
+        const char *line = memrchr(data + start, '\n', match_start - start);
+        const size_t line_start = line == NULL ? start : (size_t)(line - data) + 1;
+        const char *newline = memchr(match, '\n', size - match_start);
+        const size_t line_end = newline == NULL ? size : (size_t)(newline - data);
+
+        if (output_line(out, prefix, data + line_start, line_end - line_start) != 0) {
+            return -1;
+        }
+
+        ++ found;
+        pos = line_end + 1;
+    }
+
+    return found;
+}
+
+int64_t bloom_search(const char *filename, const char *word, const char *prefix, int outfd) {
+    struct Pipelog_Mapped_File file;
+    struct Pipelog_Output_Buffer *out = NULL;
+    struct Pipelog_Needle needle;
+    bool *maybe = NULL;
+    uint64_t block_size = 0;
+    int64_t found = 0;
+    int64_t status = -1;
+    const size_t word_size = strlen(word);
+
+    if (word_size == 0 || memchr(word, '\n', word_size) != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (map_file(&file, filename) != 0) {
+        return -1;
+    }
+
+    out = malloc(sizeof(struct Pipelog_Output_Buffer));
+    if (out == NULL) {
+        goto cleanup;
+    }
+    out->fd   = outfd;
+    out->size = 0;
+
+    if (bloom_candidates(filename, word, word_size, true, file.size, &block_size, &maybe) != 0) {
+        goto cleanup;
+    }
+
+    needle_init(&needle, word, word_size);
+
+    const char *data = file.data;
+    const size_t size = file.size;
+    const uint64_t block_count = (size + block_size - 1) / block_size;
+    for (uint64_t block = 0; block < block_count; ++ block) {
+        if (!maybe[block]) {
+            continue;
+        }
+
+        const size_t start = next_line_start(data, size, block * block_size);
+        const size_t end   = next_line_start(data, size, (block + 1) * block_size);
+        const int64_t count = search_region(data, size, start, end, &needle, prefix, out);
+        if (count < 0) {
+            goto cleanup;
+        }
+        found += count;
+    }
+
+    if (output_flush(out) != 0) {
+        goto cleanup;
+    }
+
+    status = found;
+
+cleanup:
+    {
+        const int errnum = errno;
+        unmap_file(&file);
+        free(maybe);
+        free(out);
+        errno = errnum;
+    }
+
+    return status;
+}
@@ -0,0 +1,100 @@
+#ifndef PIPELOG_BLOOM_H
+#define PIPELOG_BLOOM_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_BLOOM_MAGIC "PLGBLM1\n"
+#define PIPELOG_BLOOM_MAGIC_SIZE 8
+#define PIPELOG_BLOOM_SUFFIX ".blm"
+#define PIPELOG_BLOOM_HEADER_SIZE 32
+
+#define PIPELOG_BLOOM_BLOCK_SIZE (4 * 1024 * 1024)
+// bits of the filter per byte of the block
+#define PIPELOG_BLOOM_BITS_PER_BYTE 0.25
+#define PIPELOG_BLOOM_HASHES 6
+// shorter and longer tokens are not added
+#define PIPELOG_BLOOM_MIN_TOKEN 3
+#define PIPELOG_BLOOM_MAX_TOKEN 128
+// number of recently added tokens that are remembered to skip them
+#define PIPELOG_BLOOM_RECENT 256
+
+/**
+ * The filter file starts with a header of the magic, the block size, the
+ * filter size in bytes and the number of hashes (64 bit little endian
+ * numbers each). Then follows one filter per block of the log file.
+ *
+ * Lines belong to the block they start in. Tokens are runs of letters,
+ * digits, '_' and non-ASCII bytes. A token sets PIPELOG_BLOOM_HASHES bits
+ * in one 64 bit word of the filter (a blocked Bloom filter), so adding and
+ * testing it touches a single cache line. The filter of the last block is
+ * written when the log file is closed.
+ */
+struct Pipelog_Bloom {
+    int       fd;
+    uint64_t  block_size;
+    size_t    filter_size;
+    uint64_t  block;      //!< index of the block of filter
+    uint64_t  line_block; //!< index of the block the current line started in
+    unsigned char *filter;
+    char      token[PIPELOG_BLOOM_MAX_TOKEN];
+    size_t    token_size; //!< can be larger than PIPELOG_BLOOM_MAX_TOKEN
+    uint64_t  recent[PIPELOG_BLOOM_RECENT]; //!< hashes of tokens added to filter
+};
+
+/**
+ * Open or create the filters of the log file filename, i.e. filename.blm.
+ * size is the current size of the log file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int bloom_open(struct Pipelog_Bloom *bloom, const char *filename, uint64_t block_size, uint64_t size);
+
+/**
+ * Add the tokens of data, which was written to the log file at offset.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int bloom_add(struct Pipelog_Bloom *bloom, uint64_t offset, const char *data, size_t size);
+
+/**
+ * Write the filter of the last block and close the file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int bloom_close(struct Pipelog_Bloom *bloom);
+
+/**
+ * Decide which blocks of the log file filename, which has a size of size
+ * bytes, may contain text. If word is true text has to be bounded by
+ * non-token characters in the line, otherwise only its inner tokens are
+ * known to be whole tokens. Sets *block_size to the block size of the
+ * filters and *maybe to a new array with one flag per block (plus one).
+ * Without usable filter file all flags are true.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int bloom_candidates(const char *filename, const char *text, size_t text_size, bool word, uint64_t size, uint64_t *block_size, bool **maybe);
+
+/**
+ * Write all lines of the log file filename that contain word, bounded by
+ * non-token characters, to outfd. If prefix isn't NULL every line is
+ * prefixed with it. Blocks whose filter doesn't contain all tokens of word
+ * are skipped. Without filter file all blocks are searched.
+ *
+ * Returns the number of lines found, or -1 on error and sets errno.
+ */
+int64_t bloom_search(const char *filename, const char *word, const char *prefix, int outfd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
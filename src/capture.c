@@ -0,0 +1,169 @@
+#include "capture.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static int append(struct Pipelog_Capture *capture, const char *data, size_t size) {
+    if (reserve(&capture->buf, &capture->capacity, capture->buf_size + size) != 0) {
+        return -1;
+    }
+
+    memcpy(capture->buf + capture->buf_size, data, size);
+    capture->buf_size += size;
+
+    return 0;
+}
+
+static void ring_pop(struct Pipelog_Capture *capture) {
+    const size_t size = capture->lines[capture->lines_start];
+    capture->lines_start = (capture->lines_start + 1) % capture->before_lines;
+    -- capture->lines_count;
+    capture->ring_start = (capture->ring_start + size) % capture->ring_capacity;
+    capture->ring_size -= size;
+}
+
+static void ring_push(struct Pipelog_Capture *capture, const char *line, size_t size) {
+    if (capture->before_lines == 0) {
+        return;
+    }
+
+    if (size > capture->ring_capacity) {
+        // can't keep this line, so older lines aren't its context anymore
+        capture->ring_start  = 0;
+        capture->ring_size   = 0;
+        capture->lines_start = 0;
+        capture->lines_count = 0;
+        return;
+    }
+
+    while (capture->lines_count == capture->before_lines || capture->ring_capacity - capture->ring_size < size) {
+        ring_pop(capture);
+    }
+
+    const size_t offset = (capture->ring_start + capture->ring_size) % capture->ring_capacity;
+    const size_t tail = capture->ring_capacity - offset;
+    if (size <= tail) {
+        memcpy(capture->ring + offset, line, size);
+    } else {
+        memcpy(capture->ring + offset, line, tail);
+        memcpy(capture->ring, line + tail, size - tail);
+    }
+    capture->ring_size += size;
+
+    capture->lines[(capture->lines_start + capture->lines_count) % capture->before_lines] = size;
+    ++ capture->lines_count;
+}
+
+static int ring_flush(struct Pipelog_Capture *capture) {
+    const size_t tail = capture->ring_capacity - capture->ring_start;
+    if (capture->ring_size <= tail) {
+        if (append(capture, capture->ring + capture->ring_start, capture->ring_size) != 0) {
+            return -1;
+        }
+    } else if (
+        append(capture, capture->ring + capture->ring_start, tail) != 0 ||
+        append(capture, capture->ring, capture->ring_size - tail) != 0
+    ) {
+        return -1;
+    }
+
+    capture->ring_start  = 0;
+    capture->ring_size   = 0;
+    capture->lines_start = 0;
+    capture->lines_count = 0;
+
+    return 0;
+}
+
+static int handle_line(struct Pipelog_Capture *capture, const char *line, size_t size) {
+    regmatch_t match = {
+        .rm_so = 0,
+        .rm_eo = size > 0 && line[size - 1] == '\n' ? size - 1 : size,
+    };
+
+    if (regexec(&capture->trigger, line, 1, &match, REG_STARTEND) == 0) {
+        if (ring_flush(capture) != 0 || append(capture, line, size) != 0) {
+            return -1;
+        }
+        capture->after_left = capture->after_lines;
+    } else if (capture->after_left > 0) {
+        if (append(capture, line, size) != 0) {
+            return -1;
+        }
+        -- capture->after_left;
+    } else {
+        ring_push(capture, line, size);
+    }
+
+    return 0;
+}
+
+int capture_init(struct Pipelog_Capture *capture, const struct Pipelog_Capture_Options *options, char *errbuf, size_t errbuf_size) {
+    memset(capture, 0, sizeof(*capture));
+
+    const int errcode = regcomp(&capture->trigger, options->trigger, REG_EXTENDED | REG_NOSUB);
+    if (errcode != 0) {
+        regerror(errcode, &capture->trigger, errbuf, errbuf_size);
+        errno = errcode == REG_ESPACE ? ENOMEM : EINVAL;
+        return -1;
+    }
+    capture->compiled = true;
+
+    capture->before_lines = options->before_lines;
+    capture->after_lines  = options->after_lines;
+
+    if (capture->before_lines > 0 && options->before_bytes > 0) {
+        capture->ring  = malloc(options->before_bytes);
+        capture->lines = calloc(capture->before_lines, sizeof(size_t));
+        if (capture->ring == NULL || capture->lines == NULL) {
+            const int errnum = errno;
+            snprintf(errbuf, errbuf_size, "%s", strerror(errnum));
+            capture_free(capture);
+            errno = errnum;
+            return -1;
+        }
+        capture->ring_capacity = options->before_bytes;
+    } else {
+        capture->before_lines = 0;
+    }
+
+    return 0;
+}
+
+static int handle_line_callback(void *context, const char *line, size_t size) {
+    return handle_line((struct Pipelog_Capture*)context, line, size);
+}
+
+const char *capture_lines(struct Pipelog_Capture *capture, const char *data, size_t *size, bool flush) {
+    capture->buf_size = 0;
+
+    if (split_lines(&capture->pending, data, *size, flush, handle_line_callback, capture) != 0) {
+        return NULL;
+    }
+
+    *size = capture->buf_size;
+
+    return capture->buf == NULL ? data : capture->buf;
+}
+
+void capture_free(struct Pipelog_Capture *capture) {
+    if (capture->compiled) {
+        regfree(&capture->trigger);
+        capture->compiled = false;
+    }
+
+    free(capture->ring);
+    free(capture->lines);
+    free(capture->buf);
+    lines_free(&capture->pending);
+
+    capture->ring  = NULL;
+    capture->lines = NULL;
+    capture->buf   = NULL;
+
+    capture->ring_capacity = 0;
+    capture->capacity      = 0;
+}
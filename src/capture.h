@@ -0,0 +1,64 @@
+#ifndef PIPELOG_CAPTURE_H
+#define PIPELOG_CAPTURE_H
+#pragma once
+
+#include "pipelog.h"
+#include "lines.h"
+
+#include <stdbool.h>
+#include <regex.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct Pipelog_Capture {
+    regex_t trigger;
+    bool    compiled;
+
+    size_t before_lines; //!< max number of lines in the ring
+    size_t after_lines;  //!< number of lines to pass after a trigger
+    size_t after_left;   //!< lines still to pass for the last trigger
+
+    char   *ring;        //!< last lines before a trigger (circular)
+    size_t  ring_capacity;
+    size_t  ring_start;
+    size_t  ring_size;
+
+    size_t *lines;       //!< sizes of the lines in ring (circular)
+    size_t  lines_start;
+    size_t  lines_count;
+
+    struct Pipelog_Lines pending; //!< incomplete line at the end of the last chunk
+
+    char   *buf;         //!< output buffer
+    size_t  buf_size;
+    size_t  capacity;
+};
+
+/**
+ * Returns 0 on success. On error -1 is returned and errno is set. If the
+ * trigger pattern is invalid errno is set to EINVAL and a message is written
+ * to errbuf.
+ */
+int capture_init(struct Pipelog_Capture *capture, const struct Pipelog_Capture_Options *options, char *errbuf, size_t errbuf_size);
+
+/**
+ * Only pass lines that match the trigger pattern, up to before_lines/
+ * before_bytes lines in front of them and after_lines lines after them.
+ * Everything else is discarded. If flush is true an incomplete last line
+ * is handled as if it was complete.
+ *
+ * Returns a pointer to an internal buffer that is valid until the next
+ * call. *size is updated to the size of the returned data. Returns NULL and
+ * sets errno on error.
+ */
+const char *capture_lines(struct Pipelog_Capture *capture, const char *data, size_t *size, bool flush);
+
+void capture_free(struct Pipelog_Capture *capture);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
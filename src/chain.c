@@ -0,0 +1,336 @@
+#include "chain.h"
+#include "scan.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static int chain_filename(const char *filename, char *buf, size_t size) {
+    if (snprintf(buf, size, "%s%s", filename, PIPELOG_CHAIN_SUFFIX) >= (int)size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static int read_header(int fd, uint64_t *block_size, uint64_t *covered, unsigned char start[PIPELOG_SHA256_SIZE]) {
+    unsigned char header[PIPELOG_CHAIN_HEADER_SIZE];
+
+    if (pread_all(fd, header, sizeof(header), 0) != 0) {
+        return -1;
+    }
+
+    if (memcmp(header, PIPELOG_CHAIN_MAGIC, PIPELOG_CHAIN_MAGIC_SIZE) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *block_size = get_uint64(header + 8);
+    *covered    = get_uint64(header + 16);
+    memcpy(start, header + 32, PIPELOG_SHA256_SIZE);
+
+    if (*block_size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void start_block(struct Pipelog_Chain *chain) {
+    sha256_init(&chain->sha);
+    sha256_update(&chain->sha, chain->previous, PIPELOG_SHA256_SIZE);
+}
+
+// writes the digest of the block that ends at (or contains) offset and how much is covered
+static int write_digest(struct Pipelog_Chain *chain, const unsigned char digest[PIPELOG_SHA256_SIZE]) {
+    unsigned char buf[8];
+    const uint64_t block = (chain->offset - 1) / chain->block_size;
+
+    if (pwrite_all(chain->fd, digest, PIPELOG_SHA256_SIZE, PIPELOG_CHAIN_HEADER_SIZE + block * PIPELOG_SHA256_SIZE) != 0) {
+        return -1;
+    }
+
+    // after the digest, so the header never claims more than there is
+    put_uint64(buf, chain->offset);
+    return pwrite_all(chain->fd, buf, 8, 16);
+}
+
+void chain_init(struct Pipelog_Chain *chain) {
+    memset(chain, 0, sizeof(*chain));
+    chain->fd = -1;
+}
+
+int chain_open(struct Pipelog_Chain *chain, const char *filename, uint64_t block_size, uint64_t size) {
+    char buf[PATH_MAX];
+    unsigned char start[PIPELOG_SHA256_SIZE];
+    struct stat meta;
+    int logfd = -1;
+
+    chain->fd         = -1;
+    chain->block_size = block_size;
+    chain->offset     = 0;
+
+    if (chain_filename(filename, buf, sizeof(buf)) != 0) {
+        return -1;
+    }
+
+    // digests of an empty log file belong to a file that was rotated away
+    chain->fd = open(buf, O_CREAT | O_RDWR | O_CLOEXEC | (size == 0 ? O_TRUNC : 0), 0644);
+    if (chain->fd < 0) {
+        return -1;
+    }
+
+    if (fstat(chain->fd, &meta) != 0) {
+        goto error;
+    }
+
+    uint64_t kept = 0;
+    memcpy(start, chain->head, PIPELOG_SHA256_SIZE);
+    memcpy(chain->previous, start, PIPELOG_SHA256_SIZE);
+
+    if (meta.st_size != 0) {
+        uint64_t file_block_size, covered;
+        if (read_header(chain->fd, &file_block_size, &covered, start) != 0) {
+            goto error;
+        }
+
+        if (file_block_size != block_size) {
+            errno = EINVAL;
+            goto error;
+        }
+
+        // keep the digests of blocks that were complete and still are
+        const uint64_t count = meta.st_size < PIPELOG_CHAIN_HEADER_SIZE ? 0 :
+            (meta.st_size - PIPELOG_CHAIN_HEADER_SIZE) / PIPELOG_SHA256_SIZE;
+        kept = covered / block_size;
+        if (kept > count) {
+            kept = count;
+        }
+        if (kept > size / block_size) {
+            kept = size / block_size;
+        }
+
+        if (kept > 0) {
+            if (pread_all(chain->fd, chain->previous, PIPELOG_SHA256_SIZE, PIPELOG_CHAIN_HEADER_SIZE + (kept - 1) * PIPELOG_SHA256_SIZE) != 0) {
+                goto error;
+            }
+        } else {
+            memcpy(chain->previous, start, PIPELOG_SHA256_SIZE);
+        }
+    }
+
+    unsigned char header[PIPELOG_CHAIN_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, PIPELOG_CHAIN_MAGIC, PIPELOG_CHAIN_MAGIC_SIZE);
+    put_uint64(header + 8,  block_size);
+    put_uint64(header + 16, kept * block_size);
+    memcpy(header + 32, start, PIPELOG_SHA256_SIZE);
+
+    if (pwrite_all(chain->fd, header, sizeof(header), 0) != 0 ||
+        ftruncate(chain->fd, PIPELOG_CHAIN_HEADER_SIZE + kept * PIPELOG_SHA256_SIZE) != 0) {
+        goto error;
+    }
+
+    chain->offset = kept * block_size;
+    start_block(chain);
+
+    if (chain->offset < size) {
+        // usually just the incomplete last block
+        char data[BUFSIZ * 8];
+
+        logfd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (logfd < 0) {
+            goto error;
+        }
+
+        while (chain->offset < size) {
+            const size_t want = size - chain->offset < sizeof(data) ? size - chain->offset : sizeof(data);
+            const ssize_t count = pread(logfd, data, want, chain->offset);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                goto error;
+            }
+
+            if (count == 0) {
+                // the file was truncated in the meantime
+                break;
+            }
+
+            if (chain_add(chain, data, count) != 0) {
+                goto error;
+            }
+        }
+
+        close(logfd);
+    }
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        if (logfd >= 0) {
+            close(logfd);
+        }
+        close(chain->fd);
+        chain->fd = -1;
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+int chain_add(struct Pipelog_Chain *chain, const char *data, size_t size) {
+    if (chain->fd < 0) {
+        return 0;
+    }
+
+    while (size > 0) {
+        const uint64_t rest = chain->block_size - chain->offset % chain->block_size;
+        const size_t chunk = size < rest ? size : rest;
+
+        sha256_update(&chain->sha, data, chunk);
+        chain->offset += chunk;
+        data += chunk;
+        size -= chunk;
+
+        if (chain->offset % chain->block_size == 0) {
+            sha256_final(&chain->sha, chain->previous);
+            if (write_digest(chain, chain->previous) != 0) {
+                return -1;
+            }
+            start_block(chain);
+        }
+    }
+
+    return 0;
+}
+
+int chain_close(struct Pipelog_Chain *chain) {
+    int status = 0;
+
+    if (chain->fd < 0) {
+        return 0;
+    }
+
+    if (chain->offset % chain->block_size != 0) {
+        sha256_final(&chain->sha, chain->head);
+        if (write_digest(chain, chain->head) != 0) {
+            status = -1;
+        }
+    } else {
+        memcpy(chain->head, chain->previous, PIPELOG_SHA256_SIZE);
+    }
+
+    if (close(chain->fd) != 0) {
+        status = -1;
+    }
+    chain->fd = -1;
+
+    return status;
+}
+
+int64_t chain_verify(const char *filename, FILE *out, const unsigned char *previous, unsigned char head[PIPELOG_SHA256_SIZE]) {
+    char buf[PATH_MAX];
+    unsigned char start[PIPELOG_SHA256_SIZE];
+    struct Pipelog_Mapped_File file;
+    unsigned char *digests = NULL;
+    int64_t bad = -1;
+    int fd = -1;
+
+    if (chain_filename(filename, buf, sizeof(buf)) != 0) {
+        return -1;
+    }
+
+    if (map_file(&file, filename) != 0) {
+        return -1;
+    }
+
+    if (file.data != NULL) {
+        // map_file() expects random access
+        madvise(file.data, file.size, MADV_SEQUENTIAL);
+    }
+
+    fd = open(buf, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        goto cleanup;
+    }
+
+    uint64_t block_size, covered;
+    if (read_header(fd, &block_size, &covered, start) != 0) {
+        goto cleanup;
+    }
+
+    const uint64_t count = covered / block_size + (covered % block_size != 0);
+    if (count > SIZE_MAX / PIPELOG_SHA256_SIZE) {
+        errno = EINVAL;
+        goto cleanup;
+    }
+
+    digests = malloc(count * PIPELOG_SHA256_SIZE + 1);
+    if (digests == NULL) {
+        goto cleanup;
+    }
+
+    if (pread_all(fd, digests, count * PIPELOG_SHA256_SIZE, PIPELOG_CHAIN_HEADER_SIZE) != 0) {
+        goto cleanup;
+    }
+
+    bad = 0;
+    if (previous != NULL && memcmp(previous, start, PIPELOG_SHA256_SIZE) != 0) {
+        fprintf(out, "%s: doesn't continue the chain of the file before\n", filename);
+        ++ bad;
+    }
+
+    if (file.size < covered) {
+        fprintf(out, "%s: truncated to %zu of %" PRIu64 " bytes\n", filename, file.size, covered);
+        ++ bad;
+    }
+
+    // every block is checked against the stored digest before it, so only changed blocks are reported
+    for (uint64_t block = 0; block < count; ++ block) {
+        const uint64_t block_start = block * block_size;
+        const uint64_t block_end = block_start + block_size < covered ? block_start + block_size : covered;
+        unsigned char digest[PIPELOG_SHA256_SIZE];
+        struct Pipelog_Sha256 sha;
+
+        if (block_end > file.size) {
+            break;
+        }
+
+        sha256_init(&sha);
+        sha256_update(&sha, block == 0 ? start : digests + (block - 1) * PIPELOG_SHA256_SIZE, PIPELOG_SHA256_SIZE);
+        sha256_update(&sha, file.data + block_start, block_end - block_start);
+        sha256_final(&sha, digest);
+
+        if (memcmp(digest, digests + block * PIPELOG_SHA256_SIZE, PIPELOG_SHA256_SIZE) != 0) {
+            fprintf(out, "%s: block %" PRIu64 " (bytes %" PRIu64 " to %" PRIu64 ") doesn't match the chain\n", filename, block, block_start, block_end);
+            ++ bad;
+        }
+    }
+
+    memcpy(head, count > 0 ? digests + (count - 1) * PIPELOG_SHA256_SIZE : start, PIPELOG_SHA256_SIZE);
+
+cleanup:
+    {
+        const int errnum = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(digests);
+        unmap_file(&file);
+        errno = errnum;
+    }
+
+    return bad;
+}
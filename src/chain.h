@@ -0,0 +1,86 @@
+#ifndef PIPELOG_CHAIN_H
+#define PIPELOG_CHAIN_H
+#pragma once
+
+#include "pipelog.h"
+#include "sha256.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_CHAIN_MAGIC "PLGSHA1\n"
+#define PIPELOG_CHAIN_MAGIC_SIZE 8
+#define PIPELOG_CHAIN_SUFFIX ".sha"
+#define PIPELOG_CHAIN_HEADER_SIZE (32 + PIPELOG_SHA256_SIZE)
+
+#define PIPELOG_CHAIN_BLOCK_SIZE (1024 * 1024)
+
+/**
+ * Tamper evident digests of the blocks of a log file. The digest of a block
+ * is the SHA-256 of the digest of the block before and the data of the
+ * block, so changing any block or digest breaks the chain from there on.
+ *
+ * The digest file starts with a header of the magic, the block size, the
+ * number of bytes of the log file that are covered by the digests, a
+ * reserved field (64 bit little endian numbers each) and the digest the
+ * chain starts with: the chain head of the file that was written before
+ * (by this process), or zeros. Then follows the digest of each block. The
+ * digest of the last, incomplete block, the chain head, is written when the
+ * log file is closed.
+ */
+struct Pipelog_Chain {
+    int      fd;
+    uint64_t block_size;
+    uint64_t offset; //!< bytes of the log file that were hashed
+    struct Pipelog_Sha256 sha; //!< of the current block, after the digest of the one before
+    unsigned char previous[PIPELOG_SHA256_SIZE]; //!< digest of the block before the current one
+    unsigned char head[PIPELOG_SHA256_SIZE];     //!< chain head of the last closed file
+};
+
+void chain_init(struct Pipelog_Chain *chain);
+
+/**
+ * Open or create the digests of the log file filename, i.e. filename.sha.
+ * size is the current size of the log file. A new chain continues the
+ * chain of the file that was closed last.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int chain_open(struct Pipelog_Chain *chain, const char *filename, uint64_t block_size, uint64_t size);
+
+/**
+ * Add data that was appended to the log file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int chain_add(struct Pipelog_Chain *chain, const char *data, size_t size);
+
+/**
+ * Write the chain head and close the file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int chain_close(struct Pipelog_Chain *chain);
+
+/**
+ * Check the blocks of the log file filename against their digests in
+ * filename.sha and report every block that doesn't match to out. If
+ * previous isn't NULL the chain has to start with it. The chain head is
+ * written to head.
+ *
+ * Returns the number of bad blocks (a log file shorter than the hashed part
+ * or a chain that doesn't start with previous counts as one), or -1 on
+ * error and sets errno.
+ */
+int64_t chain_verify(const char *filename, FILE *out, const unsigned char *previous, unsigned char head[PIPELOG_SHA256_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
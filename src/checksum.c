@@ -0,0 +1,298 @@
+#include "checksum.h"
+#include "crc32c.h"
+#include "scan.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static int checksum_filename(const char *filename, char *buf, size_t size) {
+    if (snprintf(buf, size, "%s%s", filename, PIPELOG_CHECKSUM_SUFFIX) >= (int)size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static int read_header(int fd, uint64_t *block_size, uint64_t *covered) {
+    unsigned char header[PIPELOG_CHECKSUM_HEADER_SIZE];
+
+    const ssize_t count = pread(fd, header, sizeof(header), 0);
+    if (count < 0) {
+        return -1;
+    }
+
+    if (count != sizeof(header) || memcmp(header, PIPELOG_CHECKSUM_MAGIC, PIPELOG_CHECKSUM_MAGIC_SIZE) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *block_size = get_uint64(header + 8);
+    *covered    = get_uint64(header + 16);
+
+    if (*block_size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+// writes the checksum of the block that ends at (or contains) offset and how much it covers
+static int write_checksum(struct Pipelog_Checksums *checksums) {
+    unsigned char buf[8];
+    const uint64_t block = (checksums->offset - 1) / checksums->block_size;
+
+    put_uint32(buf, checksums->crc);
+    if (pwrite_all(checksums->fd, buf, 4, PIPELOG_CHECKSUM_HEADER_SIZE + block * 4) != 0) {
+        return -1;
+    }
+
+    // after the checksum, so the header never claims more than there is
+    put_uint64(buf, checksums->offset);
+    return pwrite_all(checksums->fd, buf, 8, 16);
+}
+
+int checksums_open(struct Pipelog_Checksums *checksums, const char *filename, uint64_t block_size, uint64_t size) {
+    char buf[PATH_MAX];
+    struct stat meta;
+    int logfd = -1;
+
+    checksums->fd         = -1;
+    checksums->block_size = block_size;
+    checksums->offset     = 0;
+    checksums->crc        = 0;
+
+    if (checksum_filename(filename, buf, sizeof(buf)) != 0) {
+        return -1;
+    }
+
+    // checksums of an empty log file belong to a file that was rotated away
+    checksums->fd = open(buf, O_CREAT | O_RDWR | O_CLOEXEC | (size == 0 ? O_TRUNC : 0), 0644);
+    if (checksums->fd < 0) {
+        return -1;
+    }
+
+    if (fstat(checksums->fd, &meta) != 0) {
+        goto error;
+    }
+
+    uint64_t kept = 0;
+    if (meta.st_size != 0) {
+        uint64_t file_block_size, covered;
+        if (read_header(checksums->fd, &file_block_size, &covered) != 0) {
+            goto error;
+        }
+
+        if (file_block_size != block_size) {
+            errno = EINVAL;
+            goto error;
+        }
+
+        // keep the checksums of blocks that were complete and still are
+        const uint64_t count = (meta.st_size - PIPELOG_CHECKSUM_HEADER_SIZE) / 4;
+        kept = covered / block_size;
+        if (kept > count) {
+            kept = count;
+        }
+        if (kept > size / block_size) {
+            kept = size / block_size;
+        }
+    }
+
+    unsigned char header[PIPELOG_CHECKSUM_HEADER_SIZE];
+    memcpy(header, PIPELOG_CHECKSUM_MAGIC, PIPELOG_CHECKSUM_MAGIC_SIZE);
+    put_uint64(header + 8,  block_size);
+    put_uint64(header + 16, kept * block_size);
+
+    if (pwrite_all(checksums->fd, header, sizeof(header), 0) != 0 ||
+        ftruncate(checksums->fd, PIPELOG_CHECKSUM_HEADER_SIZE + kept * 4) != 0) {
+        goto error;
+    }
+
+    checksums->offset = kept * block_size;
+
+    if (checksums->offset < size) {
+        // usually just the incomplete last block
+        char data[BUFSIZ * 8];
+
+        logfd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (logfd < 0) {
+            goto error;
+        }
+
+        while (checksums->offset < size) {
+            const size_t want = size - checksums->offset < sizeof(data) ? size - checksums->offset : sizeof(data);
+            const ssize_t count = pread(logfd, data, want, checksums->offset);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                goto error;
+            }
+
+            if (count == 0) {
+                // the file was truncated in the meantime
+                break;
+            }
+
+            if (checksums_add(checksums, data, count) != 0) {
+                goto error;
+            }
+        }
+
+        close(logfd);
+    }
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        if (logfd >= 0) {
+            close(logfd);
+        }
+        close(checksums->fd);
+        checksums->fd = -1;
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+int checksums_add(struct Pipelog_Checksums *checksums, const char *data, size_t size) {
+    if (checksums->fd < 0) {
+        return 0;
+    }
+
+    while (size > 0) {
+        const uint64_t rest = checksums->block_size - checksums->offset % checksums->block_size;
+        const size_t chunk = size < rest ? size : rest;
+
+        checksums->crc = crc32c(checksums->crc, data, chunk);
+        checksums->offset += chunk;
+        data += chunk;
+        size -= chunk;
+
+        if (checksums->offset % checksums->block_size == 0) {
+            if (write_checksum(checksums) != 0) {
+                return -1;
+            }
+            checksums->crc = 0;
+        }
+    }
+
+    return 0;
+}
+
+int checksums_close(struct Pipelog_Checksums *checksums) {
+    int status = 0;
+
+    if (checksums->fd < 0) {
+        return 0;
+    }
+
+    if (checksums->offset % checksums->block_size != 0 && write_checksum(checksums) != 0) {
+        status = -1;
+    }
+
+    if (close(checksums->fd) != 0) {
+        status = -1;
+    }
+    checksums->fd = -1;
+
+    return status;
+}
+
+int64_t checksums_verify(const char *filename, FILE *out) {
+    char buf[PATH_MAX];
+    struct Pipelog_Mapped_File file;
+    unsigned char *sums = NULL;
+    int64_t bad = -1;
+    int fd = -1;
+
+    if (checksum_filename(filename, buf, sizeof(buf)) != 0) {
+        return -1;
+    }
+
+    if (map_file(&file, filename) != 0) {
+        return -1;
+    }
+
+    if (file.data != NULL) {
+        // map_file() expects random access
+        madvise(file.data, file.size, MADV_SEQUENTIAL);
+    }
+
+    fd = open(buf, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        goto cleanup;
+    }
+
+    uint64_t block_size, covered;
+    if (read_header(fd, &block_size, &covered) != 0) {
+        goto cleanup;
+    }
+
+    const uint64_t count = covered / block_size + (covered % block_size != 0);
+    if (count > SIZE_MAX / 4) {
+        errno = EINVAL;
+        goto cleanup;
+    }
+
+    sums = malloc(count * 4 + 1);
+    if (sums == NULL) {
+        goto cleanup;
+    }
+
+    const ssize_t rcount = pread(fd, sums, count * 4, PIPELOG_CHECKSUM_HEADER_SIZE);
+    if (rcount < 0) {
+        goto cleanup;
+    }
+
+    if ((uint64_t)rcount != count * 4) {
+        errno = EINVAL;
+        goto cleanup;
+    }
+
+    bad = 0;
+    if (file.size < covered) {
+        fprintf(out, "%s: truncated to %zu of %" PRIu64 " bytes\n", filename, file.size, covered);
+        ++ bad;
+    }
+
+    for (uint64_t block = 0; block < count; ++ block) {
+        const uint64_t start = block * block_size;
+        const uint64_t end = start + block_size < covered ? start + block_size : covered;
+
+        if (end > file.size) {
+            break;
+        }
+
+        const uint32_t crc = crc32c(0, file.data + start, end - start);
+        if (crc != get_uint32(sums + block * 4)) {
+            fprintf(out, "%s: block %" PRIu64 " (bytes %" PRIu64 " to %" PRIu64 ") is corrupted\n", filename, block, start, end);
+            ++ bad;
+        }
+    }
+
+cleanup:
+    {
+        const int errnum = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(sums);
+        unmap_file(&file);
+        errno = errnum;
+    }
+
+    return bad;
+}
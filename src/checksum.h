@@ -0,0 +1,75 @@
+#ifndef PIPELOG_CHECKSUM_H
+#define PIPELOG_CHECKSUM_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_CHECKSUM_MAGIC "PLGCRC1\n"
+#define PIPELOG_CHECKSUM_MAGIC_SIZE 8
+#define PIPELOG_CHECKSUM_SUFFIX ".crc"
+#define PIPELOG_CHECKSUM_HEADER_SIZE 24
+
+#define PIPELOG_CHECKSUM_BLOCK_SIZE (1024 * 1024)
+
+/**
+ * The checksum file starts with a header of the magic, the block size and
+ * the number of bytes of the log file that are covered by the checksums
+ * (64 bit little endian numbers). Then follows the CRC-32C of each block of
+ * the log file (32 bit little endian). The checksum of the last, incomplete
+ * block is written when the log file is closed. Complete blocks are written
+ * as soon as they are complete.
+ *
+ * An existing log file is continued: the checksums of its complete blocks
+ * are kept and the rest of the file is read to compute the others.
+ */
+struct Pipelog_Checksums {
+    int      fd;
+    uint64_t block_size;
+    uint64_t offset; //!< bytes of the log file that were checksummed
+    uint32_t crc;    //!< of the current block up to offset
+};
+
+/**
+ * Open or create the checksums of the log file filename, i.e.
+ * filename.crc. size is the current size of the log file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int checksums_open(struct Pipelog_Checksums *checksums, const char *filename, uint64_t block_size, uint64_t size);
+
+/**
+ * Add data that was appended to the log file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int checksums_add(struct Pipelog_Checksums *checksums, const char *data, size_t size);
+
+/**
+ * Write the checksum of the last block and close the file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int checksums_close(struct Pipelog_Checksums *checksums);
+
+/**
+ * Compare the blocks of the log file filename with their checksums in
+ * filename.crc and report every block that doesn't match to out.
+ *
+ * Returns the number of bad blocks (a log file shorter than the checksummed
+ * part counts as one), or -1 on error and sets errno.
+ */
+int64_t checksums_verify(const char *filename, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
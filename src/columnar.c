@@ -0,0 +1,1219 @@
+#include "columnar.h"
+#include "fields.h"
+#include "lines.h"
+#include "timestamp.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define NULL_SIZE UINT32_MAX
+
+struct Pipelog_Buffer {
+    char  *data;
+    size_t size;
+    size_t capacity;
+};
+
+struct Pipelog_Column_Builder {
+    char     *name;
+    size_t    name_size;
+    uint32_t *offsets; //!< into the arena, per row
+    uint32_t *sizes;   //!< NULL_SIZE for null
+};
+
+struct Pipelog_Columnar_Writer {
+    int      fd;
+    uint64_t offset;
+
+    struct Pipelog_Buffer arena;
+    struct Pipelog_Column_Builder columns[PIPELOG_COLUMNAR_MAX_COLUMNS];
+    size_t column_count;
+    size_t rows;
+
+    struct Pipelog_Buffer out;
+    struct Pipelog_Buffer directory;
+    struct Pipelog_Buffer data;
+    struct Pipelog_Buffer footer;
+    size_t block_count;
+
+    struct Pipelog_Field fields[PIPELOG_MAX_FIELDS];
+};
+
+static int buffer_put(struct Pipelog_Buffer *buffer, const void *data, size_t size) {
+    if (reserve(&buffer->data, &buffer->capacity, buffer->size + size) != 0) {
+        return -1;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return 0;
+}
+
+static int buffer_put_varint(struct Pipelog_Buffer *buffer, uint64_t value) {
+    unsigned char bytes[10];
+    size_t size = 0;
+    while (value >= 0x80) {
+        bytes[size ++] = (unsigned char)value | 0x80;
+        value >>= 7;
+    }
+    bytes[size ++] = (unsigned char)value;
+    return buffer_put(buffer, bytes, size);
+}
+
+static void buffer_free(struct Pipelog_Buffer *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+static int get_varint(const unsigned char **ptr, const unsigned char *end, uint64_t *value) {
+    uint64_t result = 0;
+
+    for (unsigned int shift = 0; shift < 64 && *ptr < end; shift += 7) {
+        const unsigned char byte = *(*ptr) ++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// only integers that format back to the same text
+static bool parse_int(const char *text, size_t size, int64_t *value) {
+    const bool negative = size > 0 && text[0] == '-';
+    const char *digits = text + negative;
+    const size_t digit_count = size - negative;
+
+    if (digit_count == 0 || digit_count > 18 || (digits[0] == '0' && (digit_count > 1 || negative))) {
+        return false;
+    }
+
+    int64_t result = 0;
+    for (size_t index = 0; index < digit_count; ++ index) {
+        if (digits[index] < '0' || digits[index] > '9') {
+            return false;
+        }
+        result = result * 10 + (digits[index] - '0');
+    }
+
+    *value = negative ? -result : result;
+    return true;
+}
+
+static int compare_bytes(const char *lhs, size_t lhs_size, const char *rhs, size_t rhs_size) {
+    const int result = memcmp(lhs, rhs, lhs_size < rhs_size ? lhs_size : rhs_size);
+    return result != 0 ? result : (lhs_size > rhs_size) - (lhs_size < rhs_size);
+}
+
+static uint64_t hash_bytes(const void *data, size_t size) {
+    // FNV-1a
+    const unsigned char *bytes = data;
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t index = 0; index < size; ++ index) {
+        hash ^= bytes[index];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static struct Pipelog_Column_Builder *get_column(struct Pipelog_Columnar_Writer *writer, const char *name, size_t name_size) {
+    for (size_t index = 0; index < writer->column_count; ++ index) {
+        struct Pipelog_Column_Builder *column = &writer->columns[index];
+        if (column->name_size == name_size && memcmp(column->name, name, name_size) == 0) {
+            return column;
+        }
+    }
+
+    if (writer->column_count == PIPELOG_COLUMNAR_MAX_COLUMNS) {
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    struct Pipelog_Column_Builder *column = &writer->columns[writer->column_count];
+    column->name    = malloc(name_size);
+    column->offsets = malloc(PIPELOG_COLUMNAR_BLOCK_ROWS * sizeof(uint32_t));
+    column->sizes   = malloc(PIPELOG_COLUMNAR_BLOCK_ROWS * sizeof(uint32_t));
+    if (column->name == NULL || column->offsets == NULL || column->sizes == NULL) {
+        free(column->name);
+        free(column->offsets);
+        free(column->sizes);
+        memset(column, 0, sizeof(*column));
+        return NULL;
+    }
+
+    memcpy(column->name, name, name_size);
+    column->name_size = name_size;
+
+    // the column didn't exist for the rows before
+    for (size_t row = 0; row < writer->rows; ++ row) {
+        column->sizes[row] = NULL_SIZE;
+    }
+    // nor for the current row, if it has no such field
+    column->sizes[writer->rows] = NULL_SIZE;
+
+    ++ writer->column_count;
+
+    return column;
+}
+
+static int set_value(struct Pipelog_Columnar_Writer *writer, const char *name, size_t name_size, const char *value, size_t value_size) {
+    struct Pipelog_Column_Builder *column = get_column(writer, name, name_size);
+    if (column == NULL) {
+        // too many columns, drop the field
+        return errno == ENOSPC ? 0 : -1;
+    }
+
+    if (column->sizes[writer->rows] != NULL_SIZE) {
+        // duplicate key, the first one wins
+        return 0;
+    }
+
+    const size_t offset = writer->arena.size;
+    if (buffer_put(&writer->arena, value, value_size) != 0) {
+        return -1;
+    }
+
+    column->offsets[writer->rows] = offset;
+    column->sizes[writer->rows]   = value_size;
+
+    return 0;
+}
+
+static int encode_int_column(struct Pipelog_Columnar_Writer *writer, const struct Pipelog_Column_Builder *column, struct Pipelog_Buffer *directory, uint64_t nulls) {
+    const size_t rows = writer->rows;
+    const size_t data_offset = writer->data.size;
+    const size_t bitmap_size = (rows + 7) / 8;
+    int64_t min = INT64_MAX, max = INT64_MIN, last = 0;
+
+    if (reserve(&writer->data.data, &writer->data.capacity, data_offset + bitmap_size) != 0) {
+        return -1;
+    }
+    memset(writer->data.data + data_offset, 0, bitmap_size);
+    writer->data.size += bitmap_size;
+
+    for (size_t row = 0; row < rows; ++ row) {
+        if (column->sizes[row] == NULL_SIZE) {
+            continue;
+        }
+
+        int64_t value = 0;
+        parse_int(writer->arena.data + column->offsets[row], column->sizes[row], &value);
+
+        // data may have moved
+        ((unsigned char*)writer->data.data)[data_offset + row / 8] |= 1 << (row % 8);
+        if (buffer_put_varint(&writer->data, zigzag(value - last)) != 0) {
+            return -1;
+        }
+        last = value;
+
+        if (value < min) {
+            min = value;
+        }
+        if (value > max) {
+            max = value;
+        }
+    }
+
+    if (nulls == rows) {
+        min = max = 0;
+    }
+
+    if (buffer_put_varint(directory, PIPELOG_COLUMN_INT) != 0 ||
+        buffer_put_varint(directory, nulls) != 0 ||
+        buffer_put_varint(directory, zigzag(min)) != 0 ||
+        buffer_put_varint(directory, zigzag(max)) != 0 ||
+        buffer_put_varint(directory, data_offset) != 0 ||
+        buffer_put_varint(directory, writer->data.size - data_offset) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int encode_string_column(struct Pipelog_Columnar_Writer *writer, const struct Pipelog_Column_Builder *column, struct Pipelog_Buffer *directory, uint64_t nulls) {
+    const size_t rows = writer->rows;
+    const char *arena = writer->arena.data;
+    const size_t data_offset = writer->data.size;
+    const char *min = NULL, *max = NULL;
+    size_t min_size = 0, max_size = 0;
+    bool has_stats = nulls < rows;
+
+    for (size_t row = 0; row < rows && has_stats; ++ row) {
+        const size_t size = column->sizes[row];
+        if (size == NULL_SIZE) {
+            continue;
+        }
+        if (size > PIPELOG_COLUMNAR_MAX_STAT) {
+            has_stats = false;
+            break;
+        }
+        const char *value = arena + column->offsets[row];
+        if (min == NULL || compare_bytes(value, size, min, min_size) < 0) {
+            min = value;
+            min_size = size;
+        }
+        if (max == NULL || compare_bytes(value, size, max, max_size) > 0) {
+            max = value;
+            max_size = size;
+        }
+    }
+
+    // dictionary encoding if values repeat enough
+    const size_t max_entries = (rows - nulls) / 2;
+    size_t capacity = 16;
+    while (capacity < max_entries * 2) {
+        capacity *= 2;
+    }
+
+    uint32_t *slots   = malloc(capacity * sizeof(uint32_t)); // row of the first occurrence + 1
+    uint32_t *indices = malloc(rows * sizeof(uint32_t));
+    uint32_t *entries = malloc((max_entries + 1) * sizeof(uint32_t));
+    size_t entry_count = 0;
+    bool dict = slots != NULL && indices != NULL && entries != NULL;
+
+    if (!dict) {
+        free(slots);
+        free(indices);
+        free(entries);
+        return -1;
+    }
+    memset(slots, 0, capacity * sizeof(uint32_t));
+
+    for (size_t row = 0; row < rows && dict; ++ row) {
+        const size_t size = column->sizes[row];
+        if (size == NULL_SIZE) {
+            indices[row] = 0;
+            continue;
+        }
+
+        const char *value = arena + column->offsets[row];
+        size_t slot = hash_bytes(value, size) & (capacity - 1);
+        for (;;) {
+            if (slots[slot] == 0) {
+                if (entry_count == max_entries) {
+                    dict = false;
+                    break;
+                }
+                entries[entry_count] = row;
+                slots[slot] = ++ entry_count;
+                indices[row] = entry_count;
+                break;
+            }
+
+            const size_t first = entries[slots[slot] - 1];
+            if (column->sizes[first] == size && memcmp(arena + column->offsets[first], value, size) == 0) {
+                indices[row] = slots[slot];
+                break;
+            }
+            slot = (slot + 1) & (capacity - 1);
+        }
+    }
+
+    int status = -1;
+    if (dict) {
+        if (buffer_put_varint(&writer->data, entry_count) != 0) {
+            goto cleanup;
+        }
+        for (size_t entry = 0; entry < entry_count; ++ entry) {
+            const size_t row = entries[entry];
+            if (buffer_put_varint(&writer->data, column->sizes[row]) != 0 ||
+                buffer_put(&writer->data, arena + column->offsets[row], column->sizes[row]) != 0) {
+                goto cleanup;
+            }
+        }
+        for (size_t row = 0; row < rows; ++ row) {
+            if (buffer_put_varint(&writer->data, indices[row]) != 0) {
+                goto cleanup;
+            }
+        }
+    } else {
+        for (size_t row = 0; row < rows; ++ row) {
+            const size_t size = column->sizes[row];
+            if (size == NULL_SIZE) {
+                if (buffer_put_varint(&writer->data, 0) != 0) {
+                    goto cleanup;
+                }
+            } else if (buffer_put_varint(&writer->data, (uint64_t)size + 1) != 0 ||
+                       buffer_put(&writer->data, arena + column->offsets[row], size) != 0) {
+                goto cleanup;
+            }
+        }
+    }
+
+    if (buffer_put_varint(directory, dict ? PIPELOG_COLUMN_DICT : PIPELOG_COLUMN_PLAIN) != 0 ||
+        buffer_put_varint(directory, nulls) != 0 ||
+        buffer_put_varint(directory, has_stats) != 0) {
+        goto cleanup;
+    }
+
+    if (has_stats && (
+            buffer_put_varint(directory, min_size) != 0 ||
+            buffer_put(directory, min, min_size) != 0 ||
+            buffer_put_varint(directory, max_size) != 0 ||
+            buffer_put(directory, max, max_size) != 0)) {
+        goto cleanup;
+    }
+
+    if (buffer_put_varint(directory, data_offset) != 0 ||
+        buffer_put_varint(directory, writer->data.size - data_offset) != 0) {
+        goto cleanup;
+    }
+
+    status = 0;
+
+cleanup:
+    free(slots);
+    free(indices);
+    free(entries);
+
+    return status;
+}
+
+static int flush_block(struct Pipelog_Columnar_Writer *writer) {
+    if (writer->rows == 0) {
+        return 0;
+    }
+
+    writer->directory.size = 0;
+    writer->data.size = 0;
+    writer->out.size = 0;
+
+    for (size_t index = 0; index < writer->column_count; ++ index) {
+        const struct Pipelog_Column_Builder *column = &writer->columns[index];
+        uint64_t nulls = 0;
+        bool all_int = true;
+
+        for (size_t row = 0; row < writer->rows; ++ row) {
+            int64_t value;
+            if (column->sizes[row] == NULL_SIZE) {
+                ++ nulls;
+            } else if (all_int && !parse_int(writer->arena.data + column->offsets[row], column->sizes[row], &value)) {
+                all_int = false;
+            }
+        }
+
+        if (buffer_put_varint(&writer->directory, column->name_size) != 0 ||
+            buffer_put(&writer->directory, column->name, column->name_size) != 0) {
+            return -1;
+        }
+
+        const int result = all_int ?
+            encode_int_column(writer, column, &writer->directory, nulls) :
+            encode_string_column(writer, column, &writer->directory, nulls);
+        if (result != 0) {
+            return -1;
+        }
+    }
+
+    if (buffer_put_varint(&writer->out, writer->rows) != 0 ||
+        buffer_put_varint(&writer->out, writer->column_count) != 0 ||
+        buffer_put_varint(&writer->out, writer->directory.size) != 0 ||
+        buffer_put(&writer->out, writer->directory.data, writer->directory.size) != 0) {
+        return -1;
+    }
+
+    if (buffer_put_varint(&writer->footer, writer->offset) != 0 ||
+        buffer_put_varint(&writer->footer, writer->rows) != 0) {
+        return -1;
+    }
+
+    if (write_all(writer->fd, writer->out.data, writer->out.size) != 0 ||
+        write_all(writer->fd, writer->data.data, writer->data.size) != 0) {
+        return -1;
+    }
+
+    writer->offset += writer->out.size + writer->data.size;
+    ++ writer->block_count;
+
+    // columns of one block don't carry over to the next
+    for (size_t index = 0; index < writer->column_count; ++ index) {
+        struct Pipelog_Column_Builder *column = &writer->columns[index];
+        free(column->name);
+        free(column->offsets);
+        free(column->sizes);
+        memset(column, 0, sizeof(*column));
+    }
+    writer->column_count = 0;
+    writer->rows = 0;
+    writer->arena.size = 0;
+
+    return 0;
+}
+
+static bool is_time_key(const char *key, size_t size) {
+    return (size == 2 && memcmp(key, "ts", 2) == 0) ||
+           (size == 4 && memcmp(key, "time", 4) == 0) ||
+           (size == 10 && memcmp(key, "@timestamp", 10) == 0);
+}
+
+static int add_row(void *context, const char *line, size_t size) {
+    struct Pipelog_Columnar_Writer *writer = context;
+    int64_t nanos;
+
+    if (size > 0 && line[size - 1] == '\n') {
+        -- size;
+    }
+
+    if (size == 0) {
+        return 0;
+    }
+
+    for (size_t index = 0; index < writer->column_count; ++ index) {
+        writer->columns[index].sizes[writer->rows] = NULL_SIZE;
+    }
+
+    const size_t field_count = parse_fields(line, size, writer->fields, PIPELOG_MAX_FIELDS);
+
+    // a leading timestamp, otherwise the first time field of a structured line
+    bool has_time = parse_timestamp(line, size, &nanos, NULL);
+    for (size_t index = 0; index < field_count && !has_time; ++ index) {
+        const struct Pipelog_Field *field = &writer->fields[index];
+        if (is_time_key(field->key, field->key_size)) {
+            has_time = parse_timestamp(field->value, field->value_size, &nanos, NULL);
+        }
+    }
+
+    if (has_time) {
+        char millis[24];
+        const int millis_size = snprintf(millis, sizeof(millis), "%" PRId64, nanos / 1000000 - (nanos % 1000000 < 0));
+        if (set_value(writer, PIPELOG_COLUMN_TIME, strlen(PIPELOG_COLUMN_TIME), millis, millis_size) != 0) {
+            return -1;
+        }
+    }
+
+    for (size_t index = 0; index < field_count; ++ index) {
+        const struct Pipelog_Field *field = &writer->fields[index];
+        if (set_value(writer, field->key, field->key_size, field->value, field->value_size) != 0) {
+            return -1;
+        }
+    }
+
+    if (field_count == 0 && set_value(writer, PIPELOG_COLUMN_RAW, strlen(PIPELOG_COLUMN_RAW), line, size) != 0) {
+        return -1;
+    }
+
+    ++ writer->rows;
+
+    if (writer->rows == PIPELOG_COLUMNAR_BLOCK_ROWS || writer->arena.size >= PIPELOG_COLUMNAR_BLOCK_BYTES) {
+        return flush_block(writer);
+    }
+
+    return 0;
+}
+
+int columnar_convert(const char *filename, const char *archive) {
+    struct Pipelog_Columnar_Writer *writer = calloc(1, sizeof(struct Pipelog_Columnar_Writer));
+    struct Pipelog_Lines lines = { NULL, 0, 0 };
+    char tmpname[PATH_MAX];
+    char buf[BUFSIZ * 16];
+    int status = -1;
+    int errnum = 0;
+    int infd = -1;
+
+    if (writer == NULL) {
+        return -1;
+    }
+    writer->fd = -1;
+
+    if (snprintf(tmpname, sizeof(tmpname), "%s.tmp", archive) >= (int)sizeof(tmpname)) {
+        errno = ENAMETOOLONG;
+        goto cleanup;
+    }
+
+    infd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (infd < 0) {
+        goto cleanup;
+    }
+
+    writer->fd = open(tmpname, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+    if (writer->fd < 0) {
+        goto cleanup;
+    }
+
+    if (write_all(writer->fd, PIPELOG_COLUMNAR_MAGIC, PIPELOG_COLUMNAR_MAGIC_SIZE) != 0) {
+        goto cleanup;
+    }
+    writer->offset = PIPELOG_COLUMNAR_MAGIC_SIZE;
+
+    for (;;) {
+        const ssize_t rcount = read(infd, buf, sizeof(buf));
+        if (rcount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            goto cleanup;
+        }
+
+        if (split_lines(&lines, buf, rcount, rcount == 0, add_row, writer) != 0) {
+            goto cleanup;
+        }
+
+        if (rcount == 0) {
+            break;
+        }
+    }
+
+    if (flush_block(writer) != 0) {
+        goto cleanup;
+    }
+
+    writer->out.size = 0;
+    unsigned char trailer[8];
+    const uint64_t footer_offset = writer->offset;
+    for (size_t index = 0; index < sizeof(trailer); ++ index) {
+        trailer[index] = footer_offset >> (index * 8);
+    }
+
+    if (buffer_put_varint(&writer->out, writer->block_count) != 0 ||
+        buffer_put(&writer->out, writer->footer.data, writer->footer.size) != 0 ||
+        buffer_put(&writer->out, trailer, sizeof(trailer)) != 0 ||
+        buffer_put(&writer->out, PIPELOG_COLUMNAR_TRAILER, PIPELOG_COLUMNAR_MAGIC_SIZE) != 0) {
+        goto cleanup;
+    }
+
+    if (write_all(writer->fd, writer->out.data, writer->out.size) != 0) {
+        goto cleanup;
+    }
+
+    if (close(writer->fd) != 0) {
+        writer->fd = -1;
+        goto cleanup;
+    }
+    writer->fd = -1;
+
+    if (rename(tmpname, archive) != 0) {
+        goto cleanup;
+    }
+
+    status = 0;
+
+cleanup:
+    errnum = errno;
+
+    if (infd >= 0) {
+        close(infd);
+    }
+
+    if (writer->fd >= 0) {
+        close(writer->fd);
+    }
+
+    if (status != 0) {
+        unlink(tmpname);
+    }
+
+    for (size_t index = 0; index < writer->column_count; ++ index) {
+        free(writer->columns[index].name);
+        free(writer->columns[index].offsets);
+        free(writer->columns[index].sizes);
+    }
+
+    buffer_free(&writer->arena);
+    buffer_free(&writer->out);
+    buffer_free(&writer->directory);
+    buffer_free(&writer->data);
+    buffer_free(&writer->footer);
+    lines_free(&lines);
+    free(writer);
+
+    errno = errnum;
+
+    return status;
+}
+
+int columnar_open(struct Pipelog_Columnar *columnar, const char *filename) {
+    unsigned char magic[PIPELOG_COLUMNAR_MAGIC_SIZE];
+    unsigned char trailer[16];
+    unsigned char *footer = NULL;
+
+    memset(columnar, 0, sizeof(*columnar));
+
+    columnar->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (columnar->fd < 0) {
+        return -1;
+    }
+
+    const off_t file_size = lseek(columnar->fd, 0, SEEK_END);
+    if (file_size < (off_t)(sizeof(magic) + sizeof(trailer))) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    if (pread_all(columnar->fd, magic, sizeof(magic), 0) != 0 ||
+        pread_all(columnar->fd, trailer, sizeof(trailer), file_size - sizeof(trailer)) != 0) {
+        goto error;
+    }
+
+    if (memcmp(magic, PIPELOG_COLUMNAR_MAGIC, sizeof(magic)) != 0 ||
+        memcmp(trailer + 8, PIPELOG_COLUMNAR_TRAILER, PIPELOG_COLUMNAR_MAGIC_SIZE) != 0) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    uint64_t footer_offset = 0;
+    for (size_t index = 0; index < 8; ++ index) {
+        footer_offset |= (uint64_t)trailer[index] << (index * 8);
+    }
+
+    if (footer_offset < sizeof(magic) || footer_offset > (uint64_t)file_size - sizeof(trailer)) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    const size_t footer_size = file_size - sizeof(trailer) - footer_offset;
+    footer = malloc(footer_size + 1);
+    if (footer == NULL || pread_all(columnar->fd, footer, footer_size, footer_offset) != 0) {
+        goto error;
+    }
+
+    const unsigned char *ptr = footer;
+    const unsigned char *end = footer + footer_size;
+    uint64_t block_count;
+    if (get_varint(&ptr, end, &block_count) != 0 || block_count > footer_size) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    columnar->block_offsets = calloc(block_count + 1, sizeof(uint64_t));
+    columnar->block_rows    = calloc(block_count + 1, sizeof(uint64_t));
+    if (columnar->block_offsets == NULL || columnar->block_rows == NULL) {
+        goto error;
+    }
+
+    for (size_t index = 0; index < block_count; ++ index) {
+        if (get_varint(&ptr, end, &columnar->block_offsets[index]) != 0 ||
+            get_varint(&ptr, end, &columnar->block_rows[index]) != 0) {
+            goto error;
+        }
+    }
+    // end of the last block
+    columnar->block_offsets[block_count] = footer_offset;
+    columnar->block_count = block_count;
+
+    free(footer);
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        free(footer);
+        columnar_close(columnar);
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+static int get_bytes(const unsigned char **ptr, const unsigned char *end, char **data, size_t *size) {
+    uint64_t length;
+    if (get_varint(ptr, end, &length) != 0 || length > (uint64_t)(end - *ptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *data = malloc(length + 1);
+    if (*data == NULL) {
+        return -1;
+    }
+    memcpy(*data, *ptr, length);
+    (*data)[length] = 0;
+    *size = length;
+    *ptr += length;
+
+    return 0;
+}
+
+int columnar_read_block(const struct Pipelog_Columnar *columnar, size_t index, struct Pipelog_Columnar_Block *block) {
+    unsigned char header[30];
+    unsigned char *directory = NULL;
+
+    memset(block, 0, sizeof(*block));
+
+    if (index >= columnar->block_count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const uint64_t offset = columnar->block_offsets[index];
+    const uint64_t block_size = columnar->block_offsets[index + 1] - offset;
+    const size_t header_size = block_size < sizeof(header) ? block_size : sizeof(header);
+    if (pread_all(columnar->fd, header, header_size, offset) != 0) {
+        return -1;
+    }
+
+    const unsigned char *ptr = header;
+    const unsigned char *end = header + header_size;
+    uint64_t column_count, directory_size;
+    if (get_varint(&ptr, end, &block->rows) != 0 ||
+        get_varint(&ptr, end, &column_count) != 0 ||
+        get_varint(&ptr, end, &directory_size) != 0) {
+        return -1;
+    }
+
+    const uint64_t directory_offset = offset + (ptr - header);
+    const uint64_t data_offset = directory_offset + directory_size;
+    if (column_count > PIPELOG_COLUMNAR_MAX_COLUMNS || data_offset > columnar->block_offsets[index + 1]) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    directory = malloc(directory_size + 1);
+    block->columns = calloc(column_count + 1, sizeof(struct Pipelog_Column));
+    if (directory == NULL || block->columns == NULL) {
+        goto error;
+    }
+
+    if (pread_all(columnar->fd, directory, directory_size, directory_offset) != 0) {
+        goto error;
+    }
+
+    ptr = directory;
+    end = directory + directory_size;
+    for (size_t column_index = 0; column_index < column_count; ++ column_index) {
+        struct Pipelog_Column *column = &block->columns[column_index];
+        uint64_t encoding, value;
+
+        block->column_count = column_index + 1;
+
+        if (get_bytes(&ptr, end, &column->name, &column->name_size) != 0 ||
+            get_varint(&ptr, end, &encoding) != 0 ||
+            get_varint(&ptr, end, &column->nulls) != 0) {
+            goto error;
+        }
+        column->encoding = encoding;
+
+        if (encoding == PIPELOG_COLUMN_INT) {
+            if (get_varint(&ptr, end, &value) != 0) {
+                goto error;
+            }
+            column->min_int = unzigzag(value);
+            if (get_varint(&ptr, end, &value) != 0) {
+                goto error;
+            }
+            column->max_int = unzigzag(value);
+            column->has_stats = column->nulls < block->rows;
+        } else if (encoding == PIPELOG_COLUMN_DICT || encoding == PIPELOG_COLUMN_PLAIN) {
+            if (get_varint(&ptr, end, &value) != 0) {
+                goto error;
+            }
+            column->has_stats = value != 0;
+            if (column->has_stats && (
+                    get_bytes(&ptr, end, &column->min, &column->min_size) != 0 ||
+                    get_bytes(&ptr, end, &column->max, &column->max_size) != 0)) {
+                goto error;
+            }
+        } else {
+            errno = EINVAL;
+            goto error;
+        }
+
+        if (get_varint(&ptr, end, &column->offset) != 0 ||
+            get_varint(&ptr, end, &column->size) != 0) {
+            goto error;
+        }
+        column->offset += data_offset;
+
+        if (column->offset + column->size > columnar->block_offsets[index + 1]) {
+            errno = EINVAL;
+            goto error;
+        }
+    }
+
+    free(directory);
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        free(directory);
+        columnar_block_free(block);
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+int columnar_read_values(const struct Pipelog_Columnar *columnar, const struct Pipelog_Columnar_Block *block, const struct Pipelog_Column *column, Pipelog_Value_Callback callback, void *context) {
+    unsigned char *data = malloc(column->size + 1);
+    const char **entries = NULL;
+    size_t *entry_sizes = NULL;
+    int status = -1;
+
+    if (data == NULL) {
+        return -1;
+    }
+
+    if (pread_all(columnar->fd, data, column->size, column->offset) != 0) {
+        goto cleanup;
+    }
+
+    const unsigned char *ptr = data;
+    const unsigned char *end = data + column->size;
+    const uint64_t rows = block->rows;
+
+    if (column->encoding == PIPELOG_COLUMN_INT) {
+        const size_t bitmap_size = (rows + 7) / 8;
+        if (bitmap_size > column->size) {
+            errno = EINVAL;
+            goto cleanup;
+        }
+        const unsigned char *bitmap = ptr;
+        ptr += bitmap_size;
+
+        int64_t value = 0;
+        for (uint64_t row = 0; row < rows; ++ row) {
+            if (!(bitmap[row / 8] & (1 << (row % 8)))) {
+                continue;
+            }
+
+            uint64_t delta;
+            if (get_varint(&ptr, end, &delta) != 0) {
+                goto cleanup;
+            }
+            value += unzigzag(delta);
+
+            char text[24];
+            const int size = snprintf(text, sizeof(text), "%" PRId64, value);
+            if ((status = callback(context, row, text, size)) != 0) {
+                goto cleanup;
+            }
+        }
+    } else if (column->encoding == PIPELOG_COLUMN_DICT) {
+        uint64_t entry_count;
+        if (get_varint(&ptr, end, &entry_count) != 0 || entry_count > column->size) {
+            errno = EINVAL;
+            goto cleanup;
+        }
+
+        entries     = malloc((entry_count + 1) * sizeof(const char*));
+        entry_sizes = malloc((entry_count + 1) * sizeof(size_t));
+        if (entries == NULL || entry_sizes == NULL) {
+            goto cleanup;
+        }
+
+        for (uint64_t entry = 0; entry < entry_count; ++ entry) {
+            uint64_t size;
+            if (get_varint(&ptr, end, &size) != 0 || size > (uint64_t)(end - ptr)) {
+                errno = EINVAL;
+                goto cleanup;
+            }
+            entries[entry] = (const char*)ptr;
+            entry_sizes[entry] = size;
+            ptr += size;
+        }
+
+        for (uint64_t row = 0; row < rows; ++ row) {
+            uint64_t entry;
+            if (get_varint(&ptr, end, &entry) != 0 || entry > entry_count) {
+                errno = EINVAL;
+                goto cleanup;
+            }
+            if (entry > 0 && (status = callback(context, row, entries[entry - 1], entry_sizes[entry - 1])) != 0) {
+                goto cleanup;
+            }
+        }
+    } else {
+        for (uint64_t row = 0; row < rows; ++ row) {
+            uint64_t size;
+            if (get_varint(&ptr, end, &size) != 0 || (size > 0 && size - 1 > (uint64_t)(end - ptr))) {
+                errno = EINVAL;
+                goto cleanup;
+            }
+            if (size == 0) {
+                continue;
+            }
+            if ((status = callback(context, row, (const char*)ptr, size - 1)) != 0) {
+                goto cleanup;
+            }
+            ptr += size - 1;
+        }
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        free(entries);
+        free(entry_sizes);
+        free(data);
+        errno = errnum;
+    }
+
+    return status;
+}
+
+void columnar_block_free(struct Pipelog_Columnar_Block *block) {
+    if (block->columns != NULL) {
+        for (size_t index = 0; index < block->column_count; ++ index) {
+            free(block->columns[index].name);
+            free(block->columns[index].min);
+            free(block->columns[index].max);
+        }
+    }
+    free(block->columns);
+    memset(block, 0, sizeof(*block));
+}
+
+void columnar_close(struct Pipelog_Columnar *columnar) {
+    if (columnar->fd >= 0) {
+        close(columnar->fd);
+    }
+    free(columnar->block_offsets);
+    free(columnar->block_rows);
+    memset(columnar, 0, sizeof(*columnar));
+    columnar->fd = -1;
+}
+
+struct Pipelog_Count {
+    char    *value;
+    size_t   size;
+    uint64_t count;
+};
+
+struct Pipelog_Counts {
+    struct Pipelog_Count *entries; //!< hash table
+    size_t count;
+    size_t capacity;
+};
+
+static int count_value(void *context, uint64_t row, const char *value, size_t size) {
+    struct Pipelog_Counts *counts = context;
+
+    if ((counts->count + 1) * 10 > counts->capacity * 7) {
+        const size_t capacity = counts->capacity == 0 ? 64 : counts->capacity * 2;
+        struct Pipelog_Count *entries = calloc(capacity, sizeof(struct Pipelog_Count));
+        if (entries == NULL) {
+            return -1;
+        }
+
+        for (size_t index = 0; index < counts->capacity; ++ index) {
+            const struct Pipelog_Count *entry = &counts->entries[index];
+            if (entry->value != NULL) {
+                size_t slot = hash_bytes(entry->value, entry->size) & (capacity - 1);
+                while (entries[slot].value != NULL) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                entries[slot] = *entry;
+            }
+        }
+
+        free(counts->entries);
+        counts->entries  = entries;
+        counts->capacity = capacity;
+    }
+
+    size_t slot = hash_bytes(value, size) & (counts->capacity - 1);
+    for (;;) {
+        struct Pipelog_Count *entry = &counts->entries[slot];
+        if (entry->value == NULL) {
+            entry->value = malloc(size + 1);
+            if (entry->value == NULL) {
+                return -1;
+            }
+            memcpy(entry->value, value, size);
+            entry->size  = size;
+            entry->count = 1;
+            ++ counts->count;
+            return 0;
+        }
+
+        if (entry->size == size && memcmp(entry->value, value, size) == 0) {
+            ++ entry->count;
+            return 0;
+        }
+
+        slot = (slot + 1) & (counts->capacity - 1);
+    }
+}
+
+static int compare_counts(const void *lhs, const void *rhs) {
+    const struct Pipelog_Count *left = lhs;
+    const struct Pipelog_Count *right = rhs;
+
+    if (left->count != right->count) {
+        return left->count < right->count ? 1 : -1;
+    }
+
+    return compare_bytes(left->value, left->size, right->value, right->size);
+}
+
+static int write_text(int fd, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static int write_text(int fd, const char *format, ...) {
+    char buf[BUFSIZ];
+    va_list args;
+
+    va_start(args, format);
+    const int size = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    if (size < 0) {
+        return -1;
+    }
+
+    return write_all(fd, buf, (size_t)size < sizeof(buf) ? (size_t)size : sizeof(buf) - 1);
+}
+
+int columnar_count_by(const char *filename, const char *column_name, int outfd) {
+    struct Pipelog_Columnar columnar;
+    struct Pipelog_Counts counts = { NULL, 0, 0 };
+    const size_t name_size = strlen(column_name);
+    int status = -1;
+
+    if (columnar_open(&columnar, filename) != 0) {
+        return -1;
+    }
+
+    for (size_t index = 0; index < columnar.block_count; ++ index) {
+        struct Pipelog_Columnar_Block block;
+        if (columnar_read_block(&columnar, index, &block) != 0) {
+            goto cleanup;
+        }
+
+        int result = 0;
+        for (size_t column_index = 0; column_index < block.column_count; ++ column_index) {
+            const struct Pipelog_Column *column = &block.columns[column_index];
+            if (column->name_size == name_size && memcmp(column->name, column_name, name_size) == 0) {
+                result = columnar_read_values(&columnar, &block, column, count_value, &counts);
+                break;
+            }
+        }
+
+        columnar_block_free(&block);
+
+        if (result != 0) {
+            goto cleanup;
+        }
+    }
+
+    // move the entries to the front of the table and sort them
+    size_t count = 0;
+    for (size_t index = 0; index < counts.capacity; ++ index) {
+        if (counts.entries[index].value != NULL) {
+            counts.entries[count ++] = counts.entries[index];
+        }
+    }
+    counts.capacity = count;
+
+    if (count > 0) {
+        qsort(counts.entries, count, sizeof(struct Pipelog_Count), compare_counts);
+    }
+
+    for (size_t index = 0; index < count; ++ index) {
+        const struct Pipelog_Count *entry = &counts.entries[index];
+        if (write_text(outfd, "%" PRIu64 "\t", entry->count) != 0 ||
+            write_all(outfd, entry->value, entry->size) != 0 ||
+            write_all(outfd, "\n", 1) != 0) {
+            goto cleanup;
+        }
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        for (size_t index = 0; index < counts.capacity; ++ index) {
+            free(counts.entries[index].value);
+        }
+        free(counts.entries);
+        columnar_close(&columnar);
+        errno = errnum;
+    }
+
+    return status;
+}
+
+static const char *encoding_name(int encoding) {
+    switch (encoding) {
+        case PIPELOG_COLUMN_INT:   return "int";
+        case PIPELOG_COLUMN_DICT:  return "dict";
+        case PIPELOG_COLUMN_PLAIN: return "plain";
+        default:                   return "?";
+    }
+}
+
+int columnar_summary(const char *filename, int outfd) {
+    struct Pipelog_Columnar columnar;
+    uint64_t rows = 0;
+    int status = -1;
+
+    if (columnar_open(&columnar, filename) != 0) {
+        return -1;
+    }
+
+    for (size_t index = 0; index < columnar.block_count; ++ index) {
+        rows += columnar.block_rows[index];
+    }
+
+    if (write_text(outfd, "blocks: %zu\nrows: %" PRIu64 "\n", columnar.block_count, rows) != 0) {
+        goto cleanup;
+    }
+
+    for (size_t index = 0; index < columnar.block_count; ++ index) {
+        struct Pipelog_Columnar_Block block;
+        if (columnar_read_block(&columnar, index, &block) != 0) {
+            goto cleanup;
+        }
+
+        int result = write_text(outfd, "block %zu: %" PRIu64 " rows\n", index, block.rows);
+        for (size_t column_index = 0; column_index < block.column_count && result == 0; ++ column_index) {
+            const struct Pipelog_Column *column = &block.columns[column_index];
+
+            result = write_text(outfd, "    %s\t%s\t%" PRIu64 " values\t%" PRIu64 " bytes",
+                column->name, encoding_name(column->encoding), block.rows - column->nulls, column->size);
+
+            if (result == 0 && column->has_stats) {
+                if (column->encoding == PIPELOG_COLUMN_INT) {
+                    result = write_text(outfd, "\tmin=%" PRId64 "\tmax=%" PRId64, column->min_int, column->max_int);
+                } else {
+                    result = write_text(outfd, "\tmin=%s\tmax=%s", column->min, column->max);
+                }
+            }
+
+            if (result == 0) {
+                result = write_all(outfd, "\n", 1);
+            }
+        }
+
+        columnar_block_free(&block);
+
+        if (result != 0) {
+            goto cleanup;
+        }
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        columnar_close(&columnar);
+        errno = errnum;
+    }
+
+    return status;
+}
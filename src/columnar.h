@@ -0,0 +1,130 @@
+#ifndef PIPELOG_COLUMNAR_H
+#define PIPELOG_COLUMNAR_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_COLUMNAR_MAGIC "PLGCOL1\n"
+#define PIPELOG_COLUMNAR_TRAILER "PLGCOLE\n"
+#define PIPELOG_COLUMNAR_MAGIC_SIZE 8
+#define PIPELOG_COLUMNAR_SUFFIX ".plc"
+
+#define PIPELOG_COLUMNAR_BLOCK_ROWS 16384
+#define PIPELOG_COLUMNAR_BLOCK_BYTES (64 * 1024 * 1024)
+#define PIPELOG_COLUMNAR_MAX_COLUMNS 128
+// longer strings don't get min/max statistics
+#define PIPELOG_COLUMNAR_MAX_STAT 256
+
+// timestamp at the start of the line or of its ts, time or @timestamp field,
+// in milliseconds since the epoch
+#define PIPELOG_COLUMN_TIME "_time"
+// lines without fields
+#define PIPELOG_COLUMN_RAW "_raw"
+
+/**
+ * File layout (all numbers are LEB128 varints unless noted):
+ *
+ * magic, blocks..., footer, footer offset (uint64 LE), trailer
+ *
+ * block:  rows, column count, directory size, directory, column data
+ * column: name size, name, encoding, null count, statistics,
+ *         data offset (relative to the column data of the block), data size
+ * footer: block count, per block: offset, rows
+ *
+ * Statistics of INT columns are the zigzag encoded min and max. String
+ * columns have a flag and, if it is 1, min and max (size, bytes).
+ *
+ * INT:   presence bitmap (1 bit per row), zigzag deltas of present values
+ * DICT:  entry count, entries (size, bytes), per row: 0 for null or index + 1
+ * PLAIN: per row: 0 for null or size + 1, bytes
+ */
+enum {
+    PIPELOG_COLUMN_INT   = 1,
+    PIPELOG_COLUMN_DICT  = 2,
+    PIPELOG_COLUMN_PLAIN = 3,
+};
+
+struct Pipelog_Column {
+    char    *name;
+    size_t   name_size;
+    int      encoding;
+    uint64_t nulls;
+    bool     has_stats;
+    int64_t  min_int;
+    int64_t  max_int;
+    char    *min;      //!< string statistics
+    size_t   min_size;
+    char    *max;
+    size_t   max_size;
+    uint64_t offset;   //!< absolute file offset of the data
+    uint64_t size;
+};
+
+struct Pipelog_Columnar_Block {
+    uint64_t rows;
+    size_t   column_count;
+    struct Pipelog_Column *columns;
+};
+
+struct Pipelog_Columnar {
+    int       fd;
+    size_t    block_count;
+    uint64_t *block_offsets;
+    uint64_t *block_rows;
+};
+
+/**
+ * Called for every non-null value. INT values are passed as decimal text.
+ * A non-zero return value stops the iteration and is passed on.
+ */
+typedef int (*Pipelog_Value_Callback)(void *context, uint64_t row, const char *value, size_t size);
+
+/**
+ * Convert the log file filename to a columnar archive. Every line is parsed
+ * with parse_fields() and each field is stored in its own column. Lines
+ * without fields are stored in the column _raw. The archive is written to a
+ * temporary file that is renamed to archive when done.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int columnar_convert(const char *filename, const char *archive);
+
+int columnar_open(struct Pipelog_Columnar *columnar, const char *filename);
+
+/**
+ * Read the column directory of a block. Free it with columnar_block_free().
+ */
+int columnar_read_block(const struct Pipelog_Columnar *columnar, size_t index, struct Pipelog_Columnar_Block *block);
+
+/**
+ * Read and decode only the data of one column.
+ */
+int columnar_read_values(const struct Pipelog_Columnar *columnar, const struct Pipelog_Columnar_Block *block, const struct Pipelog_Column *column, Pipelog_Value_Callback callback, void *context);
+
+void columnar_block_free(struct Pipelog_Columnar_Block *block);
+
+void columnar_close(struct Pipelog_Columnar *columnar);
+
+/**
+ * Write the number of rows per distinct value of column to outfd, most
+ * frequent first. Only the data of this column is read.
+ */
+int columnar_count_by(const char *filename, const char *column, int outfd);
+
+/**
+ * Write the columns of an archive with their encodings and statistics to outfd.
+ */
+int columnar_summary(const char *filename, int outfd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,112 @@
+#include "crc32c.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// reversed Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc32c_table[8][256];
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+typedef uint32_t (*Crc32c_Func)(uint32_t crc, const unsigned char *data, size_t size);
+
+static Crc32c_Func crc32c_func = NULL;
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *data, size_t size) {
+    while (size > 0 && ((uintptr_t)data & 7) != 0) {
+        crc = crc32c_table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+        ++ data;
+        -- size;
+    }
+
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        word ^= crc;
+        crc = crc32c_table[7][ word        & 0xff] ^
+              crc32c_table[6][(word >>  8) & 0xff] ^
+              crc32c_table[5][(word >> 16) & 0xff] ^
+              crc32c_table[4][(word >> 24) & 0xff] ^
+              crc32c_table[3][(word >> 32) & 0xff] ^
+              crc32c_table[2][(word >> 40) & 0xff] ^
+              crc32c_table[1][(word >> 48) & 0xff] ^
+              crc32c_table[0][ word >> 56];
+        data += 8;
+        size -= 8;
+    }
+
+    while (size > 0) {
+        crc = crc32c_table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+        ++ data;
+        -- size;
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *data, size_t size) {
+    uint64_t crc64 = crc;
+
+    while (size > 0 && ((uintptr_t)data & 7) != 0) {
+        crc64 = __builtin_ia32_crc32qi(crc64, *data);
+        ++ data;
+        -- size;
+    }
+
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+
+    while (size > 0) {
+        crc64 = __builtin_ia32_crc32qi(crc64, *data);
+        ++ data;
+        -- size;
+    }
+
+    return crc64;
+}
+#endif
+
+static void crc32c_init(void) {
+    for (uint32_t byte = 0; byte < 256; ++ byte) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; ++ bit) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][byte] = crc;
+    }
+
+    for (uint32_t byte = 0; byte < 256; ++ byte) {
+        uint32_t crc = crc32c_table[0][byte];
+        for (int slice = 1; slice < 8; ++ slice) {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            crc32c_table[slice][byte] = crc;
+        }
+    }
+
+    crc32c_func = crc32c_sw;
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_func = crc32c_hw;
+    }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t size) {
+    pthread_once(&crc32c_once, crc32c_init);
+
+    return ~crc32c_func(~crc, data, size);
+}
@@ -0,0 +1,26 @@
+#ifndef PIPELOG_CRC32C_H
+#define PIPELOG_CRC32C_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * CRC-32C (Castagnoli) of data, continuing crc, which is 0 for the start.
+ * crc32c(crc32c(0, a), b) is the checksum of a followed by b.
+ *
+ * Uses the crc32 instruction of SSE 4.2 if the CPU has it, slicing-by-8
+ * tables otherwise.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
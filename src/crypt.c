@@ -0,0 +1,420 @@
+#include "crypt.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+static void frame_nonce(uint64_t frame, bool final, unsigned char nonce[PIPELOG_CRYPT_NONCE_SIZE]) {
+    memset(nonce, 0, 4);
+    nonce[0] = final;
+    for (size_t index = 0; index < 8; ++ index) {
+        nonce[4 + index] = frame >> (index * 8);
+    }
+}
+
+// a context for AES-256-GCM with key, whose nonce is set for each message
+static EVP_CIPHER_CTX *gcm_new(const unsigned char key[PIPELOG_CRYPT_KEY_SIZE], bool encrypt) {
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), NULL, key, NULL, encrypt) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        errno = EIO;
+        return NULL;
+    }
+
+    return ctx;
+}
+
+// encrypts size bytes of input to output, and writes the tag that authenticates them and aad
+static int gcm_encrypt(EVP_CIPHER_CTX *ctx, const unsigned char nonce[PIPELOG_CRYPT_NONCE_SIZE],
+                       const void *aad, size_t aad_size, const void *input, void *output, size_t size,
+                       unsigned char tag[PIPELOG_CRYPT_TAG_SIZE]) {
+    int count = 0;
+
+    if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_EncryptUpdate(ctx, NULL, &count, aad, aad_size) != 1 ||
+        (size > 0 && EVP_EncryptUpdate(ctx, output, &count, input, size) != 1) ||
+        EVP_EncryptFinal_ex(ctx, (unsigned char*)output + size, &count) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, PIPELOG_CRYPT_TAG_SIZE, tag) != 1) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+// errno is EBADMSG if tag doesn't match, then output holds no plaintext
+static int gcm_decrypt(EVP_CIPHER_CTX *ctx, const unsigned char nonce[PIPELOG_CRYPT_NONCE_SIZE],
+                       const void *aad, size_t aad_size, const void *input, void *output, size_t size,
+                       const unsigned char tag[PIPELOG_CRYPT_TAG_SIZE]) {
+    int count = 0;
+
+    if (EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_DecryptUpdate(ctx, NULL, &count, aad, aad_size) != 1 ||
+        (size > 0 && EVP_DecryptUpdate(ctx, output, &count, input, size) != 1) ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, PIPELOG_CRYPT_TAG_SIZE, (void*)tag) != 1) {
+        errno = EIO;
+        return -1;
+    }
+
+    if (EVP_DecryptFinal_ex(ctx, (unsigned char*)output + size, &count) != 1) {
+        explicit_bzero(output, size);
+        errno = EBADMSG;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int random_bytes(unsigned char *buf, size_t size) {
+    while (size > 0) {
+        const ssize_t count = getrandom(buf, size, 0);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf  += count;
+        size -= count;
+    }
+    return 0;
+}
+
+static int hex_digit(int ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+int crypt_load_key(const char *filename, unsigned char key[PIPELOG_CRYPT_KEY_SIZE]) {
+    // room for the hexadecimal form, a line end and one byte to detect longer files
+    unsigned char buf[PIPELOG_CRYPT_KEY_SIZE * 2 + 3];
+    size_t size = 0;
+    int status = -1;
+
+    const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    while (size < sizeof(buf)) {
+        const ssize_t count = read(fd, buf + size, sizeof(buf) - size);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            goto cleanup;
+        }
+        if (count == 0) {
+            break;
+        }
+        size += count;
+    }
+
+    if (size == PIPELOG_CRYPT_KEY_SIZE) {
+        memcpy(key, buf, PIPELOG_CRYPT_KEY_SIZE);
+        status = 0;
+        goto cleanup;
+    }
+
+    while (size > 0 && (buf[size - 1] == '\n' || buf[size - 1] == '\r' || buf[size - 1] == ' ' || buf[size - 1] == '\t')) {
+        -- size;
+    }
+
+    errno = EINVAL;
+    if (size != PIPELOG_CRYPT_KEY_SIZE * 2) {
+        goto cleanup;
+    }
+
+    for (size_t index = 0; index < PIPELOG_CRYPT_KEY_SIZE; ++ index) {
+        const int high = hex_digit(buf[index * 2]);
+        const int low  = hex_digit(buf[index * 2 + 1]);
+        if (high < 0 || low < 0) {
+            goto cleanup;
+        }
+        key[index] = high << 4 | low;
+    }
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        explicit_bzero(buf, sizeof(buf));
+        close(fd);
+        errno = errnum;
+    }
+
+    return status;
+}
+
+int crypt_init(struct Pipelog_Crypt *crypt, const char *keyfile) {
+    unsigned char key[PIPELOG_CRYPT_KEY_SIZE];
+
+    memset(crypt, 0, sizeof(*crypt));
+
+    if (crypt_load_key(keyfile, key) != 0) {
+        return -1;
+    }
+
+    crypt->master = gcm_new(key, true);
+    explicit_bzero(key, sizeof(key));
+
+    return crypt->master == NULL ? -1 : 0;
+}
+
+// writes the header of a new segment with a fresh file key to buf
+static int start_segment(struct Pipelog_Crypt *crypt, unsigned char *buf) {
+    unsigned char key[PIPELOG_CRYPT_KEY_SIZE];
+    unsigned char *nonce = buf + PIPELOG_CRYPT_MAGIC_SIZE;
+    unsigned char *wrapped = nonce + PIPELOG_CRYPT_NONCE_SIZE;
+
+    if (random_bytes(key, sizeof(key)) != 0 || random_bytes(nonce, PIPELOG_CRYPT_NONCE_SIZE) != 0) {
+        explicit_bzero(key, sizeof(key));
+        return -1;
+    }
+
+    memcpy(buf, PIPELOG_CRYPT_MAGIC, PIPELOG_CRYPT_MAGIC_SIZE);
+    if (gcm_encrypt(crypt->master, nonce, buf, PIPELOG_CRYPT_MAGIC_SIZE, key, wrapped, sizeof(key), wrapped + sizeof(key)) != 0) {
+        explicit_bzero(key, sizeof(key));
+        return -1;
+    }
+
+    if (crypt->file != NULL) {
+        EVP_CIPHER_CTX_free(crypt->file);
+    }
+    crypt->file = gcm_new(key, true);
+    explicit_bzero(key, sizeof(key));
+    if (crypt->file == NULL) {
+        return -1;
+    }
+    crypt->frame = 0;
+
+    return 0;
+}
+
+const char *encrypt_output(struct Pipelog_Crypt *crypt, unsigned long opened, const char *data, size_t *size) {
+    const size_t input_size = *size;
+
+    if (input_size == 0) {
+        return data;
+    }
+
+    const bool start = !crypt->started || crypt->opened != opened;
+    const size_t frames = (input_size + PIPELOG_CRYPT_FRAME_SIZE - 1) / PIPELOG_CRYPT_FRAME_SIZE;
+    const size_t output_size = (start ? PIPELOG_CRYPT_HEADER_SIZE : 0) +
+        frames * (PIPELOG_CRYPT_FRAME_HEADER_SIZE + PIPELOG_CRYPT_TAG_SIZE) + input_size;
+
+    if (reserve(&crypt->buf, &crypt->capacity, output_size) != 0) {
+        return NULL;
+    }
+
+    unsigned char *ptr = (unsigned char*)crypt->buf;
+
+    if (start) {
+        // new file, start a self-contained segment
+        if (start_segment(crypt, ptr) != 0) {
+            return NULL;
+        }
+        crypt->opened  = opened;
+        crypt->started = true;
+        ptr += PIPELOG_CRYPT_HEADER_SIZE;
+    }
+
+    size_t offset = 0;
+    while (offset < input_size) {
+        unsigned char nonce[PIPELOG_CRYPT_NONCE_SIZE];
+        const size_t frame_size = input_size - offset < PIPELOG_CRYPT_FRAME_SIZE ? input_size - offset : PIPELOG_CRYPT_FRAME_SIZE;
+
+        put_uint32(ptr, frame_size);
+        frame_nonce(crypt->frame, false, nonce);
+        if (gcm_encrypt(crypt->file, nonce, ptr, PIPELOG_CRYPT_FRAME_HEADER_SIZE, data + offset,
+                        ptr + PIPELOG_CRYPT_FRAME_HEADER_SIZE, frame_size,
+                        ptr + PIPELOG_CRYPT_FRAME_HEADER_SIZE + frame_size) != 0) {
+            return NULL;
+        }
+
+        ++ crypt->frame;
+        ptr    += PIPELOG_CRYPT_FRAME_HEADER_SIZE + frame_size + PIPELOG_CRYPT_TAG_SIZE;
+        offset += frame_size;
+    }
+
+    *size = output_size;
+    return crypt->buf;
+}
+
+int crypt_close(struct Pipelog_Crypt *crypt, int fd) {
+    unsigned char buf[PIPELOG_CRYPT_FRAME_HEADER_SIZE + PIPELOG_CRYPT_TAG_SIZE];
+    unsigned char nonce[PIPELOG_CRYPT_NONCE_SIZE];
+
+    if (!crypt->started) {
+        return 0;
+    }
+    crypt->started = false;
+
+    put_uint32(buf, PIPELOG_CRYPT_FRAME_FINAL);
+    frame_nonce(crypt->frame, true, nonce);
+    if (gcm_encrypt(crypt->file, nonce, buf, PIPELOG_CRYPT_FRAME_HEADER_SIZE, NULL, buf + PIPELOG_CRYPT_FRAME_HEADER_SIZE, 0,
+                    buf + PIPELOG_CRYPT_FRAME_HEADER_SIZE) != 0) {
+        return -1;
+    }
+
+    return write_all(fd, buf, sizeof(buf));
+}
+
+void crypt_free(struct Pipelog_Crypt *crypt) {
+    // freeing a context clears its key
+    if (crypt->master != NULL) {
+        EVP_CIPHER_CTX_free(crypt->master);
+    }
+    if (crypt->file != NULL) {
+        EVP_CIPHER_CTX_free(crypt->file);
+    }
+    free(crypt->buf);
+    crypt->master   = NULL;
+    crypt->file     = NULL;
+    crypt->buf      = NULL;
+    crypt->capacity = 0;
+    crypt->started  = false;
+}
+
+int decrypt_stream(const unsigned char key[PIPELOG_CRYPT_KEY_SIZE], int infd, int outfd) {
+    EVP_CIPHER_CTX *master = NULL;
+    EVP_CIPHER_CTX *file = NULL;
+    unsigned char header[PIPELOG_CRYPT_HEADER_SIZE];
+    unsigned char *buf = NULL;
+    bool started = false;
+    bool closed = false; //!< the final frame of the segment was read
+    uint64_t frame = 0;
+    int status = -1;
+
+    master = gcm_new(key, false);
+    if (master == NULL) {
+        goto cleanup;
+    }
+
+    buf = malloc(PIPELOG_CRYPT_FRAME_SIZE + PIPELOG_CRYPT_TAG_SIZE);
+    if (buf == NULL) {
+        goto cleanup;
+    }
+
+    for (;;) {
+        ssize_t count = read_full(infd, header, PIPELOG_CRYPT_FRAME_HEADER_SIZE);
+        if (count < 0) {
+            goto cleanup;
+        }
+        if (count == 0) {
+            if (started && !closed) {
+                errno = EINVAL;
+                goto cleanup;
+            }
+            break;
+        }
+        if (count < PIPELOG_CRYPT_FRAME_HEADER_SIZE) {
+            errno = EINVAL;
+            goto cleanup;
+        }
+
+        const uint32_t value = get_uint32(header);
+        const bool final = value & PIPELOG_CRYPT_FRAME_FINAL;
+        const uint32_t frame_size = value & ~PIPELOG_CRYPT_FRAME_FINAL;
+        if (!final && frame_size > PIPELOG_CRYPT_FRAME_SIZE) {
+            // no frame is that big, so this is the magic of a new segment
+            if (started && !closed) {
+                errno = EINVAL;
+                goto cleanup;
+            }
+            count = read_full(infd, header + PIPELOG_CRYPT_FRAME_HEADER_SIZE, PIPELOG_CRYPT_HEADER_SIZE - PIPELOG_CRYPT_FRAME_HEADER_SIZE);
+            if (count < 0) {
+                goto cleanup;
+            }
+            if (count < PIPELOG_CRYPT_HEADER_SIZE - PIPELOG_CRYPT_FRAME_HEADER_SIZE ||
+                memcmp(header, PIPELOG_CRYPT_MAGIC, PIPELOG_CRYPT_MAGIC_SIZE) != 0) {
+                errno = EINVAL;
+                goto cleanup;
+            }
+
+            unsigned char file_key[PIPELOG_CRYPT_KEY_SIZE];
+            const unsigned char *nonce = header + PIPELOG_CRYPT_MAGIC_SIZE;
+            const unsigned char *wrapped = nonce + PIPELOG_CRYPT_NONCE_SIZE;
+            if (gcm_decrypt(master, nonce, header, PIPELOG_CRYPT_MAGIC_SIZE, wrapped, file_key, sizeof(file_key), wrapped + sizeof(file_key)) != 0) {
+                goto cleanup;
+            }
+
+            if (file != NULL) {
+                EVP_CIPHER_CTX_free(file);
+            }
+            file = gcm_new(file_key, false);
+            explicit_bzero(file_key, sizeof(file_key));
+            if (file == NULL) {
+                goto cleanup;
+            }
+            started = true;
+            closed  = false;
+            frame   = 0;
+            continue;
+        }
+
+        if (!started || closed || frame_size > PIPELOG_CRYPT_FRAME_SIZE) {
+            errno = EINVAL;
+            goto cleanup;
+        }
+
+        count = read_full(infd, buf, frame_size + PIPELOG_CRYPT_TAG_SIZE);
+        if (count < 0) {
+            goto cleanup;
+        }
+        if ((size_t)count < frame_size + PIPELOG_CRYPT_TAG_SIZE) {
+            errno = EINVAL;
+            goto cleanup;
+        }
+
+        unsigned char nonce[PIPELOG_CRYPT_NONCE_SIZE];
+        frame_nonce(frame, final, nonce);
+        if (gcm_decrypt(file, nonce, header, PIPELOG_CRYPT_FRAME_HEADER_SIZE, buf, buf, frame_size, buf + frame_size) != 0) {
+            goto cleanup;
+        }
+        ++ frame;
+        closed = final;
+
+        if (write_all(outfd, buf, frame_size) != 0) {
+            goto cleanup;
+        }
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        if (master != NULL) {
+            EVP_CIPHER_CTX_free(master);
+        }
+        if (file != NULL) {
+            EVP_CIPHER_CTX_free(file);
+        }
+        if (buf != NULL) {
+            explicit_bzero(buf, PIPELOG_CRYPT_FRAME_SIZE + PIPELOG_CRYPT_TAG_SIZE);
+            free(buf);
+        }
+        errno = errnum;
+    }
+
+    return status;
+}
@@ -0,0 +1,115 @@
+#ifndef PIPELOG_CRYPT_H
+#define PIPELOG_CRYPT_H
+#pragma once
+
+#include "pipelog.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <openssl/evp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * AES-256-GCM is done by libcrypto, which uses constant time code and AES-NI
+ * where the CPU has it.
+ *
+ * Every file, and every time a file is re-opened, starts a segment with this
+ * magic, a random nonce and a random file key encrypted and authenticated
+ * with the master key using that nonce (AES-256-GCM, the magic as additional
+ * data), followed by the tag. So each segment can be decrypted on its own and
+ * the master key encrypts only one block per segment.
+ */
+#define PIPELOG_CRYPT_KEY_SIZE   32
+#define PIPELOG_CRYPT_NONCE_SIZE 12
+#define PIPELOG_CRYPT_TAG_SIZE   16
+
+#define PIPELOG_CRYPT_MAGIC "PLGENC2\n"
+#define PIPELOG_CRYPT_MAGIC_SIZE 8
+#define PIPELOG_CRYPT_HEADER_SIZE (PIPELOG_CRYPT_MAGIC_SIZE + PIPELOG_CRYPT_NONCE_SIZE + PIPELOG_CRYPT_KEY_SIZE + PIPELOG_CRYPT_TAG_SIZE)
+
+/**
+ * Then follow frames of a 32 bit little endian size, that many bytes of
+ * ciphertext and the tag. The size is the additional data and the nonce is
+ * 4 zero bytes and the 64 bit little endian number of the frame in the
+ * segment, so frames can't be changed, reordered or moved to another
+ * segment. The size of a frame is at most PIPELOG_CRYPT_FRAME_SIZE, so it
+ * can't be confused with the magic.
+ *
+ * When the file is closed the segment ends with an empty frame that has
+ * PIPELOG_CRYPT_FRAME_FINAL set in its size and 1 as the first byte of its
+ * nonce, so frames cut off the end of a segment are noticed.
+ */
+#define PIPELOG_CRYPT_FRAME_HEADER_SIZE 4
+#define PIPELOG_CRYPT_FRAME_SIZE (1024 * 1024)
+#define PIPELOG_CRYPT_FRAME_FINAL 0x80000000
+
+struct Pipelog_Crypt {
+    EVP_CIPHER_CTX *master;
+    EVP_CIPHER_CTX *file;      //!< key of the current segment
+    unsigned long opened;      //!< file the current segment was written to
+    bool          started;     //!< a segment was started
+    uint64_t      frame;       //!< number of the next frame in the segment
+
+    char  *buf;
+    size_t capacity;
+};
+
+/**
+ * Read a 256 bit key from filename. The file holds the key as 32 raw bytes or
+ * as 64 hexadecimal digits, optionally followed by white space.
+ *
+ * Returns 0 on success, -1 on error and sets errno. errno is EINVAL if the
+ * file holds no key.
+ */
+int crypt_load_key(const char *filename, unsigned char key[PIPELOG_CRYPT_KEY_SIZE]);
+
+/**
+ * Initialize crypt with the master key read from keyfile.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int crypt_init(struct Pipelog_Crypt *crypt, const char *keyfile);
+
+/**
+ * Encrypt data as one or more frames. A new segment is started whenever
+ * opened differs from the last call, which means the output file was
+ * (re-)opened in between.
+ *
+ * Returns a pointer to an internal buffer that is valid until the next call.
+ * *size is updated to the size of the returned data. Returns NULL and sets
+ * errno on error.
+ */
+const char *encrypt_output(struct Pipelog_Crypt *crypt, unsigned long opened, const char *data, size_t *size);
+
+/**
+ * End the current segment, if any, by writing its final frame to fd, the file
+ * it was written to, before that is closed. The next call of
+ * encrypt_output() starts a new segment.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int crypt_close(struct Pipelog_Crypt *crypt, int fd);
+
+/**
+ * Overwrite the keys and free the buffer. Safe to call on a zeroed struct.
+ */
+void crypt_free(struct Pipelog_Crypt *crypt);
+
+/**
+ * Write the plaintext of the encrypted stream infd to outfd. Frames are
+ * checked before they are written, so everything written is authentic.
+ *
+ * Returns 0 on success, -1 on error and sets errno. errno is EBADMSG if the
+ * input was modified or the key is wrong and EINVAL if the input is
+ * malformed or truncated, including a segment without its final frame, e.g.
+ * of a file that is still written.
+ */
+int decrypt_stream(const unsigned char key[PIPELOG_CRYPT_KEY_SIZE], int infd, int outfd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
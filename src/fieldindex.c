@@ -0,0 +1,706 @@
+#include "fieldindex.h"
+#include "scan.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TABLE_SIZE (PIPELOG_FIELD_INDEX_MAX_VALUES * 2)
+
+struct Pipelog_Buffer {
+    char  *data;
+    size_t size;
+    size_t capacity;
+};
+
+static int buffer_put(struct Pipelog_Buffer *buffer, const void *data, size_t size) {
+    if (reserve(&buffer->data, &buffer->capacity, buffer->size + size) != 0) {
+        return -1;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return 0;
+}
+
+static int buffer_put_varint(struct Pipelog_Buffer *buffer, uint64_t value) {
+    unsigned char bytes[10];
+    size_t size = 0;
+    while (value >= 0x80) {
+        bytes[size ++] = (unsigned char)value | 0x80;
+        value >>= 7;
+    }
+    bytes[size ++] = (unsigned char)value;
+    return buffer_put(buffer, bytes, size);
+}
+
+static int get_varint(const unsigned char **ptr, const unsigned char *end, uint64_t *value) {
+    uint64_t result = 0;
+
+    for (unsigned int shift = 0; shift < 64 && *ptr < end; shift += 7) {
+        const unsigned char byte = *(*ptr) ++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static int get_bytes(const unsigned char **ptr, const unsigned char *end, const char **data, size_t *size) {
+    uint64_t length;
+    if (get_varint(ptr, end, &length) != 0 || length > (uint64_t)(end - *ptr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    *data = (const char*)*ptr;
+    *size = length;
+    *ptr += length;
+    return 0;
+}
+
+static uint32_t hash_value(const char *value, size_t size) {
+    // FNV-1a
+    uint32_t hash = 0x811c9dc5;
+    for (size_t index = 0; index < size; ++ index) {
+        hash ^= (unsigned char)value[index];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+static struct Pipelog_Field_Key *find_key(struct Pipelog_Field_Index *index, const char *key, size_t key_size) {
+    for (size_t key_index = 0; key_index < index->key_count; ++ key_index) {
+        struct Pipelog_Field_Key *entry = &index->keys[key_index];
+        if (entry->key_size == key_size && memcmp(entry->key, key, key_size) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static int add_key(struct Pipelog_Field_Index *index, const char *key, size_t key_size) {
+    if (find_key(index, key, key_size) != NULL) {
+        return 0;
+    }
+
+    if (index->key_count == PIPELOG_FIELD_INDEX_MAX_KEYS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct Pipelog_Field_Key *entry = &index->keys[index->key_count];
+    entry->key    = malloc(key_size + 1);
+    entry->values = calloc(PIPELOG_FIELD_INDEX_MAX_VALUES, sizeof(struct Pipelog_Posting));
+    entry->table  = calloc(TABLE_SIZE, sizeof(uint32_t));
+    if (entry->key == NULL || entry->values == NULL || entry->table == NULL) {
+        free(entry->key);
+        free(entry->values);
+        free(entry->table);
+        memset(entry, 0, sizeof(*entry));
+        return -1;
+    }
+
+    memcpy(entry->key, key, key_size);
+    entry->key[key_size] = 0;
+    entry->key_size = key_size;
+    ++ index->key_count;
+
+    return 0;
+}
+
+// returns NULL and sets overflow if the value can't be indexed
+static struct Pipelog_Posting *get_posting(struct Pipelog_Field_Key *key, const char *value, size_t value_size) {
+    size_t slot = hash_value(value, value_size) & (TABLE_SIZE - 1);
+
+    for (;;) {
+        const uint32_t entry = key->table[slot];
+        if (entry == 0) {
+            break;
+        }
+        struct Pipelog_Posting *posting = &key->values[entry - 1];
+        if (posting->value_size == value_size && memcmp(posting->value, value, value_size) == 0) {
+            return posting;
+        }
+        slot = (slot + 1) & (TABLE_SIZE - 1);
+    }
+
+    if (key->value_count == PIPELOG_FIELD_INDEX_MAX_VALUES || value_size > PIPELOG_FIELD_INDEX_MAX_VALUE) {
+        key->overflow = true;
+        return NULL;
+    }
+
+    struct Pipelog_Posting *posting = &key->values[key->value_count];
+    posting->value = malloc(value_size + 1);
+    if (posting->value == NULL) {
+        return NULL;
+    }
+    memcpy(posting->value, value, value_size);
+    posting->value[value_size] = 0;
+    posting->value_size = value_size;
+
+    key->table[slot] = ++ key->value_count;
+
+    return posting;
+}
+
+static int add_block(struct Pipelog_Posting *posting, uint64_t block) {
+    if (posting->block_count > 0 && posting->blocks[posting->block_count - 1] == block) {
+        return 0;
+    }
+
+    if (posting->block_count == posting->capacity) {
+        const size_t capacity = posting->capacity == 0 ? 16 : posting->capacity * 2;
+        uint64_t *blocks = realloc(posting->blocks, capacity * sizeof(uint64_t));
+        if (blocks == NULL) {
+            return -1;
+        }
+        posting->blocks   = blocks;
+        posting->capacity = capacity;
+    }
+
+    posting->blocks[posting->block_count ++] = block;
+
+    return 0;
+}
+
+static void free_keys(struct Pipelog_Field_Index *index) {
+    for (size_t key_index = 0; key_index < index->key_count; ++ key_index) {
+        struct Pipelog_Field_Key *key = &index->keys[key_index];
+        for (size_t value_index = 0; value_index < key->value_count; ++ value_index) {
+            free(key->values[value_index].value);
+            free(key->values[value_index].blocks);
+        }
+        free(key->key);
+        free(key->values);
+        free(key->table);
+        memset(key, 0, sizeof(*key));
+    }
+    index->key_count = 0;
+}
+
+static int read_file(const char *filename, unsigned char **data, size_t *size) {
+    struct stat meta;
+    const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &meta) != 0) {
+        goto error;
+    }
+
+    *data = malloc(meta.st_size + 1);
+    if (*data == NULL) {
+        goto error;
+    }
+
+    size_t offset = 0;
+    while (offset < (size_t)meta.st_size) {
+        const ssize_t rcount = read(fd, *data + offset, meta.st_size - offset);
+        if (rcount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            free(*data);
+            goto error;
+        }
+        if (rcount == 0) {
+            break;
+        }
+        offset += rcount;
+    }
+    *size = offset;
+
+    close(fd);
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        close(fd);
+        errno = errnum;
+    }
+    return -1;
+}
+
+/**
+ * Load the index file into index. If keys isn't NULL the keys of the file
+ * have to be the same, otherwise they are taken from the file.
+ */
+static int load_index(struct Pipelog_Field_Index *index, const char *filename, bool same_keys, uint64_t *end) {
+    unsigned char *data = NULL;
+    size_t size = 0;
+    uint64_t value;
+
+    if (read_file(filename, &data, &size) != 0) {
+        return -1;
+    }
+
+    const unsigned char *ptr = data + PIPELOG_FIELD_INDEX_MAGIC_SIZE;
+    const unsigned char *data_end = data + size;
+    uint64_t key_count;
+
+    if (size < PIPELOG_FIELD_INDEX_MAGIC_SIZE || memcmp(data, PIPELOG_FIELD_INDEX_MAGIC, PIPELOG_FIELD_INDEX_MAGIC_SIZE) != 0 ||
+        get_varint(&ptr, data_end, &value) != 0 || get_varint(&ptr, data_end, &index->first) != 0 ||
+        get_varint(&ptr, data_end, end) != 0 || get_varint(&ptr, data_end, &key_count) != 0) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    if (value != index->block_size || (same_keys && key_count != index->key_count) || key_count > PIPELOG_FIELD_INDEX_MAX_KEYS) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    for (size_t key_index = 0; key_index < key_count; ++ key_index) {
+        const char *name;
+        size_t name_size;
+        uint64_t overflow, value_count;
+
+        if (get_bytes(&ptr, data_end, &name, &name_size) != 0 ||
+            get_varint(&ptr, data_end, &overflow) != 0 ||
+            get_varint(&ptr, data_end, &value_count) != 0 ||
+            value_count > PIPELOG_FIELD_INDEX_MAX_VALUES) {
+            errno = EINVAL;
+            goto error;
+        }
+
+        if (same_keys) {
+            if (index->keys[key_index].key_size != name_size || memcmp(index->keys[key_index].key, name, name_size) != 0) {
+                errno = EINVAL;
+                goto error;
+            }
+        } else if (add_key(index, name, name_size) != 0) {
+            goto error;
+        }
+
+        struct Pipelog_Field_Key *key = &index->keys[key_index];
+        key->overflow = overflow != 0;
+
+        for (size_t value_index = 0; value_index < value_count; ++ value_index) {
+            const char *text;
+            size_t text_size;
+            uint64_t block_count, block = 0;
+
+            if (get_bytes(&ptr, data_end, &text, &text_size) != 0 ||
+                get_varint(&ptr, data_end, &block_count) != 0 ||
+                block_count > size) {
+                errno = EINVAL;
+                goto error;
+            }
+
+            struct Pipelog_Posting *posting = get_posting(key, text, text_size);
+            if (posting == NULL) {
+                if (errno != ENOMEM) {
+                    errno = EINVAL;
+                }
+                goto error;
+            }
+
+            for (uint64_t block_index = 0; block_index < block_count; ++ block_index) {
+                uint64_t delta;
+                if (get_varint(&ptr, data_end, &delta) != 0) {
+                    goto error;
+                }
+                block += delta;
+                if (add_block(posting, block) != 0) {
+                    goto error;
+                }
+            }
+        }
+    }
+
+    free(data);
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        free(data);
+        errno = errnum;
+    }
+    return -1;
+}
+
+static int parse_keys(struct Pipelog_Field_Index *index, const char *keys) {
+    while (*keys) {
+        const char *comma = strchr(keys, ',');
+        const size_t key_size = comma == NULL ? strlen(keys) : (size_t)(comma - keys);
+
+        if (key_size > 0 && add_key(index, keys, key_size) != 0) {
+            return -1;
+        }
+
+        keys += key_size;
+        if (*keys == ',') {
+            ++ keys;
+        }
+    }
+
+    if (index->key_count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int field_index_open(struct Pipelog_Field_Index *index, const char *filename, const char *keys, uint64_t block_size, uint64_t size) {
+    const size_t filename_size = strlen(filename);
+
+    memset(index, 0, sizeof(*index));
+    index->block_size = block_size;
+    index->offset     = size;
+
+    index->filename = malloc(filename_size + sizeof(PIPELOG_FIELD_INDEX_SUFFIX));
+    if (index->filename == NULL) {
+        return -1;
+    }
+    memcpy(index->filename, filename, filename_size);
+    memcpy(index->filename + filename_size, PIPELOG_FIELD_INDEX_SUFFIX, sizeof(PIPELOG_FIELD_INDEX_SUFFIX));
+
+    if (parse_keys(index, keys) != 0) {
+        goto error;
+    }
+
+    uint64_t end = 0;
+    if (size > 0 && load_index(index, index->filename, true, &end) == 0 && end == size) {
+        return 0;
+    }
+
+    // no usable index of the data so far, only index new lines
+    free_keys(index);
+    if (parse_keys(index, keys) != 0) {
+        goto error;
+    }
+    // the block of the existing data is only partially indexed
+    index->first = (size + block_size - 1) / block_size;
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        free_keys(index);
+        free(index->filename);
+        memset(index, 0, sizeof(*index));
+        errno = errnum;
+    }
+    return -1;
+}
+
+static int index_line(void *context, const char *line, size_t size) {
+    struct Pipelog_Field_Index *index = context;
+    const uint64_t block = index->offset / index->block_size;
+
+    index->offset += size;
+
+    const size_t field_count = parse_fields(line, size, index->fields, PIPELOG_MAX_FIELDS);
+    for (size_t field_index = 0; field_index < field_count; ++ field_index) {
+        const struct Pipelog_Field *field = &index->fields[field_index];
+        struct Pipelog_Field_Key *key = find_key(index, field->key, field->key_size);
+        if (key == NULL) {
+            continue;
+        }
+
+        struct Pipelog_Posting *posting = get_posting(key, field->value, field->value_size);
+        if (posting == NULL) {
+            if (!key->overflow) {
+                return -1;
+            }
+            continue;
+        }
+
+        if (add_block(posting, block) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int field_index_add(struct Pipelog_Field_Index *index, const char *data, size_t size) {
+    return split_lines(&index->lines, data, size, false, index_line, index);
+}
+
+static int write_index(struct Pipelog_Field_Index *index) {
+    struct Pipelog_Buffer buffer = { NULL, 0, 0 };
+    const size_t filename_size = strlen(index->filename);
+    char *tmpname = malloc(filename_size + 5);
+    int status = -1;
+    int fd = -1;
+
+    if (tmpname == NULL) {
+        return -1;
+    }
+    memcpy(tmpname, index->filename, filename_size);
+    memcpy(tmpname + filename_size, ".tmp", 5);
+
+    if (buffer_put(&buffer, PIPELOG_FIELD_INDEX_MAGIC, PIPELOG_FIELD_INDEX_MAGIC_SIZE) != 0 ||
+        buffer_put_varint(&buffer, index->block_size) != 0 ||
+        buffer_put_varint(&buffer, index->first) != 0 ||
+        buffer_put_varint(&buffer, index->offset) != 0 ||
+        buffer_put_varint(&buffer, index->key_count) != 0) {
+        goto cleanup;
+    }
+
+    for (size_t key_index = 0; key_index < index->key_count; ++ key_index) {
+        const struct Pipelog_Field_Key *key = &index->keys[key_index];
+        if (buffer_put_varint(&buffer, key->key_size) != 0 ||
+            buffer_put(&buffer, key->key, key->key_size) != 0 ||
+            buffer_put_varint(&buffer, key->overflow) != 0 ||
+            buffer_put_varint(&buffer, key->value_count) != 0) {
+            goto cleanup;
+        }
+
+        for (size_t value_index = 0; value_index < key->value_count; ++ value_index) {
+            const struct Pipelog_Posting *posting = &key->values[value_index];
+            if (buffer_put_varint(&buffer, posting->value_size) != 0 ||
+                buffer_put(&buffer, posting->value, posting->value_size) != 0 ||
+                buffer_put_varint(&buffer, posting->block_count) != 0) {
+                goto cleanup;
+            }
+
+            uint64_t last = 0;
+            for (size_t block_index = 0; block_index < posting->block_count; ++ block_index) {
+                if (buffer_put_varint(&buffer, posting->blocks[block_index] - last) != 0) {
+                    goto cleanup;
+                }
+                last = posting->blocks[block_index];
+            }
+        }
+    }
+
+    fd = open(tmpname, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        goto cleanup;
+    }
+
+    if (write_all(fd, buffer.data, buffer.size) != 0) {
+        goto cleanup;
+    }
+
+    if (close(fd) != 0) {
+        fd = -1;
+        goto cleanup;
+    }
+    fd = -1;
+
+    if (rename(tmpname, index->filename) != 0) {
+        goto cleanup;
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (status != 0) {
+            unlink(tmpname);
+        }
+        free(tmpname);
+        free(buffer.data);
+        errno = errnum;
+    }
+
+    return status;
+}
+
+int field_index_close(struct Pipelog_Field_Index *index) {
+    int status = 0;
+
+    if (index->filename == NULL) {
+        return 0;
+    }
+
+    // the last line has no newline yet
+    if (split_lines(&index->lines, NULL, 0, true, index_line, index) != 0 || write_index(index) != 0) {
+        status = -1;
+    }
+
+    const int errnum = errno;
+    free_keys(index);
+    lines_free(&index->lines);
+    free(index->filename);
+    memset(index, 0, sizeof(*index));
+    errno = errnum;
+
+    return status;
+}
+
+static bool line_matches(const char *line, size_t size, const struct Pipelog_Field where[], size_t count, struct Pipelog_Field fields[]) {
+    const size_t field_count = parse_fields(line, size, fields, PIPELOG_MAX_FIELDS);
+
+    for (size_t where_index = 0; where_index < count; ++ where_index) {
+        const struct Pipelog_Field *cond = &where[where_index];
+        bool found = false;
+        for (size_t field_index = 0; field_index < field_count; ++ field_index) {
+            const struct Pipelog_Field *field = &fields[field_index];
+            if (field->key_size == cond->key_size && field->value_size == cond->value_size &&
+                memcmp(field->key, cond->key, cond->key_size) == 0 &&
+                memcmp(field->value, cond->value, cond->value_size) == 0) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int64_t field_index_search(const char *filename, const struct Pipelog_Field where[], size_t count, const char *prefix, int outfd) {
+    struct Pipelog_Field_Index *index = calloc(1, sizeof(struct Pipelog_Field_Index));
+    struct Pipelog_Output_Buffer *out = malloc(sizeof(struct Pipelog_Output_Buffer));
+    struct Pipelog_Mapped_File file = { -1, NULL, 0 };
+    uint32_t *hits = NULL;
+    char *index_filename = NULL;
+    int64_t status = -1;
+    int64_t found = 0;
+
+    if (index == NULL || out == NULL) {
+        goto cleanup;
+    }
+    out->fd   = outfd;
+    out->size = 0;
+
+    if (map_file(&file, filename) != 0) {
+        goto cleanup;
+    }
+
+    index_filename = malloc(strlen(filename) + sizeof(PIPELOG_FIELD_INDEX_SUFFIX));
+    if (index_filename == NULL) {
+        goto cleanup;
+    }
+    strcpy(index_filename, filename);
+    strcat(index_filename, PIPELOG_FIELD_INDEX_SUFFIX);
+
+    // the block size is read from the file
+    uint64_t end = 0;
+    bool indexed = false;
+    {
+        unsigned char header[PIPELOG_FIELD_INDEX_MAGIC_SIZE + 10];
+        const int fd = open(index_filename, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            const ssize_t rcount = read(fd, header, sizeof(header));
+            close(fd);
+            const unsigned char *ptr = header + PIPELOG_FIELD_INDEX_MAGIC_SIZE;
+            if (rcount > PIPELOG_FIELD_INDEX_MAGIC_SIZE && memcmp(header, PIPELOG_FIELD_INDEX_MAGIC, PIPELOG_FIELD_INDEX_MAGIC_SIZE) == 0 &&
+                get_varint(&ptr, header + rcount, &index->block_size) == 0 && index->block_size > 0) {
+                indexed = load_index(index, index_filename, false, &end) == 0;
+            }
+        }
+    }
+
+    if (!indexed) {
+        free_keys(index);
+        index->block_size = PIPELOG_FIELD_INDEX_BLOCK_SIZE;
+        index->first = 0;
+        end = 0;
+    }
+
+    const uint64_t block_size = index->block_size;
+    const uint64_t block_count = (file.size + block_size - 1) / block_size;
+    // blocks that are only partially indexed have to be searched
+    const uint64_t indexed_end = end / block_size;
+    size_t list_count = 0;
+
+    hits = calloc(block_count + 1, sizeof(uint32_t));
+    if (hits == NULL) {
+        goto cleanup;
+    }
+
+    for (size_t where_index = 0; where_index < count && indexed; ++ where_index) {
+        struct Pipelog_Field_Key *key = find_key(index, where[where_index].key, where[where_index].key_size);
+        if (key == NULL) {
+            // not indexed
+            continue;
+        }
+
+        struct Pipelog_Posting *posting = NULL;
+        size_t slot = hash_value(where[where_index].value, where[where_index].value_size) & (TABLE_SIZE - 1);
+        while (key->table[slot] != 0) {
+            struct Pipelog_Posting *entry = &key->values[key->table[slot] - 1];
+            if (entry->value_size == where[where_index].value_size &&
+                memcmp(entry->value, where[where_index].value, entry->value_size) == 0) {
+                posting = entry;
+                break;
+            }
+            slot = (slot + 1) & (TABLE_SIZE - 1);
+        }
+
+        if (posting == NULL && key->overflow) {
+            // the value might just not be indexed
+            continue;
+        }
+
+        ++ list_count;
+        if (posting != NULL) {
+            for (size_t block_index = 0; block_index < posting->block_count; ++ block_index) {
+                const uint64_t block = posting->blocks[block_index];
+                if (block < block_count) {
+                    ++ hits[block];
+                }
+            }
+        }
+    }
+
+    for (uint64_t block = 0; block < block_count; ++ block) {
+        const bool in_index = indexed && block >= index->first && block < indexed_end;
+        if (in_index && hits[block] != list_count) {
+            continue;
+        }
+
+        const size_t start = next_line_start(file.data, file.size, block * block_size);
+        const size_t stop  = next_line_start(file.data, file.size, (block + 1) * block_size);
+        size_t pos = start;
+        while (pos < stop) {
+            const char *newline = memchr(file.data + pos, '\n', stop - pos);
+            const size_t line_end = newline == NULL ? stop : (size_t)(newline - file.data);
+
+            if (line_matches(file.data + pos, line_end - pos, where, count, index->fields)) {
+                if (output_line(out, prefix, file.data + pos, line_end - pos) != 0) {
+                    goto cleanup;
+                }
+                ++ found;
+            }
+
+            pos = line_end + 1;
+        }
+    }
+
+    if (output_flush(out) != 0) {
+        goto cleanup;
+    }
+
+    status = found;
+
+cleanup:
+    {
+        const int errnum = errno;
+        if (index != NULL) {
+            free_keys(index);
+        }
+        unmap_file(&file);
+        free(index_filename);
+        free(hits);
+        free(index);
+        free(out);
+        errno = errnum;
+    }
+
+    return status;
+}
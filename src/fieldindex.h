@@ -0,0 +1,103 @@
+#ifndef PIPELOG_FIELDINDEX_H
+#define PIPELOG_FIELDINDEX_H
+#pragma once
+
+#include "pipelog.h"
+#include "fields.h"
+#include "lines.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_FIELD_INDEX_MAGIC "PLGFDX1\n"
+#define PIPELOG_FIELD_INDEX_MAGIC_SIZE 8
+#define PIPELOG_FIELD_INDEX_SUFFIX ".fdx"
+
+#define PIPELOG_FIELD_INDEX_BLOCK_SIZE (1024 * 1024)
+#define PIPELOG_FIELD_INDEX_MAX_KEYS 32
+// a field with more distinct values isn't indexed any further
+#define PIPELOG_FIELD_INDEX_MAX_VALUES 1024
+#define PIPELOG_FIELD_INDEX_MAX_VALUE 128
+
+/**
+ * File layout (all numbers are LEB128 varints):
+ *
+ * magic, block size, first block, end offset, key count, keys...
+ *
+ * key:   key size, key, overflow flag, value count, values...
+ * value: value size, value, block count, deltas of the block indices
+ *
+ * Only blocks from first block up to end offset (exclusive) are indexed.
+ * Of a key with the overflow flag set only some values are indexed. The
+ * file is rewritten when the log file is closed.
+ */
+struct Pipelog_Posting {
+    char     *value;
+    size_t    value_size;
+    uint64_t *blocks;
+    size_t    block_count;
+    size_t    capacity;
+};
+
+struct Pipelog_Field_Key {
+    char   *key;
+    size_t  key_size;
+    bool    overflow;
+    struct Pipelog_Posting *values;
+    size_t  value_count;
+    uint32_t *table; //!< hash table of indices + 1 into values
+};
+
+struct Pipelog_Field_Index {
+    char     *filename; //!< of the index
+    uint64_t  block_size;
+    uint64_t  first;    //!< first indexed block
+    uint64_t  offset;   //!< offset of the next line in the log file
+    struct Pipelog_Field_Key keys[PIPELOG_FIELD_INDEX_MAX_KEYS];
+    size_t    key_count;
+    struct Pipelog_Lines lines;
+    struct Pipelog_Field fields[PIPELOG_MAX_FIELDS];
+};
+
+/**
+ * Start indexing the fields named in the comma separated list keys of the
+ * log file filename, which currently has a size of size bytes. The index
+ * of an earlier run is continued if it ends at size.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int field_index_open(struct Pipelog_Field_Index *index, const char *filename, const char *keys, uint64_t block_size, uint64_t size);
+
+/**
+ * Index the lines of data, which was appended to the log file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int field_index_add(struct Pipelog_Field_Index *index, const char *data, size_t size);
+
+/**
+ * Write the index to filename.fdx and free it.
+ *
+ * Returns 0 on success, -1 on error and sets errno. It is freed either way.
+ */
+int field_index_close(struct Pipelog_Field_Index *index);
+
+/**
+ * Write all lines of the log file filename that have all fields of where
+ * with the given values to outfd. If prefix isn't NULL every line is
+ * prefixed with it. Only blocks that the index lists for all of where are
+ * read. Without index file all blocks are searched.
+ *
+ * Returns the number of lines found, or -1 on error and sets errno.
+ */
+int64_t field_index_search(const char *filename, const struct Pipelog_Field where[], size_t count, const char *prefix, int outfd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,167 @@
+#include "fields.h"
+
+static bool is_space(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+// returns a pointer to the closing quote or end
+static const char *skip_string(const char *ptr, const char *end) {
+    while (ptr < end && *ptr != '"') {
+        if (*ptr == '\\' && ptr + 1 < end) {
+            ++ ptr;
+        }
+        ++ ptr;
+    }
+    return ptr;
+}
+
+// skips an object or array, returns a pointer after it
+static const char *skip_nested(const char *ptr, const char *end) {
+    size_t depth = 0;
+
+    while (ptr < end) {
+        const char ch = *ptr;
+        if (ch == '"') {
+            ptr = skip_string(ptr + 1, end);
+            if (ptr == end) {
+                return end;
+            }
+        } else if (ch == '{' || ch == '[') {
+            ++ depth;
+        } else if (ch == '}' || ch == ']') {
+            -- depth;
+            if (depth == 0) {
+                return ptr + 1;
+            }
+        }
+        ++ ptr;
+    }
+
+    return end;
+}
+
+static size_t parse_json(const char *ptr, const char *end, struct Pipelog_Field fields[], size_t max) {
+    size_t count = 0;
+
+    // skip '{'
+    ++ ptr;
+
+    while (count < max) {
+        while (ptr < end && (is_space(*ptr) || *ptr == ',')) {
+            ++ ptr;
+        }
+
+        if (ptr >= end || *ptr != '"') {
+            break;
+        }
+
+        const char *key = ptr + 1;
+        ptr = skip_string(key, end);
+        if (ptr == end) {
+            break;
+        }
+        const size_t key_size = ptr - key;
+        ++ ptr;
+
+        while (ptr < end && is_space(*ptr)) {
+            ++ ptr;
+        }
+        if (ptr == end || *ptr != ':') {
+            break;
+        }
+        ++ ptr;
+        while (ptr < end && is_space(*ptr)) {
+            ++ ptr;
+        }
+        if (ptr == end) {
+            break;
+        }
+
+        const char *value;
+        size_t value_size;
+        if (*ptr == '"') {
+            value = ptr + 1;
+            ptr = skip_string(value, end);
+            if (ptr == end) {
+                break;
+            }
+            value_size = ptr - value;
+            ++ ptr;
+        } else if (*ptr == '{' || *ptr == '[') {
+            value = ptr;
+            ptr = skip_nested(ptr, end);
+            value_size = ptr - value;
+        } else {
+            value = ptr;
+            while (ptr < end && *ptr != ',' && *ptr != '}' && !is_space(*ptr)) {
+                ++ ptr;
+            }
+            value_size = ptr - value;
+        }
+
+        fields[count ++] = (struct Pipelog_Field){ key, key_size, value, value_size };
+    }
+
+    return count;
+}
+
+static size_t parse_logfmt(const char *ptr, const char *end, struct Pipelog_Field fields[], size_t max) {
+    size_t count = 0;
+
+    while (ptr < end && count < max) {
+        while (ptr < end && is_space(*ptr)) {
+            ++ ptr;
+        }
+
+        const char *key = ptr;
+        while (ptr < end && !is_space(*ptr) && *ptr != '=' && *ptr != '"') {
+            ++ ptr;
+        }
+
+        if (ptr == end || *ptr != '=' || ptr == key) {
+            // not a key, skip the word
+            while (ptr < end && !is_space(*ptr)) {
+                ++ ptr;
+            }
+            continue;
+        }
+        const size_t key_size = ptr - key;
+        ++ ptr;
+
+        const char *value;
+        size_t value_size;
+        if (ptr < end && *ptr == '"') {
+            value = ptr + 1;
+            ptr = skip_string(value, end);
+            value_size = ptr - value;
+            if (ptr < end) {
+                ++ ptr;
+            }
+        } else {
+            value = ptr;
+            while (ptr < end && !is_space(*ptr)) {
+                ++ ptr;
+            }
+            value_size = ptr - value;
+        }
+
+        fields[count ++] = (struct Pipelog_Field){ key, key_size, value, value_size };
+    }
+
+    return count;
+}
+
+size_t parse_fields(const char *line, size_t size, struct Pipelog_Field fields[], size_t max) {
+    const char *ptr = line;
+    const char *end = line + size;
+
+    while (ptr < end && is_space(*ptr)) {
+        ++ ptr;
+    }
+
+    if (ptr < end && *ptr == '{') {
+        return parse_json(ptr, end, fields, max);
+    }
+
+    return parse_logfmt(ptr, end, fields, max);
+}
@@ -0,0 +1,37 @@
+#ifndef PIPELOG_FIELDS_H
+#define PIPELOG_FIELDS_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_MAX_FIELDS 128
+
+struct Pipelog_Field {
+    const char *key;
+    size_t      key_size;
+    const char *value; //!< strings without quotes, but escapes are kept
+    size_t      value_size;
+};
+
+/**
+ * Parse the fields of a structured log line. If the line (after white space)
+ * starts with '{' it is read as a JSON object. Nested objects and arrays are
+ * returned as their JSON text. Otherwise the line is read as logfmt, i.e.
+ * KEY=VALUE or KEY="VALUE" pairs separated by spaces. Words without '=' are
+ * skipped, so a logfmt part after a timestamp and log level is found, too.
+ *
+ * Returns the number of fields written to fields, at most max.
+ */
+size_t parse_fields(const char *line, size_t size, struct Pipelog_Field fields[], size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,261 @@
+#include "pipelog.h"
+#include "progress.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/sendfile.h>
+
+// wait at most this long if pipelog can't be asked to wake us
+#define FOLLOW_READONLY_TIMEOUT 100
+
+enum {
+    OPT_HELP,
+    OPT_VERSION,
+    OPT_FROM_START,
+    OPT_EXIT,
+    OPT_END,
+};
+
+static const struct option options[] = {
+    [OPT_HELP]       = { "help",       no_argument, 0, 'h' },
+    [OPT_VERSION]    = { "version",    no_argument, 0, 'v' },
+    [OPT_FROM_START] = { "from-start", no_argument, 0, 'b' },
+    [OPT_EXIT]       = { "exit",       no_argument, 0, 'x' },
+    [OPT_END]        = { 0, 0, 0, 0 },
+};
+
+static void short_usage(int argc, char *argv[]) {
+    const char *progname = argc > 0 ? argv[0] : "pipelog-follow";
+    printf(
+        "Usage: %s [OPTION]... [--] PROGRESS\n",
+        progname
+    );
+}
+
+static void usage(int argc, char *argv[]) {
+    short_usage(argc, argv);
+    printf(
+        "follow the log files written by pipelog\n"
+        "\n"
+        "\n"
+        "Write the data pipelog writes to the log file of an output with\n"
+        "+progress=PROGRESS to standard output as soon as it is written. When pipelog\n"
+        "rotates the file the rest of the old file is written and then the new file\n"
+        "is followed, so nothing is missed or written twice, also when pipelog is\n"
+        "restarted. pipelog wakes pipelog-follow up, it doesn't poll. If PROGRESS\n"
+        "isn't writable for the user pipelog-follow checks for new data ten times a\n"
+        "second instead.\n"
+        "\n"
+        "OPTIONS:\n"
+        "\n"
+        "    -h, --help                 Print this help message.\n"
+        "    -v, --version              Print version.\n"
+        "    -b, --from-start           Start at the beginning of the current file\n"
+        "                               instead of its end.\n"
+        "    -x, --exit                 Exit when pipelog exits, instead of waiting for\n"
+        "                               it to be started again.\n"
+        "\n"
+        "\n"
+        "https://github.com/panzi/pipelog\n"
+        "(c) 2022 Mathias Panzenböck\n"
+    );
+}
+
+// writes the bytes [start, end) of fd to standard output
+static int copy_range(int fd, uint64_t start, uint64_t end) {
+    char buf[BUFSIZ * 8];
+    off_t offset = start;
+
+    while ((uint64_t)offset < end) {
+        const ssize_t count = sendfile(STDOUT_FILENO, fd, &offset, end - offset);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EINVAL && errno != ENOSYS) {
+                return -1;
+            }
+
+            // standard output doesn't support sendfile()
+            const size_t size = end - offset < sizeof(buf) ? end - offset : sizeof(buf);
+            const ssize_t rcount = pread(fd, buf, size, offset);
+            if (rcount < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+
+            if (write_all(STDOUT_FILENO, buf, rcount) != 0) {
+                return -1;
+            }
+
+            offset += rcount;
+            if (rcount == 0) {
+                // the file was truncated
+                break;
+            }
+        } else if (count == 0) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int open_file(const char *filename) {
+    if (*filename == 0) {
+        // pipelog didn't open a file yet
+        return -1;
+    }
+
+    const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "*** error: opening \"%s\": %s\n", filename, strerror(errno));
+    }
+
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    struct Pipelog_Progress progress;
+    struct Pipelog_Progress_Snapshot snapshot;
+    struct Pipelog_Progress_File *file = NULL;
+    struct Pipelog_Progress_File *next = NULL;
+    bool from_start = false;
+    bool exit_on_close = false;
+    int status = 0;
+    int fd = -1;
+
+    for (;;) {
+        int longind = 0;
+        int opt = getopt_long(argc, argv, "hvbx", options, &longind);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'h':
+                usage(argc, argv);
+                return 0;
+
+            case 'v':
+                printf("%d.%d.%d\n", PIPELOG_VERSION_MAJOR, PIPELOG_VERSION_MINOR, PIPELOG_VERSION_PATCH);
+                return 0;
+
+            case 'b':
+                from_start = true;
+                break;
+
+            case 'x':
+                exit_on_close = true;
+                break;
+
+            case '?':
+                short_usage(argc, argv);
+                return 1;
+
+            default:
+                assert(false);
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "*** error: illegal number of arguments\n");
+        short_usage(argc, argv);
+        return 1;
+    }
+
+    const char *filename = argv[optind];
+    if (progress_open(&progress, filename, false) != 0) {
+        fprintf(stderr, "*** error: opening progress file \"%s\": %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    file = malloc(sizeof(struct Pipelog_Progress_File));
+    next = malloc(sizeof(struct Pipelog_Progress_File));
+    if (file == NULL || next == NULL) {
+        fprintf(stderr, "*** error: allocating memory: %s\n", strerror(errno));
+        status = 1;
+        goto cleanup;
+    }
+
+    // start with the current file
+    progress_snapshot(&progress, &snapshot, 0, NULL, NULL);
+    uint64_t generation = snapshot.generation;
+    progress_snapshot(&progress, &snapshot, generation, file, NULL);
+    uint64_t offset = from_start ? 0 : generation == snapshot.generation ? snapshot.offset : file->end;
+    fd = open_file(file->filename);
+
+    const int timeout = progress.readonly ? FOLLOW_READONLY_TIMEOUT : -1;
+
+    for (;;) {
+        if (!progress_snapshot(&progress, &snapshot, generation, file, next)) {
+            // the names of the files in between are gone
+            const uint64_t oldest = snapshot.generation - PIPELOG_PROGRESS_FILES + 1;
+            fprintf(stderr, "*** error: fell behind by %" PRIu64 " files, skipping to the oldest known file\n", oldest - generation);
+            if (fd >= 0) {
+                close(fd);
+            }
+            generation = oldest;
+            progress_snapshot(&progress, &snapshot, generation, file, NULL);
+            offset = file->start;
+            fd = open_file(file->filename);
+            continue;
+        }
+
+        if (generation < snapshot.generation) {
+            // the file is complete, write the rest and go on with the next
+            if (fd >= 0) {
+                if (copy_range(fd, offset, file->end) != 0) {
+                    fprintf(stderr, "*** error: writing output: %s\n", strerror(errno));
+                    status = 1;
+                    break;
+                }
+                close(fd);
+            }
+
+            ++ generation;
+            offset = next->start;
+            fd = open_file(next->filename);
+            continue;
+        }
+
+        if (offset < snapshot.offset) {
+            if (fd >= 0 && copy_range(fd, offset, snapshot.offset) != 0) {
+                fprintf(stderr, "*** error: writing output: %s\n", strerror(errno));
+                status = 1;
+                break;
+            }
+            offset = snapshot.offset;
+            continue;
+        }
+
+        if (snapshot.closed && exit_on_close) {
+            break;
+        }
+
+        progress_wait(&progress, &snapshot, timeout);
+    }
+
+cleanup:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(file);
+    free(next);
+    progress_close(&progress);
+
+    return status;
+}
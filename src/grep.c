@@ -0,0 +1,853 @@
+#include "pipelog.h"
+#include "scan.h"
+#include "bloom.h"
+#include "timeindex.h"
+#include "checksum.h"
+#include "chain.h"
+#include "fieldindex.h"
+#include "columnar.h"
+#include "timestamp.h"
+#include "pool.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <glob.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// size of the pieces files are split into if they have no Bloom filters
+#define GREP_CHUNK_SIZE (4 * 1024 * 1024)
+// chunks searched at once per thread before their results are written
+#define GREP_CHUNKS_PER_THREAD 4
+// don't format more file names than this when expanding a time range
+#define GREP_MAX_EXPANSIONS (16 * 1024 * 1024)
+
+enum {
+    OPT_HELP,
+    OPT_VERSION,
+    OPT_FROM,
+    OPT_TO,
+    OPT_WORD,
+    OPT_COUNT,
+    OPT_WITH_FILENAME,
+    OPT_NO_FILENAME,
+    OPT_THREADS,
+    OPT_LIST,
+    OPT_END,
+};
+
+static const struct option options[] = {
+    [OPT_HELP]          = { "help",          no_argument,       0, 'h' },
+    [OPT_VERSION]       = { "version",       no_argument,       0, 'v' },
+    [OPT_FROM]          = { "from",          required_argument, 0, 'F' },
+    [OPT_TO]            = { "to",            required_argument, 0, 'T' },
+    [OPT_WORD]          = { "word",          no_argument,       0, 'w' },
+    [OPT_COUNT]         = { "count",         no_argument,       0, 'c' },
+    [OPT_WITH_FILENAME] = { "with-filename", no_argument,       0, 'H' },
+    [OPT_NO_FILENAME]   = { "no-filename",   no_argument,       0, 'N' },
+    [OPT_THREADS]       = { "threads",       required_argument, 0, 'j' },
+    [OPT_LIST]          = { "list",          no_argument,       0, 'l' },
+    [OPT_END]           = { 0, 0, 0, 0 },
+};
+
+struct Grep {
+    struct Pipelog_Needle needle;
+    bool    word;
+    bool    timed; //!< lines are filtered by from and to
+    int64_t from;
+    int64_t to;
+    bool    count;
+};
+
+struct Grep_Chunk {
+    const char *data; //!< of the whole file
+    size_t  size;
+    size_t  start;
+    size_t  end;
+    char   *out;
+    size_t  out_size;
+    size_t  out_capacity;
+    int64_t found;
+    int     errnum;
+};
+
+struct Grep_Batch {
+    const struct Grep *grep;
+    const char *prefix;
+    struct Grep_Chunk *chunks;
+};
+
+struct Grep_Files {
+    char  **names;
+    size_t  count;
+    size_t  capacity;
+};
+
+static void short_usage(int argc, char *argv[]) {
+    const char *progname = argc > 0 ? argv[0] : "pipelog-grep";
+    printf(
+        "Usage: %s [OPTION]... [--] PATTERN TEMPLATE...\n",
+        progname
+    );
+}
+
+static void usage(int argc, char *argv[]) {
+    short_usage(argc, argv);
+    printf(
+        "search log files written by pipelog\n"
+        "\n"
+        "\n"
+        "Write all lines that contain the string PATTERN of the log files named by\n"
+        "TEMPLATE to standard output. TEMPLATE is a FILE argument of pipelog and may\n"
+        "contain strftime compatible format specifications. If --from and --to are\n"
+        "given only the file names the time range formats to are searched, otherwise\n"
+        "all existing files that match TEMPLATE. Files are searched from the oldest\n"
+        "to the newest and the lines of each file are written in order.\n"
+        "\n"
+        "Files are searched in parallel in blocks. If a file has Bloom filters (see\n"
+        "+bloom of pipelog) blocks that can't contain PATTERN are skipped, and if it\n"
+        "has a time index (see +index) only the part of the time range is read.\n"
+        "\n"
+        "OPTIONS:\n"
+        "\n"
+        "    -h, --help                 Print this help message.\n"
+        "    -v, --version              Print version.\n"
+        "    -F, --from=TIMESTAMP       Start of the time range, inclusive. TIMESTAMP\n"
+        "                               is an ISO 8601 date and time or UNIX timestamp.\n"
+        "                               Without time zone UTC is assumed. Lines with a\n"
+        "                               timestamp outside of the time range are not\n"
+        "                               written, lines without are.\n"
+        "    -T, --to=TIMESTAMP         End of the time range, inclusive.\n"
+        "    -w, --word                 PATTERN must not be part of a longer word.\n"
+        "                               Words are runs of letters, digits, '_' and\n"
+        "                               non-ASCII characters.\n"
+        "    -c, --count                Only write the number of matching lines of\n"
+        "                               each file.\n"
+        "    -H, --with-filename        Prefix each line with the name of its file.\n"
+        "                               This is the default if there are several.\n"
+        "    -N, --no-filename          Never prefix lines with the name of the file.\n"
+        "    -j, --threads=COUNT        Number of threads to search with.\n"
+        "                               Default: number of processors\n"
+        "    -l, --list                 Only write the names of the files that would\n"
+        "                               be searched.\n"
+        "\n"
+        "Exits with 0 if a line was found, 1 if not and 2 on error.\n"
+        "\n"
+        "\n"
+        "https://github.com/panzi/pipelog\n"
+        "(c) 2022 Mathias Panzenböck\n"
+    );
+}
+
+static int files_add(struct Grep_Files *files, const char *name) {
+    // a time range formats to the same name many times in a row
+    if (files->count > 0 && strcmp(files->names[files->count - 1], name) == 0) {
+        return 0;
+    }
+
+    if (files->count == files->capacity) {
+        const size_t capacity = files->capacity == 0 ? 64 : files->capacity * 2;
+        char **names = realloc(files->names, capacity * sizeof(char*));
+        if (names == NULL) {
+            return -1;
+        }
+        files->names = names;
+        files->capacity = capacity;
+    }
+
+    char *copy = strdup(name);
+    if (copy == NULL) {
+        return -1;
+    }
+    files->names[files->count ++] = copy;
+
+    return 0;
+}
+
+static void files_free(struct Grep_Files *files) {
+    for (size_t index = 0; index < files->count; ++ index) {
+        free(files->names[index]);
+    }
+    free(files->names);
+    memset(files, 0, sizeof(*files));
+}
+
+/**
+ * Returns the number of seconds after which the result of formatting
+ * template can change at the earliest, or 0 if it doesn't depend on time.
+ */
+static time_t template_resolution(const char *template) {
+    time_t resolution = 0;
+
+    for (const char *ptr = strchr(template, '%'); ptr != NULL; ptr = strchr(ptr, '%')) {
+        ++ ptr;
+        if (*ptr == 'E' || *ptr == 'O') {
+            ++ ptr;
+        }
+
+        time_t seconds = 0;
+        switch (*ptr) {
+            case 'S': case 's': case 'T': case 'r': case 'c': case 'X': case '+':
+                seconds = 1;
+                break;
+
+            case 'M': case 'R':
+                seconds = 60;
+                break;
+
+            case '%': case 'n': case 't': case 'z': case 'Z': case 0:
+                break;
+
+            default:
+                // hours, days, weeks, months and years. Steps of days would
+                // skip dates at daylight saving time changes.
+                seconds = 1800;
+                break;
+        }
+
+        if (*ptr) {
+            ++ ptr;
+        }
+
+        if (seconds > 0 && (resolution == 0 || seconds < resolution)) {
+            resolution = seconds;
+        }
+    }
+
+    return resolution;
+}
+
+static int compare_refs(const void *lhs, const void *rhs) {
+    char **const *left  = lhs;
+    char **const *right = rhs;
+    const int cmp = strcmp(**left, **right);
+    // equal names are ordered by position
+    return cmp != 0 ? cmp : (*left < *right ? -1 : *left > *right);
+}
+
+// removes names that appeared before, keeping the order
+static int remove_duplicates(struct Grep_Files *files) {
+    if (files->count < 2) {
+        return 0;
+    }
+
+    // sort pointers into names, so the first of equal names can be kept
+    char ***refs = malloc(files->count * sizeof(char**));
+    if (refs == NULL) {
+        return -1;
+    }
+    for (size_t index = 0; index < files->count; ++ index) {
+        refs[index] = &files->names[index];
+    }
+    qsort(refs, files->count, sizeof(char**), compare_refs);
+
+    for (size_t index = 1; index < files->count; ++ index) {
+        if (strcmp(*refs[index], *refs[index - 1]) == 0) {
+            free(*refs[index]);
+            *refs[index] = NULL;
+        }
+    }
+    free(refs);
+
+    size_t count = 0;
+    for (size_t index = 0; index < files->count; ++ index) {
+        if (files->names[index] != NULL) {
+            files->names[count ++] = files->names[index];
+        }
+    }
+    files->count = count;
+
+    return 0;
+}
+
+static int format_names(struct Grep_Files *files, const char *template, time_t resolution, int64_t from, int64_t to) {
+    char buf[PATH_MAX];
+    struct tm local;
+    const time_t first = from / 1000 - (from % 1000 < 0);
+    const time_t last  = to / 1000 - (to % 1000 < 0);
+
+    if ((uint64_t)(last - first) / resolution > GREP_MAX_EXPANSIONS) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    for (time_t now = first;; now += resolution) {
+        if (now > last) {
+            // the end of the range may be between two steps
+            now = last;
+        }
+
+        if (localtime_r(&now, &local) == NULL) {
+            return -1;
+        }
+
+        if (strftime(buf, sizeof(buf), template, &local) == 0) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        if (files_add(files, buf) != 0) {
+            return -1;
+        }
+
+        if (now == last) {
+            break;
+        }
+    }
+
+    return remove_duplicates(files);
+}
+
+struct Grep_Glob_Entry {
+    char  *name;
+    time_t mtime;
+};
+
+static int compare_mtime(const void *lhs, const void *rhs) {
+    const struct Grep_Glob_Entry *left  = lhs;
+    const struct Grep_Glob_Entry *right = rhs;
+    if (left->mtime != right->mtime) {
+        return left->mtime < right->mtime ? -1 : 1;
+    }
+    return strcmp(left->name, right->name);
+}
+
+// glob pattern of the conversion c, fixed width digits where strftime() pads
+static const char *glob_conversion(char c) {
+    switch (c) {
+        case 'Y': case 'G':
+            return "[0-9][0-9][0-9][0-9]";
+        case 'j':
+            return "[0-9][0-9][0-9]";
+        case 'm': case 'd': case 'H': case 'I': case 'M': case 'S':
+        case 'y': case 'g': case 'C': case 'U': case 'W': case 'V':
+            return "[0-9][0-9]";
+        case 'u': case 'w':
+            return "[0-9]";
+        case 'F':
+            return "[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]";
+        case 'T':
+            return "[0-9][0-9]:[0-9][0-9]:[0-9][0-9]";
+        case 'R':
+            return "[0-9][0-9]:[0-9][0-9]";
+        default:
+            return "*";
+    }
+}
+
+static const char *const SIDECAR_SUFFIXES[] = {
+    PIPELOG_TIME_INDEX_SUFFIX,
+    PIPELOG_BLOOM_SUFFIX,
+    PIPELOG_FIELD_INDEX_SUFFIX,
+    PIPELOG_FIELD_INDEX_SUFFIX ".tmp",
+    PIPELOG_CHECKSUM_SUFFIX,
+    PIPELOG_CHAIN_SUFFIX,
+    PIPELOG_COLUMNAR_SUFFIX,
+};
+
+// files pipelog writes next to a log file, which a '*' of the template matches as well
+static bool is_sidecar(const char *name, const char *template) {
+    const size_t size = strlen(name);
+    const size_t template_size = strlen(template);
+
+    for (size_t index = 0; index < sizeof(SIDECAR_SUFFIXES) / sizeof(SIDECAR_SUFFIXES[0]); ++ index) {
+        const char *suffix = SIDECAR_SUFFIXES[index];
+        const size_t suffix_size = strlen(suffix);
+        if (size > suffix_size && strcmp(name + size - suffix_size, suffix) == 0 &&
+            // unless the log files themselves are named like that
+            !(template_size >= suffix_size && strcmp(template + template_size - suffix_size, suffix) == 0)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// finds the existing files matching template, oldest first
+static int glob_names(struct Grep_Files *files, const char *template) {
+    const size_t size = strlen(template);
+    // the longest glob of a conversion is that of %F, for 2 characters
+    char *pattern = malloc(size * 22 + 1);
+    struct Grep_Glob_Entry *entries = NULL;
+    glob_t found;
+    int status = -1;
+
+    if (pattern == NULL) {
+        return -1;
+    }
+
+    char *out = pattern;
+    for (const char *ptr = template; *ptr; ++ ptr) {
+        if (*ptr == '%') {
+            ++ ptr;
+            if (*ptr == '%') {
+                *out ++ = '%';
+                continue;
+            }
+            if (*ptr == 'E' || *ptr == 'O') {
+                ++ ptr;
+            }
+            if (*ptr == 0) {
+                break;
+            }
+            const char *glob = glob_conversion(*ptr);
+            // consecutive '*' are no different from one
+            if (strcmp(glob, "*") != 0 || out == pattern || out[-1] != '*') {
+                const size_t glob_size = strlen(glob);
+                memcpy(out, glob, glob_size);
+                out += glob_size;
+            }
+        } else {
+            if (strchr("*?[]\\", *ptr) != NULL) {
+                *out ++ = '\\';
+            }
+            *out ++ = *ptr;
+        }
+    }
+    *out = 0;
+
+    const int result = glob(pattern, 0, NULL, &found);
+    if (result == GLOB_NOMATCH) {
+        free(pattern);
+        return 0;
+    }
+
+    if (result != 0) {
+        free(pattern);
+        errno = result == GLOB_NOSPACE ? ENOMEM : EIO;
+        return -1;
+    }
+
+    entries = malloc(found.gl_pathc * sizeof(struct Grep_Glob_Entry));
+    if (entries == NULL) {
+        goto cleanup;
+    }
+
+    size_t count = 0;
+    for (size_t index = 0; index < found.gl_pathc; ++ index) {
+        struct stat meta;
+        if (is_sidecar(found.gl_pathv[index], template) || stat(found.gl_pathv[index], &meta) != 0 || !S_ISREG(meta.st_mode)) {
+            continue;
+        }
+        entries[count].name  = found.gl_pathv[index];
+        entries[count].mtime = meta.st_mtime;
+        ++ count;
+    }
+
+    // files are rotated, so the last modification tells their order
+    qsort(entries, count, sizeof(struct Grep_Glob_Entry), compare_mtime);
+
+    for (size_t index = 0; index < count; ++ index) {
+        if (files_add(files, entries[index].name) != 0) {
+            goto cleanup;
+        }
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        globfree(&found);
+        free(entries);
+        free(pattern);
+        errno = errnum;
+    }
+
+    return status;
+}
+
+static int expand_template(struct Grep_Files *files, const char *template, int64_t from, int64_t to) {
+    const time_t resolution = template_resolution(template);
+
+    if (resolution == 0) {
+        char buf[PATH_MAX];
+        const struct tm zero = { .tm_mday = 1 };
+        // still unescape "%%"
+        if (strftime(buf, sizeof(buf), template, &zero) == 0 && *template != 0) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        return files_add(files, buf);
+    }
+
+    if (from != INT64_MIN && to != INT64_MAX) {
+        return format_names(files, template, resolution, from, to);
+    }
+
+    return glob_names(files, template);
+}
+
+static int chunk_put(struct Grep_Chunk *chunk, const char *data, size_t size) {
+    if (reserve(&chunk->out, &chunk->out_capacity, chunk->out_size + size) != 0) {
+        return -1;
+    }
+    memcpy(chunk->out + chunk->out_size, data, size);
+    chunk->out_size += size;
+    return 0;
+}
+
+static void search_chunk(void *context, size_t index) {
+    const struct Grep_Batch *batch = context;
+    const struct Grep *grep = batch->grep;
+    struct Grep_Chunk *chunk = &batch->chunks[index];
+    const char *data = chunk->data;
+    const size_t size = chunk->size;
+    const size_t end = chunk->end;
+    size_t pos = chunk->start;
+
+    // the file is mapped for random access, but a chunk is read through
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t page = pos & ~(page_size - 1);
+    madvise((char*)data + page, end - page, MADV_WILLNEED);
+
+    while (pos < end) {
+        const char *match = needle_find(&grep->needle, data + pos, end - pos);
+        if (match == NULL) {
+            break;
+        }
+
+        const size_t match_start = match - data;
+        const size_t match_end   = match_start + grep->needle.size;
+        if (grep->word && (
+            (match_start > 0 && is_token_char(data[match_start - 1])) ||
+            (match_end < size && is_token_char(data[match_end])))) {
+            pos = match_start + 1;
+            continue;
+        }
+
+        const char *line = memrchr(data + chunk->start, '\n', match_start - chunk->start);
+        const size_t line_start = line == NULL ? chunk->start : (size_t)(line - data) + 1;
+        const char *newline = memchr(match, '\n', size - match_start);
+        const size_t line_end = newline == NULL ? size : (size_t)(newline - data);
+        pos = line_end + 1;
+
+        if (grep->timed) {
+            int64_t nanos;
+            if (parse_timestamp(data + line_start, line_end - line_start, &nanos, NULL)) {
+                const int64_t millis = nanos / 1000000 - (nanos % 1000000 < 0);
+                if (millis < grep->from || millis > grep->to) {
+                    continue;
+                }
+            }
+        }
+
+        ++ chunk->found;
+
+        if (!grep->count) {
+            if ((batch->prefix != NULL && chunk_put(chunk, batch->prefix, strlen(batch->prefix)) != 0) ||
+                chunk_put(chunk, data + line_start, line_end - line_start) != 0 ||
+                chunk_put(chunk, "\n", 1) != 0) {
+                chunk->errnum = errno;
+                return;
+            }
+        }
+    }
+}
+
+// searches the chunks and writes their results in order
+static int run_batch(struct Pipelog_Pool *pool, struct Grep_Batch *batch, size_t count, int64_t *found) {
+    int status = 0;
+
+    pool_run(pool, search_chunk, batch, count);
+
+    for (size_t index = 0; index < count; ++ index) {
+        struct Grep_Chunk *chunk = &batch->chunks[index];
+        if (chunk->errnum != 0) {
+            if (status == 0) {
+                errno = chunk->errnum;
+                status = -1;
+            }
+        } else if (status == 0 && write_all(STDOUT_FILENO, chunk->out, chunk->out_size) != 0) {
+            status = -1;
+        }
+        *found += chunk->found;
+        free(chunk->out);
+        memset(chunk, 0, sizeof(*chunk));
+    }
+
+    return status;
+}
+
+/**
+ * Returns the number of matching lines, or -1 on error and sets errno.
+ */
+static int64_t grep_file(struct Pipelog_Pool *pool, const struct Grep *grep, const char *filename, const char *prefix) {
+    struct Pipelog_Mapped_File file;
+    struct Grep_Batch batch = { .grep = grep, .prefix = prefix, .chunks = NULL };
+    bool *maybe = NULL;
+    uint64_t block_size = 0;
+    int64_t found = 0;
+    int64_t status = -1;
+    const size_t batch_size = pool_threads(pool) * GREP_CHUNKS_PER_THREAD;
+
+    if (map_file(&file, filename) != 0) {
+        return -1;
+    }
+
+    // the part of the file that can contain the time range
+    uint64_t start = 0, end = file.size;
+    if (grep->timed && time_index_lookup(filename, grep->from, grep->to, &start, &end) != 0) {
+        start = 0;
+        end = file.size;
+    }
+    if (end > file.size) {
+        end = file.size;
+    }
+
+    if (bloom_candidates(filename, grep->needle.text, grep->needle.size, grep->word, file.size, &block_size, &maybe) != 0) {
+        goto cleanup;
+    }
+
+    // without filters a file is split for the threads only
+    if (block_size > GREP_CHUNK_SIZE) {
+        bool all = true;
+        for (uint64_t block = 0; block * block_size < file.size && all; ++ block) {
+            all = maybe[block];
+        }
+        if (all) {
+            bool *more = realloc(maybe, file.size / GREP_CHUNK_SIZE + 2);
+            if (more == NULL) {
+                goto cleanup;
+            }
+            maybe = more;
+            memset(maybe, true, file.size / GREP_CHUNK_SIZE + 2);
+            block_size = GREP_CHUNK_SIZE;
+        }
+    }
+
+    batch.chunks = calloc(batch_size, sizeof(struct Grep_Chunk));
+    if (batch.chunks == NULL) {
+        goto cleanup;
+    }
+
+    size_t count = 0;
+    for (uint64_t block = start / block_size; start < end && block * block_size < end; ++ block) {
+        if (!maybe[block]) {
+            continue;
+        }
+
+        const uint64_t block_start = block * block_size < start ? start : block * block_size;
+        const uint64_t block_end   = (block + 1) * block_size > end ? end : (block + 1) * block_size;
+        struct Grep_Chunk *chunk = &batch.chunks[count ++];
+
+        chunk->data  = file.data;
+        chunk->size  = file.size;
+        chunk->start = next_line_start(file.data, file.size, block_start);
+        chunk->end   = next_line_start(file.data, file.size, block_end);
+
+        if (count == batch_size) {
+            if (run_batch(pool, &batch, count, &found) != 0) {
+                goto cleanup;
+            }
+            count = 0;
+        }
+    }
+
+    if (count > 0 && run_batch(pool, &batch, count, &found) != 0) {
+        goto cleanup;
+    }
+
+    status = found;
+
+cleanup:
+    {
+        const int errnum = errno;
+        unmap_file(&file);
+        free(batch.chunks);
+        free(maybe);
+        errno = errnum;
+    }
+
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    struct Grep grep = {
+        .word  = false,
+        .timed = false,
+        .from  = INT64_MIN,
+        .to    = INT64_MAX,
+        .count = false,
+    };
+    struct Grep_Files files = { NULL, 0, 0 };
+    struct Pipelog_Pool *pool = NULL;
+    int with_filename = -1;
+    bool list = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int status = 1;
+
+    for (;;) {
+        int longind = 0;
+        int opt = getopt_long(argc, argv, "hvF:T:wcHNj:l", options, &longind);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'h':
+                usage(argc, argv);
+                return 0;
+
+            case 'v':
+                printf("%d.%d.%d\n", PIPELOG_VERSION_MAJOR, PIPELOG_VERSION_MINOR, PIPELOG_VERSION_PATCH);
+                return 0;
+
+            case 'F':
+                if (parse_time(optarg, &grep.from) != 0) {
+                    fprintf(stderr, "*** error: illegal value for --from: %s\n", optarg);
+                    return 2;
+                }
+                grep.timed = true;
+                break;
+
+            case 'T':
+                if (parse_time(optarg, &grep.to) != 0) {
+                    fprintf(stderr, "*** error: illegal value for --to: %s\n", optarg);
+                    return 2;
+                }
+                grep.timed = true;
+                break;
+
+            case 'w':
+                grep.word = true;
+                break;
+
+            case 'c':
+                grep.count = true;
+                break;
+
+            case 'H':
+                with_filename = 1;
+                break;
+
+            case 'N':
+                with_filename = 0;
+                break;
+
+            case 'j':
+            {
+                char *endptr = NULL;
+                threads = strtol(optarg, &endptr, 10);
+                if (*optarg < '0' || *optarg > '9' || *endptr != 0 || threads <= 0 || threads > PIPELOG_MAX_THREADS) {
+                    fprintf(stderr, "*** error: illegal value for --threads: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            }
+
+            case 'l':
+                list = true;
+                break;
+
+            case '?':
+                short_usage(argc, argv);
+                return 2;
+
+            default:
+                assert(false);
+        }
+    }
+
+    if (argc - optind < 2) {
+        fprintf(stderr, "*** error: illegal number of arguments\n");
+        short_usage(argc, argv);
+        return 2;
+    }
+
+    if (grep.from > grep.to) {
+        fprintf(stderr, "*** error: --from is after --to\n");
+        return 2;
+    }
+
+    const char *pattern = argv[optind];
+    if (*pattern == 0 || strchr(pattern, '\n') != NULL) {
+        fprintf(stderr, "*** error: PATTERN may not be empty or contain newlines\n");
+        return 2;
+    }
+    needle_init(&grep.needle, pattern, strlen(pattern));
+
+    for (int argind = optind + 1; argind < argc; ++ argind) {
+        if (expand_template(&files, argv[argind], grep.from, grep.to) != 0) {
+            fprintf(stderr, "*** error: expanding \"%s\": %s\n", argv[argind], strerror(errno));
+            status = 2;
+            goto cleanup;
+        }
+    }
+
+    if (list) {
+        for (size_t index = 0; index < files.count; ++ index) {
+            if (access(files.names[index], F_OK) == 0) {
+                printf("%s\n", files.names[index]);
+            }
+        }
+        status = 0;
+        goto cleanup;
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > PIPELOG_MAX_THREADS) {
+        threads = PIPELOG_MAX_THREADS;
+    }
+
+    pool = pool_create(threads);
+    if (pool == NULL) {
+        fprintf(stderr, "*** error: creating threads: %s\n", strerror(errno));
+        status = 2;
+        goto cleanup;
+    }
+
+    if (with_filename < 0) {
+        with_filename = files.count > 1;
+    }
+
+    for (size_t index = 0; index < files.count; ++ index) {
+        const char *filename = files.names[index];
+        char prefix[PATH_MAX + 2];
+        snprintf(prefix, sizeof(prefix), "%s:", filename);
+
+        const int64_t found = grep_file(pool, &grep, filename, with_filename && !grep.count ? prefix : NULL);
+        if (found < 0) {
+            // names formatted from the time range don't all exist
+            if (errno != ENOENT) {
+                fprintf(stderr, "*** error: searching \"%s\": %s\n", filename, strerror(errno));
+                status = 2;
+            }
+            continue;
+        }
+
+        if (grep.count) {
+            if (with_filename) {
+                printf("%s%" PRId64 "\n", prefix, found);
+            } else {
+                printf("%" PRId64 "\n", found);
+            }
+            fflush(stdout);
+        }
+
+        if (found > 0 && status == 1) {
+            status = 0;
+        }
+    }
+
+cleanup:
+    if (pool != NULL) {
+        pool_destroy(pool);
+    }
+    files_free(&files);
+
+    return status;
+}
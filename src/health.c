@@ -0,0 +1,139 @@
+#include "health.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+uint64_t health_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void health_init(struct Pipelog_Health *health, size_t index) {
+    memset(health, 0, sizeof(*health));
+    health->fallback_fd = -1;
+    // any odd seed will do, it only has to differ between outputs and runs
+    health->random = (health_now() ^ (uint64_t)getpid() << 32 ^ (uint64_t)index * 0x9e3779b97f4a7c15) | 1;
+}
+
+void health_failed(struct Pipelog_Health *health, int errnum, uint64_t now) {
+    uint64_t delay = PIPELOG_HEALTH_MAX_DELAY;
+
+    if (health->failures < 20) {
+        delay = (uint64_t)PIPELOG_HEALTH_MIN_DELAY << health->failures;
+        if (delay > PIPELOG_HEALTH_MAX_DELAY) {
+            delay = PIPELOG_HEALTH_MAX_DELAY;
+        }
+    }
+
+    if (health->failures == 0) {
+        // the failure itself was just reported
+        health->reported_at = now;
+    }
+
+    health->random ^= health->random << 13;
+    health->random ^= health->random >> 7;
+    health->random ^= health->random << 17;
+
+    // somewhere between half and all of the delay
+    health->retry_at = now + delay / 2 + health->random % (delay / 2 + 1);
+    health->errnum   = errnum;
+    ++ health->failures;
+}
+
+bool health_report_due(struct Pipelog_Health *health, uint64_t now) {
+    if (now - health->reported_at < PIPELOG_HEALTH_REPORT_INTERVAL) {
+        return false;
+    }
+
+    health->reported_at = now;
+    return true;
+}
+
+void health_divert(struct Pipelog_Health *health, const struct Pipelog_Output *out, const char *data, size_t size) {
+    switch (out->fallback) {
+        case PIPELOG_FALLBACK_SPILL:
+        {
+            const size_t room = out->spill_size > health->spill_size ? out->spill_size - health->spill_size : 0;
+            size_t keep = size;
+            if (keep > room) {
+                // only whole lines, a partial one would be glued to the next line written
+                const char *end = memrchr(data, '\n', room);
+                keep = end == NULL ? 0 : (size_t)(end - data) + 1;
+            }
+
+            if (keep > 0 && reserve(&health->spill, &health->spill_capacity, health->spill_size + keep) == 0) {
+                memcpy(health->spill + health->spill_size, data, keep);
+                health->spill_size += keep;
+                health->diverted   += keep;
+                health->dropped    += size - keep;
+            } else {
+                health->dropped += size;
+            }
+            break;
+        }
+        case PIPELOG_FALLBACK_FILE:
+            if (health->fallback_fd < 0) {
+                health->fallback_fd = open(out->fallback_path, O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND, 0644);
+                if (health->fallback_fd < 0 && errno == ENOENT && make_parent_dirs(out->fallback_path, 0755) == 0) {
+                    health->fallback_fd = open(out->fallback_path, O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND, 0644);
+                }
+            }
+
+            if (health->fallback_fd >= 0 && write_all(health->fallback_fd, data, size) == 0) {
+                health->diverted += size;
+            } else {
+                // the fallback is tried again with the next data
+                if (health->fallback_fd >= 0) {
+                    close(health->fallback_fd);
+                    health->fallback_fd = -1;
+                }
+                health->dropped += size;
+            }
+            break;
+
+        default:
+            health->dropped += size;
+            break;
+    }
+}
+
+int health_append_spill(struct Pipelog_Health *health, const char *data, size_t size) {
+    if (reserve(&health->spill, &health->spill_capacity, health->spill_size + size) != 0) {
+        return -1;
+    }
+
+    memcpy(health->spill + health->spill_size, data, size);
+    health->spill_size += size;
+
+    return 0;
+}
+
+void health_recovered(struct Pipelog_Health *health) {
+    if (health->fallback_fd >= 0) {
+        close(health->fallback_fd);
+        health->fallback_fd = -1;
+    }
+
+    health->failures = 0;
+    health->dropped  = 0;
+    health->diverted = 0;
+}
+
+void health_free(struct Pipelog_Health *health) {
+    if (health->fallback_fd >= 0) {
+        close(health->fallback_fd);
+        health->fallback_fd = -1;
+    }
+
+    free(health->spill);
+    health->spill          = NULL;
+    health->spill_size     = 0;
+    health->spill_capacity = 0;
+}
@@ -0,0 +1,89 @@
+#ifndef PIPELOG_HEALTH_H
+#define PIPELOG_HEALTH_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// milliseconds before the first attempt to re-open a failed output
+#define PIPELOG_HEALTH_MIN_DELAY 100
+// maximum milliseconds between attempts
+#define PIPELOG_HEALTH_MAX_DELAY 60000
+// milliseconds between reports of an output that keeps failing
+#define PIPELOG_HEALTH_REPORT_INTERVAL 10000
+
+#define PIPELOG_SPILL_SIZE (16 * 1024 * 1024)
+
+/**
+ * Circuit breaker of an output. After its file can't be opened or written
+ * the output is down: it isn't tried again before retry_at, which doubles
+ * with every failure up to PIPELOG_HEALTH_MAX_DELAY, with random jitter so
+ * that many outputs on the same failed device don't retry in lockstep. Data
+ * for an output that is down goes to its fallback.
+ */
+struct Pipelog_Health {
+    unsigned int failures; //!< in a row, 0 if the output is up
+    int      errnum;       //!< of the last failure
+    uint64_t retry_at;     //!< CLOCK_MONOTONIC milliseconds
+    uint64_t reported_at;
+    uint64_t random;       //!< xorshift state for the jitter
+    uint64_t dropped;      //!< bytes lost since the output went down
+    uint64_t diverted;     //!< bytes written to the fallback file or spilled
+
+    char  *spill;          //!< data to write once the output is up again
+    size_t spill_size;
+    size_t spill_capacity;
+
+    int fallback_fd;       //!< of the fallback file, -1 if not open
+};
+
+uint64_t health_now(void);
+
+void health_init(struct Pipelog_Health *health, size_t index);
+
+static inline bool health_down(const struct Pipelog_Health *health, uint64_t now) {
+    return health->failures > 0 && now < health->retry_at;
+}
+
+/**
+ * Record a failure and schedule the next attempt.
+ */
+void health_failed(struct Pipelog_Health *health, int errnum, uint64_t now);
+
+/**
+ * Returns true at most every PIPELOG_HEALTH_REPORT_INTERVAL milliseconds.
+ */
+bool health_report_due(struct Pipelog_Health *health, uint64_t now);
+
+/**
+ * Hand data of an output that is down to out->fallback: drop it, keep whole
+ * lines of it in memory up to out->spill_size bytes, or append it to the file
+ * out->fallback_path. Whatever can't be kept is counted as dropped.
+ */
+void health_divert(struct Pipelog_Health *health, const struct Pipelog_Output *out, const char *data, size_t size);
+
+/**
+ * Append data to the spilled data, regardless of the limit, so that both
+ * can be written at once. Returns 0 on success, -1 on error and sets errno.
+ */
+int health_append_spill(struct Pipelog_Health *health, const char *data, size_t size);
+
+/**
+ * The output is up again. Closes the fallback file. Spilled data is kept
+ * for the caller to write.
+ */
+void health_recovered(struct Pipelog_Health *health);
+
+void health_free(struct Pipelog_Health *health);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
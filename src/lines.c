@@ -0,0 +1,70 @@
+#include "lines.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int append_line(struct Pipelog_Lines *lines, const char *data, size_t size) {
+    if (lines->capacity < lines->size + size) {
+        size_t capacity = lines->capacity == 0 ? BUFSIZ : lines->capacity;
+        while (capacity < lines->size + size) {
+            capacity *= 2;
+        }
+
+        char *line = realloc(lines->line, capacity);
+        if (line == NULL) {
+            return -1;
+        }
+
+        lines->line = line;
+        lines->capacity = capacity;
+    }
+
+    memcpy(lines->line + lines->size, data, size);
+    lines->size += size;
+
+    return 0;
+}
+
+int split_lines(struct Pipelog_Lines *lines, const char *data, size_t size, bool flush, Pipelog_Line_Callback callback, void *context) {
+    const char *ptr = data;
+    const char *end = data + size;
+    int result = 0;
+
+    while (ptr < end) {
+        const char *newline = memchr(ptr, '\n', end - ptr);
+        const size_t chunk = newline == NULL ? (size_t)(end - ptr) : (size_t)(newline + 1 - ptr);
+
+        if (newline == NULL || lines->size > 0) {
+            if (append_line(lines, ptr, chunk) != 0) {
+                return -1;
+            }
+
+            if (newline != NULL) {
+                result = callback(context, lines->line, lines->size);
+                lines->size = 0;
+                if (result != 0) {
+                    return result;
+                }
+            }
+        } else if ((result = callback(context, ptr, chunk)) != 0) {
+            return result;
+        }
+
+        ptr += chunk;
+    }
+
+    if (flush && lines->size > 0) {
+        result = callback(context, lines->line, lines->size);
+        lines->size = 0;
+    }
+
+    return result;
+}
+
+void lines_free(struct Pipelog_Lines *lines) {
+    free(lines->line);
+    lines->line = NULL;
+    lines->size = 0;
+    lines->capacity = 0;
+}
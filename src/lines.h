@@ -0,0 +1,41 @@
+#ifndef PIPELOG_LINES_H
+#define PIPELOG_LINES_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct Pipelog_Lines {
+    char  *line; //!< incomplete line at the end of the last chunk
+    size_t size;
+    size_t capacity;
+};
+
+/**
+ * Called for every line, including its newline (if any). A non-zero return
+ * value stops split_lines() and is passed on to its caller.
+ */
+typedef int (*Pipelog_Line_Callback)(void *context, const char *line, size_t size);
+
+/**
+ * Split data into lines and call callback for each. An incomplete line at
+ * the end of data is kept and completed by the next call, unless flush is
+ * true. Complete lines are passed without copying.
+ *
+ * Returns 0 on success, -1 on allocation errors (errno is set), or the
+ * non-zero return value of callback.
+ */
+int split_lines(struct Pipelog_Lines *lines, const char *data, size_t size, bool flush, Pipelog_Line_Callback callback, void *context);
+
+void lines_free(struct Pipelog_Lines *lines);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
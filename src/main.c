@@ -1,4 +1,19 @@
 #include "pipelog.h"
+#include "ring.h"
+#include "merge.h"
+#include "template.h"
+#include "columnar.h"
+#include "timeindex.h"
+#include "bloom.h"
+#include "fieldindex.h"
+#include "manifest.h"
+#include "checksum.h"
+#include "chain.h"
+#include "crypt.h"
+#include "route.h"
+#include "replica.h"
+#include "health.h"
+#include "timestamp.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,6 +27,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <signal.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
 
 enum {
     OPT_HELP,
@@ -21,6 +39,24 @@ enum {
     OPT_QUIET,
     OPT_EXIT_ON_WRITE_ERROR,
     OPT_NO_SPLICE,
+    OPT_DUMP_RING,
+    OPT_DECODE_TEMPLATES,
+    OPT_ARCHIVE,
+    OPT_COUNT_BY,
+    OPT_LOOKUP,
+    OPT_FROM,
+    OPT_TO,
+    OPT_SEARCH,
+    OPT_WHERE,
+    OPT_METRICS,
+    OPT_METRICS_INTERVAL,
+    OPT_COUNTER,
+    OPT_THREADS,
+    OPT_INPUT,
+    OPT_MERGE_WINDOW,
+    OPT_MANIFEST,
+    OPT_VERIFY,
+    OPT_DECRYPT,
     OPT_COUNT,
 };
 
@@ -32,6 +68,24 @@ static const struct option options[] = {
     [OPT_QUIET]               = { "quiet",               no_argument,       0, 'q' },
     [OPT_EXIT_ON_WRITE_ERROR] = { "exit-on-write-error", no_argument,       0, 'e' },
     [OPT_NO_SPLICE]           = { "no-splice",           no_argument,       0, 'S' },
+    [OPT_DUMP_RING]           = { "dump-ring",           required_argument, 0, 'D' },
+    [OPT_DECODE_TEMPLATES]    = { "decode-templates",    required_argument, 0, 'd' },
+    [OPT_ARCHIVE]             = { "archive",             required_argument, 0, 'A' },
+    [OPT_COUNT_BY]            = { "count-by",            required_argument, 0, 'B' },
+    [OPT_LOOKUP]              = { "lookup",              required_argument, 0, 'L' },
+    [OPT_FROM]                = { "from",                required_argument, 0, 'F' },
+    [OPT_TO]                  = { "to",                  required_argument, 0, 'T' },
+    [OPT_SEARCH]              = { "search",              required_argument, 0, 's' },
+    [OPT_WHERE]               = { "where",               required_argument, 0, 'W' },
+    [OPT_METRICS]             = { "metrics",             required_argument, 0, 'm' },
+    [OPT_METRICS_INTERVAL]    = { "metrics-interval",    required_argument, 0, 'i' },
+    [OPT_COUNTER]             = { "count",               required_argument, 0, 'c' },
+    [OPT_THREADS]             = { "threads",             required_argument, 0, 'j' },
+    [OPT_INPUT]               = { "input",               required_argument, 0, 'I' },
+    [OPT_MERGE_WINDOW]        = { "merge-window",        required_argument, 0, 'w' },
+    [OPT_MANIFEST]            = { "manifest",            required_argument, 0, 'M' },
+    [OPT_VERIFY]              = { "verify",              no_argument,       0, 'C' },
+    [OPT_DECRYPT]             = { "decrypt",             required_argument, 0, 'E' },
     [OPT_COUNT]               = { 0, 0, 0, 0 },
 };
 
@@ -44,10 +98,502 @@ static void handle_sigint(int sig) {
     }
 }
 
+// parses a number with an optional K, M or G suffix (powers of 1024)
+static int parse_size(const char *str, size_t *value) {
+    if (*str < '0' || *str > '9') {
+        return -1;
+    }
+
+    char *endptr = NULL;
+    errno = 0;
+    unsigned long long num = strtoull(str, &endptr, 10);
+    if (errno != 0) {
+        return -1;
+    }
+
+    unsigned long long unit = 1;
+    switch (*endptr) {
+        case 'K': unit = 1024ULL;               ++ endptr; break;
+        case 'M': unit = 1024ULL * 1024;        ++ endptr; break;
+        case 'G': unit = 1024ULL * 1024 * 1024; ++ endptr; break;
+    }
+
+    if (*endptr != 0 || num > SIZE_MAX / unit) {
+        return -1;
+    }
+
+    *value = num * unit;
+    return 0;
+}
+
+// returns the VALUE of "NAME=VALUE" or NULL if option isn't NAME
+static const char *option_value(const char *option, const char *name) {
+    const size_t len = strlen(name);
+    if (strncmp(option, name, len) == 0 && option[len] == '=') {
+        return option + len + 1;
+    }
+    return NULL;
+}
+
+static int parse_output_option(const char *option, struct Pipelog_Output *out) {
+    const char *value;
+
+    if (strcmp(option, "strip-ansi") == 0) {
+        out->flags |= PIPELOG_OUTPUT_STRIP_ANSI;
+    } else if (strcmp(option, "sanitize") == 0) {
+        out->flags |= PIPELOG_OUTPUT_SANITIZE;
+    } else if ((value = option_value(option, "trigger")) != NULL) {
+        if (*value == 0) {
+            fprintf(stderr, "*** error: +trigger may not be an empty string\n");
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_CAPTURE;
+        out->capture.trigger = value;
+    } else if ((value = option_value(option, "before")) != NULL) {
+        if (parse_size(value, &out->capture.before_lines) != 0) {
+            fprintf(stderr, "*** error: illegal value for +before: %s\n", value);
+            return -1;
+        }
+    } else if ((value = option_value(option, "before-bytes")) != NULL) {
+        if (parse_size(value, &out->capture.before_bytes) != 0) {
+            fprintf(stderr, "*** error: illegal value for +before-bytes: %s\n", value);
+            return -1;
+        }
+    } else if ((value = option_value(option, "ring")) != NULL) {
+        if (parse_size(value, &out->ring_size) != 0 || out->ring_size == 0) {
+            fprintf(stderr, "*** error: illegal value for +ring: %s\n", value);
+            return -1;
+        }
+        if (out->filename == NULL || out->link != NULL || strchr(out->filename, '%') != NULL) {
+            fprintf(stderr, "*** error: +ring needs a FILE without format specifications and without @LINK\n");
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_RING;
+    } else if ((value = option_value(option, "dump")) != NULL) {
+        if (*value == 0) {
+            fprintf(stderr, "*** error: +dump may not be an empty string\n");
+            return -1;
+        }
+        out->ring_dump = value;
+    } else if (strcmp(option, "templates") == 0) {
+        out->flags |= PIPELOG_OUTPUT_TEMPLATES;
+    } else if ((value = option_value(option, "encrypt")) != NULL) {
+        if (*value == 0) {
+            fprintf(stderr, "*** error: +encrypt may not be an empty string\n");
+            return -1;
+        }
+        out->key_file = value;
+        out->flags |= PIPELOG_OUTPUT_ENCRYPT;
+    } else if (strcmp(option, "index") == 0) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +index needs a FILE\n");
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_INDEX;
+    } else if ((value = option_value(option, "index")) != NULL) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +index needs a FILE\n");
+            return -1;
+        }
+        if (parse_size(value, &out->index_bytes) != 0 || out->index_bytes == 0) {
+            fprintf(stderr, "*** error: illegal value for +index: %s\n", value);
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_INDEX;
+    } else if ((value = option_value(option, "index-interval")) != NULL) {
+        size_t interval = 0;
+        if (parse_size(value, &interval) != 0 || interval == 0 || interval > UINT_MAX) {
+            fprintf(stderr, "*** error: illegal value for +index-interval: %s\n", value);
+            return -1;
+        }
+        out->index_interval = interval;
+    } else if (strcmp(option, "bloom") == 0) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +bloom needs a FILE\n");
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_BLOOM;
+    } else if ((value = option_value(option, "bloom")) != NULL) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +bloom needs a FILE\n");
+            return -1;
+        }
+        if (parse_size(value, &out->bloom_block_size) != 0 || out->bloom_block_size < 4096) {
+            fprintf(stderr, "*** error: illegal value for +bloom: %s\n", value);
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_BLOOM;
+    } else if (strcmp(option, "crc") == 0) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +crc needs a FILE\n");
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_CHECKSUMS;
+    } else if ((value = option_value(option, "crc")) != NULL) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +crc needs a FILE\n");
+            return -1;
+        }
+        if (parse_size(value, &out->checksum_block_size) != 0 || out->checksum_block_size < 4096) {
+            fprintf(stderr, "*** error: illegal value for +crc: %s\n", value);
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_CHECKSUMS;
+    } else if (strcmp(option, "chain") == 0) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +chain needs a FILE\n");
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_CHAIN;
+    } else if ((value = option_value(option, "chain")) != NULL) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +chain needs a FILE\n");
+            return -1;
+        }
+        if (parse_size(value, &out->chain_block_size) != 0 || out->chain_block_size < 4096) {
+            fprintf(stderr, "*** error: illegal value for +chain: %s\n", value);
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_CHAIN;
+    } else if ((value = option_value(option, "fields")) != NULL) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +fields needs a FILE\n");
+            return -1;
+        }
+        if (strspn(value, ",") == strlen(value)) {
+            fprintf(stderr, "*** error: illegal value for +fields: %s\n", value);
+            return -1;
+        }
+        out->fields = value;
+        out->flags |= PIPELOG_OUTPUT_FIELDS;
+    } else if ((value = option_value(option, "fields-block")) != NULL) {
+        if (parse_size(value, &out->field_block_size) != 0 || out->field_block_size < 4096) {
+            fprintf(stderr, "*** error: illegal value for +fields-block: %s\n", value);
+            return -1;
+        }
+    } else if ((value = option_value(option, "progress")) != NULL) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +progress needs a FILE\n");
+            return -1;
+        }
+        if (*value == 0) {
+            fprintf(stderr, "*** error: +progress may not be an empty string\n");
+            return -1;
+        }
+        out->progress = value;
+    } else if ((value = option_value(option, "manifest")) != NULL) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +manifest needs a FILE\n");
+            return -1;
+        }
+        if (*value == 0) {
+            fprintf(stderr, "*** error: +manifest may not be an empty string\n");
+            return -1;
+        }
+        out->manifest = value;
+        out->flags |= PIPELOG_OUTPUT_MANIFEST;
+    } else if ((value = option_value(option, "shard")) != NULL) {
+        if (*value == 0) {
+            fprintf(stderr, "*** error: +shard may not be an empty string\n");
+            return -1;
+        }
+        out->shard = value;
+        out->flags |= PIPELOG_OUTPUT_SHARD;
+    } else if ((value = option_value(option, "shard-key")) != NULL) {
+        if (*value == 0) {
+            fprintf(stderr, "*** error: +shard-key may not be an empty string\n");
+            return -1;
+        }
+        out->shard_key = value;
+    } else if ((value = option_value(option, "max-open")) != NULL) {
+        if (out->filename == NULL || !(out->flags & PIPELOG_OUTPUT_ROUTE)) {
+            fprintf(stderr, "*** error: +max-open needs a FILE with %%{FIELD}\n");
+            return -1;
+        }
+        if (parse_size(value, &out->max_open) != 0 || out->max_open == 0) {
+            fprintf(stderr, "*** error: illegal value for +max-open: %s\n", value);
+            return -1;
+        }
+    } else if ((value = option_value(option, "replica")) != NULL) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +replica needs a FILE\n");
+            return -1;
+        }
+        if (*value == 0) {
+            fprintf(stderr, "*** error: +replica may not be an empty string\n");
+            return -1;
+        }
+        out->replica = value;
+    } else if ((value = option_value(option, "replica-interval")) != NULL) {
+        size_t interval = 0;
+        if (parse_size(value, &interval) != 0 || interval > UINT_MAX) {
+            fprintf(stderr, "*** error: illegal value for +replica-interval: %s\n", value);
+            return -1;
+        }
+        out->replica_interval = interval;
+    } else if ((value = option_value(option, "fallback")) != NULL) {
+        if (*value == 0) {
+            fprintf(stderr, "*** error: +fallback may not be an empty string\n");
+            return -1;
+        }
+        if (strcmp(value, "drop") == 0) {
+            out->fallback = PIPELOG_FALLBACK_DROP;
+        } else if (strcmp(value, "spill") == 0) {
+            out->fallback = PIPELOG_FALLBACK_SPILL;
+        } else {
+            out->fallback      = PIPELOG_FALLBACK_FILE;
+            out->fallback_path = value;
+        }
+    } else if ((value = option_value(option, "spill-size")) != NULL) {
+        if (parse_size(value, &out->spill_size) != 0 || out->spill_size == 0) {
+            fprintf(stderr, "*** error: illegal value for +spill-size: %s\n", value);
+            return -1;
+        }
+    } else if (strcmp(option, "columnar") == 0) {
+        if (out->filename == NULL) {
+            fprintf(stderr, "*** error: +columnar needs a FILE\n");
+            return -1;
+        }
+        out->flags |= PIPELOG_OUTPUT_COLUMNAR;
+    } else if ((value = option_value(option, "after")) != NULL) {
+        if (parse_size(value, &out->capture.after_lines) != 0) {
+            fprintf(stderr, "*** error: illegal value for +after: %s\n", value);
+            return -1;
+        }
+    } else {
+        fprintf(stderr, "*** error: unknown output option: +%s\n", option);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int dump_ring(const char *filename) {
+    struct Pipelog_Ring ring;
+
+    if (ring_open(&ring, filename, 0) != 0) {
+        fprintf(stderr, "*** error: opening ring file \"%s\": %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    int status = 0;
+    if (ring_dump(&ring, STDOUT_FILENO) != 0) {
+        fprintf(stderr, "*** error: writing ring file \"%s\": %s\n", filename, strerror(errno));
+        status = 1;
+    }
+
+    ring_close(&ring);
+
+    return status;
+}
+
+static int show_manifest(const char *filename) {
+    if (manifest_dump(filename, STDOUT_FILENO) != 0) {
+        fprintf(stderr, "*** error: reading manifest \"%s\": %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+static int decode_templates_file(const char *filename) {
+    const int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        fprintf(stderr, "*** error: opening template file \"%s\": %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    int status = 0;
+    if (decode_templates(fd, STDOUT_FILENO) != 0) {
+        fprintf(stderr, "*** error: decoding template file \"%s\": %s\n", filename, strerror(errno));
+        status = 1;
+    }
+
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    return status;
+}
+
+/**
+ * Write the plaintext of the files written using +encrypt to standard output.
+ */
+static int decrypt_files(const char *keyfile, char *filenames[], size_t count) {
+    unsigned char key[PIPELOG_CRYPT_KEY_SIZE];
+    int status = 0;
+
+    if (crypt_load_key(keyfile, key) != 0) {
+        fprintf(stderr, "*** error: reading key file \"%s\": %s\n", keyfile, strerror(errno));
+        return 1;
+    }
+
+    for (size_t index = 0; index < count; ++ index) {
+        const char *filename = filenames[index];
+        const int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) {
+            fprintf(stderr, "*** error: opening encrypted file \"%s\": %s\n", filename, strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        if (decrypt_stream(key, fd, STDOUT_FILENO) != 0) {
+            fprintf(stderr, "*** error: decrypting \"%s\": %s\n", filename,
+                errno == EBADMSG ? "wrong key or the file was modified" :
+                errno == EINVAL  ? "truncated or malformed file" : strerror(errno));
+            status = 1;
+        }
+
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+
+    explicit_bzero(key, sizeof(key));
+
+    return status;
+}
+
+static int query_archive(const char *filename, const char *count_by) {
+    const int status = count_by != NULL ?
+        columnar_count_by(filename, count_by, STDOUT_FILENO) :
+        columnar_summary(filename, STDOUT_FILENO);
+
+    if (status != 0) {
+        fprintf(stderr, "*** error: reading columnar archive \"%s\": %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+// parses a whole argument as timestamp, returns milliseconds since the epoch
+static int lookup_range(const char *filename, int64_t from, int64_t to) {
+    uint64_t start = 0, end = 0;
+
+    if (time_index_lookup(filename, from, to, &start, &end) != 0) {
+        fprintf(stderr, "*** error: reading index of \"%s\": %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    if (end == UINT64_MAX) {
+        struct stat meta;
+        if (stat(filename, &meta) != 0) {
+            fprintf(stderr, "*** error: getting size of \"%s\": %s\n", filename, strerror(errno));
+            return 1;
+        }
+        end = meta.st_size;
+    }
+
+    printf("%" PRIu64 "\t%" PRIu64 "\n", start, end);
+
+    return 0;
+}
+
+/**
+ * Search for lines with word, or with all fields of where if word is NULL.
+ */
+static int search_files(const char *word, const struct Pipelog_Field where[], size_t where_count, char *filenames[], size_t count) {
+    char prefix[PATH_MAX + 2];
+    int status = 1;
+
+    for (size_t index = 0; index < count; ++ index) {
+        // like grep, name the file only if there are several
+        if (count > 1) {
+            snprintf(prefix, sizeof(prefix), "%s:", filenames[index]);
+        }
+
+        const int64_t found = word != NULL ?
+            bloom_search(filenames[index], word, count > 1 ? prefix : NULL, STDOUT_FILENO) :
+            field_index_search(filenames[index], where, where_count, count > 1 ? prefix : NULL, STDOUT_FILENO);
+        if (found < 0) {
+            fprintf(stderr, "*** error: searching \"%s\": %s\n", filenames[index], strerror(errno));
+            return 2;
+        }
+
+        if (found > 0) {
+            status = 0;
+        }
+    }
+
+    return status;
+}
+
+static bool sidecar_exists(const char *filename, const char *suffix) {
+    char buf[PATH_MAX];
+
+    return snprintf(buf, sizeof(buf), "%s%s", filename, suffix) < (int)sizeof(buf) && access(buf, F_OK) == 0;
+}
+
+/**
+ * Check the blocks of the log files against their checksums and digests.
+ * The chains of consecutive files have to be linked.
+ */
+static int verify_files(char *filenames[], size_t count) {
+    unsigned char head[PIPELOG_SHA256_SIZE];
+    bool has_head = false;
+    int status = 0;
+
+    for (size_t index = 0; index < count; ++ index) {
+        const char *filename = filenames[index];
+        const bool has_checksums = sidecar_exists(filename, PIPELOG_CHECKSUM_SUFFIX);
+        const bool has_chain = sidecar_exists(filename, PIPELOG_CHAIN_SUFFIX);
+        int64_t bad = 0;
+
+        if (!has_checksums && !has_chain) {
+            fprintf(stderr, "*** error: verifying \"%s\": neither %s nor %s file found\n", filename, PIPELOG_CHECKSUM_SUFFIX, PIPELOG_CHAIN_SUFFIX);
+            status = 2;
+            has_head = false;
+            continue;
+        }
+
+        if (has_checksums) {
+            const int64_t result = checksums_verify(filename, stdout);
+            if (result < 0) {
+                fprintf(stderr, "*** error: verifying \"%s\": %s\n", filename, strerror(errno));
+                status = 2;
+                has_head = false;
+                continue;
+            }
+            bad += result;
+        }
+
+        if (has_chain) {
+            const int64_t result = chain_verify(filename, stdout, has_head ? head : NULL, head);
+            if (result < 0) {
+                fprintf(stderr, "*** error: verifying \"%s\": %s\n", filename, strerror(errno));
+                status = 2;
+                has_head = false;
+                continue;
+            }
+            bad += result;
+        }
+        has_head = has_chain;
+
+        if (bad > 0) {
+            if (status == 0) {
+                status = 1;
+            }
+        } else if (has_chain) {
+            printf("%s: OK, chain head ", filename);
+            for (size_t byte = 0; byte < PIPELOG_SHA256_SIZE; ++ byte) {
+                printf("%02x", head[byte]);
+            }
+            printf("\n");
+        } else {
+            printf("%s: OK\n", filename);
+        }
+    }
+
+    return status;
+}
+
 static void short_usage(int argc, char *argv[]) {
     const char *progname = argc > 0 ? argv[0] : "pipelog";
     printf(
-        "Usage: %s [OPTION]... [--] [FILE [@LINK]]...\n",
+        "Usage: %s [OPTION]... [--] [FILE [@LINK] [+OUTOPT]...]...\n",
         progname
     );
 }
@@ -64,6 +610,12 @@ static void usage(int argc, char *argv[]) {
         "If FILE is a path it may contain strftime compatible format specifications.\n"
         "If any of the log file's anchestor directories don't exists they are created.\n"
         "The directory names may also contain format specifications.\n"
+        "FILE may also contain %%{FIELD} to write each line to the file named by the\n"
+        "value of the field FIELD of the line (parsed as JSON object or logfmt), e.g.\n"
+        "logs/%%{tenant}/%%Y-%%m-%%d.log. Missing values are written as \"_\", '/' and\n"
+        "control characters of values as '_'. Only line filters and +capture can be\n"
+        "used with such a FILE, and no LINK. At most +max-open files are kept open,\n"
+        "the least recently written one is closed when another one is needed.\n"
         "\n"
         "LINK may be a path where a symbolic link to the latest FILE is created.\n"
         "Note that the target of the link will be the absolute path of FILE.\n"
@@ -72,8 +624,159 @@ static void usage(int argc, char *argv[]) {
         "If SIGHUP is sent to pipelog it re-opens all it's open files. This may lead\n"
         "the creation of new empty log files if the timestamp changed.\n"
         "\n"
-        "If there is only one output file splice() is used to transfer data without\n"
-        "user space copies.\n"
+        "OUTOPT are options that only apply to the preceding FILE:\n"
+        "\n"
+        "    +strip-ansi                Remove ANSI escape sequences (colors, cursor\n"
+        "                               movement, window titles etc.) from the data\n"
+        "                               written to FILE.\n"
+        "    +sanitize                  Replace invalid UTF-8 sequences and control\n"
+        "                               characters other than tab and newline by\n"
+        "                               U+FFFD. Applied after +strip-ansi.\n"
+        "    +trigger=REGEX             Only write lines matching the POSIX extended\n"
+        "                               regular expression REGEX and the lines around\n"
+        "                               them to FILE. Everything else is discarded.\n"
+        "                               Applied after +strip-ansi and +sanitize.\n"
+        "    +before=LINES              Number of lines kept in memory and written\n"
+        "                               before a line matching +trigger.\n"
+        "                               Default: 100\n"
+        "    +before-bytes=SIZE         Maximum size of the lines kept for +before.\n"
+        "                               SIZE may have a K, M or G suffix.\n"
+        "                               Default: 1M\n"
+        "    +after=LINES               Number of lines written after a line matching\n"
+        "                               +trigger. Default: 10\n"
+        "    +ring=SIZE                 Don't write FILE like a log file, but use it as\n"
+        "                               a memory mapped ring buffer holding the last\n"
+        "                               SIZE bytes. The file is preallocated and its\n"
+        "                               contents survive a restart of pipelog. FILE may\n"
+        "                               not contain format specifications.\n"
+        "    +dump=TEMPLATE             When pipelog receives SIGUSR1 it writes the\n"
+        "                               contents of all rings to files named by\n"
+        "                               formatting TEMPLATE with strftime.\n"
+        "                               Default: FILE.%%Y-%%m-%%dT%%H-%%M-%%S\n"
+        "    +templates                 Write lines in a compact binary format. Message\n"
+        "                               templates are learned while logging and each\n"
+        "                               line is stored as a template ID, the variable\n"
+        "                               parts and the difference to the timestamp of\n"
+        "                               the line before. Use --decode-templates to get\n"
+        "                               the original text back.\n"
+        "    +encrypt=KEYFILE           Encrypt the output with AES-256-GCM. Each file,\n"
+        "                               and each time it is re-opened, gets a random\n"
+        "                               key, which is stored in the file encrypted with\n"
+        "                               the key in KEYFILE: 32 bytes, or 64 hexadecimal\n"
+        "                               digits. The data is split into authenticated\n"
+        "                               frames of up to 1 MB, one per write, and a\n"
+        "                               final frame when the file is closed. Uses\n"
+        "                               libcrypto. Use --decrypt to read the output.\n"
+        "                               Can't be combined with +ring, +columnar and\n"
+        "                               sidecar files.\n"
+        "    +bloom[=SIZE]              Write a Bloom filter of the words of each block\n"
+        "                               of SIZE bytes of the log file to FILE.blm, so\n"
+        "                               that --search can skip blocks that don't\n"
+        "                               contain a word. Words are runs of letters,\n"
+        "                               digits, '_' and non-ASCII characters of at\n"
+        "                               least 3 bytes. A line belongs to the block it\n"
+        "                               starts in. SIZE may have a K, M or G suffix.\n"
+        "                               Default: 4M\n"
+        "    +crc[=SIZE]                Write the CRC-32C of each block of SIZE bytes of\n"
+        "                               the log file to FILE.crc, so that --verify can\n"
+        "                               tell which blocks got corrupted. SIZE may have\n"
+        "                               a K, M or G suffix. Default: 1M\n"
+        "    +chain[=SIZE]              Write a SHA-256 digest of each block of SIZE\n"
+        "                               bytes of the log file to FILE.sha. Each digest\n"
+        "                               covers the digest before it, and the first the\n"
+        "                               chain head of the file written before, so that\n"
+        "                               changes to a block or to the order of files\n"
+        "                               are evident to --verify. SIZE may have a K, M\n"
+        "                               or G suffix. Default: 1M\n"
+        "    +fields=KEYS               Write an index of the values of the fields\n"
+        "                               named in the comma separated list KEYS to\n"
+        "                               FILE.fdx, so that --where only reads the\n"
+        "                               blocks of the log file that contain a value.\n"
+        "                               Meant for fields with few distinct values,\n"
+        "                               like a status or a host name. Of a field with\n"
+        "                               more than 1024 values only the first 1024 are\n"
+        "                               indexed. Lines are parsed as JSON objects or\n"
+        "                               logfmt. The index is written when the log file\n"
+        "                               is closed.\n"
+        "    +fields-block=SIZE         Size of the blocks of +fields. SIZE may have a\n"
+        "                               K, M or G suffix. Default: 1M\n"
+        "    +progress=PATH             Publish the file that is written and its size\n"
+        "                               in the small shared memory file PATH, so that\n"
+        "                               pipelog-follow can read new data as soon as it\n"
+        "                               is written and follow rotations without\n"
+        "                               polling. Works with splice.\n"
+        "    +manifest=PATH             Append a record to PATH whenever a log file is\n"
+        "                               opened, closed or converted by +columnar. A\n"
+        "                               record has the tab separated fields state\n"
+        "                               (active, closed or archived), arrival time of\n"
+        "                               the first and last data in milliseconds since\n"
+        "                               the epoch, size, number of lines and file name.\n"
+        "                               The last record of a file is its current\n"
+        "                               state. Use --manifest to list those.\n"
+        "    +shard=GROUP               Distribute the lines among all outputs with the\n"
+        "                               same GROUP instead of writing every line to\n"
+        "                               each of them, e.g. to spread a stream over\n"
+        "                               several devices. Each output keeps its own\n"
+        "                               rotation, link and options and is written by\n"
+        "                               its own thread. All outputs of a group need the\n"
+        "                               same line filters.\n"
+        "    +shard-key=KEY             Pick the output of a line of the group by the\n"
+        "                               hash of the value of its field KEY, so that the\n"
+        "                               lines with the same value are in the same file.\n"
+        "                               Lines are parsed as JSON objects or logfmt.\n"
+        "                               Lines without KEY, and all lines if no output\n"
+        "                               of the group has a KEY, are distributed\n"
+        "                               round-robin.\n"
+        "    +max-open=COUNT            Files of a FILE with %%{FIELD} to keep open.\n"
+        "                               Default: half of the limit of open files\n"
+        "    +replica=PATH              Keep a copy of each log file at PATH, which may\n"
+        "                               contain format specifications like FILE. The\n"
+        "                               copy isn't written along with FILE, but made\n"
+        "                               from it in the background: every\n"
+        "                               +replica-interval seconds the new data is\n"
+        "                               appended with copy_file_range(), and when FILE\n"
+        "                               is closed PATH becomes a reflink of it, so that\n"
+        "                               both share their blocks on file systems like\n"
+        "                               XFS and btrfs. Elsewhere the rest is copied.\n"
+        "    +replica-interval=SECONDS  0 for only when FILE is closed. Default: 60\n"
+        "    +fallback=drop|spill|PATH  Where the data goes while the output can't be\n"
+        "                               opened or written. Such an output is tried\n"
+        "                               again after a delay that doubles with every\n"
+        "                               failed attempt, from 0.1 up to 60 seconds.\n"
+        "                               drop discards the data, spill keeps up to\n"
+        "                               +spill-size bytes in memory and writes them\n"
+        "                               once the output works again, and anything\n"
+        "                               else is a file the data is appended to\n"
+        "                               instead. Use ./drop for a file named drop.\n"
+        "                               Failures are reported at most every 10\n"
+        "                               seconds. Default: drop\n"
+        "    +spill-size=SIZE           Bytes kept by +fallback=spill, the rest is\n"
+        "                               dropped. Default: 16M\n"
+        "    +columnar                  When the file is rotated to a new name, convert\n"
+        "                               the old file to a columnar archive named\n"
+        "                               FILE.plc in the background. Lines are parsed as\n"
+        "                               JSON objects or logfmt and each field is\n"
+        "                               stored in its own column and lines without\n"
+        "                               fields in _raw. _time holds the timestamp at\n"
+        "                               the start of the line, or else the one of its\n"
+        "                               first ts, time or @timestamp field. The log\n"
+        "                               file itself is kept. Use --archive to query\n"
+        "                               archives.\n"
+        "    +index[=SIZE]              Write an index of timestamps and byte offsets\n"
+        "                               of lines to FILE.idx next to the log file. An\n"
+        "                               entry is added at least every SIZE bytes and\n"
+        "                               every +index-interval seconds. The time of an\n"
+        "                               entry is the timestamp of its line or, if it\n"
+        "                               has none, when it was received. Use --lookup to\n"
+        "                               find the lines of a time range. SIZE may have\n"
+        "                               a K, M or G suffix. Default: 1M\n"
+        "    +index-interval=SECONDS    Default: 60\n"
+        "\n"
+        "If there is only one output file, it is not a ring, has no filtering\n"
+        "output options and no metrics are collected splice() is used to transfer\n"
+        "data without user space copies. +index, +bloom, +fields, +crc, +chain\n"
+        "and +manifest don't count as filtering, they get a copy of the data made\n"
+        "by tee() on a separate thread, which lags behind by at most 1 MB.\n"
         "\n"
         "\n"
         "OPTIONS:\n"
@@ -85,11 +788,93 @@ static void usage(int argc, char *argv[]) {
         "                               ended.\n"
         "    -f, --fifo=FILE            Read input from FILE, create FILE as fifo if\n"
         "                               not exists and re-open file when at end.\n"
+        "    -I, --input=FILE           Read input from FILE instead of stdin. May be\n"
+        "                               given multiple times, in which case the lines\n"
+        "                               of all inputs are merged in the order of their\n"
+        "                               timestamps. Use - for stdin.\n"
+        "    -w, --merge-window=MS      Every input is expected to be ordered except\n"
+        "                               for jitter up to MS milliseconds. Lines are\n"
+        "                               held back at most about this long to be\n"
+        "                               merged in order. Default: 500\n"
         "    -q, --quiet                Don't print error messages.\n"
         "    -e, --exit-on-write-error  Exit if writing to any output fails or when\n"
-        "                               opening log files on log rotate fails.\n"
+        "                               opening log files on log rotate fails,\n"
+        "                               instead of using the +fallback of the output.\n"
         "    -S, --no-splice            Don't try to use splice() system call in case\n"
         "                               there is only one output file.\n"
+        "    -D, --dump-ring=FILE       Write the contents of the ring file FILE to\n"
+        "                               standard output and exit.\n"
+        "    -d, --decode-templates=FILE\n"
+        "                               Write the original text of FILE, which was\n"
+        "                               written using +templates, to standard output\n"
+        "                               and exit. Use - for stdin.\n"
+        "    -M, --manifest=FILE        Write the last record of every log file of the\n"
+        "                               manifest FILE (see +manifest) to standard\n"
+        "                               output and exit.\n"
+        "    -L, --lookup=FILE          Print the start and end byte offsets of the\n"
+        "                               part of the log file FILE that holds the lines\n"
+        "                               from --from to --to, using the index written\n"
+        "                               by +index, and exit.\n"
+        "    -F, --from=TIMESTAMP       Start of the time range of --lookup, as ISO 8601\n"
+        "                               date and time or UNIX timestamp. Without time\n"
+        "                               zone UTC is assumed. Default: start of FILE\n"
+        "    -T, --to=TIMESTAMP         End of the time range of --lookup, inclusive.\n"
+        "                               Default: end of FILE\n"
+        "    -s, --search=WORD          Write all lines of the log files given as\n"
+        "                               arguments that contain WORD, not as part of a\n"
+        "                               longer word, to standard output and exit. If a\n"
+        "                               file has Bloom filters (see +bloom) only blocks\n"
+        "                               that may contain WORD are read. Exits with 1 if\n"
+        "                               nothing was found.\n"
+        "    -W, --where=KEY=VALUE      Write all lines of the log files given as\n"
+        "                               arguments that have a field KEY with the value\n"
+        "                               VALUE to standard output and exit. Can be\n"
+        "                               given several times, then lines need to match\n"
+        "                               all of them. If a file has a field index (see\n"
+        "                               +fields) only blocks that may contain the\n"
+        "                               values are read. Exits with 1 if nothing was\n"
+        "                               found.\n"
+        "    -C, --verify               Check the log files given as arguments against\n"
+        "                               their checksums written by +crc and digests\n"
+        "                               written by +chain, report the corrupted blocks\n"
+        "                               and exit. The chains of the files have to be\n"
+        "                               linked in the given order. Prints the chain\n"
+        "                               head of each good file. Exits with 1 if a\n"
+        "                               block is corrupted and 2 on errors.\n"
+        "    -E, --decrypt=KEYFILE      Write the plaintext of the files given as\n"
+        "                               arguments, which were written using +encrypt\n"
+        "                               with the key in KEYFILE, to standard output and\n"
+        "                               exit. Use - for stdin. Only authentic data is\n"
+        "                               written. Exits with 1 if a file was modified,\n"
+        "                               lacks its final frame, i.e. was truncated or is\n"
+        "                               still written, or on errors.\n"
+        "    -A, --archive=FILE         Write the columns of the columnar archive FILE\n"
+        "                               with their encodings and statistics to\n"
+        "                               standard output and exit.\n"
+        "    -B, --count-by=COLUMN      Together with --archive: write the number of\n"
+        "                               rows per value of COLUMN, most frequent first,\n"
+        "                               instead. Only the data of COLUMN is read.\n"
+        "    -m, --metrics=FILE         Write metrics about the processed data to FILE in\n"
+        "                               the Prometheus text format. Counted are input\n"
+        "                               bytes and lines, input lines by log level (the\n"
+        "                               first level name like ERROR or warn in the\n"
+        "                               first 256 bytes of a line), lines matching\n"
+        "                               --count patterns and bytes and lines passed to\n"
+        "                               each output. For each counter the total and the\n"
+        "                               increase during the last interval is written.\n"
+        "                               FILE is atomically replaced at the end of each\n"
+        "                               interval.\n"
+        "    -i, --metrics-interval=SECONDS\n"
+        "                               Length of the metrics interval. Default: 60\n"
+        "    -c, --count=NAME=REGEX     Count input lines matching the POSIX extended\n"
+        "                               regular expression REGEX as NAME in the\n"
+        "                               metrics. May be given multiple times.\n"
+        "    -j, --threads=N            Apply the line filtering output options\n"
+        "                               (+strip-ansi, +sanitize) on N threads. Large\n"
+        "                               reads are split into blocks at line ends and\n"
+        "                               put back together in order. This is only done\n"
+        "                               when filtering is slow enough to be worth it.\n"
+        "                               Default: 1\n"
         "\n"
         "\n"
         "EXAMPLE:\n"
@@ -108,14 +893,101 @@ static void usage(int argc, char *argv[]) {
     );
 }
 
+// runs pipelog() on the given input files, merging them if there is more than one
+static int pipelog_inputs(const char *inputs[], size_t input_count, unsigned int merge_window,
+                          const struct Pipelog_Output output[], size_t count,
+                          const struct Pipelog_Options *options, unsigned int flags) {
+    int fds[input_count];
+    int status = PIPELOG_SUCCESS;
+    size_t index = 0;
+
+    for (; index < input_count; ++ index) {
+        if (strcmp(inputs[index], "-") == 0) {
+            fds[index] = STDIN_FILENO;
+        } else {
+            fds[index] = open(inputs[index], O_RDONLY | O_CLOEXEC);
+            if (fds[index] < 0) {
+                const int errnum = errno;
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: opening input \"%s\": %s\n", inputs[index], strerror(errnum));
+                }
+                status = errnum == EINTR ? PIPELOG_INTERRUPTED : PIPELOG_ERROR;
+                goto cleanup;
+            }
+        }
+    }
+
+    if (input_count == 1) {
+        status = pipelog(fds[0], output, count, options, flags);
+        goto cleanup;
+    }
+
+    struct Pipelog_Merge merge;
+    int readfd = -1;
+    if (merge_start(&merge, fds, input_count, merge_window, &readfd) != 0) {
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: starting merge of inputs: %s\n", strerror(errno));
+        }
+        // fds are already closed
+        return PIPELOG_ERROR;
+    }
+
+    status = pipelog(readfd, output, count, options, flags);
+
+    // unblocks the merge thread if pipelog() stopped early
+    close(readfd);
+
+    if (merge_stop(&merge) != 0) {
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: merging inputs: %s\n", strerror(errno));
+        }
+        if (status == PIPELOG_SUCCESS) {
+            status = PIPELOG_ERROR;
+        }
+    }
+
+    return status;
+
+cleanup:
+    for (size_t closeind = 0; closeind < index; ++ closeind) {
+        if (fds[closeind] != STDIN_FILENO) {
+            close(fds[closeind]);
+        }
+    }
+
+    return status;
+}
+
 int main(int argc, char *argv[]) {
     int flags = PIPELOG_NONE;
     int longind = 0;
     const char *pidfile = NULL;
     const char *fifo = NULL;
+    const char *archive = NULL;
+    const char *count_by = NULL;
+    const char *lookup = NULL;
+    const char *search = NULL;
+    bool verify = false;
+    const char *decrypt = NULL;
+    struct Pipelog_Field where[argc];
+    size_t where_count = 0;
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+    const char *inputs[argc];
+    size_t input_count = 0;
+    unsigned int merge_window = PIPELOG_MERGE_WINDOW;
+    // there can't be more counters than arguments
+    struct Pipelog_Counter counters[argc];
+    struct Pipelog_Options pipelog_options = {
+        .metrics          = NULL,
+        .metrics_interval = PIPELOG_METRICS_INTERVAL,
+        .counters         = counters,
+        .counter_count    = 0,
+        .threads          = 1,
+    };
 
     for (;;) {
-        int opt = getopt_long(argc, argv, "hvpqeS", options, &longind);
+        int opt = getopt_long(argc, argv, "hvp:f:qeSD:d:M:CE:A:B:L:F:T:s:W:m:i:c:j:I:w:", options, &longind);
 
         if (opt == -1) {
             break;
@@ -155,6 +1027,124 @@ int main(int argc, char *argv[]) {
                 fifo = optarg;
                 break;
 
+            case 'D':
+                return dump_ring(optarg);
+
+            case 'd':
+                return decode_templates_file(optarg);
+
+            case 'M':
+                return show_manifest(optarg);
+
+            case 'C':
+                verify = true;
+                break;
+
+            case 'E':
+                decrypt = optarg;
+                break;
+
+            case 'A':
+                archive = optarg;
+                break;
+
+            case 'B':
+                count_by = optarg;
+                break;
+
+            case 'L':
+                lookup = optarg;
+                break;
+
+            case 's':
+                search = optarg;
+                break;
+
+            case 'W':
+            {
+                const char *equals = strchr(optarg, '=');
+                if (equals == NULL || equals == optarg) {
+                    fprintf(stderr, "*** error: illegal value for --where: %s\n", optarg);
+                    return 2;
+                }
+                where[where_count ++] = (struct Pipelog_Field){
+                    .key        = optarg,
+                    .key_size   = equals - optarg,
+                    .value      = equals + 1,
+                    .value_size = strlen(equals + 1),
+                };
+                break;
+            }
+
+            case 'F':
+                if (parse_time(optarg, &from) != 0) {
+                    fprintf(stderr, "*** error: illegal value for --from: %s\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'T':
+                if (parse_time(optarg, &to) != 0) {
+                    fprintf(stderr, "*** error: illegal value for --to: %s\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'm':
+                pipelog_options.metrics = optarg;
+                break;
+
+            case 'i':
+            {
+                size_t interval = 0;
+                if (parse_size(optarg, &interval) != 0 || interval == 0 || interval > UINT_MAX) {
+                    fprintf(stderr, "*** error: illegal value for --metrics-interval: %s\n", optarg);
+                    return 1;
+                }
+                pipelog_options.metrics_interval = interval;
+                break;
+            }
+            case 'c':
+            {
+                char *pattern = strchr(optarg, '=');
+                if (pattern == NULL || pattern == optarg || pattern[1] == 0) {
+                    fprintf(stderr, "*** error: --count needs a value of the form NAME=REGEX: %s\n", optarg);
+                    return 1;
+                }
+                *pattern = 0;
+                counters[pipelog_options.counter_count ++] = (struct Pipelog_Counter){
+                    .name    = optarg,
+                    .pattern = pattern + 1,
+                };
+                break;
+            }
+
+            case 'j':
+            {
+                size_t threads = 0;
+                if (parse_size(optarg, &threads) != 0 || threads == 0 || threads > PIPELOG_MAX_THREADS) {
+                    fprintf(stderr, "*** error: illegal value for --threads: %s\n", optarg);
+                    return 1;
+                }
+                pipelog_options.threads = threads;
+                break;
+            }
+
+            case 'I':
+                inputs[input_count ++] = optarg;
+                break;
+
+            case 'w':
+            {
+                size_t window = 0;
+                if (parse_size(optarg, &window) != 0 || window > UINT_MAX) {
+                    fprintf(stderr, "*** error: illegal value for --merge-window: %s\n", optarg);
+                    return 1;
+                }
+                merge_window = window;
+                break;
+            }
+
             case '?':
                 short_usage(argc, argv);
                 return 1;
@@ -164,6 +1154,59 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (archive != NULL) {
+        return query_archive(archive, count_by);
+    }
+
+    if (lookup != NULL) {
+        return lookup_range(lookup, from, to);
+    }
+
+    if (count_by != NULL) {
+        fprintf(stderr, "*** error: --count-by needs --archive\n");
+        short_usage(argc, argv);
+        return 1;
+    }
+
+    if (input_count > 0 && fifo != NULL) {
+        fprintf(stderr, "*** error: --input and --fifo are mutually exclusive\n");
+        short_usage(argc, argv);
+        return 1;
+    }
+
+    if (verify) {
+        if (argc == optind) {
+            fprintf(stderr, "*** error: --verify needs files to check\n");
+            short_usage(argc, argv);
+            return 2;
+        }
+        return verify_files(argv + optind, argc - optind);
+    }
+
+    if (decrypt != NULL) {
+        if (argc == optind) {
+            fprintf(stderr, "*** error: --decrypt needs files to decrypt\n");
+            short_usage(argc, argv);
+            return 1;
+        }
+        return decrypt_files(decrypt, argv + optind, argc - optind);
+    }
+
+    if (search != NULL && where_count > 0) {
+        fprintf(stderr, "*** error: --search and --where are mutually exclusive\n");
+        short_usage(argc, argv);
+        return 2;
+    }
+
+    if (search != NULL || where_count > 0) {
+        if (argc == optind) {
+            fprintf(stderr, "*** error: %s needs files to search\n", search != NULL ? "--search" : "--where");
+            short_usage(argc, argv);
+            return 2;
+        }
+        return search_files(search, where, where_count, argv + optind, argc - optind);
+    }
+
     if (argc == optind) {
         fprintf(stderr, "*** error: illegal number of arguments\n");
         short_usage(argc, argv);
@@ -205,13 +1248,86 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
         }
+        while (index + 1 < argc && argv[index + 1][0] == '+') {
+            ++ index;
+        }
         ++ count;
     }
 
+    struct Pipelog_Output *output = calloc(count, sizeof(struct Pipelog_Output));
+    if (output == NULL) {
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: allocating memory: %s\n", strerror(errno));
+        }
+        return 1;
+    }
+
+    const struct Pipelog_Capture_Options capture_defaults = {
+        .trigger      = NULL,
+        .before_lines = PIPELOG_CAPTURE_BEFORE_LINES,
+        .before_bytes = PIPELOG_CAPTURE_BEFORE_BYTES,
+        .after_lines  = PIPELOG_CAPTURE_AFTER_LINES,
+    };
+
+    size_t index = 0;
+    for (int argind = optind; argind < argc; ++ argind, ++ index) {
+        const char *arg = argv[argind];
+        if (strcmp(arg, "STDOUT") == 0 || strcmp(arg, "-") == 0) {
+            output[index] = (struct Pipelog_Output){
+                .fd       = STDOUT_FILENO,
+                .filename = NULL,
+                .link     = NULL,
+                .flags    = PIPELOG_OUTPUT_NONE,
+                .capture  = capture_defaults,
+                .spill_size = PIPELOG_SPILL_SIZE,
+            };
+        } else if (strcmp(arg, "STDERR") == 0) {
+            output[index] = (struct Pipelog_Output){
+                .fd       = STDERR_FILENO,
+                .filename = NULL,
+                .link     = NULL,
+                .flags    = PIPELOG_OUTPUT_NONE,
+                .capture  = capture_defaults,
+                .spill_size = PIPELOG_SPILL_SIZE,
+            };
+        } else {
+            const char *link = NULL;
+            if (argind + 1 < argc && argv[argind + 1][0] == '@') {
+                ++ argind;
+                link = argv[argind] + 1;
+            }
+            output[index] = (struct Pipelog_Output){
+                .fd       = -1,
+                .filename = arg,
+                .link     = link,
+                .flags    = route_has_fields(arg) ? PIPELOG_OUTPUT_ROUTE : PIPELOG_OUTPUT_NONE,
+                .capture  = capture_defaults,
+                .index_bytes    = PIPELOG_INDEX_BYTES,
+                .index_interval = PIPELOG_INDEX_INTERVAL,
+                .bloom_block_size = PIPELOG_BLOOM_BLOCK_SIZE,
+                .field_block_size = PIPELOG_FIELD_INDEX_BLOCK_SIZE,
+                .checksum_block_size = PIPELOG_CHECKSUM_BLOCK_SIZE,
+                .chain_block_size    = PIPELOG_CHAIN_BLOCK_SIZE,
+                .replica_interval    = PIPELOG_REPLICA_INTERVAL,
+                .spill_size          = PIPELOG_SPILL_SIZE,
+            };
+        }
+
+        while (argind + 1 < argc && argv[argind + 1][0] == '+') {
+            ++ argind;
+            if (parse_output_option(argv[argind] + 1, &output[index]) != 0) {
+                short_usage(argc, argv);
+                free(output);
+                return 1;
+            }
+        }
+    }
+
     if (signal(SIGINT, handle_sigint) == SIG_ERR) {
         if (!(flags & PIPELOG_QUIET)) {
             fprintf(stderr, "*** error: signal(SIGINT, handle_sigint): %s\n", strerror(errno));
         }
+        free(output);
         return 1;
     }
 
@@ -219,6 +1335,7 @@ int main(int argc, char *argv[]) {
         if (!(flags & PIPELOG_QUIET)) {
             fprintf(stderr, "*** error: signal(SIGTERM, handle_sigint): %s\n", strerror(errno));
         }
+        free(output);
         return 1;
     }
 
@@ -227,6 +1344,7 @@ int main(int argc, char *argv[]) {
             if (!(flags & PIPELOG_QUIET)) {
                 fprintf(stderr, "*** error: creating parent directories of pidfile \"%s\": %s\n", pidfile, strerror(errno));
             }
+            free(output);
             return 1;
         }
 
@@ -235,6 +1353,7 @@ int main(int argc, char *argv[]) {
             if (!(flags & PIPELOG_QUIET)) {
                 fprintf(stderr, "*** error: opening pidfile \"%s\": %s\n", pidfile, strerror(errno));
             }
+            free(output);
             return 1;
         }
         const pid_t pid = getpid();
@@ -243,47 +1362,12 @@ int main(int argc, char *argv[]) {
         fclose(fp);
     }
 
-    struct Pipelog_Output *output = calloc(count, sizeof(struct Pipelog_Output));
-    if (output == NULL) {
-        if (!(flags & PIPELOG_QUIET)) {
-            fprintf(stderr, "*** error: allocating memory: %s\n", strerror(errno));
-        }
-        return 1;
-    }
-
-    for (size_t index = 0; index < count; ++ index) {
-        const size_t argind = optind + index;
-        const char *arg = argv[argind];
-        if (strcmp(arg, "STDOUT") == 0 || strcmp(arg, "-") == 0) {
-            output[index] = (struct Pipelog_Output){
-                .fd       = STDOUT_FILENO,
-                .filename = NULL,
-                .link     = NULL,
-            };
-        } else if (strcmp(arg, "STDERR") == 0) {
-            output[index] = (struct Pipelog_Output){
-                .fd       = STDERR_FILENO,
-                .filename = NULL,
-                .link     = NULL,
-            };
-        } else {
-            const char *link = NULL;
-            if (argind + 1 < argc && argv[argind + 1][0] == '@') {
-                link = argv[argind + 1] + 1;
-                ++ optind;
-            }
-            output[index] = (struct Pipelog_Output){
-                .fd       = -1,
-                .filename = arg,
-                .link     = link,
-            };
-        }
-    }
-
     int status = PIPELOG_SUCCESS;
 
-    if (fifo == NULL) {
-        status = pipelog(STDIN_FILENO, output, count, flags);
+    if (input_count > 0) {
+        status = pipelog_inputs(inputs, input_count, merge_window, output, count, &pipelog_options, flags);
+    } else if (fifo == NULL) {
+        status = pipelog(STDIN_FILENO, output, count, &pipelog_options, flags);
     } else {
         if (make_parent_dirs(fifo, 0755) != 0) {
             const int errnum = errno;
@@ -336,7 +1420,7 @@ int main(int argc, char *argv[]) {
                 break;
             }
 
-            status = pipelog(fd, output, count, flags);
+            status = pipelog(fd, output, count, &pipelog_options, flags);
 
             if (close(fd) != 0) {
                 const int errnum = errno;
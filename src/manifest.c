@@ -0,0 +1,489 @@
+#include "manifest.h"
+#include "scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// longest formatted record without the filename
+#define MANIFEST_RECORD_SIZE 128
+
+static const char *const STATE_NAMES[] = {
+    [PIPELOG_MANIFEST_ACTIVE]   = "active",
+    [PIPELOG_MANIFEST_CLOSED]   = "closed",
+    [PIPELOG_MANIFEST_ARCHIVED] = "archived",
+};
+
+struct Manifest_Entry {
+    const char *line; //!< of the record in the manifest
+    size_t      size; //!< of the line without the newline
+    char       *filename;
+    size_t      position;
+    struct Pipelog_Manifest_Record record;
+};
+
+struct Manifest_Entries {
+    struct Manifest_Entry *items;
+    size_t count;
+    size_t capacity;
+};
+
+static void entries_free(struct Manifest_Entries *entries) {
+    for (size_t index = 0; index < entries->count; ++ index) {
+        free(entries->items[index].filename);
+    }
+    free(entries->items);
+    entries->items    = NULL;
+    entries->count    = 0;
+    entries->capacity = 0;
+}
+
+static bool parse_time_field(const char *field, const char *end, int64_t *value) {
+    if (end - field == 1 && *field == '-') {
+        *value = -1;
+        return true;
+    }
+
+    char *endptr = NULL;
+    const long long number = strtoll(field, &endptr, 10);
+    if (endptr != end || endptr == field) {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+static bool parse_size_field(const char *field, const char *end, uint64_t *value) {
+    char *endptr = NULL;
+    const unsigned long long number = strtoull(field, &endptr, 10);
+    if (endptr != end || endptr == field || *field == '-') {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+static char *unescape(const char *str, size_t size) {
+    char *buf = malloc(size + 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    size_t len = 0;
+    for (size_t index = 0; index < size; ++ index) {
+        char ch = str[index];
+        if (ch == '\\' && index + 1 < size) {
+            ++ index;
+            switch (str[index]) {
+                case 't': ch = '\t'; break;
+                case 'n': ch = '\n'; break;
+                default:  ch = str[index]; break;
+            }
+        }
+        buf[len ++] = ch;
+    }
+    buf[len] = 0;
+
+    return buf;
+}
+
+// parses one line of the manifest, returns false for comments and malformed lines
+static bool parse_record(const char *line, size_t size, struct Manifest_Entry *entry) {
+    const char *fields[6];
+    const char *ends[6];
+    const char *ptr = line;
+    const char *end = line + size;
+
+    if (size == 0 || *line == '#') {
+        return false;
+    }
+
+    for (size_t index = 0; index < 6; ++ index) {
+        fields[index] = ptr;
+        if (index == 5) {
+            ends[index] = end;
+        } else {
+            const char *tab = memchr(ptr, '\t', end - ptr);
+            if (tab == NULL) {
+                return false;
+            }
+            ends[index] = tab;
+            ptr = tab + 1;
+        }
+    }
+
+    bool known_state = false;
+    for (size_t index = 0; index < sizeof(STATE_NAMES) / sizeof(STATE_NAMES[0]); ++ index) {
+        const size_t len = strlen(STATE_NAMES[index]);
+        if ((size_t)(ends[0] - fields[0]) == len && memcmp(fields[0], STATE_NAMES[index], len) == 0) {
+            known_state = true;
+            break;
+        }
+    }
+
+    // strto*() stop at the tab, the fields are not NUL terminated
+    if (!known_state ||
+        !parse_time_field(fields[1], ends[1], &entry->record.first) ||
+        !parse_time_field(fields[2], ends[2], &entry->record.last) ||
+        !parse_size_field(fields[3], ends[3], &entry->record.bytes) ||
+        !parse_size_field(fields[4], ends[4], &entry->record.lines) ||
+        fields[5] == ends[5]) {
+        return false;
+    }
+
+    entry->line     = line;
+    entry->size     = size;
+    entry->filename = unescape(fields[5], ends[5] - fields[5]);
+
+    return true;
+}
+
+// reads all well formed records of the mapped manifest
+static int read_entries(const struct Pipelog_Mapped_File *file, struct Manifest_Entries *entries) {
+    size_t offset = 0;
+
+    while (offset < file->size) {
+        const char *line = file->data + offset;
+        const char *newline = memchr(line, '\n', file->size - offset);
+        if (newline == NULL) {
+            // an incomplete record of an interrupted write
+            break;
+        }
+        offset = newline - file->data + 1;
+
+        struct Manifest_Entry entry;
+        if (!parse_record(line, newline - line, &entry)) {
+            continue;
+        }
+
+        if (entry.filename == NULL) {
+            return -1;
+        }
+
+        if (entries->count == entries->capacity) {
+            const size_t capacity = entries->capacity ? entries->capacity * 2 : 64;
+            struct Manifest_Entry *items = realloc(entries->items, capacity * sizeof(struct Manifest_Entry));
+            if (items == NULL) {
+                free(entry.filename);
+                return -1;
+            }
+            entries->items    = items;
+            entries->capacity = capacity;
+        }
+
+        entry.position = entries->count;
+        entries->items[entries->count ++] = entry;
+    }
+
+    return 0;
+}
+
+// finds the last record of filename, returns false if there is none
+static bool find_last_record(const char *path, const char *filename, struct Pipelog_Manifest_Record *record) {
+    struct Pipelog_Mapped_File file;
+    struct Manifest_Entries entries = { NULL, 0, 0 };
+    bool found = false;
+
+    if (map_file(&file, path) != 0) {
+        return false;
+    }
+
+    if (read_entries(&file, &entries) == 0) {
+        for (size_t index = entries.count; index > 0; -- index) {
+            const struct Manifest_Entry *entry = &entries.items[index - 1];
+            if (strcmp(entry->filename, filename) == 0) {
+                *record = entry->record;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    entries_free(&entries);
+    unmap_file(&file);
+
+    return found;
+}
+
+static int count_lines(const char *filename, uint64_t size, uint64_t *lines) {
+    struct Pipelog_Mapped_File file;
+
+    if (map_file(&file, filename) != 0) {
+        return -1;
+    }
+
+    uint64_t count = 0;
+    const size_t end = file.size < size ? file.size : size;
+    const char *ptr = file.data;
+    const char *data_end = file.data + end;
+    while (ptr < data_end) {
+        const char *newline = memchr(ptr, '\n', data_end - ptr);
+        if (newline == NULL) {
+            break;
+        }
+        ++ count;
+        ptr = newline + 1;
+    }
+
+    unmap_file(&file);
+    *lines = count;
+
+    return 0;
+}
+
+void manifest_init(struct Pipelog_Manifest *manifest) {
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+int manifest_append(const char *path, enum Pipelog_Manifest_State state, const char *filename, const struct Pipelog_Manifest_Record *record) {
+    const size_t header_size = sizeof(PIPELOG_MANIFEST_HEADER) - 1;
+    const size_t filename_size = strlen(filename);
+    char first[24] = "-";
+    char last[24] = "-";
+    struct stat meta;
+    int status = -1;
+
+    // escaping at most doubles the filename
+    char *buf = malloc(header_size + MANIFEST_RECORD_SIZE + filename_size * 2 + 1);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    int fd = open(path, O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT) {
+        if (make_parent_dirs(path, 0755) != 0) {
+            goto cleanup;
+        }
+        fd = open(path, O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0644);
+    }
+
+    if (fd < 0 || fstat(fd, &meta) != 0) {
+        goto cleanup;
+    }
+
+    size_t size = 0;
+    if (meta.st_size == 0) {
+        memcpy(buf, PIPELOG_MANIFEST_HEADER, header_size);
+        size = header_size;
+    }
+
+    if (record->first >= 0) {
+        snprintf(first, sizeof(first), "%" PRId64, record->first);
+    }
+
+    if (record->last >= 0) {
+        snprintf(last, sizeof(last), "%" PRId64, record->last);
+    }
+
+    size += snprintf(buf + size, MANIFEST_RECORD_SIZE, "%s\t%s\t%s\t%" PRIu64 "\t%" PRIu64 "\t",
+        STATE_NAMES[state], first, last, record->bytes, record->lines);
+
+    for (const char *ptr = filename; *ptr; ++ ptr) {
+        switch (*ptr) {
+            case '\\': buf[size ++] = '\\'; buf[size ++] = '\\'; break;
+            case '\t': buf[size ++] = '\\'; buf[size ++] = 't';  break;
+            case '\n': buf[size ++] = '\\'; buf[size ++] = 'n';  break;
+            default:   buf[size ++] = *ptr; break;
+        }
+    }
+    buf[size ++] = '\n';
+
+    // a single write so concurrent readers never see half a record
+    const ssize_t count = write(fd, buf, size);
+    if (count < 0) {
+        goto cleanup;
+    }
+
+    if ((size_t)count != size) {
+        errno = EIO;
+        goto cleanup;
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(buf);
+        errno = errnum;
+    }
+
+    return status;
+}
+
+int manifest_open(struct Pipelog_Manifest *manifest, const char *path, const char *filename, uint64_t size) {
+    struct Pipelog_Manifest_Record record = {
+        .first = -1,
+        .last  = -1,
+        .bytes = size,
+        .lines = 0,
+    };
+
+    if (manifest->open) {
+        manifest_close(manifest);
+    }
+    manifest->path = NULL;
+
+    char *copy = strdup(filename);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    if (size > 0) {
+        struct Pipelog_Manifest_Record previous;
+        if (find_last_record(path, filename, &previous) && previous.bytes == size) {
+            record = previous;
+        } else if (count_lines(filename, size, &record.lines) != 0) {
+            const int errnum = errno;
+            free(copy);
+            errno = errnum;
+            return -1;
+        }
+    }
+
+    if (manifest_append(path, PIPELOG_MANIFEST_ACTIVE, filename, &record) != 0) {
+        const int errnum = errno;
+        free(copy);
+        errno = errnum;
+        return -1;
+    }
+
+    manifest->path     = path;
+    manifest->filename = copy;
+    manifest->record   = record;
+    manifest->open     = true;
+
+    return 0;
+}
+
+void manifest_write(struct Pipelog_Manifest *manifest, const char *data, size_t size, int64_t now) {
+    if (!manifest->open || size == 0) {
+        return;
+    }
+
+    const char *ptr = data;
+    const char *end = data + size;
+    while (ptr < end) {
+        const char *newline = memchr(ptr, '\n', end - ptr);
+        if (newline == NULL) {
+            break;
+        }
+        ++ manifest->record.lines;
+        ptr = newline + 1;
+    }
+
+    if (manifest->record.first < 0) {
+        manifest->record.first = now;
+    }
+    manifest->record.last   = now;
+    manifest->record.bytes += size;
+}
+
+int manifest_close(struct Pipelog_Manifest *manifest) {
+    if (!manifest->open) {
+        return 0;
+    }
+
+    const int status = manifest_append(manifest->path, PIPELOG_MANIFEST_CLOSED, manifest->filename, &manifest->record);
+    const int errnum = errno;
+
+    free(manifest->filename);
+    manifest->filename = NULL;
+    manifest->open     = false;
+    errno = errnum;
+
+    return status;
+}
+
+static int compare_by_filename(const void *lhs, const void *rhs) {
+    const struct Manifest_Entry *left = lhs;
+    const struct Manifest_Entry *right = rhs;
+    const int cmp = strcmp(left->filename, right->filename);
+
+    if (cmp != 0) {
+        return cmp;
+    }
+
+    return left->position < right->position ? -1 : left->position > right->position ? 1 : 0;
+}
+
+static int compare_by_position(const void *lhs, const void *rhs) {
+    const struct Manifest_Entry *left = lhs;
+    const struct Manifest_Entry *right = rhs;
+
+    return left->position < right->position ? -1 : left->position > right->position ? 1 : 0;
+}
+
+int manifest_dump(const char *path, int outfd) {
+    struct Pipelog_Mapped_File file;
+    struct Manifest_Entries entries = { NULL, 0, 0 };
+    struct Pipelog_Output_Buffer *out = NULL;
+    int status = -1;
+
+    if (map_file(&file, path) != 0) {
+        return -1;
+    }
+
+    out = malloc(sizeof(struct Pipelog_Output_Buffer));
+    if (out == NULL || read_entries(&file, &entries) != 0) {
+        goto cleanup;
+    }
+    out->fd   = outfd;
+    out->size = 0;
+
+    // keep the last record of each file, at the position of its first
+    qsort(entries.items, entries.count, sizeof(struct Manifest_Entry), compare_by_filename);
+
+    size_t count = 0;
+    for (size_t index = 0; index < entries.count;) {
+        size_t end = index + 1;
+        while (end < entries.count && strcmp(entries.items[end].filename, entries.items[index].filename) == 0) {
+            ++ end;
+        }
+
+        struct Manifest_Entry entry = entries.items[end - 1];
+        entry.position = entries.items[index].position;
+        for (size_t other = index; other < end; ++ other) {
+            if (other != end - 1) {
+                free(entries.items[other].filename);
+            }
+        }
+        entries.items[count ++] = entry;
+        index = end;
+    }
+    entries.count = count;
+
+    qsort(entries.items, entries.count, sizeof(struct Manifest_Entry), compare_by_position);
+
+    for (size_t index = 0; index < entries.count; ++ index) {
+        const struct Manifest_Entry *entry = &entries.items[index];
+        if (output_line(out, NULL, entry->line, entry->size) != 0) {
+            goto cleanup;
+        }
+    }
+
+    if (output_flush(out) != 0) {
+        goto cleanup;
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        entries_free(&entries);
+        free(out);
+        unmap_file(&file);
+        errno = errnum;
+    }
+
+    return status;
+}
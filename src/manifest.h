@@ -0,0 +1,91 @@
+#ifndef PIPELOG_MANIFEST_H
+#define PIPELOG_MANIFEST_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_MANIFEST_HEADER "#pipelog-manifest 1\n"
+
+enum Pipelog_Manifest_State {
+    PIPELOG_MANIFEST_ACTIVE,   //!< pipelog is writing the file
+    PIPELOG_MANIFEST_CLOSED,   //!< pipelog rotated away from the file or exited
+    PIPELOG_MANIFEST_ARCHIVED, //!< a columnar archive of the file was written
+};
+
+struct Pipelog_Manifest_Record {
+    int64_t  first; //!< arrival of the first data in milliseconds since the epoch, -1 if unknown
+    int64_t  last;  //!< arrival of the last data, -1 if unknown
+    uint64_t bytes;
+    uint64_t lines;
+};
+
+/**
+ * The manifest of an output is a text file with one record per line, which
+ * are only ever appended with a single write() each:
+ *
+ *     STATE TAB FIRST TAB LAST TAB BYTES TAB LINES TAB FILENAME
+ *
+ * STATE is active, closed or archived. FIRST and LAST are milliseconds since
+ * the epoch or "-". Backslash, tab and newline in FILENAME are escaped as
+ * "\\", "\t" and "\n". The last record of a file tells its current state.
+ * A record is appended when a file is opened and when it is closed. Lines
+ * starting with "#" are comments, the first is PIPELOG_MANIFEST_HEADER.
+ */
+struct Pipelog_Manifest {
+    const char *path;     //!< of the manifest
+    char       *filename; //!< of the log file
+    bool        open;
+    struct Pipelog_Manifest_Record record;
+};
+
+void manifest_init(struct Pipelog_Manifest *manifest);
+
+/**
+ * Start recording the log file filename, which has a size of size bytes.
+ * The numbers of an existing file are continued from its last record, or
+ * its lines are counted if there is none that matches its size.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int manifest_open(struct Pipelog_Manifest *manifest, const char *path, const char *filename, uint64_t size);
+
+/**
+ * Count data that was written to the log file at time now (milliseconds
+ * since the epoch).
+ */
+void manifest_write(struct Pipelog_Manifest *manifest, const char *data, size_t size, int64_t now);
+
+/**
+ * Append the closed record. manifest->record keeps the final numbers.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int manifest_close(struct Pipelog_Manifest *manifest);
+
+/**
+ * Append a record to the manifest path.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int manifest_append(const char *path, enum Pipelog_Manifest_State state, const char *filename, const struct Pipelog_Manifest_Record *record);
+
+/**
+ * Write the last record of every file of the manifest path to outfd, in
+ * the order the files first appear.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int manifest_dump(const char *path, int outfd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,379 @@
+#include "merge.h"
+#include "timestamp.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+struct Pipelog_Merge_Context {
+    struct Pipelog_Merge *merge;
+    size_t input;
+};
+
+static uint64_t monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int64_t realtime_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static bool record_less(const struct Pipelog_Merge_Record *lhs, const struct Pipelog_Merge_Record *rhs) {
+    return lhs->timestamp != rhs->timestamp ? lhs->timestamp < rhs->timestamp : lhs->sequence < rhs->sequence;
+}
+
+static int heap_push(struct Pipelog_Merge *merge, struct Pipelog_Merge_Record *record) {
+    if (merge->heap_size == merge->heap_capacity) {
+        const size_t capacity = merge->heap_capacity == 0 ? 256 : merge->heap_capacity * 2;
+        struct Pipelog_Merge_Record **heap = realloc(merge->heap, capacity * sizeof(*heap));
+        if (heap == NULL) {
+            return -1;
+        }
+        merge->heap = heap;
+        merge->heap_capacity = capacity;
+    }
+
+    struct Pipelog_Merge_Record **heap = merge->heap;
+    size_t index = merge->heap_size ++;
+    while (index > 0) {
+        const size_t parent = (index - 1) / 2;
+        if (!record_less(record, heap[parent])) {
+            break;
+        }
+        heap[index] = heap[parent];
+        index = parent;
+    }
+    heap[index] = record;
+    merge->buffered += record->size;
+
+    return 0;
+}
+
+static struct Pipelog_Merge_Record *heap_pop(struct Pipelog_Merge *merge) {
+    struct Pipelog_Merge_Record **heap = merge->heap;
+    struct Pipelog_Merge_Record *top = heap[0];
+    struct Pipelog_Merge_Record *last = heap[-- merge->heap_size];
+    const size_t size = merge->heap_size;
+
+    size_t index = 0;
+    for (;;) {
+        size_t child = index * 2 + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && record_less(heap[child + 1], heap[child])) {
+            ++ child;
+        }
+        if (!record_less(heap[child], last)) {
+            break;
+        }
+        heap[index] = heap[child];
+        index = child;
+    }
+    if (size > 0) {
+        heap[index] = last;
+    }
+    merge->buffered -= top->size;
+
+    return top;
+}
+
+static int push_line(void *context, const char *line, size_t size) {
+    struct Pipelog_Merge_Context *ctx = context;
+    struct Pipelog_Merge *merge = ctx->merge;
+    struct Pipelog_Merge_Input *input = &merge->inputs[ctx->input];
+    const bool newline = size > 0 && line[size - 1] == '\n';
+    int64_t timestamp;
+
+    if (parse_timestamp(line, size, &timestamp, NULL)) {
+        input->timestamp = timestamp;
+        if (!input->has_timestamp || timestamp > input->highest) {
+            input->highest = timestamp;
+        }
+        input->has_timestamp = true;
+    } else if (!input->has_timestamp && input->timestamp == 0) {
+        // nothing to inherit yet
+        input->timestamp = realtime_ns();
+    }
+
+    struct Pipelog_Merge_Record *record = malloc(sizeof(struct Pipelog_Merge_Record) + size + 1);
+    if (record == NULL) {
+        return -1;
+    }
+
+    record->timestamp = input->timestamp;
+    record->sequence  = merge->sequence ++;
+    record->arrival   = monotonic_ms();
+    record->size      = size + !newline;
+    memcpy(record->line, line, size);
+    if (!newline) {
+        // last line of an input without newline
+        record->line[size] = '\n';
+    }
+
+    if (heap_push(merge, record) != 0) {
+        free(record);
+        return -1;
+    }
+
+    return 0;
+}
+
+static bool record_ready(const struct Pipelog_Merge *merge, const struct Pipelog_Merge_Record *record, uint64_t now) {
+    if (merge->open_count == 0 || merge->buffered > PIPELOG_MERGE_MAX_BYTES || now >= record->arrival + merge->window) {
+        return true;
+    }
+
+    const int64_t window = (int64_t)merge->window * 1000000;
+    for (size_t index = 0; index < merge->input_count; ++ index) {
+        const struct Pipelog_Merge_Input *input = &merge->inputs[index];
+        if (!input->eof && (!input->has_timestamp || input->highest - window < record->timestamp)) {
+            // this input might still produce an earlier line
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int append_out(struct Pipelog_Merge *merge, const char *data, size_t size) {
+    if (reserve(&merge->out, &merge->out_capacity, merge->out_size + size) != 0) {
+        return -1;
+    }
+
+    memcpy(merge->out + merge->out_size, data, size);
+    merge->out_size += size;
+
+    return 0;
+}
+
+static int flush_out(struct Pipelog_Merge *merge) {
+    if (write_all(merge->writefd, merge->out, merge->out_size) != 0) {
+        return -1;
+    }
+    merge->out_size = 0;
+
+    return 0;
+}
+
+static int emit_ready(struct Pipelog_Merge *merge) {
+    const uint64_t now = monotonic_ms();
+
+    while (merge->heap_size > 0 && record_ready(merge, merge->heap[0], now)) {
+        struct Pipelog_Merge_Record *record = heap_pop(merge);
+        const int result = append_out(merge, record->line, record->size);
+        free(record);
+        if (result != 0) {
+            return -1;
+        }
+    }
+
+    return flush_out(merge);
+}
+
+static int read_input(struct Pipelog_Merge *merge, size_t index, char *buf, size_t bufsize) {
+    struct Pipelog_Merge_Input *input = &merge->inputs[index];
+    struct Pipelog_Merge_Context context = { merge, index };
+
+    const ssize_t rcount = read(input->fd, buf, bufsize);
+    if (rcount < 0) {
+        return errno == EINTR || errno == EAGAIN ? 0 : -1;
+    }
+
+    if (rcount == 0) {
+        input->eof = true;
+        -- merge->open_count;
+    }
+
+    return split_lines(&input->lines, buf, rcount, input->eof, push_line, &context);
+}
+
+static void *merge_thread(void *arg) {
+    struct Pipelog_Merge *merge = arg;
+    struct pollfd *pollfds = calloc(merge->input_count + 1, sizeof(struct pollfd));
+    size_t *polled = calloc(merge->input_count, sizeof(size_t));
+    char buf[BUFSIZ];
+
+    if (pollfds == NULL || polled == NULL) {
+        merge->errnum = errno;
+        goto cleanup;
+    }
+
+    for (;;) {
+        if (emit_ready(merge) != 0) {
+            merge->errnum = errno;
+            break;
+        }
+
+        if (merge->open_count == 0) {
+            break;
+        }
+
+        size_t pollcount = 0;
+        for (size_t index = 0; index < merge->input_count; ++ index) {
+            if (!merge->inputs[index].eof) {
+                pollfds[pollcount] = (struct pollfd){ merge->inputs[index].fd, POLLIN, 0 };
+                polled[pollcount] = index;
+                ++ pollcount;
+            }
+        }
+        pollfds[pollcount] = (struct pollfd){ merge->stopfd, POLLIN, 0 };
+
+        // wake up when the oldest line has to be passed on regardless
+        int timeout = -1;
+        if (merge->heap_size > 0) {
+            const uint64_t now = monotonic_ms();
+            const uint64_t deadline = merge->heap[0]->arrival + merge->window;
+            timeout = deadline > now ? (int)(deadline - now) : 0;
+        }
+
+        const int result = poll(pollfds, pollcount + 1, timeout);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            merge->errnum = errno;
+            break;
+        }
+
+        if (pollfds[pollcount].revents) {
+            break;
+        }
+
+        for (size_t pollind = 0; pollind < pollcount; ++ pollind) {
+            if (pollfds[pollind].revents && read_input(merge, polled[pollind], buf, sizeof(buf)) != 0) {
+                merge->errnum = errno;
+                goto cleanup;
+            }
+        }
+    }
+
+cleanup:
+    free(pollfds);
+    free(polled);
+
+    if (merge->errnum == EPIPE) {
+        // pipelog() stopped reading, that's not an error of merging
+        merge->errnum = 0;
+    }
+
+    // signals EOF to pipelog()
+    close(merge->writefd);
+    merge->writefd = -1;
+
+    return NULL;
+}
+
+int merge_start(struct Pipelog_Merge *merge, const int fds[], size_t count, unsigned int window, int *readfd) {
+    int pipefds[2] = { -1, -1 };
+    int errnum = 0;
+
+    memset(merge, 0, sizeof(*merge));
+    merge->writefd = -1;
+    merge->stopfd  = -1;
+    merge->window  = window;
+
+    merge->inputs = calloc(count, sizeof(struct Pipelog_Merge_Input));
+    if (merge->inputs == NULL) {
+        return -1;
+    }
+
+    for (size_t index = 0; index < count; ++ index) {
+        merge->inputs[index].fd = fds[index];
+    }
+    merge->input_count = count;
+    merge->open_count  = count;
+
+    merge->stopfd = eventfd(0, EFD_CLOEXEC);
+    if (merge->stopfd < 0) {
+        goto error;
+    }
+
+    if (pipe2(pipefds, O_CLOEXEC) != 0) {
+        goto error;
+    }
+    merge->writefd = pipefds[1];
+
+    // signals are handled by the main thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    errnum = pthread_create(&merge->thread, NULL, merge_thread, merge);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (errnum != 0) {
+        errno = errnum;
+        goto error;
+    }
+    merge->started = true;
+
+    *readfd = pipefds[0];
+
+    return 0;
+
+error:
+    errnum = errno;
+    if (pipefds[0] >= 0) {
+        close(pipefds[0]);
+    }
+    merge_stop(merge);
+    errno = errnum;
+
+    return -1;
+}
+
+int merge_stop(struct Pipelog_Merge *merge) {
+    if (merge->started) {
+        const uint64_t value = 1;
+        if (write(merge->stopfd, &value, sizeof(value)) != sizeof(value)) {
+            // the thread still stops at EOF
+        }
+        pthread_join(merge->thread, NULL);
+        merge->started = false;
+    }
+
+    if (merge->writefd >= 0) {
+        close(merge->writefd);
+        merge->writefd = -1;
+    }
+
+    if (merge->stopfd >= 0) {
+        close(merge->stopfd);
+        merge->stopfd = -1;
+    }
+
+    for (size_t index = 0; index < merge->input_count; ++ index) {
+        close(merge->inputs[index].fd);
+        lines_free(&merge->inputs[index].lines);
+    }
+
+    while (merge->heap_size > 0) {
+        free(heap_pop(merge));
+    }
+
+    free(merge->inputs);
+    free(merge->heap);
+    free(merge->out);
+
+    const int errnum = merge->errnum;
+    memset(merge, 0, sizeof(*merge));
+
+    if (errnum != 0) {
+        errno = errnum;
+        return -1;
+    }
+
+    return 0;
+}
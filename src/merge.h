@@ -0,0 +1,91 @@
+#ifndef PIPELOG_MERGE_H
+#define PIPELOG_MERGE_H
+#pragma once
+
+#include "pipelog.h"
+#include "lines.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_MERGE_WINDOW 500
+
+// hard limit of buffered data, independent of the window
+#define PIPELOG_MERGE_MAX_BYTES (16 * 1024 * 1024)
+
+struct Pipelog_Merge_Record {
+    int64_t  timestamp; //!< nanoseconds since the epoch
+    size_t   input;
+    uint64_t sequence;  //!< keeps lines with equal timestamps in arrival order
+    uint64_t arrival;   //!< monotonic milliseconds
+    size_t   size;
+    char     line[];
+};
+
+struct Pipelog_Merge_Input {
+    int     fd;
+    bool    eof;
+    bool    has_timestamp;
+    int64_t timestamp; //!< of the last line, inherited by lines without one
+    int64_t highest;   //!< highest timestamp seen
+    struct Pipelog_Lines lines;
+};
+
+struct Pipelog_Merge {
+    struct Pipelog_Merge_Input *inputs;
+    size_t input_count;
+    size_t open_count;
+
+    unsigned int window; //!< milliseconds
+    uint64_t sequence;
+
+    struct Pipelog_Merge_Record **heap;
+    size_t heap_size;
+    size_t heap_capacity;
+    size_t buffered; //!< bytes in the heap
+
+    char  *out;
+    size_t out_size;
+    size_t out_capacity;
+
+    int writefd; //!< pipe to pipelog()
+    int stopfd;  //!< eventfd to interrupt the merge thread
+    int errnum;  //!< error that ended the merge thread
+
+    pthread_t thread;
+    bool      started;
+};
+
+/**
+ * Start a thread that reads lines from all fds and writes them ordered by
+ * their timestamps into a pipe. Every input is expected to be ordered except
+ * for jitter up to window milliseconds. A line is passed on once every open
+ * input has advanced window milliseconds past its timestamp, or once it was
+ * held for window milliseconds of wall clock time, so memory and latency are
+ * bounded by the window. Lines without a timestamp get the timestamp of the
+ * line before them.
+ *
+ * fds are closed by merge_stop(). On success *readfd is set to the read end
+ * of the pipe, which the caller has to close.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int merge_start(struct Pipelog_Merge *merge, const int fds[], size_t count, unsigned int window, int *readfd);
+
+/**
+ * Stop the merge thread and free all resources.
+ *
+ * Returns 0 if merging finished without error, otherwise -1 and sets errno.
+ */
+int merge_stop(struct Pipelog_Merge *merge);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,353 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define LEVEL_SCAN_SIZE 256
+
+static const char *const LEVEL_NAMES[PIPELOG_LEVEL_COUNT] = {
+    [PIPELOG_LEVEL_NONE]     = "none",
+    [PIPELOG_LEVEL_TRACE]    = "trace",
+    [PIPELOG_LEVEL_DEBUG]    = "debug",
+    [PIPELOG_LEVEL_INFO]     = "info",
+    [PIPELOG_LEVEL_NOTICE]   = "notice",
+    [PIPELOG_LEVEL_WARNING]  = "warning",
+    [PIPELOG_LEVEL_ERROR]    = "error",
+    [PIPELOG_LEVEL_CRITICAL] = "critical",
+    [PIPELOG_LEVEL_FATAL]    = "fatal",
+    [PIPELOG_LEVEL_PANIC]    = "panic",
+};
+
+static const struct {
+    const char *name;
+    int level;
+} LEVEL_ALIASES[] = {
+    { "trace",    PIPELOG_LEVEL_TRACE    },
+    { "debug",    PIPELOG_LEVEL_DEBUG    },
+    { "info",     PIPELOG_LEVEL_INFO     },
+    { "notice",   PIPELOG_LEVEL_NOTICE   },
+    { "warn",     PIPELOG_LEVEL_WARNING  },
+    { "warning",  PIPELOG_LEVEL_WARNING  },
+    { "err",      PIPELOG_LEVEL_ERROR    },
+    { "error",    PIPELOG_LEVEL_ERROR    },
+    { "crit",     PIPELOG_LEVEL_CRITICAL },
+    { "critical", PIPELOG_LEVEL_CRITICAL },
+    { "fatal",    PIPELOG_LEVEL_FATAL    },
+    { "panic",    PIPELOG_LEVEL_PANIC    },
+};
+
+static inline bool is_alpha(char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+int detect_level(const char *line, size_t size) {
+    const size_t limit = size < LEVEL_SCAN_SIZE ? size : LEVEL_SCAN_SIZE;
+    size_t index = 0;
+
+    while (index < limit) {
+        while (index < limit && !is_alpha(line[index])) {
+            ++ index;
+        }
+
+        const size_t start = index;
+        while (index < limit && is_alpha(line[index])) {
+            ++ index;
+        }
+
+        const size_t len = index - start;
+        if (len >= 3 && len <= 8) {
+            for (size_t alias = 0; alias < sizeof(LEVEL_ALIASES) / sizeof(LEVEL_ALIASES[0]); ++ alias) {
+                const char *name = LEVEL_ALIASES[alias].name;
+                if (strncasecmp(line + start, name, len) == 0 && name[len] == 0) {
+                    return LEVEL_ALIASES[alias].level;
+                }
+            }
+        }
+    }
+
+    return PIPELOG_LEVEL_NONE;
+}
+
+static inline void metric_tick(struct Pipelog_Metric *metric) {
+    metric->last_interval = metric->total - metric->at_tick;
+    metric->at_tick = metric->total;
+}
+
+static void next_tick(struct Pipelog_Metrics *metrics, time_t now) {
+    metrics->next_tick = (now / metrics->interval + 1) * metrics->interval;
+}
+
+int metrics_init(struct Pipelog_Metrics *metrics, const struct Pipelog_Options *options, const struct Pipelog_Output output[], size_t output_count, char *errbuf, size_t errbuf_size) {
+    memset(metrics, 0, sizeof(*metrics));
+
+    metrics->filename      = options->metrics;
+    metrics->interval      = options->metrics_interval > 0 ? options->metrics_interval : PIPELOG_METRICS_INTERVAL;
+    metrics->counters      = options->counters;
+    metrics->output        = output;
+    metrics->output_count  = output_count;
+
+    metrics->patterns       = calloc(options->counter_count, sizeof(regex_t));
+    metrics->counter_values = calloc(options->counter_count, sizeof(struct Pipelog_Metric));
+    metrics->output_bytes   = calloc(output_count, sizeof(struct Pipelog_Metric));
+    metrics->output_lines   = calloc(output_count, sizeof(struct Pipelog_Metric));
+
+    if ((options->counter_count > 0 && (metrics->patterns == NULL || metrics->counter_values == NULL)) ||
+        (output_count > 0 && (metrics->output_bytes == NULL || metrics->output_lines == NULL))) {
+        const int errnum = errno;
+        snprintf(errbuf, errbuf_size, "%s", strerror(errnum));
+        metrics_free(metrics);
+        errno = errnum;
+        return -1;
+    }
+
+    for (; metrics->counter_count < options->counter_count; ++ metrics->counter_count) {
+        const struct Pipelog_Counter *counter = &options->counters[metrics->counter_count];
+        const int errcode = regcomp(&metrics->patterns[metrics->counter_count], counter->pattern, REG_EXTENDED | REG_NOSUB);
+        if (errcode != 0) {
+            char msg[256];
+            regerror(errcode, &metrics->patterns[metrics->counter_count], msg, sizeof(msg));
+            snprintf(errbuf, errbuf_size, "counter \"%s\": %s", counter->name, msg);
+            metrics_free(metrics);
+            errno = errcode == REG_ESPACE ? ENOMEM : EINVAL;
+            return -1;
+        }
+    }
+
+    next_tick(metrics, time(NULL));
+
+    return 0;
+}
+
+static int count_line(void *context, const char *line, size_t size) {
+    struct Pipelog_Metrics *metrics = context;
+    regmatch_t match = {
+        .rm_so = 0,
+        .rm_eo = size > 0 && line[size - 1] == '\n' ? size - 1 : size,
+    };
+
+    ++ metrics->input_lines.total;
+    ++ metrics->levels[detect_level(line, match.rm_eo)].total;
+
+    for (size_t index = 0; index < metrics->counter_count; ++ index) {
+        if (regexec(&metrics->patterns[index], line, 1, &match, REG_STARTEND) == 0) {
+            ++ metrics->counter_values[index].total;
+        }
+    }
+
+    return 0;
+}
+
+int metrics_input(struct Pipelog_Metrics *metrics, const char *data, size_t size, bool flush) {
+    metrics->input_bytes.total += size;
+
+    return split_lines(&metrics->pending, data, size, flush, count_line, metrics);
+}
+
+static size_t count_newlines(const char *data, size_t size) {
+    size_t count = 0;
+    const char *end = data + size;
+
+    while ((data = memchr(data, '\n', end - data)) != NULL) {
+        ++ count;
+        ++ data;
+    }
+
+    return count;
+}
+
+void metrics_output(struct Pipelog_Metrics *metrics, size_t index, const char *data, size_t size) {
+    metrics->output_bytes[index].total += size;
+    metrics->output_lines[index].total += count_newlines(data, size);
+}
+
+int metrics_timeout(const struct Pipelog_Metrics *metrics) {
+    const time_t now = time(NULL);
+
+    if (now >= metrics->next_tick) {
+        return 0;
+    }
+
+    const time_t seconds = metrics->next_tick - now;
+
+    return seconds > INT_MAX / 1000 ? INT_MAX : (int)seconds * 1000;
+}
+
+static void write_label_value(FILE *fp, const char *value) {
+    for (; *value; ++ value) {
+        switch (*value) {
+            case '\\': fputs("\\\\", fp); break;
+            case '"':  fputs("\\\"", fp); break;
+            case '\n': fputs("\\n",  fp); break;
+            default:   fputc(*value, fp); break;
+        }
+    }
+}
+
+static void write_header(FILE *fp, const char *name, const char *type, const char *help) {
+    fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void write_metric(FILE *fp, const char *name, const char *help, const struct Pipelog_Metric *metric) {
+    char buf[128];
+
+    snprintf(buf, sizeof(buf), "%s_total", name);
+    write_header(fp, buf, "counter", help);
+    fprintf(fp, "%s %" PRIu64 "\n", buf, metric->total);
+
+    snprintf(buf, sizeof(buf), "%s_last_interval", name);
+    write_header(fp, buf, "gauge", help);
+    fprintf(fp, "%s %" PRIu64 "\n", buf, metric->last_interval);
+}
+
+static void write_output_metrics(FILE *fp, const struct Pipelog_Metrics *metrics, const char *name, const char *help, const struct Pipelog_Metric *values) {
+    char buf[128];
+
+    for (int pass = 0; pass < 2; ++ pass) {
+        snprintf(buf, sizeof(buf), pass == 0 ? "%s_total" : "%s_last_interval", name);
+        write_header(fp, buf, pass == 0 ? "counter" : "gauge", help);
+
+        for (size_t index = 0; index < metrics->output_count; ++ index) {
+            const struct Pipelog_Output *out = &metrics->output[index];
+            const char *file = out->filename != NULL ? out->filename :
+                out->fd == STDOUT_FILENO ? "STDOUT" :
+                out->fd == STDERR_FILENO ? "STDERR" : "";
+
+            fprintf(fp, "%s{output=\"%zu\",file=\"", buf, index);
+            write_label_value(fp, file);
+            fprintf(fp, "\"} %" PRIu64 "\n", pass == 0 ? values[index].total : values[index].last_interval);
+        }
+    }
+}
+
+static int write_metrics(const struct Pipelog_Metrics *metrics) {
+    char tmpname[PATH_MAX];
+
+    const int len = snprintf(tmpname, sizeof(tmpname), "%s.tmp", metrics->filename);
+    if (len < 0 || (size_t)len >= sizeof(tmpname)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    FILE *fp = fopen(tmpname, "we");
+    if (fp == NULL && errno == ENOENT) {
+        if (make_parent_dirs(tmpname, 0755) != 0) {
+            return -1;
+        }
+        fp = fopen(tmpname, "we");
+    }
+
+    if (fp == NULL) {
+        return -1;
+    }
+
+    write_header(fp, "pipelog_metrics_interval_seconds", "gauge", "Length of the intervals of the *_last_interval metrics.");
+    fprintf(fp, "pipelog_metrics_interval_seconds %u\n", metrics->interval);
+
+    write_metric(fp, "pipelog_input_bytes", "Bytes read from the input.", &metrics->input_bytes);
+    write_metric(fp, "pipelog_input_lines", "Lines read from the input.", &metrics->input_lines);
+
+    for (int pass = 0; pass < 2; ++ pass) {
+        const char *name = pass == 0 ? "pipelog_level_lines_total" : "pipelog_level_lines_last_interval";
+        write_header(fp, name, pass == 0 ? "counter" : "gauge", "Input lines by log level.");
+        for (int level = 0; level < PIPELOG_LEVEL_COUNT; ++ level) {
+            const struct Pipelog_Metric *metric = &metrics->levels[level];
+            fprintf(fp, "%s{level=\"%s\"} %" PRIu64 "\n", name, LEVEL_NAMES[level], pass == 0 ? metric->total : metric->last_interval);
+        }
+    }
+
+    if (metrics->counter_count > 0) {
+        for (int pass = 0; pass < 2; ++ pass) {
+            const char *name = pass == 0 ? "pipelog_pattern_lines_total" : "pipelog_pattern_lines_last_interval";
+            write_header(fp, name, pass == 0 ? "counter" : "gauge", "Input lines matching a counter pattern.");
+            for (size_t index = 0; index < metrics->counter_count; ++ index) {
+                const struct Pipelog_Metric *metric = &metrics->counter_values[index];
+                fprintf(fp, "%s{name=\"", name);
+                write_label_value(fp, metrics->counters[index].name);
+                fprintf(fp, "\"} %" PRIu64 "\n", pass == 0 ? metric->total : metric->last_interval);
+            }
+        }
+    }
+
+    write_output_metrics(fp, metrics, "pipelog_output_bytes", "Bytes passed to an output.", metrics->output_bytes);
+    write_output_metrics(fp, metrics, "pipelog_output_lines", "Lines passed to an output.", metrics->output_lines);
+
+    if (ferror(fp)) {
+        const int errnum = errno;
+        fclose(fp);
+        unlink(tmpname);
+        errno = errnum;
+        return -1;
+    }
+
+    if (fclose(fp) != 0) {
+        const int errnum = errno;
+        unlink(tmpname);
+        errno = errnum;
+        return -1;
+    }
+
+    // atomically replace the old file so readers never see a partial file
+    if (rename(tmpname, metrics->filename) != 0) {
+        const int errnum = errno;
+        unlink(tmpname);
+        errno = errnum;
+        return -1;
+    }
+
+    return 0;
+}
+
+int metrics_tick(struct Pipelog_Metrics *metrics, bool force) {
+    const time_t now = time(NULL);
+
+    if (now < metrics->next_tick && !force) {
+        return 0;
+    }
+
+    if (now >= metrics->next_tick) {
+        metric_tick(&metrics->input_bytes);
+        metric_tick(&metrics->input_lines);
+
+        for (int level = 0; level < PIPELOG_LEVEL_COUNT; ++ level) {
+            metric_tick(&metrics->levels[level]);
+        }
+
+        for (size_t index = 0; index < metrics->counter_count; ++ index) {
+            metric_tick(&metrics->counter_values[index]);
+        }
+
+        for (size_t index = 0; index < metrics->output_count; ++ index) {
+            metric_tick(&metrics->output_bytes[index]);
+            metric_tick(&metrics->output_lines[index]);
+        }
+
+        next_tick(metrics, now);
+    }
+
+    return write_metrics(metrics);
+}
+
+void metrics_free(struct Pipelog_Metrics *metrics) {
+    for (size_t index = 0; index < metrics->counter_count; ++ index) {
+        regfree(&metrics->patterns[index]);
+    }
+    metrics->counter_count = 0;
+
+    free(metrics->patterns);
+    free(metrics->counter_values);
+    free(metrics->output_bytes);
+    free(metrics->output_lines);
+
+    metrics->patterns       = NULL;
+    metrics->counter_values = NULL;
+    metrics->output_bytes   = NULL;
+    metrics->output_lines   = NULL;
+
+    lines_free(&metrics->pending);
+}
@@ -0,0 +1,100 @@
+#ifndef PIPELOG_METRICS_H
+#define PIPELOG_METRICS_H
+#pragma once
+
+#include "pipelog.h"
+#include "lines.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <regex.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    PIPELOG_LEVEL_NONE,
+    PIPELOG_LEVEL_TRACE,
+    PIPELOG_LEVEL_DEBUG,
+    PIPELOG_LEVEL_INFO,
+    PIPELOG_LEVEL_NOTICE,
+    PIPELOG_LEVEL_WARNING,
+    PIPELOG_LEVEL_ERROR,
+    PIPELOG_LEVEL_CRITICAL,
+    PIPELOG_LEVEL_FATAL,
+    PIPELOG_LEVEL_PANIC,
+    PIPELOG_LEVEL_COUNT,
+};
+
+struct Pipelog_Metric {
+    uint64_t total;
+    uint64_t at_tick;       //!< total at the start of the current interval
+    uint64_t last_interval; //!< increase during the last complete interval
+};
+
+struct Pipelog_Metrics {
+    const char  *filename;
+    unsigned int interval;
+    time_t       next_tick;
+
+    struct Pipelog_Lines pending; //!< incomplete input line
+
+    struct Pipelog_Metric input_bytes;
+    struct Pipelog_Metric input_lines;
+    struct Pipelog_Metric levels[PIPELOG_LEVEL_COUNT];
+
+    const struct Pipelog_Counter *counters;
+    size_t                 counter_count;
+    regex_t               *patterns;
+    struct Pipelog_Metric *counter_values;
+
+    const struct Pipelog_Output *output;
+    size_t                 output_count;
+    struct Pipelog_Metric *output_bytes;
+    struct Pipelog_Metric *output_lines;
+};
+
+/**
+ * Returns the level of the first level name (e.g. "ERROR", "warn") found in
+ * the first 256 bytes of line, or PIPELOG_LEVEL_NONE.
+ */
+int detect_level(const char *line, size_t size);
+
+/**
+ * Returns 0 on success. On error -1 is returned and errno is set. If a
+ * counter pattern is invalid errno is set to EINVAL and a message is written
+ * to errbuf.
+ */
+int metrics_init(struct Pipelog_Metrics *metrics, const struct Pipelog_Options *options, const struct Pipelog_Output output[], size_t output_count, char *errbuf, size_t errbuf_size);
+
+/**
+ * Count bytes, lines, levels and pattern matches of input data.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int metrics_input(struct Pipelog_Metrics *metrics, const char *data, size_t size, bool flush);
+
+void metrics_output(struct Pipelog_Metrics *metrics, size_t index, const char *data, size_t size);
+
+/**
+ * Milliseconds until the current interval ends, suitable for poll().
+ */
+int metrics_timeout(const struct Pipelog_Metrics *metrics);
+
+/**
+ * If the current interval ended (or force is true) close it and write the
+ * metrics file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int metrics_tick(struct Pipelog_Metrics *metrics, bool force);
+
+void metrics_free(struct Pipelog_Metrics *metrics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,20 @@
 #include "pipelog.h"
+#include "capture.h"
+#include "transform.h"
+#include "template.h"
+#include "crypt.h"
+#include "columnar.h"
+#include "worker.h"
+#include "sidecar.h"
+#include "progress.h"
+#include "tee.h"
+#include "shard.h"
+#include "route.h"
+#include "pool.h"
+#include "replica.h"
+#include "health.h"
+#include "ring.h"
+#include "metrics.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,20 +29,261 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <poll.h>
+#include <inttypes.h>
 
 #define SPLICE_SIZE ((size_t)2 * 1024 * 1024 * 1024)
 
 struct Pipelog_State {
     char *filename; //!< actual formatted filename
     int   fd;       //!< opened filename
+    unsigned long opened; //!< number of times the file was opened
+    struct Pipelog_Capture    capture;
+    struct Pipelog_Ring       ring;
+    struct Pipelog_Templates  templates;
+    struct Pipelog_Crypt      crypt;
+    struct Pipelog_Route      route;  //!< files by field values, if the filename has %{FIELD}
+    struct Pipelog_Health     health; //!< whether the file can be written, and where the data goes if not
+    struct Pipelog_Sidecars   sidecars;
+    struct Pipelog_Progress   progress;
+    struct Pipelog_Worker    *worker; //!< converts rotated files and copies replicas
+    struct Pipelog_Tee       *tee;    //!< writes the sidecars, if they are fed by tee()
+    unsigned int flags;               //!< flags of pipelog() for the worker jobs
+    char  *replica;         //!< formatted replica name of the open file
+    time_t replica_synced;  //!< when the last copy to the replica was queued
+    bool   replica_fresh;   //!< the replica hasn't been copied to since the file was opened
+
+    // filtered data of the current chunk, written by write_task()
+    int         write_fd;
+    const char *write_data;
+    size_t      write_size;
+    size_t      written;
+    int         write_errnum;
+
+    // result of get_outfd() if it already ran on the rotation pool for this chunk
+    bool rotate_pending;
+    int  rotate_fd;
+    int  rotate_errnum;
+
+    size_t    template_of;  //!< first output with the same filename template, formats it for all
+    char     *formatted;    //!< the template formatted with formatted_at, if this output is the first
+    struct tm formatted_at;
+
+    // outputs that write the same data to the same file are written once
+    size_t same_as; //!< earlier output that writes the file for this one, or SIZE_MAX
+    dev_t  dev;     //!< of the open file
+    ino_t  ino;
 };
 
+struct Pipelog_Rotate {
+    const struct Pipelog_Output *output;
+    struct Pipelog_State *state;
+    const struct tm *local_now;
+    unsigned int flags;
+};
+
+struct Pipelog_Convert_Job {
+    size_t index;
+    unsigned int flags;
+    const char *manifest; //!< to record the archive in, or NULL
+    struct Pipelog_Manifest_Record record;
+    char filename[];
+};
+
+static void convert_job(void *arg) {
+    struct Pipelog_Convert_Job *job = arg;
+    char archive[PATH_MAX];
+
+    if (snprintf(archive, sizeof(archive), "%s%s", job->filename, PIPELOG_COLUMNAR_SUFFIX) >= (int)sizeof(archive)) {
+        if (!(job->flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: converting \"%s\": %s\n", job->index, job->filename, strerror(ENAMETOOLONG));
+        }
+    } else if (columnar_convert(job->filename, archive) != 0) {
+        if (!(job->flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: converting \"%s\" to \"%s\": %s\n", job->index, job->filename, archive, strerror(errno));
+        }
+    } else if (job->manifest != NULL && manifest_append(job->manifest, PIPELOG_MANIFEST_ARCHIVED, job->filename, &job->record) != 0) {
+        if (!(job->flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: writing manifest \"%s\": %s\n", job->index, job->manifest, strerror(errno));
+        }
+    }
+
+    free(job);
+}
+
+static void submit_convert(struct Pipelog_State *ptr, size_t index) {
+    const size_t len = strlen(ptr->filename) + 1;
+    struct Pipelog_Convert_Job *job = malloc(sizeof(struct Pipelog_Convert_Job) + len);
+
+    if (job == NULL) {
+        if (!(ptr->flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: cannot queue conversion of \"%s\": %s\n", index, ptr->filename, strerror(errno));
+        }
+        return;
+    }
+
+    job->index    = index;
+    job->flags    = ptr->flags;
+    job->manifest = ptr->sidecars.manifest.path;
+    job->record   = ptr->sidecars.manifest.record;
+    memcpy(job->filename, ptr->filename, len);
+
+    if (worker_submit(ptr->worker, convert_job, job) != 0) {
+        if (!(ptr->flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: cannot queue conversion of \"%s\": %s\n", index, ptr->filename, strerror(errno));
+        }
+        free(job);
+    }
+}
+
+struct Pipelog_Replica_Job {
+    size_t index;
+    unsigned int flags;
+    bool clone;          //!< the file is complete
+    bool fresh;          //!< first copy since the file was opened
+    const char *replica; //!< points behind filename
+    char filename[];
+};
+
+static void replica_job(void *arg) {
+    struct Pipelog_Replica_Job *job = arg;
+
+    if (replica_sync(job->filename, job->replica, job->clone, job->fresh) != 0) {
+        if (!(job->flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: copying \"%s\" to replica \"%s\": %s\n", job->index, job->filename, job->replica, strerror(errno));
+        }
+    }
+
+    free(job);
+}
+
+// the replica is copied from filename on the worker thread, so the log itself is only written once
+static void submit_replica(struct Pipelog_State *ptr, size_t index, const char *filename, bool clone) {
+    const size_t len = strlen(filename) + 1;
+    const size_t replica_len = strlen(ptr->replica) + 1;
+    struct Pipelog_Replica_Job *job = malloc(sizeof(struct Pipelog_Replica_Job) + len + replica_len);
+
+    if (job == NULL) {
+        if (!(ptr->flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: cannot queue copy of \"%s\": %s\n", index, filename, strerror(errno));
+        }
+        return;
+    }
+
+    job->index = index;
+    job->flags = ptr->flags;
+    job->clone = clone;
+    job->fresh = ptr->replica_fresh;
+    memcpy(job->filename, filename, len);
+    memcpy(job->filename + len, ptr->replica, replica_len);
+    job->replica = job->filename + len;
+
+    if (worker_submit(ptr->worker, replica_job, job) != 0) {
+        if (!(ptr->flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: cannot queue copy of \"%s\": %s\n", index, filename, strerror(errno));
+        }
+        free(job);
+        return;
+    }
+
+    ptr->replica_fresh = false;
+}
+
+// a replica that can't be named is skipped until the next file
+static void format_replica(const struct Pipelog_Output *out, struct Pipelog_State *ptr, size_t index, const struct tm *local_now) {
+    char buf[PATH_MAX];
+
+    free(ptr->replica);
+    ptr->replica = NULL;
+
+    if (strftime(buf, sizeof(buf), out->replica, local_now) == 0) {
+        if (!(ptr->flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: cannot format replica \"%s\": %s\n", index, out->replica, strerror(ENAMETOOLONG));
+        }
+        return;
+    }
+
+    ptr->replica = strdup(buf);
+    // a replica left from before doesn't tell how much of the file it has
+    ptr->replica_fresh = true;
+    if (ptr->replica == NULL && !(ptr->flags & PIPELOG_QUIET)) {
+        fprintf(stderr, "*** error: output[%zu]: cannot allocate string \"%s\": %s\n", index, buf, strerror(errno));
+    }
+}
+
+static void sync_replicas(const struct Pipelog_Output output[], struct Pipelog_State state[], size_t count, time_t now) {
+    for (size_t index = 0; index < count; ++ index) {
+        const struct Pipelog_Output *out = &output[index];
+        struct Pipelog_State *ptr = &state[index];
+
+        if (ptr->replica == NULL || ptr->fd < 0 || out->replica_interval == 0 || now - ptr->replica_synced < (time_t)out->replica_interval) {
+            continue;
+        }
+
+        ptr->replica_synced = now;
+        submit_replica(ptr, index, ptr->filename != NULL ? ptr->filename : out->filename, false);
+    }
+}
+
+// moves size bytes that were duplicated by tee() from fd to outfd, when splice() can't
+static int copy_teed(int fd, int outfd, size_t size) {
+    char buf[BUFSIZ * 8];
+
+    while (size > 0) {
+        const ssize_t rcount = read(fd, buf, size < sizeof(buf) ? size : sizeof(buf));
+        if (rcount < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return -1;
+        }
+
+        if (rcount == 0) {
+            break;
+        }
+
+        for (ssize_t written = 0; written < rcount;) {
+            const ssize_t wcount = write(outfd, buf + written, rcount - written);
+            if (wcount < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            written += wcount;
+        }
+
+        size -= rcount;
+    }
+
+    return 0;
+}
+
+// makes the input blocking again for the slow path
+static void leave_splice(int fd, unsigned int flags) {
+    const int infd_flags = fcntl(fd, F_GETFL, 0);
+    if (infd_flags == -1) {
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: getting flags of input file descriptor: %s\n", strerror(errno));
+        }
+    } else if (fcntl(fd, F_SETFL, (infd_flags & ~O_NONBLOCK) | O_APPEND) == -1) {
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: setting input file descriptor to blocking and appending: %s\n", strerror(errno));
+        }
+    }
+}
+
 static volatile bool received_sighup = false;
 
+static volatile bool received_sigusr1 = false;
+
 static void handle_sighup(int sig) {
     received_sighup = true;
 }
 
+static void handle_sigusr1(int sig) {
+    received_sigusr1 = true;
+}
+
 // logic works for UNIX-only
 int make_parent_dirs(const char *path, mode_t mode) {
     char *buf = strdup(path);
@@ -78,6 +335,255 @@ int make_parent_dirs(const char *path, mode_t mode) {
     return 0;
 }
 
+// line filters are already applied by transform_run()
+static const char *filter_output(const struct Pipelog_Output *out, struct Pipelog_State *ptr, const char *data, size_t *size, bool flush) {
+    if (out->flags & PIPELOG_OUTPUT_CAPTURE) {
+        data = capture_lines(&ptr->capture, data, size, flush);
+        if (data == NULL) {
+            return NULL;
+        }
+    }
+
+    // last, because it changes the format
+    if (out->flags & PIPELOG_OUTPUT_TEMPLATES) {
+        data = encode_templates(&ptr->templates, ptr->opened, data, size, flush);
+        if (data == NULL) {
+            return NULL;
+        }
+    }
+
+    // after everything else, ciphertext doesn't compress and can't be parsed
+    if (out->flags & PIPELOG_OUTPUT_ENCRYPT) {
+        data = encrypt_output(&ptr->crypt, ptr->opened, data, size);
+        if (data == NULL) {
+            return NULL;
+        }
+    }
+
+    return data;
+}
+
+// opening a FIFO blocks until it has a reader, a ring snapshot shouldn't end that
+static int open_output(const char *filename, int open_flags) {
+    for (;;) {
+        const int fd = open(filename, open_flags, 0644);
+        if (fd >= 0 || errno != EINTR || !received_sigusr1) {
+            return fd;
+        }
+    }
+}
+
+static void write_task(void *context, size_t index) {
+    struct Pipelog_State *ptr = &((struct Pipelog_State*)context)[index];
+
+    ptr->written      = 0;
+    ptr->write_errnum = 0;
+
+    if (ptr->write_fd < 0) {
+        return;
+    }
+
+    while (ptr->written < ptr->write_size) {
+        const ssize_t wcount = write(ptr->write_fd, ptr->write_data + ptr->written, ptr->write_size - ptr->written);
+        if (wcount < 0) {
+            // SIGUSR1 has no SA_RESTART for the read(), but only asks for a ring snapshot
+            if (errno == EINTR && received_sigusr1) {
+                continue;
+            }
+            ptr->write_errnum = errno;
+            break;
+        }
+        ptr->written += wcount;
+    }
+}
+
+static void dump_rings(const struct Pipelog_Output output[], struct Pipelog_State state[], size_t count, unsigned int flags) {
+    char template[PATH_MAX];
+    char filename[PATH_MAX];
+    struct tm local_now;
+    const time_t now = time(NULL);
+
+    if (localtime_r(&now, &local_now) == NULL) {
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: getting local time: %s\n", strerror(errno));
+        }
+        return;
+    }
+
+    for (size_t index = 0; index < count; ++ index) {
+        const struct Pipelog_Output *out = &output[index];
+
+        if (!(out->flags & PIPELOG_OUTPUT_RING)) {
+            continue;
+        }
+
+        const char *dump = out->ring_dump;
+        if (dump == NULL) {
+            const int len = snprintf(template, sizeof(template), "%s.%%Y-%%m-%%dT%%H-%%M-%%S", out->filename);
+            if (len < 0 || (size_t)len >= sizeof(template)) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: ring snapshot filename too long\n", index);
+                }
+                continue;
+            }
+            dump = template;
+        }
+
+        if (strftime(filename, sizeof(filename), dump, &local_now) == 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: output[%zu]: cannot format ring snapshot filename \"%s\": %s\n", index, dump, strerror(errno));
+            }
+            continue;
+        }
+
+        int fd = open(filename, O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND, 0644);
+        if (fd < 0 && errno == ENOENT) {
+            if (make_parent_dirs(filename, 0755) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: cannot create parent path of \"%s\": %s\n", index, filename, strerror(errno));
+                }
+                continue;
+            }
+            fd = open(filename, O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND, 0644);
+        }
+
+        if (fd < 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: output[%zu]: opening ring snapshot file \"%s\": %s\n", index, filename, strerror(errno));
+            }
+            continue;
+        }
+
+        if (ring_dump(&state[index].ring, fd) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: output[%zu]: writing ring snapshot file \"%s\": %s\n", index, filename, strerror(errno));
+            }
+        }
+
+        if (close(fd) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: output[%zu]: closing ring snapshot file \"%s\": %s\n", index, filename, strerror(errno));
+            }
+        }
+    }
+}
+
+static bool same_second(const struct tm *a, const struct tm *b) {
+    return a->tm_sec  == b->tm_sec  && a->tm_min == b->tm_min && a->tm_hour == b->tm_hour &&
+           a->tm_mday == b->tm_mday && a->tm_mon == b->tm_mon && a->tm_year == b->tm_year;
+}
+
+// runs strftime() once per distinct filename template and second, get_outfd() uses the result
+static void format_templates(const struct Pipelog_Output output[], struct Pipelog_State state[], size_t count, const struct tm *local_now) {
+    char buf[BUFSIZ > PATH_MAX ? BUFSIZ : PATH_MAX];
+
+    for (size_t index = 0; index < count; ++ index) {
+        struct Pipelog_State *ptr = &state[index];
+
+        if (ptr->template_of != index || ptr->filename == NULL || (ptr->formatted != NULL && same_second(&ptr->formatted_at, local_now))) {
+            continue;
+        }
+
+        free(ptr->formatted);
+        // on error get_outfd() formats the template itself and reports it
+        ptr->formatted = strftime(buf, sizeof(buf), output[index].filename, local_now) == 0 ? NULL : strdup(buf);
+        ptr->formatted_at = *local_now;
+    }
+}
+
+// remembers which file is open, to find outputs that write the same one
+static void record_file(struct Pipelog_State *ptr) {
+    struct stat meta;
+
+    if (fstat(ptr->fd, &meta) == 0) {
+        ptr->dev = meta.st_dev;
+        ptr->ino = meta.st_ino;
+    } else {
+        ptr->dev = 0;
+        ptr->ino = 0;
+    }
+}
+
+// outputs whose data is the same if they have the same flags; sidecar files
+// are left out, each output would own its own FILE.idx etc. of the same file
+static bool plain_output(const struct Pipelog_Output *out) {
+    return out->filename != NULL && out->progress == NULL && out->replica == NULL &&
+        !(out->flags & ~PIPELOG_OUTPUT_LINE_FILTERS);
+}
+
+// whether the data of both goes to the same place while their file fails
+static bool same_fallback(const struct Pipelog_Output *out, const struct Pipelog_Output *other) {
+    if (out->fallback != other->fallback) {
+        return false;
+    }
+
+    switch (out->fallback) {
+        case PIPELOG_FALLBACK_SPILL: return out->spill_size == other->spill_size;
+        case PIPELOG_FALLBACK_FILE:  return strcmp(out->fallback_path, other->fallback_path) == 0;
+        default:                     return true;
+    }
+}
+
+/**
+ * Find outputs that resolve to the same file as an earlier one with the
+ * same options, e.g. a fixed path and a template that currently expands to
+ * it. They would write every byte twice, instead only the earlier one does.
+ */
+static void plan_outputs(const struct Pipelog_Output output[], struct Pipelog_State state[], size_t count) {
+    for (size_t index = 0; index < count; ++ index) {
+        struct Pipelog_State *ptr = &state[index];
+
+        ptr->same_as = SIZE_MAX;
+        if (ptr->fd < 0 || !plain_output(&output[index])) {
+            continue;
+        }
+
+        for (size_t other = 0; other < index; ++ other) {
+            if (state[other].same_as == SIZE_MAX && state[other].fd >= 0 &&
+                state[other].dev == ptr->dev && state[other].ino == ptr->ino &&
+                output[other].flags == output[index].flags && plain_output(&output[other]) &&
+                same_fallback(&output[other], &output[index])) {
+                ptr->same_as = other;
+                break;
+            }
+        }
+    }
+}
+
+static int open_sidecars(const struct Pipelog_Output *out, struct Pipelog_State *ptr, size_t index, const char *filename, unsigned int flags) {
+    struct stat meta;
+
+    if (!(out->flags & PIPELOG_OUTPUT_SIDECARS)) {
+        return 0;
+    }
+
+    if (fstat(ptr->fd, &meta) != 0 || sidecars_open(&ptr->sidecars, out, filename, meta.st_size) != 0) {
+        const int errnum = errno;
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: opening sidecar files of \"%s\": %s\n", index, filename, strerror(errnum));
+        }
+        errno = errnum;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void publish_rotate(const struct Pipelog_Output *out, struct Pipelog_State *ptr, size_t index, const char *filename, unsigned int flags) {
+    struct stat meta;
+
+    if (out->progress == NULL) {
+        return;
+    }
+
+    // followers only miss out on this file, the log itself keeps going
+    if (fstat(ptr->fd, &meta) != 0 || progress_rotate(&ptr->progress, filename, meta.st_size) != 0) {
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: publishing progress of \"%s\": %s\n", index, filename, strerror(errno));
+        }
+    }
+}
+
 static int get_outfd(const struct Pipelog_Output output[], struct Pipelog_State state[], size_t index, const struct tm *local_now, unsigned int flags) {
     char buf[BUFSIZ > PATH_MAX ? BUFSIZ : PATH_MAX];
     struct Pipelog_State *ptr = &state[index];
@@ -92,7 +598,10 @@ static int get_outfd(const struct Pipelog_Output output[], struct Pipelog_State
         const char *filename;
 
         if (has_format) {
-            if (strftime(buf, sizeof(buf), out->filename, local_now) == 0) {
+            const struct Pipelog_State *leader = &state[ptr->template_of];
+            if (leader->formatted != NULL && same_second(&leader->formatted_at, local_now)) {
+                filename = leader->formatted;
+            } else if (strftime(buf, sizeof(buf), out->filename, local_now) == 0) {
                 if (!(flags & PIPELOG_QUIET)) {
                     const int errnum = errno;
                     fprintf(stderr, "*** error: output[%zu]: cannot format logfile \"%s\": %s\n", index, out->filename, strerror(errnum));
@@ -100,8 +609,9 @@ static int get_outfd(const struct Pipelog_Output output[], struct Pipelog_State
                 }
                 outfd = -1;
                 goto cleanup;
+            } else {
+                filename = buf;
             }
-            filename = buf;
             new_name = strcmp(ptr->filename, filename) != 0;
         } else {
             filename = out->filename;
@@ -127,34 +637,58 @@ static int get_outfd(const struct Pipelog_Output output[], struct Pipelog_State
                 unblock_sighup = true;
             }
 
+            if (outfd >= 0 && (out->flags & PIPELOG_OUTPUT_ENCRYPT) && crypt_close(&ptr->crypt, outfd) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: ending encrypted segment of \"%s\": %s\n", index, filename, strerror(errno));
+                }
+            }
             if (outfd >= 0 && close(outfd) != 0) {
                 if (!(flags & PIPELOG_QUIET)) {
                     fprintf(stderr, "*** error: output[%zu]: closing file \"%s\": %s\n", index, filename, strerror(errno));
                 }
             }
+            if (ptr->tee != NULL) {
+                // the sidecars of the old file need to see all of its data
+                tee_drain(ptr->tee);
+            }
+            if (sidecars_close(&ptr->sidecars) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: closing sidecar files of \"%s\": %s\n", index, filename, strerror(errno));
+                }
+            }
+
+            if (new_name && outfd >= 0 && (out->flags & PIPELOG_OUTPUT_COLUMNAR)) {
+                // the old file is complete now
+                submit_convert(ptr, index);
+            }
+
+            if (outfd >= 0 && ptr->replica != NULL) {
+                submit_replica(ptr, index, has_format ? ptr->filename : out->filename, true);
+            }
 
             if (new_name) {
-                const size_t len = strlen(buf) + 1;
+                const size_t len = strlen(filename) + 1;
 
-                char *filename = realloc(ptr->filename, len);
-                if (filename == NULL) {
+                char *copy = realloc(ptr->filename, len);
+                if (copy == NULL) {
                     if (!(flags & PIPELOG_QUIET)) {
                         const int errnum = errno;
-                        fprintf(stderr, "*** error: output[%zu]: cannot allocate string \"%s\": %s\n", index, buf, strerror(errnum));
+                        fprintf(stderr, "*** error: output[%zu]: cannot allocate string \"%s\": %s\n", index, filename, strerror(errnum));
                         errno = errnum;
                     }
                     outfd = -1;
                     goto cleanup;
                 }
 
-                memcpy(filename, buf, len);
-                ptr->filename = filename;
+                memcpy(copy, filename, len);
+                ptr->filename = copy;
+                filename = copy;
             }
 
             const int open_flags = flags & PIPELOG_SPLICE ?
                 O_CREAT | O_RDWR | O_CLOEXEC :
                 O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND;
-            ptr->fd = outfd = open(filename, open_flags, 0644);
+            ptr->fd = outfd = open_output(filename, open_flags);
             if (outfd < 0 && errno == ENOENT) {
                 if (make_parent_dirs(filename, 0755) != 0) {
                     if (!(flags & PIPELOG_QUIET)) {
@@ -165,7 +699,7 @@ static int get_outfd(const struct Pipelog_Output output[], struct Pipelog_State
                     outfd = -1;
                     goto cleanup;
                 }
-                ptr->fd = outfd = open(filename, open_flags, 0644);
+                ptr->fd = outfd = open_output(filename, open_flags);
             }
 
             if (outfd < 0) {
@@ -178,6 +712,18 @@ static int get_outfd(const struct Pipelog_Output output[], struct Pipelog_State
                 outfd = -1;
                 goto cleanup;
             } else {
+                ++ ptr->opened;
+                record_file(ptr);
+
+                if (out->replica != NULL) {
+                    format_replica(out, ptr, index, local_now);
+                    ptr->replica_synced = time(NULL);
+                }
+
+                // the log itself is more important, keep writing it
+                open_sidecars(out, ptr, index, filename, flags);
+                publish_rotate(out, ptr, index, filename, flags);
+
                 if ((flags & PIPELOG_SPLICE) && lseek(outfd, 0, SEEK_END) == (off_t)-1) {
                     const int errnum = errno;
                     if (errnum != EPIPE) {
@@ -193,7 +739,8 @@ static int get_outfd(const struct Pipelog_Output output[], struct Pipelog_State
                     }
                 }
 
-                if (new_name && out->link != NULL) {
+                // or the file couldn't be opened at the start
+                if ((new_name || ptr->opened == 1) && out->link != NULL) {
                     if (unlink(out->link) != 0 && errno != ENOENT) {
                         const int errnum = errno;
                         if (!(flags & PIPELOG_QUIET)) {
@@ -253,14 +800,59 @@ cleanup:
     return outfd;
 }
 
-int pipelog(const int fd, const struct Pipelog_Output output[], const size_t count, const unsigned int flags) {
+// true if get_outfd() would open a file, so it is worth to do that on the rotation pool
+static bool needs_open(const struct Pipelog_Output *out, const struct Pipelog_State state[], size_t index, unsigned int flags) {
+    const struct Pipelog_State *ptr = &state[index];
+    const struct Pipelog_State *leader = &state[ptr->template_of];
+
+    // retries of failed outputs are reported as such, by the main loop
+    if (out->filename == NULL || (out->flags & (PIPELOG_OUTPUT_RING | PIPELOG_OUTPUT_ROUTE)) || ptr->health.failures > 0) {
+        return false;
+    }
+
+    if (ptr->fd < 0 || (flags & PIPELOG_FORCE_ROTATE)) {
+        return true;
+    }
+
+    // a formatting error is reported by get_outfd()
+    return ptr->filename != NULL && (leader->formatted == NULL || strcmp(ptr->filename, leader->formatted) != 0);
+}
+
+static void rotate_task(void *context, size_t index) {
+    struct Pipelog_Rotate *rotate = context;
+    struct Pipelog_State *ptr = &rotate->state[index];
+
+    if (!ptr->rotate_pending) {
+        return;
+    }
+
+    ptr->rotate_fd     = get_outfd(rotate->output, rotate->state, index, rotate->local_now, rotate->flags);
+    ptr->rotate_errnum = errno;
+}
+
+int pipelog(const int fd, const struct Pipelog_Output output[], const size_t count, const struct Pipelog_Options *options, const unsigned int flags) {
     char buf[BUFSIZ];
+    char *readbuf = buf;
+    size_t readbuf_size = sizeof(buf);
     char link_target[PATH_MAX];
     int status = PIPELOG_SUCCESS;
     size_t init_count = 0;
     struct Pipelog_State *state = calloc(count, sizeof(struct Pipelog_State));
     struct tm local_now;
     sighandler_t old_handle_sighup = SIG_ERR;
+    struct sigaction old_sigusr1;
+    bool sigusr1_installed = false;
+    struct Pipelog_Metrics metrics_buf;
+    struct Pipelog_Metrics *metrics = NULL;
+    struct Pipelog_Transform transform;
+    bool transform_initialized = false;
+    struct Pipelog_Worker worker;
+    bool worker_started = false;
+    struct Pipelog_Tee tee;
+    bool tee_started = false;
+    struct Pipelog_Shards shards;
+    bool shards_initialized = false;
+    struct Pipelog_Pool *rotate_pool = NULL;
 
     if (state == NULL) {
         if (!(flags & PIPELOG_QUIET)) {
@@ -270,6 +862,28 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
         goto cleanup;
     }
 
+    for (size_t index = 0; index < count; ++ index) {
+        sidecars_init(&state[index].sidecars);
+        state[index].progress.fd     = -1;
+        state[index].progress.header = NULL;
+        state[index].same_as         = SIZE_MAX;
+        health_init(&state[index].health, index);
+
+        // outputs with the same template share its formatting
+        const char *filename = output[index].filename;
+        size_t template_of = 0;
+        if (filename != NULL && !(output[index].flags & (PIPELOG_OUTPUT_RING | PIPELOG_OUTPUT_ROUTE))) {
+            while (template_of < index && (output[template_of].filename == NULL ||
+                   (output[template_of].flags & (PIPELOG_OUTPUT_RING | PIPELOG_OUTPUT_ROUTE)) ||
+                   strcmp(output[template_of].filename, filename) != 0)) {
+                ++ template_of;
+            }
+        } else {
+            template_of = index;
+        }
+        state[index].template_of = template_of;
+    }
+
     {
         const time_t now = time(NULL);
         if (localtime_r(&now, &local_now) == NULL) {
@@ -305,7 +919,47 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
     sigemptyset(&mask);
     sigaddset(&mask, SIGHUP);
 
-    bool use_splice = count == 1 && !(flags & PIPELOG_NO_SPLICE);
+    bool any_ring = false;
+    for (size_t index = 0; index < count; ++ index) {
+        if (output[index].flags & PIPELOG_OUTPUT_RING) {
+            any_ring = true;
+            break;
+        }
+    }
+
+    if (any_ring) {
+        // no SA_RESTART, so a blocking read() is interrupted for the snapshot
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handle_sigusr1;
+        sigemptyset(&action.sa_mask);
+
+        if (sigaction(SIGUSR1, &action, &old_sigusr1) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: sigaction(SIGUSR1, handle_sigusr1): %s\n", strerror(errno));
+            }
+            status = PIPELOG_ERROR;
+            goto cleanup;
+        }
+        sigusr1_installed = true;
+    }
+
+    // before use_splice, metrics need to see the data
+    if (options != NULL && options->metrics != NULL) {
+        char errbuf[256];
+        if (metrics_init(&metrics_buf, options, output, count, errbuf, sizeof(errbuf)) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: initializing metrics: %s\n", errbuf);
+            }
+            status = PIPELOG_ERROR;
+            goto cleanup;
+        }
+        metrics = &metrics_buf;
+    }
+
+    // sidecars get a copy of the data made by tee()
+    const unsigned int splice_filters = PIPELOG_OUTPUT_FILTERS & ~PIPELOG_OUTPUT_SIDECARS;
+    bool use_splice = count == 1 && !(flags & PIPELOG_NO_SPLICE) && metrics == NULL && !(output[0].flags & (splice_filters | PIPELOG_OUTPUT_RING));
 
     if (use_splice) {
         const int infd_flags = fcntl(fd, F_GETFL, 0);
@@ -322,16 +976,245 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
         }
     }
 
-    int open_flags = use_splice ?
-        O_CREAT | O_RDWR | O_CLOEXEC :
-        O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND;
-
+    int open_flags = use_splice ?
+        O_CREAT | O_RDWR | O_CLOEXEC :
+        O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND;
+
+    // filters that keep data between chunks need to be flushed at the end
+    bool any_flush = metrics != NULL;
+    bool any_sidecar = false;
+    bool any_replica = false;
+    for (size_t index = 0; index < count; ++ index) {
+        const struct Pipelog_Output *out = &output[index];
+
+        // as does data spilled while the output failed
+        if (out->flags & (PIPELOG_OUTPUT_SANITIZE | PIPELOG_OUTPUT_CAPTURE | PIPELOG_OUTPUT_TEMPLATES | PIPELOG_OUTPUT_SHARD | PIPELOG_OUTPUT_ROUTE) ||
+            out->fallback == PIPELOG_FALLBACK_SPILL) {
+            any_flush = true;
+        }
+
+        if (out->flags & PIPELOG_OUTPUT_TEMPLATES) {
+            if (out->flags & PIPELOG_OUTPUT_RING) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: a ring can't hold templates, because the start of the data is overwritten\n", index);
+                }
+                errno = EINVAL;
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+            templates_init(&state[index].templates);
+        }
+
+        if (out->flags & PIPELOG_OUTPUT_ENCRYPT) {
+            if (out->flags & PIPELOG_OUTPUT_RING) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: a ring can't be encrypted, because the start of the data is overwritten\n", index);
+                }
+                errno = EINVAL;
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+            if (crypt_init(&state[index].crypt, out->key_file) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: reading key file \"%s\": %s\n", index, out->key_file, strerror(errno));
+                }
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+        }
+
+        if (out->flags & PIPELOG_OUTPUT_SIDECARS) {
+            any_sidecar = true;
+            if (out->flags & (PIPELOG_OUTPUT_RING | PIPELOG_OUTPUT_TEMPLATES | PIPELOG_OUTPUT_ENCRYPT)) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: only plain text log files can be indexed\n", index);
+                }
+                errno = EINVAL;
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+        }
+
+        if (out->progress != NULL && progress_open(&state[index].progress, out->progress, true) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: output[%zu]: opening progress file \"%s\": %s\n", index, out->progress, strerror(errno));
+            }
+            status = PIPELOG_ERROR;
+            goto cleanup;
+        }
+
+        if (out->replica != NULL) {
+            any_replica = true;
+            if (out->filename == NULL || (out->flags & (PIPELOG_OUTPUT_RING | PIPELOG_OUTPUT_ROUTE))) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: only log files with a single name per time can have a replica\n", index);
+                }
+                errno = EINVAL;
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+        }
+
+        if (out->flags & PIPELOG_OUTPUT_COLUMNAR) {
+            if (out->flags & (PIPELOG_OUTPUT_RING | PIPELOG_OUTPUT_TEMPLATES | PIPELOG_OUTPUT_ENCRYPT)) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: only plain text log files can be converted to columnar archives\n", index);
+                }
+                errno = EINVAL;
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+        }
+
+        if ((out->flags & PIPELOG_OUTPUT_COLUMNAR) || out->replica != NULL) {
+            if (!worker_started) {
+                if (worker_start(&worker) != 0) {
+                    if (!(flags & PIPELOG_QUIET)) {
+                        fprintf(stderr, "*** error: starting background thread: %s\n", strerror(errno));
+                    }
+                    status = PIPELOG_ERROR;
+                    goto cleanup;
+                }
+                worker_started = true;
+            }
+            state[index].worker = &worker;
+            state[index].flags  = flags;
+        }
+
+        if (out->flags & PIPELOG_OUTPUT_CAPTURE) {
+            char errbuf[256];
+            if (capture_init(&state[index].capture, &out->capture, errbuf, sizeof(errbuf)) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: cannot initialize trigger \"%s\": %s\n", index, out->capture.trigger, errbuf);
+                }
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+        }
+    }
+
+    // pass-through without line filters costs nothing, and splice may fall back to read()
+    const size_t threads = options != NULL ? options->threads : 1;
+    if (transform_init(&transform, output, count, threads) != 0) {
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: initializing line filters: %s\n", strerror(errno));
+        }
+        status = PIPELOG_ERROR;
+        goto cleanup;
+    }
+    transform_initialized = true;
+
+    if (transform.pool != NULL) {
+        // reads of BUFSIZ are too small to be split among threads
+        readbuf = malloc(PIPELOG_PARALLEL_READ_SIZE);
+        if (readbuf == NULL) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: allocating memory: %s\n", strerror(errno));
+            }
+            status = PIPELOG_ERROR;
+            goto cleanup;
+        }
+        readbuf_size = PIPELOG_PARALLEL_READ_SIZE;
+
+        // fails if fd is no pipe, which is fine
+        fcntl(fd, F_SETPIPE_SZ, PIPELOG_PARALLEL_READ_SIZE);
+    }
+
+    {
+        char errbuf[256];
+        if (shards_init(&shards, output, count, errbuf, sizeof(errbuf)) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                if (errno == EINVAL) {
+                    fprintf(stderr, "*** error: %s\n", errbuf);
+                } else {
+                    fprintf(stderr, "*** error: initializing shards: %s\n", strerror(errno));
+                }
+            }
+            status = PIPELOG_ERROR;
+            goto cleanup;
+        }
+        shards_initialized = true;
+    }
+
+    {
+        // opening hundreds of files one after the other at midnight would stall the input
+        size_t files = 0;
+        bool any_route = false;
+        for (size_t index = 0; index < count; ++ index) {
+            if (output[index].flags & PIPELOG_OUTPUT_ROUTE) {
+                any_route = true;
+            } else if (output[index].filename != NULL && !(output[index].flags & PIPELOG_OUTPUT_RING)) {
+                ++ files;
+            }
+        }
+
+        if (files > 1 || any_route) {
+            rotate_pool = pool_create(any_route || files > PIPELOG_ROTATE_THREADS ? PIPELOG_ROTATE_THREADS : files);
+            if (rotate_pool == NULL) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: starting rotation threads: %s\n", strerror(errno));
+                }
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+        }
+    }
+
     bool any_rotate = false;
+    struct tm rotate_checked = local_now;
+    size_t planned = 0; //!< sum of the opened counters when the outputs were planned
     for (; init_count < count; ++ init_count) {
         const struct Pipelog_Output *out = &output[init_count];
         struct Pipelog_State *ptr = &state[init_count];
 
-        if (out->filename != NULL) {
+        if (out->flags & PIPELOG_OUTPUT_RING) {
+            ptr->fd = -1;
+
+            if (out->filename == NULL || out->link != NULL || strchr(out->filename, '%') != NULL || out->ring_size == 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: a ring needs a fixed filename, a size and no link\n", init_count);
+                }
+                errno = EINVAL;
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+
+            if (ring_open(&ptr->ring, out->filename, out->ring_size) != 0) {
+                const int errnum = errno;
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: cannot open ring file \"%s\": %s\n", init_count, out->filename, strerror(errnum));
+                }
+                status = errnum == EINTR ? PIPELOG_INTERRUPTED : PIPELOG_ERROR;
+                goto cleanup;
+            }
+        } else if (out->flags & PIPELOG_OUTPUT_ROUTE) {
+            // files are opened when the first line for them arrives
+            ptr->fd = -1;
+
+            if (out->filename == NULL || out->link != NULL || out->progress != NULL ||
+                (out->flags & ~(PIPELOG_OUTPUT_LINE_FILTERS | PIPELOG_OUTPUT_CAPTURE | PIPELOG_OUTPUT_ROUTE))) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: a file name with %%{FIELD} only supports line filters and +capture\n", init_count);
+                }
+                errno = EINVAL;
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+
+            if (route_init(&ptr->route, out->filename, out->max_open, rotate_pool, init_count) != 0) {
+                const int errnum = errno;
+                if (!(flags & PIPELOG_QUIET)) {
+                    if (errnum == EINVAL) {
+                        fprintf(stderr, "*** error: output[%zu]: illegal field reference in file name \"%s\"\n", init_count, out->filename);
+                    } else {
+                        fprintf(stderr, "*** error: output[%zu]: initializing file name \"%s\": %s\n", init_count, out->filename, strerror(errnum));
+                    }
+                }
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+            any_rotate = true;
+        } else if (out->filename != NULL) {
             if (out->fd != -1) {
                 if (!(flags & PIPELOG_QUIET)) {
                     fprintf(stderr, "*** error: output[%zu]: file descriptor must be -1 when filename given, but was: %d\n", init_count, out->fd);
@@ -367,27 +1250,54 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
                 filename = out->filename;
             }
 
-            ptr->fd = open(filename, open_flags, 0644);
+            bool reported = false;
+            ptr->fd = open_output(filename, open_flags);
             if (ptr->fd < 0 && errno == ENOENT) {
                 if (make_parent_dirs(filename, 0755) != 0) {
                     const int errnum = errno;
                     if (!(flags & PIPELOG_QUIET)) {
                         fprintf(stderr, "*** error: output[%zu]: cannot create parent path of \"%s\": %s\n", init_count, filename, strerror(errnum));
                     }
-                    status = errnum == EINTR ? PIPELOG_INTERRUPTED : PIPELOG_ERROR;
-                    goto cleanup;
+                    errno = errnum;
+                    reported = true;
+                } else {
+                    ptr->fd = open_output(filename, open_flags);
                 }
-                ptr->fd = open(filename, open_flags, 0644);
             }
 
             if (ptr->fd < 0) {
                 const int errnum = errno;
-                if (!(flags & PIPELOG_QUIET)) {
+                if (!reported && !(flags & PIPELOG_QUIET)) {
                     fprintf(stderr, "*** error: output[%zu]: cannot open file \"%s\": %s\n", init_count, filename, strerror(errnum));
                 }
-                status = errnum == EINTR ? PIPELOG_INTERRUPTED : PIPELOG_ERROR;
+
+                if (errnum == EINTR || (flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
+                    status = errnum == EINTR ? PIPELOG_INTERRUPTED : PIPELOG_ERROR;
+                    goto cleanup;
+                }
+
+                // the other outputs go on, this one is retried with backoff like
+                // any failing output, its sidecars etc. are set up when it opens
+                health_failed(&ptr->health, errnum, health_now());
+                if (use_splice) {
+                    use_splice = false;
+                    leave_splice(fd, flags);
+                }
+                continue;
+            }
+            ++ ptr->opened;
+            record_file(ptr);
+
+            if (out->replica != NULL) {
+                format_replica(out, ptr, init_count, &local_now);
+                ptr->replica_synced = time(NULL);
+            }
+
+            if (open_sidecars(out, ptr, init_count, filename, flags) != 0) {
+                status = PIPELOG_ERROR;
                 goto cleanup;
             }
+            publish_rotate(out, ptr, init_count, filename, flags);
 
             if (!(open_flags & O_APPEND) && lseek(ptr->fd, 0, SEEK_END) == (off_t)-1) {
                 const int errnum = errno;
@@ -460,6 +1370,18 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
         }
     }
 
+    if (use_splice && (output[0].flags & PIPELOG_OUTPUT_SIDECARS)) {
+        if (tee_start(&tee, &output[0], &state[0].sidecars, 0, flags) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: starting sidecar thread: %s\n", strerror(errno));
+            }
+            status = PIPELOG_ERROR;
+            goto cleanup;
+        }
+        tee_started = true;
+        state[0].tee = &tee;
+    }
+
     if (sigprocmask(SIG_UNBLOCK, &mask, NULL) != 0) {
         if (!(flags & PIPELOG_QUIET)) {
             fprintf(stderr, "*** error: unblocking SIGHUP: %s\n", strerror(errno));
@@ -469,6 +1391,11 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
     }
 
     for (;;) {
+        if (any_replica) {
+            // between rotations new data is copied to the replicas at most every replica_interval seconds
+            sync_replicas(output, state, count, time(NULL));
+        }
+
         if (use_splice) {
             if (received_sighup) {
                 // re-open all files
@@ -483,8 +1410,9 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
                     goto cleanup;
                 }
 
+                // a failure is handled below, when the file is needed
                 int outfd = get_outfd(output, state, 0, &local_now, flags | PIPELOG_FORCE_ROTATE | PIPELOG_BLOCK_SIGHUP | PIPELOG_SPLICE);
-                if (outfd < 0 && !(flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
+                if (outfd < 0 && (errno == EINTR || (flags & PIPELOG_EXIT_ON_WRITE_ERROR))) {
                     const int errnum = errno;
                     if (!(flags & PIPELOG_QUIET)) {
                         fprintf(stderr, "*** error: writing output: %s\n", strerror(errnum));
@@ -514,7 +1442,7 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
                         }
 
                         int outfd = get_outfd(output, state, 0, &local_now, flags | PIPELOG_FORCE_ROTATE | PIPELOG_BLOCK_SIGHUP | PIPELOG_SPLICE);
-                        if (outfd < 0 && !(flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
+                        if (outfd < 0 && (errno == EINTR || (flags & PIPELOG_EXIT_ON_WRITE_ERROR))) {
                             const int errnum = errno;
                             if (!(flags & PIPELOG_QUIET)) {
                                 fprintf(stderr, "*** error: writing output: %s\n", strerror(errnum));
@@ -548,8 +1476,34 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
 
             int outfd = get_outfd(output, state, 0, &local_now, flags | PIPELOG_BLOCK_SIGHUP | PIPELOG_SPLICE);
             if (outfd > -1) {
+                // with tee() exactly the duplicated bytes have to be spliced
+                size_t splice_size = SPLICE_SIZE;
+                if (tee_started) {
+                    const ssize_t tcount = tee_copy(&tee, fd);
+                    if (tcount == 0) {
+                        goto cleanup;
+                    } else if (tcount < 0) {
+                        const int errnum = errno;
+                        if (errnum == EAGAIN || errnum == EINTR) {
+                            // poll again, or handle SIGHUP first
+                            continue;
+                        }
+                        if (!(flags & PIPELOG_QUIET)) {
+                            fprintf(stderr, "*** error: tee failed, retrying slow path: %s\n", strerror(errnum));
+                        }
+                        tee_stop(&tee);
+                        tee_started = false;
+                        state[0].tee = NULL;
+                        use_splice = false;
+                        leave_splice(fd, flags);
+                        continue;
+                    } else {
+                        splice_size = tcount;
+                    }
+                }
+
                 for (;;) {
-                    const ssize_t wcount = splice(fd, NULL, outfd, NULL, SPLICE_SIZE, SPLICE_F_NONBLOCK);
+                    const ssize_t wcount = splice(fd, NULL, outfd, NULL, splice_size, SPLICE_F_NONBLOCK);
                     if (wcount < 0) {
                         const int errnum = errno;
                         if (errnum == EINVAL) {
@@ -557,18 +1511,22 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
                                 fprintf(stderr, "*** error: splice failed, retrying slow path.\n");
                             }
                             use_splice = false;
+                            leave_splice(fd, flags);
 
-                            const int infd_flags = fcntl(fd, F_GETFL, 0);
-                            if (infd_flags == -1) {
-                                if (!(flags & PIPELOG_QUIET)) {
-                                    fprintf(stderr, "*** error: getting flags of input file descriptor: %s\n", strerror(errno));
-                                }
-                            } else if (fcntl(fd, F_SETFL, (infd_flags & ~O_NONBLOCK) | O_APPEND) == -1) {
-                                if (!(flags & PIPELOG_QUIET)) {
-                                    fprintf(stderr, "*** error: setting input file descriptor to blocking and appending: %s\n", strerror(errno));
+                            if (tee_started) {
+                                // the sidecars got the duplicated data already
+                                if (copy_teed(fd, outfd, splice_size) != 0 && !(flags & PIPELOG_QUIET)) {
+                                    fprintf(stderr, "*** error: writing output: %s\n", strerror(errno));
                                 }
+                                progress_commit(&state[0].progress, splice_size);
+                                tee_stop(&tee);
+                                tee_started = false;
+                                state[0].tee = NULL;
                             }
                             break;
+                        } else if ((errnum == EINTR || errnum == EAGAIN) && tee_started) {
+                            // the duplicated data belongs to the current file, rotate afterwards
+                            continue;
                         } else if (errnum == EINTR && received_sighup) {
                             // re-open all files
                             received_sighup = false;
@@ -585,6 +1543,19 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
                             if (outfd < 0) {
                                 break;
                             }
+                        } else if (errnum != EINTR && errnum != EAGAIN && !tee_started && !(flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
+                            // nothing was moved, the slow path retries the file with backoff
+                            if (!(flags & PIPELOG_QUIET)) {
+                                fprintf(stderr, "*** error: output[0]: writing output: %s\n", strerror(errnum));
+                            }
+                            if (output[0].filename != NULL) {
+                                close(state[0].fd);
+                            }
+                            state[0].fd = -1;
+                            health_failed(&state[0].health, errnum, health_now());
+                            use_splice = false;
+                            leave_splice(fd, flags);
+                            break;
                         } else {
                             if (!(flags & PIPELOG_QUIET)) {
                                 fprintf(stderr, "*** error: splice failed, retrying slow path: %s\n", strerror(errnum));
@@ -595,28 +1566,67 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
                     } else if (wcount == 0) {
                         goto cleanup;
                     } else {
+                        progress_commit(&state[0].progress, wcount);
+                        if (tee_started && (size_t)wcount < splice_size) {
+                            splice_size -= wcount;
+                            continue;
+                        }
                         break;
                     }
                 }
-            } else if (!(flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
+            } else if (errno == EINTR || (flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
                 const int errnum = errno;
                 if (!(flags & PIPELOG_QUIET)) {
                     fprintf(stderr, "*** error: writing output: %s\n", strerror(errnum));
                 }
                 status = errnum == EINTR ? PIPELOG_INTERRUPTED : PIPELOG_ERROR;
                 goto cleanup;
+            } else {
+                // get_outfd() reported the error, the slow path retries the file with backoff
+                health_failed(&state[0].health, errno, health_now());
+                if (tee_started) {
+                    tee_stop(&tee);
+                    tee_started = false;
+                    state[0].tee = NULL;
+                }
+                use_splice = false;
+                leave_splice(fd, flags);
             }
         } else { // !use_splice
             unsigned int get_outfd_flags = flags;
             ssize_t rcount = 0;
+            bool eof = false;
+            bool readable = true;
+            if (metrics != NULL && !received_sighup) {
+                // wake up at the end of the metrics interval even if there is no input
+                struct pollfd pollfds[] = { { fd, POLLIN, 0 } };
+                const int result = poll(pollfds, 1, metrics_timeout(metrics));
+                if (result < 0) {
+                    const int errnum = errno;
+                    if (errnum != EINTR) {
+                        if (!(flags & PIPELOG_QUIET)) {
+                            fprintf(stderr, "*** error: polling input: %s\n", strerror(errnum));
+                        }
+                        status = PIPELOG_ERROR;
+                        goto cleanup;
+                    }
+                    readable = false;
+                } else if (result == 0) {
+                    readable = false;
+                }
+            }
+
             if (received_sighup) {
                 // pending SIGHUP was delivered when it was unblocked
                 get_outfd_flags |= PIPELOG_FORCE_ROTATE;
                 received_sighup = false;
-            } else {
-                rcount = read(fd, buf, sizeof(buf));
+            } else if (readable) {
+                rcount = read(fd, readbuf, readbuf_size);
                 if (rcount == 0) {
-                    break;
+                    if (!any_flush) {
+                        break;
+                    }
+                    eof = true;
                 }
 
                 if (rcount < 0) {
@@ -624,6 +1634,10 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
                     if (errnum == EINTR && received_sighup) {
                         get_outfd_flags |= PIPELOG_FORCE_ROTATE;
                         received_sighup = false;
+                        rcount = 0;
+                    } else if (errnum == EINTR && received_sigusr1) {
+                        // ring snapshot is taken below
+                        rcount = 0;
                     } else {
                         if (!(flags & PIPELOG_QUIET)) {
                             fprintf(stderr, "*** error: reading input: %s\n", strerror(errnum));
@@ -655,44 +1669,270 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
                 }
             }
 
+            if (metrics != NULL && metrics_input(metrics, readbuf, rcount, eof) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: counting metrics: %s\n", strerror(errno));
+                }
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+
+            int64_t arrival = 0;
+            if (any_sidecar) {
+                struct timespec now;
+                clock_gettime(CLOCK_REALTIME, &now);
+                arrival = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+            }
+
+            if (transform_run(&transform, readbuf, rcount, eof) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: filtering output: %s\n", strerror(errno));
+                }
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+
+            if (shards_run(&shards, transform.result, transform.result_size, eof) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: sharding output: %s\n", strerror(errno));
+                }
+                status = PIPELOG_ERROR;
+                goto cleanup;
+            }
+
+            if (any_rotate) {
+                format_templates(output, state, count, &local_now);
+            }
+
+            if (rotate_pool != NULL && ((get_outfd_flags & PIPELOG_FORCE_ROTATE) || !same_second(&local_now, &rotate_checked))) {
+                // the chunk waits for the slowest open instead of for all of them in turn
+                size_t opening = 0;
+                rotate_checked = local_now;
+                for (size_t index = 0; index < count; ++ index) {
+                    state[index].rotate_pending = needs_open(&output[index], state, index, get_outfd_flags);
+                    if (state[index].rotate_pending) {
+                        ++ opening;
+                    }
+                }
+
+                if (opening > 1) {
+                    struct Pipelog_Rotate rotate = {
+                        .output    = output,
+                        .state     = state,
+                        .local_now = &local_now,
+                        .flags     = get_outfd_flags,
+                    };
+                    pool_run(rotate_pool, rotate_task, &rotate, count);
+                } else {
+                    for (size_t index = 0; index < count; ++ index) {
+                        state[index].rotate_pending = false;
+                    }
+                }
+            }
+
+            // open the files first, filters may depend on whether it is a new file
+            size_t opened = 0;
+            const uint64_t now_ms = health_now();
             for (size_t index = 0; index < count; ++ index) {
-                int outfd = get_outfd(output, state, index, &local_now, get_outfd_flags);
+                struct Pipelog_State *ptr = &state[index];
+                struct Pipelog_Health *health = &ptr->health;
+                int outfd = -1;
+
+                // an output that is down isn't tried again on every chunk, but once
+                // more at the end, and a standard stream that failed can't be opened
+                // again at all
+                if (!(output[index].flags & (PIPELOG_OUTPUT_RING | PIPELOG_OUTPUT_ROUTE)) && (eof || !health_down(health, now_ms)) &&
+                    (output[index].filename != NULL || health->failures == 0)) {
+                    if (ptr->rotate_pending) {
+                        ptr->rotate_pending = false;
+                        outfd = ptr->rotate_fd;
+                        errno = ptr->rotate_errnum;
+                    } else {
+                        // only the first failure is reported in full, the others are counted
+                        outfd = get_outfd(output, state, index, &local_now, health->failures > 0 ? get_outfd_flags | PIPELOG_QUIET : get_outfd_flags);
+                    }
 
-                if (outfd > -1) {
-                    size_t offset = 0;
-                    while (offset < rcount) {
-                        const ssize_t wcount = write(outfd, buf + offset, rcount - offset);
-                        if (wcount < 0) {
-                            const int errnum = errno;
+                    if (outfd < 0) {
+                        const int errnum = errno;
+                        if (errnum == EINTR || (flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
                             if (!(flags & PIPELOG_QUIET)) {
                                 fprintf(stderr, "*** error: output[%zu]: writing output: %s\n", index, strerror(errnum));
                             }
+                            status = errnum == EINTR ? PIPELOG_INTERRUPTED : PIPELOG_ERROR;
+                            goto cleanup;
+                        }
 
-                            if (errnum == EINTR) {
-                                status = PIPELOG_INTERRUPTED;
-                                goto cleanup;
-                            }
-
-                            if ((flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
-                                status = PIPELOG_ERROR;
-                                goto cleanup;
-                            }
-
-                            if (errnum != EAGAIN) {
-                                state[index].fd = -1;
-                            }
-                            break;
+                        health_failed(health, errnum, now_ms);
+                        if ((health_report_due(health, now_ms) || eof) && !(flags & PIPELOG_QUIET)) {
+                            fprintf(stderr, "*** error: output[%zu]: still failing after %u attempts: %s, %" PRIu64 " bytes kept, %" PRIu64 " bytes dropped\n",
+                                    index, health->failures, strerror(errnum), health->diverted, health->dropped);
                         }
-                        offset += wcount;
                     }
-                } else if (!(flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
+                }
+
+                ptr->write_fd = outfd;
+                opened += ptr->opened;
+            }
+
+            if (opened != planned) {
+                // some file was (re-)opened
+                planned = opened;
+                plan_outputs(output, state, count);
+            }
+
+            for (size_t index = 0; index < count; ++ index) {
+                const int outfd = state[index].write_fd;
+                state[index].write_fd = -1;
+
+                size_t size = transform.result_size[index];
+                const char *data = transform.result[index];
+                if (output[index].flags & PIPELOG_OUTPUT_SHARD) {
+                    data = shard_data(&shards, index, &size);
+                }
+
+                data = filter_output(&output[index], &state[index], data, &size, eof);
+                if (data == NULL) {
                     const int errnum = errno;
                     if (!(flags & PIPELOG_QUIET)) {
-                        fprintf(stderr, "*** error: output[%zu]: writing output: %s\n", index, strerror(errnum));
+                        fprintf(stderr, "*** error: output[%zu]: filtering output: %s\n", index, strerror(errnum));
                     }
-                    status = errnum == EINTR ? PIPELOG_INTERRUPTED : PIPELOG_ERROR;
+                    status = PIPELOG_ERROR;
                     goto cleanup;
                 }
+
+                if (metrics != NULL) {
+                    metrics_output(metrics, index, data, size);
+                }
+
+                if (output[index].flags & PIPELOG_OUTPUT_RING) {
+                    ring_write(&state[index].ring, data, size);
+                    continue;
+                }
+
+                if (state[index].same_as != SIZE_MAX && state[state[index].same_as].write_fd >= 0) {
+                    // written by an earlier output
+                    continue;
+                }
+
+                struct Pipelog_Health *health = &state[index].health;
+                if (outfd < 0 && health->failures > 0) {
+                    health_divert(health, &output[index], data, size);
+                    continue;
+                }
+
+                if (health->spill_size > 0) {
+                    // what was kept while the file was unavailable comes first
+                    if (health_append_spill(health, data, size) != 0) {
+                        if (!(flags & PIPELOG_QUIET)) {
+                            fprintf(stderr, "*** error: output[%zu]: allocating memory: %s\n", index, strerror(errno));
+                        }
+                        status = PIPELOG_ERROR;
+                        goto cleanup;
+                    }
+                    data = health->spill;
+                    size = health->spill_size;
+                }
+
+                if (output[index].flags & PIPELOG_OUTPUT_ROUTE) {
+                    // errors of single files are reported and skipped by route_write()
+                    if (route_write(&state[index].route, data, size, eof, &local_now, get_outfd_flags) != 0) {
+                        const int errnum = errno;
+                        if (!(flags & PIPELOG_QUIET)) {
+                            fprintf(stderr, "*** error: output[%zu]: writing output: %s\n", index, strerror(errnum));
+                        }
+                        status = errnum == EINTR ? PIPELOG_INTERRUPTED : PIPELOG_ERROR;
+                        goto cleanup;
+                    }
+                    continue;
+                }
+
+                state[index].write_fd   = outfd;
+                state[index].write_data = data;
+                state[index].write_size = size;
+            }
+
+            // shards may be on different devices, so one waiting for its device doesn't hold up the others
+            if (shards.pool != NULL) {
+                pool_run(shards.pool, write_task, state, count);
+            } else {
+                for (size_t index = 0; index < count; ++ index) {
+                    write_task(state, index);
+                }
+            }
+
+            for (size_t index = 0; index < count; ++ index) {
+                struct Pipelog_State *ptr = &state[index];
+                struct Pipelog_Health *health = &ptr->health;
+
+                if (ptr->write_fd < 0) {
+                    continue;
+                }
+
+                if (ptr->write_errnum != 0) {
+                    const int errnum = ptr->write_errnum;
+                    // a failing output is reported once, and then from time to time below
+                    if (!(flags & PIPELOG_QUIET) && health->failures == 0) {
+                        fprintf(stderr, "*** error: output[%zu]: writing output: %s\n", index, strerror(errnum));
+                    }
+
+                    if (errnum == EINTR) {
+                        status = PIPELOG_INTERRUPTED;
+                        goto cleanup;
+                    }
+
+                    if ((flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
+                        status = PIPELOG_ERROR;
+                        goto cleanup;
+                    }
+
+                    if (errnum != EAGAIN) {
+                        if (output[index].filename != NULL) {
+                            close(ptr->fd);
+                        }
+                        ptr->fd = -1;
+
+                        const uint64_t now_ms = health_now();
+                        health_failed(health, errnum, now_ms);
+                        if ((health_report_due(health, now_ms) || eof) && !(flags & PIPELOG_QUIET)) {
+                            fprintf(stderr, "*** error: output[%zu]: still failing after %u attempts: %s, %" PRIu64 " bytes kept, %" PRIu64 " bytes dropped\n",
+                                    index, health->failures, strerror(errnum), health->diverted, health->dropped);
+                        }
+                    }
+                } else if (health->failures > 0) {
+                    if (!(flags & PIPELOG_QUIET)) {
+                        fprintf(stderr, "*** error: output[%zu]: writing again after %u failed attempts, %" PRIu64 " bytes kept, %" PRIu64 " bytes dropped\n",
+                                index, health->failures, health->diverted, health->dropped);
+                    }
+                    health_recovered(health);
+                }
+
+                progress_commit(&ptr->progress, ptr->written);
+
+                if (sidecars_write(&ptr->sidecars, &output[index], ptr->write_data, ptr->written, arrival) != 0) {
+                    if (!(flags & PIPELOG_QUIET)) {
+                        fprintf(stderr, "*** error: output[%zu]: writing sidecar files: %s\n", index, strerror(errno));
+                    }
+                    sidecars_close(&ptr->sidecars);
+                }
+
+                if (ptr->write_data == health->spill && ptr->write_size > 0) {
+                    // keep what couldn't be written of the spilled data, regardless of the limit
+                    health->spill_size -= ptr->written;
+                    memmove(health->spill, health->spill + ptr->written, health->spill_size);
+                } else if (health->failures > 0) {
+                    health_divert(health, &output[index], ptr->write_data + ptr->written, ptr->write_size - ptr->written);
+                }
+            }
+
+            if (received_sigusr1) {
+                received_sigusr1 = false;
+                dump_rings(output, state, count, flags);
+            }
+
+            if (metrics != NULL && metrics_tick(metrics, false) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: writing metrics file \"%s\": %s\n", metrics->filename, strerror(errno));
+                }
             }
 
             if (sigprocmask(SIG_UNBLOCK, &mask, NULL) != 0) {
@@ -702,23 +1942,113 @@ int pipelog(const int fd, const struct Pipelog_Output output[], const size_t cou
                 status = PIPELOG_ERROR;
                 goto cleanup;
             }
+
+            if (eof) {
+                break;
+            }
         }
     }
 
 cleanup:
+    if (metrics != NULL) {
+        if (metrics_tick(metrics, true) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: writing metrics file \"%s\": %s\n", metrics->filename, strerror(errno));
+            }
+        }
+        metrics_free(metrics);
+        metrics = NULL;
+    }
+
     for (size_t index = 0; index < init_count; ++ index) {
         struct Pipelog_State *ptr = &state[index];
+        // standard streams end too
+        if (ptr->fd > -1 && (output[index].flags & PIPELOG_OUTPUT_ENCRYPT) && crypt_close(&ptr->crypt, ptr->fd) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: output[%zu]: ending encrypted segment: %s\n", index, strerror(errno));
+            }
+        }
+
         if (ptr->fd > -1 && output[index].filename != NULL) {
             // close file descriptors opened by this function, and only those
             close(ptr->fd);
             ptr->fd = -1;
+
+            if (ptr->replica != NULL && worker_started) {
+                submit_replica(ptr, index, ptr->filename != NULL ? ptr->filename : output[index].filename, true);
+            }
         }
         free(ptr->filename);
         ptr->filename = NULL;
+        free(ptr->replica);
+        ptr->replica = NULL;
+        free(ptr->formatted);
+        ptr->formatted = NULL;
+    }
+
+    if (tee_started) {
+        // the sidecars are closed below
+        tee_started = false;
+        tee_stop(&tee);
+    }
+
+    if (worker_started) {
+        // finish conversions of files that were rotated already
+        worker_started = false;
+        worker_stop(&worker);
+    }
+
+    if (state != NULL) {
+        for (size_t index = 0; index < count; ++ index) {
+            struct Pipelog_State *ptr = &state[index];
+            capture_free(&ptr->capture);
+            templates_free(&ptr->templates);
+            crypt_free(&ptr->crypt);
+            route_free(&ptr->route);
+            health_free(&ptr->health);
+            if (sidecars_close(&ptr->sidecars) != 0) {
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: closing sidecar files: %s\n", index, strerror(errno));
+                }
+                status = PIPELOG_ERROR;
+            }
+            ring_close(&ptr->ring);
+            progress_close(&ptr->progress);
+        }
     }
     free(state);
     state = NULL;
 
+    if (transform_initialized) {
+        transform_initialized = false;
+        transform_free(&transform);
+    }
+
+    if (shards_initialized) {
+        shards_initialized = false;
+        shards_free(&shards);
+    }
+
+    if (rotate_pool != NULL) {
+        pool_destroy(rotate_pool);
+        rotate_pool = NULL;
+    }
+
+    if (readbuf != buf) {
+        free(readbuf);
+        readbuf = buf;
+    }
+
+    if (sigusr1_installed) {
+        sigusr1_installed = false;
+        if (sigaction(SIGUSR1, &old_sigusr1, NULL) != 0) {
+            if (!(flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: restoring SIGUSR1 handler: %s\n", strerror(errno));
+            }
+            status = PIPELOG_ERROR;
+        }
+    }
+
     if (old_handle_sighup != SIG_ERR && signal(SIGHUP, old_handle_sighup) == SIG_ERR) {
         if (!(flags & PIPELOG_QUIET)) {
             fprintf(stderr, "*** error: signal(SIGHUP, old_handle_sighup): %s\n", strerror(errno));
@@ -17,10 +17,74 @@ extern "C" {
 #define PIPELOG_VERSION_MINOR 9
 #define PIPELOG_VERSION_PATCH 0
 
+enum {
+    PIPELOG_OUTPUT_NONE       = 0,
+    PIPELOG_OUTPUT_STRIP_ANSI = 1,
+    PIPELOG_OUTPUT_SANITIZE   = 2,
+    PIPELOG_OUTPUT_CAPTURE    = 4,
+    PIPELOG_OUTPUT_RING       = 8,
+    PIPELOG_OUTPUT_TEMPLATES  = 16,
+    PIPELOG_OUTPUT_COLUMNAR   = 32,
+    PIPELOG_OUTPUT_INDEX      = 64,
+    PIPELOG_OUTPUT_BLOOM      = 128,
+    PIPELOG_OUTPUT_FIELDS     = 256,
+    PIPELOG_OUTPUT_MANIFEST   = 512,
+    PIPELOG_OUTPUT_CHECKSUMS  = 1024,
+    PIPELOG_OUTPUT_CHAIN      = 2048,
+    PIPELOG_OUTPUT_ENCRYPT    = 4096,
+    PIPELOG_OUTPUT_SHARD      = 8192,
+    PIPELOG_OUTPUT_ROUTE      = 16384,
+};
+
+// output flags that need the data in user space
+#define PIPELOG_OUTPUT_FILTERS (PIPELOG_OUTPUT_STRIP_ANSI | PIPELOG_OUTPUT_SANITIZE | PIPELOG_OUTPUT_CAPTURE | PIPELOG_OUTPUT_TEMPLATES | PIPELOG_OUTPUT_INDEX | PIPELOG_OUTPUT_BLOOM | PIPELOG_OUTPUT_FIELDS | PIPELOG_OUTPUT_MANIFEST | PIPELOG_OUTPUT_CHECKSUMS | PIPELOG_OUTPUT_CHAIN | PIPELOG_OUTPUT_ENCRYPT | PIPELOG_OUTPUT_SHARD | PIPELOG_OUTPUT_ROUTE)
+
+#define PIPELOG_CAPTURE_BEFORE_LINES 100
+#define PIPELOG_CAPTURE_BEFORE_BYTES (1024 * 1024)
+#define PIPELOG_CAPTURE_AFTER_LINES   10
+
+#define PIPELOG_INDEX_BYTES    (1024 * 1024)
+#define PIPELOG_INDEX_INTERVAL 60
+
+struct Pipelog_Capture_Options {
+    const char *trigger; //!< POSIX extended regular expression
+    size_t before_lines;
+    size_t before_bytes;
+    size_t after_lines;
+};
+
 struct Pipelog_Output {
     const char *filename;
     const char *link;
     int fd;
+    unsigned int flags;
+    struct Pipelog_Capture_Options capture;
+    size_t ring_size;      //!< size of the data area of the ring file
+    const char *ring_dump; //!< strftime template of ring snapshot files
+    size_t index_bytes;          //!< write a time index entry at least every this many bytes
+    unsigned int index_interval; //!< or seconds
+    size_t bloom_block_size;     //!< size of the blocks of the log file that get a Bloom filter
+    const char *fields;          //!< comma separated keys of the fields to index
+    size_t field_block_size;     //!< size of the blocks the field index refers to
+    const char *progress;        //!< file to publish the writing progress in, for pipelog-follow
+    const char *manifest;        //!< file to record the log files and their state in
+    size_t checksum_block_size;  //!< size of the blocks of the log file that get a CRC-32C
+    size_t chain_block_size;     //!< size of the blocks of the log file that get a chained SHA-256
+    const char *key_file;        //!< file with the master key to encrypt the output with
+    const char *shard;           //!< name of the group of outputs the lines are distributed among
+    const char *shard_key;       //!< field whose value picks the output of a line, NULL for round-robin
+    size_t max_open;             //!< files of a per-field file name kept open, 0 for half of RLIMIT_NOFILE
+    const char *replica;         //!< strftime template of the copy of each log file, or NULL
+    unsigned int replica_interval; //!< seconds between copies of new data to the replica, 0 for only when the file is closed
+    unsigned int fallback;       //!< where data goes while the file can't be opened or written
+    const char *fallback_path;   //!< file for PIPELOG_FALLBACK_FILE
+    size_t spill_size;           //!< bytes kept in memory for PIPELOG_FALLBACK_SPILL
+};
+
+enum {
+    PIPELOG_FALLBACK_DROP  = 0,
+    PIPELOG_FALLBACK_SPILL = 1, //!< keep in memory and write when the file is back
+    PIPELOG_FALLBACK_FILE  = 2, //!< write to another file
 };
 
 enum {
@@ -34,6 +98,29 @@ enum {
     PIPELOG_SPLICE              = 32,
 };
 
+#define PIPELOG_METRICS_INTERVAL 60
+
+#define PIPELOG_MAX_THREADS 256
+
+// threads that open new files when many outputs rotate at once
+#define PIPELOG_ROTATE_THREADS 8
+
+// read size used when line filters run on multiple threads
+#define PIPELOG_PARALLEL_READ_SIZE (1024 * 1024)
+
+struct Pipelog_Counter {
+    const char *name;
+    const char *pattern; //!< POSIX extended regular expression
+};
+
+struct Pipelog_Options {
+    const char *metrics;           //!< Prometheus textfile, NULL to disable metrics
+    unsigned int metrics_interval; //!< seconds
+    const struct Pipelog_Counter *counters;
+    size_t counter_count;
+    unsigned int threads;          //!< threads for line filters, 0 or 1 for none
+};
+
 enum {
     PIPELOG_SUCCESS     = 0,
     PIPELOG_ERROR       = 1,
@@ -42,7 +129,10 @@ enum {
 
 int make_parent_dirs(const char *path, mode_t mode);
 
-int pipelog(int fd, const struct Pipelog_Output output[], size_t count, unsigned int flags);
+/**
+ * options may be NULL.
+ */
+int pipelog(int fd, const struct Pipelog_Output output[], size_t count, const struct Pipelog_Options *options, unsigned int flags);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,172 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+struct Pipelog_Pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t  start;
+    pthread_cond_t  done;
+
+    pthread_t *workers;
+    size_t     worker_count;
+    size_t     threads;
+
+    Pipelog_Task task;
+    void        *context;
+    size_t       count;
+    size_t       next;       //!< next index to take, atomic
+    size_t       pending;    //!< indices not finished yet, atomic
+    size_t       generation; //!< incremented for every pool_run()
+    size_t       active;     //!< workers still working on the current generation
+    bool         stop;
+};
+
+static void run_tasks(struct Pipelog_Pool *pool) {
+    for (;;) {
+        const size_t index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (index >= pool->count) {
+            break;
+        }
+
+        pool->task(pool->context, index);
+
+        if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+            pthread_mutex_lock(&pool->mutex);
+            pthread_cond_broadcast(&pool->done);
+            pthread_mutex_unlock(&pool->mutex);
+        }
+    }
+}
+
+static void *worker(void *arg) {
+    struct Pipelog_Pool *pool = arg;
+    size_t generation = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->stop && pool->generation == generation) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+
+        if (pool->stop) {
+            break;
+        }
+
+        generation = pool->generation;
+        ++ pool->active;
+        pthread_mutex_unlock(&pool->mutex);
+
+        run_tasks(pool);
+
+        pthread_mutex_lock(&pool->mutex);
+        -- pool->active;
+        pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+struct Pipelog_Pool *pool_create(size_t threads) {
+    if (threads == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct Pipelog_Pool *pool = calloc(1, sizeof(struct Pipelog_Pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->threads = threads;
+    pool->workers = calloc(threads > 1 ? threads - 1 : 1, sizeof(pthread_t));
+    if (pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // signals are handled by the main thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    int errnum = 0;
+    for (; pool->worker_count < threads - 1; ++ pool->worker_count) {
+        errnum = pthread_create(&pool->workers[pool->worker_count], NULL, worker, pool);
+        if (errnum != 0) {
+            break;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (errnum != 0) {
+        pool_destroy(pool);
+        errno = errnum;
+        return NULL;
+    }
+
+    return pool;
+}
+
+size_t pool_threads(const struct Pipelog_Pool *pool) {
+    return pool->threads;
+}
+
+void pool_run(struct Pipelog_Pool *pool, Pipelog_Task task, void *context, size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    // workers of the last generation may still be on their way out of run_tasks()
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pool->task    = task;
+    pool->context = context;
+    pool->count   = count;
+    pool->next    = 0;
+    pool->pending = count;
+    ++ pool->generation;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    run_tasks(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_destroy(struct Pipelog_Pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t index = 0; index < pool->worker_count; ++ index) {
+        pthread_join(pool->workers[index], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+
+    free(pool->workers);
+    free(pool);
+}
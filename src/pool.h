@@ -0,0 +1,39 @@
+#ifndef PIPELOG_POOL_H
+#define PIPELOG_POOL_H
+#pragma once
+
+#include "pipelog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct Pipelog_Pool;
+
+typedef void (*Pipelog_Task)(void *context, size_t index);
+
+/**
+ * Create a pool that runs tasks on threads threads in total, including the
+ * thread calling pool_run(). Worker threads block all signals.
+ *
+ * Returns NULL and sets errno on error.
+ */
+struct Pipelog_Pool *pool_create(size_t threads);
+
+size_t pool_threads(const struct Pipelog_Pool *pool);
+
+/**
+ * Call task(context, index) for every index in [0, count) and return when
+ * all calls are done. Idle threads take the next index as soon as they are
+ * done with the previous one, so uneven tasks are balanced. The calling
+ * thread participates.
+ */
+void pool_run(struct Pipelog_Pool *pool, Pipelog_Task task, void *context, size_t count);
+
+void pool_destroy(struct Pipelog_Pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
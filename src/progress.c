@@ -0,0 +1,251 @@
+#include "progress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// tries to read a consistent snapshot before sleeping a bit
+#define PROGRESS_SPINS 100
+
+static void futex_wait(uint32_t *addr, uint32_t value, int timeout_ms) {
+    struct timespec timeout = {
+        .tv_sec  = timeout_ms / 1000,
+        .tv_nsec = (long)(timeout_ms % 1000) * 1000000,
+    };
+    // a shared futex: pipelog and the followers map the same file
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static void write_begin(struct Pipelog_Progress_Header *header) {
+    const uint32_t seq = __atomic_load_n(&header->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(struct Pipelog_Progress_Header *header) {
+    const uint32_t seq = __atomic_load_n(&header->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->seq, seq + 1, __ATOMIC_SEQ_CST);
+
+    // pairs with the increment of waiters in progress_wait()
+    if (__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST) != 0) {
+        futex_wake(&header->seq);
+    }
+}
+
+int progress_open(struct Pipelog_Progress *progress, const char *filename, bool writer) {
+    struct Pipelog_Progress_Header header;
+    struct stat meta;
+    bool valid = false;
+
+    progress->fd       = -1;
+    progress->writer   = writer;
+    progress->readonly = false;
+    progress->header   = NULL;
+
+    int fd = open(filename, writer ? O_CREAT | O_RDWR | O_CLOEXEC : O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT && writer) {
+        if (make_parent_dirs(filename, 0755) != 0) {
+            return -1;
+        }
+        fd = open(filename, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    } else if (fd < 0 && errno == EACCES && !writer) {
+        // can still follow, but without being woken up
+        fd = open(filename, O_RDONLY | O_CLOEXEC);
+        progress->readonly = true;
+    }
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &meta) != 0) {
+        goto error;
+    }
+
+    if (meta.st_size == sizeof(header) &&
+        pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.magic, PIPELOG_PROGRESS_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == PIPELOG_PROGRESS_VERSION) {
+        valid = true;
+    }
+
+    if (!writer) {
+        if (!valid) {
+            errno = EINVAL;
+            goto error;
+        }
+    } else if (!valid && meta.st_size != 0) {
+        // don't overwrite something that isn't a progress file
+        errno = EEXIST;
+        goto error;
+    } else if (!valid) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PIPELOG_PROGRESS_MAGIC, sizeof(header.magic));
+        header.version = PIPELOG_PROGRESS_VERSION;
+
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            goto error;
+        }
+    }
+
+    void *map = mmap(NULL, sizeof(header), progress->readonly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        goto error;
+    }
+
+    progress->fd     = fd;
+    progress->header = map;
+
+    if (writer) {
+        // followers of an earlier run continue with the next generation
+        write_begin(progress->header);
+        __atomic_store_n(&progress->header->closed, 0, __ATOMIC_RELAXED);
+        write_end(progress->header);
+    }
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        close(fd);
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+int progress_rotate(struct Pipelog_Progress *progress, const char *filename, uint64_t size) {
+    char buf[PATH_MAX];
+    struct Pipelog_Progress_Header *header = progress->header;
+
+    if (header == NULL) {
+        return 0;
+    }
+
+    // followers may run in another directory
+    const char *path = realpath(filename, buf);
+    if (path == NULL) {
+        return -1;
+    }
+
+    const uint64_t generation = header->generation;
+    const uint64_t offset = header->offset;
+    struct Pipelog_Progress_File *current = &header->files[generation % PIPELOG_PROGRESS_FILES];
+    struct Pipelog_Progress_File *next = &header->files[(generation + 1) % PIPELOG_PROGRESS_FILES];
+    const size_t path_size = strlen(path) + 1;
+
+    write_begin(header);
+    __atomic_store_n(&current->end, offset, __ATOMIC_RELAXED);
+    __atomic_store_n(&next->start, size, __ATOMIC_RELAXED);
+    __atomic_store_n(&next->end, size, __ATOMIC_RELAXED);
+    memcpy(next->filename, path, path_size);
+    __atomic_store_n(&header->offset, size, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->generation, generation + 1, __ATOMIC_RELAXED);
+    write_end(header);
+
+    return 0;
+}
+
+void progress_commit(struct Pipelog_Progress *progress, uint64_t size) {
+    struct Pipelog_Progress_Header *header = progress->header;
+
+    if (header == NULL || size == 0) {
+        return;
+    }
+
+    write_begin(header);
+    __atomic_store_n(&header->offset, header->offset + size, __ATOMIC_RELAXED);
+    write_end(header);
+}
+
+bool progress_snapshot(const struct Pipelog_Progress *progress, struct Pipelog_Progress_Snapshot *snapshot,
+                       uint64_t generation, struct Pipelog_Progress_File *file, struct Pipelog_Progress_File *next) {
+    struct Pipelog_Progress_Header *header = progress->header;
+    unsigned int spins = 0;
+
+    for (;;) {
+        const uint32_t seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            // pipelog is in the middle of an update (or died there)
+            if (++ spins < PROGRESS_SPINS) {
+                sched_yield();
+            } else {
+                futex_wait(&header->seq, seq, 10);
+            }
+            continue;
+        }
+
+        snapshot->seq        = seq;
+        snapshot->closed     = __atomic_load_n(&header->closed, __ATOMIC_RELAXED) != 0;
+        snapshot->generation = __atomic_load_n(&header->generation, __ATOMIC_RELAXED);
+        snapshot->offset     = __atomic_load_n(&header->offset, __ATOMIC_RELAXED);
+
+        if (file != NULL) {
+            memcpy(file, &header->files[generation % PIPELOG_PROGRESS_FILES], sizeof(*file));
+        }
+
+        if (next != NULL) {
+            memcpy(next, &header->files[(generation + 1) % PIPELOG_PROGRESS_FILES], sizeof(*next));
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&header->seq, __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+    }
+
+    if (file != NULL) {
+        file->filename[sizeof(file->filename) - 1] = 0;
+    }
+
+    if (next != NULL) {
+        next->filename[sizeof(next->filename) - 1] = 0;
+    }
+
+    return generation <= snapshot->generation && snapshot->generation - generation < PIPELOG_PROGRESS_FILES;
+}
+
+void progress_wait(struct Pipelog_Progress *progress, const struct Pipelog_Progress_Snapshot *snapshot, int timeout_ms) {
+    struct Pipelog_Progress_Header *header = progress->header;
+
+    if (progress->readonly) {
+        futex_wait(&header->seq, snapshot->seq, timeout_ms);
+        return;
+    }
+
+    __atomic_add_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+    // the kernel compares seq again, so a change before the call isn't missed
+    futex_wait(&header->seq, snapshot->seq, timeout_ms);
+    __atomic_sub_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+void progress_close(struct Pipelog_Progress *progress) {
+    if (progress->header != NULL) {
+        if (progress->writer) {
+            write_begin(progress->header);
+            __atomic_store_n(&progress->header->closed, 1, __ATOMIC_RELAXED);
+            write_end(progress->header);
+        }
+        munmap(progress->header, sizeof(struct Pipelog_Progress_Header));
+        progress->header = NULL;
+    }
+
+    if (progress->fd >= 0) {
+        close(progress->fd);
+        progress->fd = -1;
+    }
+}
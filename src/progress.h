@@ -0,0 +1,116 @@
+#ifndef PIPELOG_PROGRESS_H
+#define PIPELOG_PROGRESS_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_PROGRESS_MAGIC "PLGPRG1"
+#define PIPELOG_PROGRESS_VERSION 1
+// number of files a follower can fall behind
+#define PIPELOG_PROGRESS_FILES 16
+
+struct Pipelog_Progress_File {
+    uint64_t start; //!< size of the file when it was opened
+    uint64_t end;   //!< size of the file when it was closed
+    char     filename[PATH_MAX]; //!< absolute path
+};
+
+/**
+ * Memory mapped progress file, written by pipelog and read by followers.
+ *
+ * The fields after seq are protected by a sequence lock: seq is odd while
+ * pipelog changes them and incremented again afterwards. seq is also a
+ * futex, so followers can sleep until it changes. pipelog only calls
+ * FUTEX_WAKE if waiters isn't 0, so publishing costs no system call when
+ * nobody waits.
+ *
+ * Every file pipelog opens gets a new generation. files[generation %
+ * PIPELOG_PROGRESS_FILES] describes it; its end is only valid once a newer
+ * generation exists. offset is the size of the current file up to which
+ * the data is completely written.
+ */
+struct Pipelog_Progress_Header {
+    char     magic[8];
+    uint64_t version;
+    uint32_t seq;
+    uint32_t waiters;
+    uint32_t closed;  //!< pipelog exited
+    uint32_t reserved;
+    uint64_t generation;
+    uint64_t offset;
+    struct Pipelog_Progress_File files[PIPELOG_PROGRESS_FILES];
+};
+
+struct Pipelog_Progress {
+    int fd;
+    bool writer;
+    bool readonly; //!< mapped read-only
+    struct Pipelog_Progress_Header *header;
+};
+
+/**
+ * Consistent copy of the state of the header.
+ */
+struct Pipelog_Progress_Snapshot {
+    uint32_t seq;
+    bool     closed;
+    uint64_t generation;
+    uint64_t offset;
+};
+
+/**
+ * Open or create the progress file filename. If writer is false it has to
+ * exist already. It is mapped read-only if it can't be opened for writing.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int progress_open(struct Pipelog_Progress *progress, const char *filename, bool writer);
+
+/**
+ * Publish that pipelog opened filename, which has a size of size bytes.
+ * The previous file ends at the current offset.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int progress_rotate(struct Pipelog_Progress *progress, const char *filename, uint64_t size);
+
+/**
+ * Publish that size more bytes were written to the current file.
+ */
+void progress_commit(struct Pipelog_Progress *progress, uint64_t size);
+
+/**
+ * Read a consistent snapshot. If file isn't NULL the entry of generation
+ * is copied to it, and if next isn't NULL the entry of generation + 1.
+ *
+ * Returns false if the entries were overwritten by newer generations.
+ */
+bool progress_snapshot(const struct Pipelog_Progress *progress, struct Pipelog_Progress_Snapshot *snapshot,
+                       uint64_t generation, struct Pipelog_Progress_File *file, struct Pipelog_Progress_File *next);
+
+/**
+ * Sleep until seq isn't snapshot->seq anymore, or for at most timeout_ms
+ * (-1 for no limit). Followers that mapped the file read-only can't tell
+ * pipelog to wake them and should use a timeout.
+ */
+void progress_wait(struct Pipelog_Progress *progress, const struct Pipelog_Progress_Snapshot *snapshot, int timeout_ms);
+
+/**
+ * If this is the writer publish that pipelog exited. Does nothing if the
+ * file was never successfully opened.
+ */
+void progress_close(struct Pipelog_Progress *progress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+#include "replica.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+// for file systems and kernels copy_file_range() doesn't work with
+static int copy_range(int infd, int outfd, off_t offset, off_t end) {
+    char buf[BUFSIZ];
+
+    while (offset < end) {
+        const size_t size = end - offset < (off_t)sizeof(buf) ? (size_t)(end - offset) : sizeof(buf);
+        const ssize_t rcount = pread(infd, buf, size, offset);
+        if (rcount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (rcount == 0) {
+            break;
+        }
+
+        ssize_t written = 0;
+        while (written < rcount) {
+            const ssize_t wcount = pwrite(outfd, buf + written, rcount - written, offset + written);
+            if (wcount < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            written += wcount;
+        }
+        offset += rcount;
+    }
+
+    return 0;
+}
+
+int replica_sync(const char *filename, const char *replica, bool clone, bool fresh) {
+    struct stat in_meta;
+    struct stat out_meta;
+    int status = -1;
+    int outfd = -1;
+
+    const int infd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (infd < 0) {
+        return -1;
+    }
+
+    outfd = open(replica, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+    if (outfd < 0 && errno == ENOENT) {
+        if (make_parent_dirs(replica, 0755) != 0) {
+            goto cleanup;
+        }
+        outfd = open(replica, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+    }
+
+    if (outfd < 0) {
+        goto cleanup;
+    }
+
+    if (clone && ioctl(outfd, FICLONE, infd) == 0) {
+        status = 0;
+        goto cleanup;
+    }
+
+    if (fstat(infd, &in_meta) != 0 || fstat(outfd, &out_meta) != 0) {
+        goto cleanup;
+    }
+
+    off_t in_offset  = out_meta.st_size;
+    off_t out_offset = out_meta.st_size;
+
+    // whatever a replica had before this process copied to it isn't a prefix of filename
+    if (fresh || out_meta.st_size > in_meta.st_size) {
+        if (ftruncate(outfd, 0) != 0) {
+            goto cleanup;
+        }
+        in_offset = out_offset = 0;
+    }
+
+    while (in_offset < in_meta.st_size) {
+        // shares the blocks too where the file system can, otherwise copies in the kernel
+        const ssize_t count = copy_file_range(infd, &in_offset, outfd, &out_offset, in_meta.st_size - in_offset, 0);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+                if (copy_range(infd, outfd, in_offset, in_meta.st_size) != 0) {
+                    goto cleanup;
+                }
+                break;
+            }
+            goto cleanup;
+        }
+        if (count == 0) {
+            // filename got shorter meanwhile
+            break;
+        }
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        close(infd);
+        if (outfd >= 0 && close(outfd) != 0 && status == 0) {
+            status = -1;
+        } else {
+            errno = errnum;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,35 @@
+#ifndef PIPELOG_REPLICA_H
+#define PIPELOG_REPLICA_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// seconds between copies of the new data of a log file to its replica
+#define PIPELOG_REPLICA_INTERVAL 60
+
+/**
+ * Bring replica up to date with filename without reading the data into user
+ * space. If clone is true, which is meant for complete files, replica is
+ * made a reflink (FICLONE) of filename, so both share their blocks on file
+ * systems like XFS and btrfs. Otherwise, or if cloning isn't supported, the
+ * bytes filename has beyond the size of replica are appended with
+ * copy_file_range(). If fresh is true, i.e. on the first copy since filename
+ * was opened, or if replica is bigger than filename, replica is copied anew.
+ *
+ * Missing parent directories of replica are created.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int replica_sync(const char *filename, const char *replica, bool clone, bool fresh);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+#include "ring.h"
+#include "util.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int ring_open(struct Pipelog_Ring *ring, const char *filename, size_t size) {
+    const bool readonly = size == 0;
+    struct Pipelog_Ring_Header header;
+    struct stat meta;
+    bool valid = false;
+    int errnum = 0;
+
+    ring->fd     = -1;
+    ring->map    = NULL;
+    ring->size   = 0;
+    ring->header = NULL;
+
+    int fd = open(filename, readonly ? O_RDONLY | O_CLOEXEC : O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT && !readonly) {
+        if (make_parent_dirs(filename, 0755) != 0) {
+            return -1;
+        }
+        fd = open(filename, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    }
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &meta) != 0) {
+        goto error;
+    }
+
+    if (meta.st_size >= PIPELOG_RING_HEADER_SIZE &&
+        pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.magic, PIPELOG_RING_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == PIPELOG_RING_VERSION &&
+        header.size == (uint64_t)(meta.st_size - PIPELOG_RING_HEADER_SIZE)) {
+        valid = true;
+    }
+
+    if (readonly) {
+        if (!valid) {
+            errno = EINVAL;
+            goto error;
+        }
+        size = header.size;
+    } else if (!valid && meta.st_size != 0) {
+        // don't overwrite something that isn't a ring file
+        errno = EEXIST;
+        goto error;
+    } else if (!valid || header.size != size) {
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, PIPELOG_RING_HEADER_SIZE + size) != 0) {
+            goto error;
+        }
+
+        // reserve the space now so writing never fails with ENOSPC later
+        errnum = posix_fallocate(fd, 0, PIPELOG_RING_HEADER_SIZE + size);
+        if (errnum != 0) {
+            errno = errnum;
+            goto error;
+        }
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PIPELOG_RING_MAGIC, sizeof(header.magic));
+        header.version = PIPELOG_RING_VERSION;
+        header.size    = size;
+        header.head    = 0;
+
+        if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            goto error;
+        }
+    }
+
+    char *map = mmap(NULL, PIPELOG_RING_HEADER_SIZE + size, readonly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        goto error;
+    }
+
+    ring->fd     = fd;
+    ring->map    = map;
+    ring->size   = size;
+    ring->header = (struct Pipelog_Ring_Header*)map;
+
+    return 0;
+
+error:
+    errnum = errno;
+    close(fd);
+    errno = errnum;
+
+    return -1;
+}
+
+void ring_write(struct Pipelog_Ring *ring, const char *data, size_t size) {
+    uint64_t head = ring->header->head;
+
+    if (size > ring->size) {
+        // only the end fits
+        head += size - ring->size;
+        data += size - ring->size;
+        size  = ring->size;
+    }
+
+    char *area = ring->map + PIPELOG_RING_HEADER_SIZE;
+    const size_t offset = head % ring->size;
+    const size_t tail = ring->size - offset;
+
+    if (size <= tail) {
+        memcpy(area + offset, data, size);
+    } else {
+        memcpy(area + offset, data, tail);
+        memcpy(area, data + tail, size - tail);
+    }
+
+    // publish the new head only after the data is in place
+    __atomic_store_n(&ring->header->head, head + size, __ATOMIC_RELEASE);
+}
+
+int ring_dump(const struct Pipelog_Ring *ring, int fd) {
+    const uint64_t head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+    const size_t size = head < ring->size ? head : ring->size;
+    const size_t offset = (head - size) % ring->size;
+    const size_t tail = ring->size - offset;
+    const char *area = ring->map + PIPELOG_RING_HEADER_SIZE;
+
+    if (size <= tail) {
+        return write_all(fd, area + offset, size);
+    }
+
+    if (write_all(fd, area + offset, tail) != 0) {
+        return -1;
+    }
+
+    return write_all(fd, area, size - tail);
+}
+
+void ring_close(struct Pipelog_Ring *ring) {
+    if (ring->map == NULL) {
+        // never opened
+        return;
+    }
+
+    munmap(ring->map, PIPELOG_RING_HEADER_SIZE + ring->size);
+    close(ring->fd);
+
+    ring->map    = NULL;
+    ring->header = NULL;
+    ring->fd     = -1;
+}
@@ -0,0 +1,59 @@
+#ifndef PIPELOG_RING_H
+#define PIPELOG_RING_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_RING_MAGIC "PLGRING"
+#define PIPELOG_RING_VERSION 1
+#define PIPELOG_RING_HEADER_SIZE 4096
+
+struct Pipelog_Ring_Header {
+    char     magic[8];
+    uint64_t version;
+    uint64_t size; //!< size of the data area following the header page
+    uint64_t head; //!< total number of bytes ever written
+};
+
+struct Pipelog_Ring {
+    int    fd;
+    char  *map;
+    size_t size; //!< size of the data area
+    struct Pipelog_Ring_Header *header;
+};
+
+/**
+ * Open or create a ring file with a data area of size bytes. If the file
+ * already is a ring file of the same size its contents are kept. If size
+ * is 0 the file has to exist already and is mapped read-only.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int ring_open(struct Pipelog_Ring *ring, const char *filename, size_t size);
+
+void ring_write(struct Pipelog_Ring *ring, const char *data, size_t size);
+
+/**
+ * Write the contents of the ring, oldest data first, to fd.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int ring_dump(const struct Pipelog_Ring *ring, int fd);
+
+/**
+ * Does nothing if the ring was never successfully opened.
+ */
+void ring_close(struct Pipelog_Ring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
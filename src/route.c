@@ -0,0 +1,701 @@
+#include "route.h"
+#include "fields.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+static uint64_t hash_key(const char *key, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t index = 0; index < size; ++ index) {
+        hash ^= (unsigned char)key[index];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/**
+ * Calls field(context, name, size) for every %{name} and literal(context,
+ * text, size) for the text in between. %% is passed on as literal.
+ *
+ * Returns 0 on success, -1 and sets errno to EINVAL if a reference isn't
+ * closed or empty, or the return value of a callback.
+ */
+typedef int (*Route_Part)(void *context, const char *text, size_t size);
+
+static int parse_pattern(const char *filename, Route_Part literal, Route_Part field, void *context) {
+    const char *ptr = filename;
+    const char *start = filename;
+    int result = 0;
+
+    while (*ptr) {
+        if (ptr[0] != '%') {
+            ++ ptr;
+            continue;
+        }
+
+        if (ptr[1] == '%') {
+            ptr += 2;
+            continue;
+        }
+
+        if (ptr[1] != '{') {
+            ++ ptr;
+            continue;
+        }
+
+        const char *end = strchr(ptr + 2, '}');
+        if (end == NULL || end == ptr + 2) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (ptr > start && (result = literal(context, start, ptr - start)) != 0) {
+            return result;
+        }
+
+        if ((result = field(context, ptr + 2, end - ptr - 2)) != 0) {
+            return result;
+        }
+
+        ptr = start = end + 1;
+    }
+
+    if (ptr > start) {
+        result = literal(context, start, ptr - start);
+    }
+
+    return result;
+}
+
+static int ignore_part(void *context, const char *text, size_t size) {
+    return 0;
+}
+
+static int count_field(void *context, const char *text, size_t size) {
+    *(size_t*)context += 1;
+    return 0;
+}
+
+bool route_has_fields(const char *filename) {
+    size_t count = 0;
+    // a malformed reference counts, so that route_init() reports it
+    return parse_pattern(filename, ignore_part, count_field, &count) != 0 || count > 0;
+}
+
+static int add_field(void *context, const char *name, size_t size) {
+    struct Pipelog_Route *route = context;
+
+    if (route->field_count == PIPELOG_ROUTE_MAX_FIELDS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    route->fields[route->field_count]      = name;
+    route->field_sizes[route->field_count] = size;
+    ++ route->field_count;
+
+    return 0;
+}
+
+int route_init(struct Pipelog_Route *route, const char *filename, size_t max_open, struct Pipelog_Pool *pool, size_t index) {
+    memset(route, 0, sizeof(*route));
+    route->filename = filename;
+    route->pool     = pool;
+    route->index    = index;
+
+    if (parse_pattern(filename, ignore_part, add_field, route) != 0) {
+        return -1;
+    }
+
+    if (route->field_count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (max_open == 0) {
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            return -1;
+        }
+        max_open = limit.rlim_cur == RLIM_INFINITY ? 4096 : limit.rlim_cur / 2;
+        if (max_open < 8) {
+            max_open = 8;
+        }
+    }
+    route->max_open = max_open;
+
+    route->batch_capacity = max_open < 1024 ? max_open : 1024;
+    route->batch = malloc(route->batch_capacity * sizeof(struct Pipelog_Route_Entry*));
+    if (route->batch == NULL) {
+        return -1;
+    }
+
+    route->bucket_count = 64;
+    route->buckets = calloc(route->bucket_count, sizeof(struct Pipelog_Route_Entry*));
+    if (route->buckets == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void lru_unlink(struct Pipelog_Route *route, struct Pipelog_Route_Entry *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        route->lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        route->lru_tail = entry->lru_prev;
+    }
+
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push(struct Pipelog_Route *route, struct Pipelog_Route_Entry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = route->lru_head;
+    if (route->lru_head != NULL) {
+        route->lru_head->lru_prev = entry;
+    } else {
+        route->lru_tail = entry;
+    }
+    route->lru_head = entry;
+}
+
+static void close_entry(struct Pipelog_Route *route, struct Pipelog_Route_Entry *entry, unsigned int flags) {
+    if (entry->fd < 0) {
+        return;
+    }
+
+    lru_unlink(route, entry);
+    if (close(entry->fd) != 0 && !(flags & PIPELOG_QUIET)) {
+        fprintf(stderr, "*** error: output[%zu]: closing file \"%s\": %s\n", route->index, entry->filename, strerror(errno));
+    }
+    entry->fd = -1;
+    -- route->open_count;
+}
+
+static void free_entry(struct Pipelog_Route_Entry *entry) {
+    free(entry->key);
+    free(entry->pattern);
+    free(entry->filename);
+    free(entry->iov);
+    free(entry);
+}
+
+// removes an entry without open file and without lines from the map
+static void remove_entry(struct Pipelog_Route *route, struct Pipelog_Route_Entry *entry) {
+    struct Pipelog_Route_Entry **ptr = &route->buckets[entry->hash & (route->bucket_count - 1)];
+
+    while (*ptr != entry) {
+        ptr = &(*ptr)->bucket_next;
+    }
+    *ptr = entry->bucket_next;
+
+    -- route->entry_count;
+    free_entry(entry);
+}
+
+// closes the least recently written file, and forgets it if it has no lines
+static void evict(struct Pipelog_Route *route, unsigned int flags) {
+    struct Pipelog_Route_Entry *entry = route->lru_tail;
+
+    close_entry(route, entry, flags);
+    if (!entry->dirty) {
+        remove_entry(route, entry);
+    }
+}
+
+static int grow_buckets(struct Pipelog_Route *route) {
+    const size_t bucket_count = route->bucket_count * 2;
+    struct Pipelog_Route_Entry **buckets = calloc(bucket_count, sizeof(struct Pipelog_Route_Entry*));
+
+    if (buckets == NULL) {
+        return -1;
+    }
+
+    for (size_t index = 0; index < route->bucket_count; ++ index) {
+        struct Pipelog_Route_Entry *entry = route->buckets[index];
+        while (entry != NULL) {
+            struct Pipelog_Route_Entry *next = entry->bucket_next;
+            const size_t slot = entry->hash & (bucket_count - 1);
+            entry->bucket_next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+
+    free(route->buckets);
+    route->buckets = buckets;
+    route->bucket_count = bucket_count;
+
+    return 0;
+}
+
+struct Pattern_Builder {
+    char  *buf;
+    size_t size;
+    size_t capacity;
+    const char *value; //!< of the next field, in the key
+};
+
+static int put_literal(void *context, const char *text, size_t size) {
+    struct Pattern_Builder *builder = context;
+
+    if (reserve(&builder->buf, &builder->capacity, builder->size + size + 1) != 0) {
+        return -1;
+    }
+    memcpy(builder->buf + builder->size, text, size);
+    builder->size += size;
+
+    return 0;
+}
+
+// values are escaped for strftime
+static int put_value(void *context, const char *name, size_t name_size) {
+    struct Pattern_Builder *builder = context;
+    const size_t size = strlen(builder->value);
+
+    if (reserve(&builder->buf, &builder->capacity, builder->size + size * 2 + 1) != 0) {
+        return -1;
+    }
+
+    for (const char *ptr = builder->value; *ptr; ++ ptr) {
+        if (*ptr == '%') {
+            builder->buf[builder->size ++] = '%';
+        }
+        builder->buf[builder->size ++] = *ptr;
+    }
+    builder->value += size + 1;
+
+    return 0;
+}
+
+static struct Pipelog_Route_Entry *get_entry(struct Pipelog_Route *route, const char *key, size_t key_size) {
+    const uint64_t hash = hash_key(key, key_size);
+
+    for (struct Pipelog_Route_Entry *entry = route->buckets[hash & (route->bucket_count - 1)]; entry != NULL; entry = entry->bucket_next) {
+        if (entry->hash == hash && entry->key_size == key_size && memcmp(entry->key, key, key_size) == 0) {
+            return entry;
+        }
+    }
+
+    if (route->entry_count >= route->bucket_count && grow_buckets(route) != 0) {
+        return NULL;
+    }
+
+    struct Pipelog_Route_Entry *entry = calloc(1, sizeof(struct Pipelog_Route_Entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->fd = -1;
+
+    entry->key = malloc(key_size);
+    if (entry->key == NULL) {
+        free_entry(entry);
+        return NULL;
+    }
+    memcpy(entry->key, key, key_size);
+    entry->key_size = key_size;
+    entry->hash     = hash;
+
+    struct Pattern_Builder builder = { .buf = NULL, .size = 0, .capacity = 0, .value = key };
+    if (parse_pattern(route->filename, put_literal, put_value, &builder) != 0) {
+        free(builder.buf);
+        free_entry(entry);
+        return NULL;
+    }
+    builder.buf[builder.size] = 0;
+    entry->pattern = builder.buf;
+
+    const size_t slot = hash & (route->bucket_count - 1);
+    entry->bucket_next = route->buckets[slot];
+    route->buckets[slot] = entry;
+    ++ route->entry_count;
+
+    return entry;
+}
+
+// appends the value to the key, without characters that would change the path
+static int put_key_value(struct Pipelog_Route *route, size_t *key_size, const char *value, size_t size) {
+    if (size > NAME_MAX) {
+        size = NAME_MAX;
+    }
+
+    if (reserve(&route->key, &route->key_capacity, *key_size + size + sizeof(PIPELOG_ROUTE_MISSING)) != 0) {
+        return -1;
+    }
+
+    char *out = route->key + *key_size;
+    if (size == 0 || (size == 1 && value[0] == '.') || (size == 2 && value[0] == '.' && value[1] == '.')) {
+        memcpy(out, PIPELOG_ROUTE_MISSING, sizeof(PIPELOG_ROUTE_MISSING));
+        *key_size += sizeof(PIPELOG_ROUTE_MISSING);
+        return 0;
+    }
+
+    for (size_t index = 0; index < size; ++ index) {
+        const unsigned char ch = value[index];
+        out[index] = ch == '/' || ch == '\\' || ch < 0x20 || ch == 0x7f ? '_' : ch;
+    }
+    out[size] = 0;
+    *key_size += size + 1;
+
+    return 0;
+}
+
+static int route_line(struct Pipelog_Route *route, const char *line, size_t size) {
+    struct Pipelog_Field fields[PIPELOG_MAX_FIELDS];
+    const size_t field_count = parse_fields(line, size, fields, PIPELOG_MAX_FIELDS);
+    size_t key_size = 0;
+
+    for (size_t index = 0; index < route->field_count; ++ index) {
+        const char *value = NULL;
+        size_t value_size = 0;
+
+        for (size_t field_index = 0; field_index < field_count; ++ field_index) {
+            if (fields[field_index].key_size == route->field_sizes[index] &&
+                memcmp(fields[field_index].key, route->fields[index], route->field_sizes[index]) == 0) {
+                value      = fields[field_index].value;
+                value_size = fields[field_index].value_size;
+                break;
+            }
+        }
+
+        if (put_key_value(route, &key_size, value, value_size) != 0) {
+            return -1;
+        }
+    }
+
+    struct Pipelog_Route_Entry *entry = get_entry(route, route->key, key_size);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    if (entry->iov_count == entry->iov_capacity) {
+        const size_t capacity = entry->iov_capacity == 0 ? 16 : entry->iov_capacity * 2;
+        struct iovec *iov = realloc(entry->iov, capacity * sizeof(struct iovec));
+        if (iov == NULL) {
+            return -1;
+        }
+        entry->iov = iov;
+        entry->iov_capacity = capacity;
+    }
+
+    entry->iov[entry->iov_count ++] = (struct iovec){
+        .iov_base = (void*)line,
+        .iov_len  = size,
+    };
+
+    if (!entry->dirty) {
+        entry->dirty = true;
+        entry->dirty_next = route->dirty;
+        route->dirty = entry;
+    }
+
+    return 0;
+}
+
+// formats the file name of entry and closes its file if the name changed
+static int prepare_entry(struct Pipelog_Route *route, struct Pipelog_Route_Entry *entry, unsigned int flags) {
+    if (entry->filename != NULL && entry->generation == route->generation) {
+        return 0;
+    }
+
+    char buf[PATH_MAX];
+
+    if (strftime(buf, sizeof(buf), entry->pattern, &route->local_now) == 0) {
+        if (!(flags & PIPELOG_QUIET)) {
+            fprintf(stderr, "*** error: output[%zu]: cannot format logfile \"%s\": %s\n", route->index, entry->pattern, strerror(ENAMETOOLONG));
+        }
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    entry->generation = route->generation;
+
+    if (entry->filename == NULL || strcmp(entry->filename, buf) != 0) {
+        char *filename = strdup(buf);
+        if (filename == NULL) {
+            return -1;
+        }
+
+        close_entry(route, entry, flags);
+        free(entry->filename);
+        entry->filename = filename;
+    }
+
+    return 0;
+}
+
+// only touches the entry, so it can run on the pool
+static void open_entry(struct Pipelog_Route_Entry *entry) {
+    entry->fd = open(entry->filename, O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND, 0644);
+    if (entry->fd < 0 && errno == ENOENT) {
+        if (make_parent_dirs(entry->filename, 0755) != 0) {
+            entry->open_errnum = errno;
+            return;
+        }
+        entry->fd = open(entry->filename, O_CREAT | O_WRONLY | O_CLOEXEC | O_APPEND, 0644);
+    }
+    entry->open_errnum = entry->fd < 0 ? errno : 0;
+}
+
+static void open_task(void *context, size_t index) {
+    struct Pipelog_Route *route = context;
+    open_entry(route->batch[index]);
+}
+
+static int writev_all(int fd, struct iovec *iov, size_t count) {
+    while (count > 0) {
+        const ssize_t wcount = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+        if (wcount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        size_t rest = wcount;
+        while (count > 0 && rest >= iov->iov_len) {
+            rest -= iov->iov_len;
+            ++ iov;
+            -- count;
+        }
+
+        if (rest > 0) {
+            iov->iov_base = (char*)iov->iov_base + rest;
+            iov->iov_len -= rest;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes and forgets the lines of all entries that have some, in batches of
+ * at most max_open entries. The files of a batch that aren't open yet are
+ * opened together, on the pool if there are several.
+ */
+static int write_dirty(struct Pipelog_Route *route, unsigned int flags) {
+    int status = 0;
+
+    while (route->dirty != NULL) {
+        size_t batch_count = 0;
+        size_t open_count  = 0;
+
+        while (route->dirty != NULL && batch_count < route->batch_capacity) {
+            struct Pipelog_Route_Entry *entry = route->dirty;
+            route->dirty = entry->dirty_next;
+            entry->dirty_next = NULL;
+
+            if (prepare_entry(route, entry, flags) != 0) {
+                if (errno == ENOMEM || (flags & PIPELOG_EXIT_ON_WRITE_ERROR)) {
+                    status = -1;
+                }
+                entry->iov_count = 0;
+                entry->dirty     = false;
+                if (entry->fd < 0) {
+                    remove_entry(route, entry);
+                }
+                continue;
+            }
+
+            if (entry->fd >= 0) {
+                // so the files of this batch are the last to be evicted
+                lru_unlink(route, entry);
+                lru_push(route, entry);
+            }
+
+            route->batch[batch_count ++] = entry;
+        }
+
+        // files that need to be opened first, the others after them
+        for (size_t index = 0; index < batch_count; ++ index) {
+            if (route->batch[index]->fd < 0) {
+                struct Pipelog_Route_Entry *entry = route->batch[index];
+                route->batch[index] = route->batch[open_count];
+                route->batch[open_count ++] = entry;
+            }
+        }
+
+        // the batch has at most max_open entries, so this never closes one of them
+        while (route->open_count + open_count > route->max_open && route->lru_tail != NULL) {
+            evict(route, flags);
+        }
+
+        if (open_count > 1 && route->pool != NULL) {
+            pool_run(route->pool, open_task, route, open_count);
+        } else if (open_count == 1) {
+            open_entry(route->batch[0]);
+        }
+
+        for (size_t index = 0; index < batch_count; ++ index) {
+            struct Pipelog_Route_Entry *entry = route->batch[index];
+
+            if (index < open_count) {
+                if (entry->fd < 0) {
+                    if (!(flags & PIPELOG_QUIET)) {
+                        fprintf(stderr, "*** error: output[%zu]: cannot open file \"%s\": %s\n", route->index, entry->filename, strerror(entry->open_errnum));
+                    }
+                    if (flags & PIPELOG_EXIT_ON_WRITE_ERROR) {
+                        status = -1;
+                    }
+                } else {
+                    ++ route->open_count;
+                    lru_push(route, entry);
+                }
+            }
+
+            if (entry->fd >= 0 && writev_all(entry->fd, entry->iov, entry->iov_count) != 0) {
+                const int errnum = errno;
+                if (!(flags & PIPELOG_QUIET)) {
+                    fprintf(stderr, "*** error: output[%zu]: writing file \"%s\": %s\n", route->index, entry->filename, strerror(errnum));
+                }
+                close_entry(route, entry, flags);
+                if (flags & PIPELOG_EXIT_ON_WRITE_ERROR) {
+                    status = -1;
+                }
+                errno = errnum;
+            }
+
+            entry->iov_count = 0;
+            entry->dirty     = false;
+
+            if (entry->fd < 0) {
+                remove_entry(route, entry);
+            }
+        }
+    }
+
+    return status;
+}
+
+static void close_all(struct Pipelog_Route *route, unsigned int flags) {
+    while (route->lru_tail != NULL) {
+        evict(route, flags);
+    }
+}
+
+int route_write(struct Pipelog_Route *route, const char *data, size_t size, bool flush, const struct tm *local_now, unsigned int flags) {
+    if (route->generation == 0 ||
+        local_now->tm_sec  != route->local_now.tm_sec  || local_now->tm_min != route->local_now.tm_min ||
+        local_now->tm_hour != route->local_now.tm_hour || local_now->tm_mday != route->local_now.tm_mday ||
+        local_now->tm_mon  != route->local_now.tm_mon  || local_now->tm_year != route->local_now.tm_year) {
+        route->local_now = *local_now;
+        ++ route->generation;
+    }
+
+    if (flags & PIPELOG_FORCE_ROTATE) {
+        // re-opened by the next write, e.g. after the files were moved away
+        close_all(route, flags);
+    }
+
+    struct Pipelog_Lines *last = &route->carry[route->current];
+    struct Pipelog_Lines *next = &route->carry[1 - route->current];
+    const char *ptr = data;
+    const char *end = data + size;
+    bool keep_last = false;
+
+    // lines point into data or into last until they are written
+    next->size = 0;
+
+    if (last->size > 0) {
+        const char *newline = memchr(ptr, '\n', end - ptr);
+        const size_t chunk = newline == NULL ? (size_t)(end - ptr) : (size_t)(newline + 1 - ptr);
+
+        if (reserve(&last->line, &last->capacity, last->size + chunk) != 0) {
+            return -1;
+        }
+        memcpy(last->line + last->size, ptr, chunk);
+        last->size += chunk;
+        ptr += chunk;
+
+        if (newline != NULL || flush) {
+            if (route_line(route, last->line, last->size) != 0) {
+                goto error;
+            }
+        } else {
+            keep_last = true;
+        }
+    }
+
+    while (ptr < end) {
+        const char *newline = memchr(ptr, '\n', end - ptr);
+
+        if (newline == NULL) {
+            if (flush) {
+                if (route_line(route, ptr, end - ptr) != 0) {
+                    goto error;
+                }
+            } else {
+                if (reserve(&next->line, &next->capacity, end - ptr) != 0) {
+                    goto error;
+                }
+                memcpy(next->line, ptr, end - ptr);
+                next->size = end - ptr;
+            }
+            break;
+        }
+
+        if (route_line(route, ptr, newline + 1 - ptr) != 0) {
+            goto error;
+        }
+        ptr = newline + 1;
+    }
+
+    const int status = write_dirty(route, flags);
+
+    if (!keep_last) {
+        last->size = 0;
+        route->current = 1 - route->current;
+    }
+
+    return status;
+
+error:
+    {
+        const int errnum = errno;
+        // the lines would point into data, which is gone by the next call
+        for (struct Pipelog_Route_Entry *entry = route->dirty; entry != NULL; entry = entry->dirty_next) {
+            entry->iov_count = 0;
+            entry->dirty = false;
+        }
+        route->dirty = NULL;
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+void route_free(struct Pipelog_Route *route) {
+    if (route->buckets != NULL) {
+        for (size_t index = 0; index < route->bucket_count; ++ index) {
+            struct Pipelog_Route_Entry *entry = route->buckets[index];
+            while (entry != NULL) {
+                struct Pipelog_Route_Entry *next = entry->bucket_next;
+                if (entry->fd >= 0) {
+                    close(entry->fd);
+                }
+                free_entry(entry);
+                entry = next;
+            }
+        }
+    }
+
+    free(route->buckets);
+    free(route->batch);
+    free(route->key);
+    lines_free(&route->carry[0]);
+    lines_free(&route->carry[1]);
+    memset(route, 0, sizeof(*route));
+}
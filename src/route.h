@@ -0,0 +1,125 @@
+#ifndef PIPELOG_ROUTE_H
+#define PIPELOG_ROUTE_H
+#pragma once
+
+#include "pipelog.h"
+#include "lines.h"
+#include "pool.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_ROUTE_MAX_FIELDS 16
+
+// value used for a field that a line doesn't have, or that has no usable characters
+#define PIPELOG_ROUTE_MISSING "_"
+
+struct Pipelog_Route_Entry {
+    char  *key;      //!< field values separated by '\0'
+    size_t key_size;
+    uint64_t hash;
+    char  *pattern;  //!< the file name with the field values, for strftime
+    char  *filename; //!< formatted pattern, NULL until the file is opened
+    uint64_t generation; //!< of the local time filename was formatted with
+    int    fd;       //!< -1 if closed
+    int    open_errnum; //!< of open() on the pool
+    bool   dirty;    //!< has lines in iov
+
+    struct iovec *iov; //!< lines of the current chunk
+    size_t iov_count;
+    size_t iov_capacity;
+
+    struct Pipelog_Route_Entry *bucket_next;
+    struct Pipelog_Route_Entry *dirty_next;
+    struct Pipelog_Route_Entry *lru_prev; //!< towards the most recently written
+    struct Pipelog_Route_Entry *lru_next;
+};
+
+/**
+ * Writes each line to the file named by formatting the file name of the
+ * output with the values of fields of the line, %{FIELD}, and then with
+ * strftime. Lines are collected per file into iovecs and written with one
+ * writev() per file and chunk.
+ *
+ * Open files are kept in a hash map by field values. Only max_open files are
+ * kept open, when another one is needed the one written least recently is
+ * closed. Files are opened with O_APPEND, so closing and re-opening them
+ * loses nothing. Entries of closed files are removed.
+ *
+ * When several files of a chunk need to be opened, e.g. because all of them
+ * rotate at midnight, they are opened on the pool in parallel.
+ */
+struct Pipelog_Route {
+    const char *filename;
+    const char *fields[PIPELOG_ROUTE_MAX_FIELDS]; //!< in the order they appear in filename
+    size_t      field_sizes[PIPELOG_ROUTE_MAX_FIELDS];
+    size_t      field_count;
+
+    struct Pipelog_Route_Entry **buckets;
+    size_t bucket_count;
+    size_t entry_count;
+    size_t open_count;
+    size_t max_open;
+
+    struct Pipelog_Route_Entry *lru_head; //!< most recently written open file
+    struct Pipelog_Route_Entry *lru_tail;
+    struct Pipelog_Route_Entry *dirty;
+
+    struct Pipelog_Route_Entry **batch; //!< entries written together, at most max_open
+    size_t batch_capacity;
+    struct Pipelog_Pool *pool; //!< to open files in parallel, or NULL
+
+    struct Pipelog_Lines carry[2]; //!< incomplete line of the last chunk, and of this chunk
+    size_t current;                //!< carry[current] holds the line of the last chunk
+
+    struct tm local_now;
+    uint64_t  generation; //!< incremented when local_now changes
+
+    char  *key; //!< of the current line
+    size_t key_capacity;
+
+    size_t index; //!< of the output, for error messages
+};
+
+/**
+ * Returns true if filename references fields of lines, i.e. has %{FIELD},
+ * or has a malformed reference.
+ */
+bool route_has_fields(const char *filename);
+
+/**
+ * Parse the field references of filename. max_open 0 means half of
+ * RLIMIT_NOFILE. pool is used to open files in parallel and may be NULL.
+ *
+ * Returns 0 on success, -1 on error and sets errno. errno is EINVAL if the
+ * file name is malformed.
+ */
+int route_init(struct Pipelog_Route *route, const char *filename, size_t max_open, struct Pipelog_Pool *pool, size_t index);
+
+/**
+ * Write the lines of data to their files. An incomplete last line is kept
+ * for the next call unless flush is true. Files are rotated when their name
+ * formatted with local_now changes, and all are closed if flags has
+ * PIPELOG_FORCE_ROTATE.
+ *
+ * Errors with single files are reported to stderr (unless flags has
+ * PIPELOG_QUIET) and their lines dropped.
+ *
+ * Returns 0 on success, -1 on allocation errors or, if flags has
+ * PIPELOG_EXIT_ON_WRITE_ERROR, when a file can't be written. errno is set.
+ */
+int route_write(struct Pipelog_Route *route, const char *data, size_t size, bool flush, const struct tm *local_now, unsigned int flags);
+
+void route_free(struct Pipelog_Route *route);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,158 @@
+#include "scan.h"
+#include "util.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define T1(C) ((C) >= '0' && (C) <= '9') || (((C) | 0x20) >= 'a' && ((C) | 0x20) <= 'z') || (C) == '_' || (C) >= 0x80
+#define T4(C)  T1(C), T1((C) + 1), T1((C) + 2), T1((C) + 3)
+#define T16(C) T4(C), T4((C) + 4), T4((C) + 8), T4((C) + 12)
+#define T64(C) T16(C), T16((C) + 16), T16((C) + 32), T16((C) + 48)
+
+const bool PIPELOG_TOKEN_CHARS[256] = { T64(0), T64(64), T64(128), T64(192) };
+
+#undef T64
+#undef T16
+#undef T4
+#undef T1
+
+int map_file(struct Pipelog_Mapped_File *file, const char *filename) {
+    struct stat meta;
+
+    file->data = NULL;
+    file->size = 0;
+    file->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (file->fd < 0) {
+        return -1;
+    }
+
+    if (fstat(file->fd, &meta) != 0) {
+        goto error;
+    }
+
+    if (meta.st_size > 0) {
+        char *data = mmap(NULL, meta.st_size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+        if (data == MAP_FAILED) {
+            goto error;
+        }
+        // blocks are skipped, so read-ahead of the whole file is wasted
+        madvise(data, meta.st_size, MADV_RANDOM);
+        file->data = data;
+        file->size = meta.st_size;
+    }
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        close(file->fd);
+        file->fd = -1;
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+void unmap_file(struct Pipelog_Mapped_File *file) {
+    if (file->data != NULL) {
+        munmap(file->data, file->size);
+        file->data = NULL;
+    }
+    if (file->fd >= 0) {
+        close(file->fd);
+        file->fd = -1;
+    }
+    file->size = 0;
+}
+
+size_t next_line_start(const char *data, size_t size, size_t offset) {
+    if (offset >= size) {
+        return size;
+    }
+    if (offset == 0 || data[offset - 1] == '\n') {
+        return offset;
+    }
+    const char *newline = memchr(data + offset, '\n', size - offset);
+    return newline == NULL ? size : (size_t)(newline - data) + 1;
+}
+
+// bytes that are common in log files, most common first
+static const char COMMON_BYTES[] = " 0123456789-:.=/\"etaoinsrhldcumfpgwybvkxjqz_,TEIASRNO";
+
+void needle_init(struct Pipelog_Needle *needle, const char *text, size_t size) {
+    size_t best_rank = SIZE_MAX;
+
+    needle->text = text;
+    needle->size = size;
+    needle->rare = 0;
+
+    for (size_t index = 0; index < size; ++ index) {
+        const char *common = memchr(COMMON_BYTES, text[index], sizeof(COMMON_BYTES) - 1);
+        const size_t rank = common == NULL ? 0 : sizeof(COMMON_BYTES) - (size_t)(common - COMMON_BYTES);
+        if (rank < best_rank) {
+            best_rank = rank;
+            needle->rare = index;
+        }
+    }
+}
+
+const char *needle_find(const struct Pipelog_Needle *needle, const char *data, size_t size) {
+    if (size < needle->size || needle->size == 0) {
+        return needle->size == 0 ? data : NULL;
+    }
+
+    const char rare = needle->text[needle->rare];
+    const char *ptr = data + needle->rare;
+    const char *end = data + size - needle->size + needle->rare + 1;
+
+    while (ptr < end) {
+        ptr = memchr(ptr, rare, end - ptr);
+        if (ptr == NULL) {
+            return NULL;
+        }
+        const char *match = ptr - needle->rare;
+        if (memcmp(match, needle->text, needle->size) == 0) {
+            return match;
+        }
+        ++ ptr;
+    }
+
+    return NULL;
+}
+
+static int output_put(struct Pipelog_Output_Buffer *out, const char *data, size_t size) {
+    while (size > 0) {
+        if (out->size == sizeof(out->data) && output_flush(out) != 0) {
+            return -1;
+        }
+        const size_t chunk = size < sizeof(out->data) - out->size ? size : sizeof(out->data) - out->size;
+        memcpy(out->data + out->size, data, chunk);
+        out->size += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+int output_line(struct Pipelog_Output_Buffer *out, const char *prefix, const char *line, size_t size) {
+    if ((prefix != NULL && output_put(out, prefix, strlen(prefix)) != 0) ||
+        output_put(out, line, size) != 0 ||
+        output_put(out, "\n", 1) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int output_flush(struct Pipelog_Output_Buffer *out) {
+    if (write_all(out->fd, out->data, out->size) != 0) {
+        return -1;
+    }
+    out->size = 0;
+    return 0;
+}
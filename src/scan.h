@@ -0,0 +1,87 @@
+#ifndef PIPELOG_SCAN_H
+#define PIPELOG_SCAN_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Helpers for reading log files block by block, as used by the search modes.
+ */
+
+// letters, digits, '_' and non-ASCII bytes, the characters words are made of
+extern const bool PIPELOG_TOKEN_CHARS[256];
+
+static inline bool is_token_char(unsigned char ch) {
+    return PIPELOG_TOKEN_CHARS[ch];
+}
+
+struct Pipelog_Mapped_File {
+    int    fd;
+    char  *data; //!< NULL for an empty file
+    size_t size;
+};
+
+/**
+ * Map filename read-only into memory.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int map_file(struct Pipelog_Mapped_File *file, const char *filename);
+
+void unmap_file(struct Pipelog_Mapped_File *file);
+
+/**
+ * Returns the offset of the first line that starts at or after offset, or
+ * size if there is none. Lines belong to the block they start in, so the
+ * lines of the block from start to end are those from next_line_start(start)
+ * to next_line_start(end).
+ */
+size_t next_line_start(const char *data, size_t size, size_t offset);
+
+/**
+ * Substring search that looks for the rarest byte of the needle (judging by
+ * the usual contents of log files) with memchr() and compares the rest only
+ * where it is found. memchr() is vectorized by the C library and the rare
+ * byte causes few false candidates.
+ */
+struct Pipelog_Needle {
+    const char *text;
+    size_t      size;
+    size_t      rare; //!< index of the byte of text that is searched for
+};
+
+void needle_init(struct Pipelog_Needle *needle, const char *text, size_t size);
+
+/**
+ * Returns the first occurrence of needle in data, or NULL.
+ */
+const char *needle_find(const struct Pipelog_Needle *needle, const char *data, size_t size);
+
+struct Pipelog_Output_Buffer {
+    int    fd;
+    char   data[BUFSIZ * 8];
+    size_t size;
+};
+
+/**
+ * Write prefix (if not NULL), line and a newline to out.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int output_line(struct Pipelog_Output_Buffer *out, const char *prefix, const char *line, size_t size);
+
+int output_flush(struct Pipelog_Output_Buffer *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,207 @@
+#include "sha256.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+typedef void (*Sha256_Blocks)(uint32_t state[8], const unsigned char *data, size_t blocks);
+
+static Sha256_Blocks sha256_blocks = NULL;
+
+static pthread_once_t sha256_once = PTHREAD_ONCE_INIT;
+
+static inline uint32_t rotr(uint32_t value, unsigned int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static void sha256_blocks_sw(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    uint32_t w[64];
+
+    while (blocks > 0) {
+        for (size_t index = 0; index < 16; ++ index) {
+            const unsigned char *ptr = data + index * 4;
+            w[index] = (uint32_t)ptr[0] << 24 | (uint32_t)ptr[1] << 16 | (uint32_t)ptr[2] << 8 | ptr[3];
+        }
+
+        for (size_t index = 16; index < 64; ++ index) {
+            const uint32_t s0 = rotr(w[index - 15], 7) ^ rotr(w[index - 15], 18) ^ (w[index - 15] >> 3);
+            const uint32_t s1 = rotr(w[index - 2], 17) ^ rotr(w[index - 2], 19) ^ (w[index - 2] >> 10);
+            w[index] = w[index - 16] + s0 + w[index - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (size_t index = 0; index < 64; ++ index) {
+            const uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            const uint32_t ch = (e & f) ^ (~e & g);
+            const uint32_t t1 = h + s1 + ch + SHA256_K[index] + w[index];
+            const uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            const uint32_t t2 = s0 + maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+
+        data += 64;
+        -- blocks;
+    }
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// SHA extensions: two rounds per sha256rnds2, the state kept as ABEF and CDGH
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_ni(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp    = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp    = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (blocks > 0) {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+        __m128i w[4];
+
+        // unrolled, w[] lives in registers
+#pragma GCC unroll 16
+        for (size_t index = 0; index < 16; ++ index) {
+            if (index < 4) {
+                w[index] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + index * 16)), mask);
+            } else {
+                // w[index & 3] holds the words of index - 4, the others of index - 3 to index - 1
+                __m128i next = _mm_sha256msg1_epu32(w[index & 3], w[(index + 1) & 3]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(index + 3) & 3], w[(index + 2) & 3], 4));
+                w[index & 3] = _mm_sha256msg2_epu32(next, w[(index + 3) & 3]);
+            }
+
+            __m128i msg = _mm_add_epi32(w[index & 3], _mm_loadu_si128((const __m128i*)&SHA256_K[index * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg    = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+
+        data += 64;
+        -- blocks;
+    }
+
+    tmp    = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+#endif
+
+static void sha256_select(void) {
+    sha256_blocks = sha256_blocks_sw;
+#if defined(__x86_64__) && defined(__GNUC__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA) &&
+        __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1)) {
+        sha256_blocks = sha256_blocks_ni;
+    }
+#endif
+}
+
+void sha256_init(struct Pipelog_Sha256 *sha) {
+    static const uint32_t INIT[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    pthread_once(&sha256_once, sha256_select);
+
+    memcpy(sha->state, INIT, sizeof(INIT));
+    sha->length      = 0;
+    sha->buffer_size = 0;
+}
+
+void sha256_update(struct Pipelog_Sha256 *sha, const void *data, size_t size) {
+    const unsigned char *ptr = data;
+
+    sha->length += size;
+
+    if (sha->buffer_size > 0) {
+        const size_t rest = sizeof(sha->buffer) - sha->buffer_size;
+        const size_t chunk = size < rest ? size : rest;
+        memcpy(sha->buffer + sha->buffer_size, ptr, chunk);
+        sha->buffer_size += chunk;
+        ptr  += chunk;
+        size -= chunk;
+
+        if (sha->buffer_size < sizeof(sha->buffer)) {
+            return;
+        }
+        sha256_blocks(sha->state, sha->buffer, 1);
+        sha->buffer_size = 0;
+    }
+
+    if (size >= 64) {
+        sha256_blocks(sha->state, ptr, size / 64);
+        ptr  += size & ~(size_t)63;
+        size &= 63;
+    }
+
+    memcpy(sha->buffer, ptr, size);
+    sha->buffer_size = size;
+}
+
+void sha256_final(const struct Pipelog_Sha256 *sha, unsigned char digest[PIPELOG_SHA256_SIZE]) {
+    unsigned char tail[128];
+    uint32_t state[8];
+    const uint64_t bits = sha->length * 8;
+
+    memcpy(state, sha->state, sizeof(state));
+    memcpy(tail, sha->buffer, sha->buffer_size);
+
+    size_t size = sha->buffer_size;
+    tail[size ++] = 0x80;
+    const size_t padded = size <= 56 ? 64 : 128;
+    memset(tail + size, 0, padded - size);
+    for (size_t index = 0; index < 8; ++ index) {
+        tail[padded - 1 - index] = bits >> (index * 8);
+    }
+
+    sha256_blocks(state, tail, padded / 64);
+
+    for (size_t index = 0; index < 8; ++ index) {
+        digest[index * 4]     = state[index] >> 24;
+        digest[index * 4 + 1] = state[index] >> 16;
+        digest[index * 4 + 2] = state[index] >> 8;
+        digest[index * 4 + 3] = state[index];
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef PIPELOG_SHA256_H
+#define PIPELOG_SHA256_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_SHA256_SIZE 32
+
+/**
+ * Incremental SHA-256. Uses the SHA extensions of x86 CPUs if available.
+ */
+struct Pipelog_Sha256 {
+    uint32_t      state[8];
+    uint64_t      length; //!< bytes hashed so far
+    unsigned char buffer[64];
+    size_t        buffer_size;
+};
+
+void sha256_init(struct Pipelog_Sha256 *sha);
+
+void sha256_update(struct Pipelog_Sha256 *sha, const void *data, size_t size);
+
+/**
+ * Write the digest of all data to digest. sha is not changed, so more data
+ * can be added afterwards.
+ */
+void sha256_final(const struct Pipelog_Sha256 *sha, unsigned char digest[PIPELOG_SHA256_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,182 @@
+#include "shard.h"
+#include "fields.h"
+#include "transform.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// FNV-1a, stable across runs so a key keeps its file after a restart
+static uint64_t hash_value(const char *value, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t index = 0; index < size; ++ index) {
+        hash ^= (unsigned char)value[index];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+int shards_init(struct Pipelog_Shards *shards, const struct Pipelog_Output output[], size_t count, char *errbuf, size_t errbuf_size) {
+    size_t sharded = 0;
+
+    memset(shards, 0, sizeof(*shards));
+
+    shards->group_of  = malloc(count * sizeof(size_t));
+    shards->member_of = malloc(count * sizeof(size_t));
+    // there can't be more groups than outputs
+    shards->groups = calloc(count, sizeof(struct Pipelog_Shard_Group));
+    if (shards->group_of == NULL || shards->member_of == NULL || shards->groups == NULL) {
+        goto error;
+    }
+
+    for (size_t index = 0; index < count; ++ index) {
+        const struct Pipelog_Output *out = &output[index];
+
+        shards->group_of[index]  = SIZE_MAX;
+        shards->member_of[index] = 0;
+
+        if (!(out->flags & PIPELOG_OUTPUT_SHARD)) {
+            continue;
+        }
+
+        size_t group_index = 0;
+        while (group_index < shards->group_count && strcmp(shards->groups[group_index].name, out->shard) != 0) {
+            ++ group_index;
+        }
+
+        struct Pipelog_Shard_Group *group = &shards->groups[group_index];
+        if (group_index == shards->group_count) {
+            ++ shards->group_count;
+            group->name   = out->shard;
+            group->source = index;
+        } else if ((out->flags & PIPELOG_OUTPUT_LINE_FILTERS) != (output[group->source].flags & PIPELOG_OUTPUT_LINE_FILTERS)) {
+            snprintf(errbuf, errbuf_size, "output[%zu]: all outputs of shard group \"%s\" need the same line filters", index, group->name);
+            errno = EINVAL;
+            goto error;
+        }
+
+        if (out->shard_key != NULL) {
+            if (group->key != NULL && strcmp(group->key, out->shard_key) != 0) {
+                snprintf(errbuf, errbuf_size, "output[%zu]: shard group \"%s\" has the keys \"%s\" and \"%s\"", index, group->name, group->key, out->shard_key);
+                errno = EINVAL;
+                goto error;
+            }
+            group->key      = out->shard_key;
+            group->key_size = strlen(out->shard_key);
+        }
+
+        shards->group_of[index]  = group_index;
+        shards->member_of[index] = group->count ++;
+        ++ sharded;
+    }
+
+    for (size_t group_index = 0; group_index < shards->group_count; ++ group_index) {
+        struct Pipelog_Shard_Group *group = &shards->groups[group_index];
+
+        group->buf      = calloc(group->count, sizeof(char*));
+        group->size     = calloc(group->count, sizeof(size_t));
+        group->capacity = calloc(group->count, sizeof(size_t));
+        if (group->buf == NULL || group->size == NULL || group->capacity == NULL) {
+            goto error;
+        }
+    }
+
+    if (sharded > 1) {
+        shards->pool = pool_create(sharded);
+        if (shards->pool == NULL) {
+            goto error;
+        }
+    }
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        shards_free(shards);
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+static int shard_line(void *context, const char *line, size_t size) {
+    struct Pipelog_Shard_Group *group = context;
+    size_t member = SIZE_MAX;
+
+    if (group->key != NULL) {
+        struct Pipelog_Field fields[PIPELOG_MAX_FIELDS];
+        const size_t field_count = parse_fields(line, size, fields, PIPELOG_MAX_FIELDS);
+
+        for (size_t index = 0; index < field_count; ++ index) {
+            if (fields[index].key_size == group->key_size && memcmp(fields[index].key, group->key, group->key_size) == 0) {
+                member = hash_value(fields[index].value, fields[index].value_size) % group->count;
+                break;
+            }
+        }
+    }
+
+    if (member == SIZE_MAX) {
+        member = group->next % group->count;
+        ++ group->next;
+    }
+
+    if (reserve(&group->buf[member], &group->capacity[member], group->size[member] + size) != 0) {
+        return -1;
+    }
+
+    memcpy(group->buf[member] + group->size[member], line, size);
+    group->size[member] += size;
+
+    return 0;
+}
+
+int shards_run(struct Pipelog_Shards *shards, const char *const result[], const size_t result_size[], bool flush) {
+    for (size_t group_index = 0; group_index < shards->group_count; ++ group_index) {
+        struct Pipelog_Shard_Group *group = &shards->groups[group_index];
+
+        memset(group->size, 0, group->count * sizeof(size_t));
+
+        if (split_lines(&group->pending, result[group->source], result_size[group->source], flush, shard_line, group) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+const char *shard_data(const struct Pipelog_Shards *shards, size_t index, size_t *size) {
+    const struct Pipelog_Shard_Group *group = &shards->groups[shards->group_of[index]];
+    const size_t member = shards->member_of[index];
+
+    *size = group->size[member];
+    return group->buf[member];
+}
+
+void shards_free(struct Pipelog_Shards *shards) {
+    if (shards->groups != NULL) {
+        for (size_t group_index = 0; group_index < shards->group_count; ++ group_index) {
+            struct Pipelog_Shard_Group *group = &shards->groups[group_index];
+            if (group->buf != NULL) {
+                for (size_t member = 0; member < group->count; ++ member) {
+                    free(group->buf[member]);
+                }
+            }
+            free(group->buf);
+            free(group->size);
+            free(group->capacity);
+            lines_free(&group->pending);
+        }
+    }
+
+    if (shards->pool != NULL) {
+        pool_destroy(shards->pool);
+    }
+
+    free(shards->groups);
+    free(shards->group_of);
+    free(shards->member_of);
+    memset(shards, 0, sizeof(*shards));
+}
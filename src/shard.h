@@ -0,0 +1,80 @@
+#ifndef PIPELOG_SHARD_H
+#define PIPELOG_SHARD_H
+#pragma once
+
+#include "pipelog.h"
+#include "lines.h"
+#include "pool.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Outputs with the same +shard name form a group. Every line goes to exactly
+ * one output of its group: by the hash of the value of the group's key field,
+ * or round-robin if there is no key or a line doesn't have the field. So the
+ * lines of one key always end up in the same file.
+ */
+struct Pipelog_Shard_Group {
+    const char *name;
+    const char *key;    //!< field, NULL for round-robin
+    size_t key_size;
+    size_t source;      //!< output whose line filtered data is split
+    size_t count;       //!< number of outputs
+    uint64_t next;      //!< round-robin counter
+    struct Pipelog_Lines pending;
+
+    char  **buf;        //!< [count] lines of each output
+    size_t *size;
+    size_t *capacity;
+};
+
+struct Pipelog_Shards {
+    struct Pipelog_Shard_Group *groups;
+    size_t group_count;
+    size_t *group_of;  //!< [output count] group of an output, SIZE_MAX if none
+    size_t *member_of; //!< [output count] position of an output in its group
+
+    /**
+     * One thread per sharded output, so the files, which may be on different
+     * devices, are written in parallel. NULL if there is at most one.
+     */
+    struct Pipelog_Pool *pool;
+};
+
+/**
+ * Group the outputs with +shard. All outputs of a group need the same line
+ * filters, because the data of one of them is split for all.
+ *
+ * Returns 0 on success. On error -1 is returned and errno is set. If the
+ * outputs of a group don't agree errno is set to EINVAL and a message is
+ * written to errbuf.
+ */
+int shards_init(struct Pipelog_Shards *shards, const struct Pipelog_Output output[], size_t count, char *errbuf, size_t errbuf_size);
+
+/**
+ * Distribute the lines of the line filtered data of every group, result[]
+ * indexed by output, among its outputs. An incomplete last line is kept for
+ * the next call unless flush is true.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int shards_run(struct Pipelog_Shards *shards, const char *const result[], const size_t result_size[], bool flush);
+
+/**
+ * The lines of output index from the last shards_run(). Valid until the next
+ * call.
+ */
+const char *shard_data(const struct Pipelog_Shards *shards, size_t index, size_t *size);
+
+void shards_free(struct Pipelog_Shards *shards);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
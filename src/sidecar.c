@@ -0,0 +1,148 @@
+#include "sidecar.h"
+
+#include <string.h>
+#include <errno.h>
+
+void sidecars_init(struct Pipelog_Sidecars *sidecars) {
+    memset(sidecars, 0, sizeof(*sidecars));
+    sidecars->index.fd = -1;
+    sidecars->bloom.fd = -1;
+    manifest_init(&sidecars->manifest);
+    sidecars->checksums.fd = -1;
+    chain_init(&sidecars->chain);
+}
+
+int sidecars_open(struct Pipelog_Sidecars *sidecars, const struct Pipelog_Output *out, const char *filename, uint64_t offset) {
+    sidecars_close(sidecars);
+
+    // assume an existing file ends with a complete line
+    sidecars->offset     = offset;
+    sidecars->line_start = true;
+
+    if ((out->flags & PIPELOG_OUTPUT_INDEX) && time_index_open(&sidecars->index, filename, offset) != 0) {
+        return -1;
+    }
+
+    if ((out->flags & PIPELOG_OUTPUT_BLOOM) && bloom_open(&sidecars->bloom, filename, out->bloom_block_size, offset) != 0) {
+        const int errnum = errno;
+        time_index_close(&sidecars->index);
+        errno = errnum;
+        return -1;
+    }
+
+    if ((out->flags & PIPELOG_OUTPUT_FIELDS) && field_index_open(&sidecars->fields, filename, out->fields, out->field_block_size, offset) != 0) {
+        const int errnum = errno;
+        time_index_close(&sidecars->index);
+        bloom_close(&sidecars->bloom);
+        errno = errnum;
+        return -1;
+    }
+
+    if ((out->flags & PIPELOG_OUTPUT_MANIFEST) && manifest_open(&sidecars->manifest, out->manifest, filename, offset) != 0) {
+        const int errnum = errno;
+        time_index_close(&sidecars->index);
+        bloom_close(&sidecars->bloom);
+        field_index_close(&sidecars->fields);
+        errno = errnum;
+        return -1;
+    }
+
+    if ((out->flags & PIPELOG_OUTPUT_CHECKSUMS) && checksums_open(&sidecars->checksums, filename, out->checksum_block_size, offset) != 0) {
+        const int errnum = errno;
+        time_index_close(&sidecars->index);
+        bloom_close(&sidecars->bloom);
+        field_index_close(&sidecars->fields);
+        manifest_close(&sidecars->manifest);
+        errno = errnum;
+        return -1;
+    }
+
+    if ((out->flags & PIPELOG_OUTPUT_CHAIN) && chain_open(&sidecars->chain, filename, out->chain_block_size, offset) != 0) {
+        const int errnum = errno;
+        time_index_close(&sidecars->index);
+        bloom_close(&sidecars->bloom);
+        field_index_close(&sidecars->fields);
+        manifest_close(&sidecars->manifest);
+        checksums_close(&sidecars->checksums);
+        errno = errnum;
+        return -1;
+    }
+
+    sidecars->open = true;
+
+    return 0;
+}
+
+int sidecars_write(struct Pipelog_Sidecars *sidecars, const struct Pipelog_Output *out, const char *data, size_t size, int64_t now) {
+    if (!sidecars->open || size == 0) {
+        return 0;
+    }
+
+    int status = 0;
+    if (out->flags & PIPELOG_OUTPUT_INDEX) {
+        if (time_index_add(&sidecars->index, sidecars->offset, data, size, sidecars->line_start, now, out->index_bytes, out->index_interval) != 0) {
+            status = -1;
+        }
+    }
+
+    if (out->flags & PIPELOG_OUTPUT_BLOOM) {
+        if (bloom_add(&sidecars->bloom, sidecars->offset, data, size) != 0) {
+            status = -1;
+        }
+    }
+
+    if (out->flags & PIPELOG_OUTPUT_FIELDS) {
+        if (field_index_add(&sidecars->fields, data, size) != 0) {
+            status = -1;
+        }
+    }
+
+    if (out->flags & PIPELOG_OUTPUT_MANIFEST) {
+        manifest_write(&sidecars->manifest, data, size, now);
+    }
+
+    if (out->flags & PIPELOG_OUTPUT_CHECKSUMS) {
+        if (checksums_add(&sidecars->checksums, data, size) != 0) {
+            status = -1;
+        }
+    }
+
+    if (out->flags & PIPELOG_OUTPUT_CHAIN) {
+        if (chain_add(&sidecars->chain, data, size) != 0) {
+            status = -1;
+        }
+    }
+
+    sidecars->offset    += size;
+    sidecars->line_start = data[size - 1] == '\n';
+
+    return status;
+}
+
+int sidecars_close(struct Pipelog_Sidecars *sidecars) {
+    int status = 0;
+
+    if (!sidecars->open) {
+        return 0;
+    }
+
+    time_index_close(&sidecars->index);
+    if (bloom_close(&sidecars->bloom) != 0) {
+        status = -1;
+    }
+    if (field_index_close(&sidecars->fields) != 0) {
+        status = -1;
+    }
+    if (manifest_close(&sidecars->manifest) != 0) {
+        status = -1;
+    }
+    if (checksums_close(&sidecars->checksums) != 0) {
+        status = -1;
+    }
+    if (chain_close(&sidecars->chain) != 0) {
+        status = -1;
+    }
+    sidecars->open = false;
+
+    return status;
+}
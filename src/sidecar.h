@@ -0,0 +1,70 @@
+#ifndef PIPELOG_SIDECAR_H
+#define PIPELOG_SIDECAR_H
+#pragma once
+
+#include "pipelog.h"
+#include "timeindex.h"
+#include "bloom.h"
+#include "fieldindex.h"
+#include "manifest.h"
+#include "checksum.h"
+#include "chain.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// output flags that are implemented as sidecar files next to the log file
+#define PIPELOG_OUTPUT_SIDECARS (PIPELOG_OUTPUT_INDEX | PIPELOG_OUTPUT_BLOOM | PIPELOG_OUTPUT_FIELDS | PIPELOG_OUTPUT_MANIFEST | PIPELOG_OUTPUT_CHECKSUMS | PIPELOG_OUTPUT_CHAIN)
+
+/**
+ * Files that are written next to a log file and describe its contents. They
+ * are opened and closed together with the log file and see all data that
+ * was written to it.
+ */
+struct Pipelog_Sidecars {
+    uint64_t offset;     //!< size of the log file
+    bool     line_start; //!< the next write starts a new line
+    bool     open;
+    struct Pipelog_Time_Index index;
+    struct Pipelog_Bloom      bloom;
+    struct Pipelog_Field_Index fields;
+    struct Pipelog_Manifest    manifest;
+    struct Pipelog_Checksums   checksums;
+    struct Pipelog_Chain       chain;
+};
+
+void sidecars_init(struct Pipelog_Sidecars *sidecars);
+
+/**
+ * Open the sidecars of the log file filename, which currently has a size of
+ * offset bytes. Sidecars that were opened already are closed first.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int sidecars_open(struct Pipelog_Sidecars *sidecars, const struct Pipelog_Output *out, const char *filename, uint64_t offset);
+
+/**
+ * Update the sidecars with data that was just written to the log file. now
+ * is the arrival time of the data in milliseconds since the epoch.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int sidecars_write(struct Pipelog_Sidecars *sidecars, const struct Pipelog_Output *out, const char *data, size_t size, int64_t now);
+
+/**
+ * Finish and close the sidecars. The final numbers of the file stay in
+ * sidecars->manifest.record.
+ *
+ * Returns 0 on success, -1 on error and sets errno. They are closed either way.
+ */
+int sidecars_close(struct Pipelog_Sidecars *sidecars);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
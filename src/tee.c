@@ -0,0 +1,145 @@
+#include "tee.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+
+static void *tee_thread(void *arg) {
+    struct Pipelog_Tee *tee = arg;
+    char buf[BUFSIZ * 8];
+
+    for (;;) {
+        const ssize_t count = read(tee->pipe[0], buf, sizeof(buf));
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!(tee->flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: output[%zu]: reading data for sidecar files: %s\n", tee->index, strerror(errno));
+            }
+            break;
+        }
+
+        if (count == 0) {
+            break;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        const int64_t arrival = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+        if (sidecars_write(tee->sidecars, tee->out, buf, count, arrival) != 0) {
+            if (!(tee->flags & PIPELOG_QUIET)) {
+                fprintf(stderr, "*** error: output[%zu]: writing sidecar files: %s\n", tee->index, strerror(errno));
+            }
+            sidecars_close(tee->sidecars);
+        }
+
+        pthread_mutex_lock(&tee->mutex);
+        tee->consumed += count;
+        pthread_cond_broadcast(&tee->cond);
+        pthread_mutex_unlock(&tee->mutex);
+    }
+
+    // don't let tee_drain() wait for data that will never be written
+    pthread_mutex_lock(&tee->mutex);
+    tee->consumed = UINT64_MAX;
+    pthread_cond_broadcast(&tee->cond);
+    pthread_mutex_unlock(&tee->mutex);
+
+    return NULL;
+}
+
+int tee_start(struct Pipelog_Tee *tee, const struct Pipelog_Output *out, struct Pipelog_Sidecars *sidecars, size_t index, unsigned int flags) {
+    memset(tee, 0, sizeof(*tee));
+    tee->out      = out;
+    tee->sidecars = sidecars;
+    tee->index    = index;
+    tee->flags    = flags;
+
+    if (pipe2(tee->pipe, O_CLOEXEC) != 0) {
+        return -1;
+    }
+
+    // fails if it is above /proc/sys/fs/pipe-max-size, then the default size bounds the lag
+    fcntl(tee->pipe[1], F_SETPIPE_SZ, PIPELOG_TEE_PIPE_SIZE);
+
+    pthread_mutex_init(&tee->mutex, NULL);
+    pthread_cond_init(&tee->cond, NULL);
+
+    // signals are handled by the main thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    const int errnum = pthread_create(&tee->thread, NULL, tee_thread, tee);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (errnum != 0) {
+        pthread_cond_destroy(&tee->cond);
+        pthread_mutex_destroy(&tee->mutex);
+        close(tee->pipe[0]);
+        close(tee->pipe[1]);
+        errno = errnum;
+        return -1;
+    }
+
+    tee->started = true;
+
+    return 0;
+}
+
+ssize_t tee_copy(struct Pipelog_Tee *side, int fd) {
+    bool waited = false;
+
+    for (;;) {
+        const ssize_t count = tee(fd, side->pipe[1], PIPELOG_TEE_PIPE_SIZE, SPLICE_F_NONBLOCK);
+        if (count >= 0) {
+            side->produced += count;
+            return count;
+        }
+
+        if (errno != EAGAIN || waited) {
+            return -1;
+        }
+
+        // either the private pipe is full or the input is empty
+        struct pollfd pollfds[] = { { side->pipe[1], POLLOUT, 0 } };
+        if (poll(pollfds, 1, -1) < 0) {
+            return -1;
+        }
+        waited = true;
+    }
+}
+
+void tee_drain(struct Pipelog_Tee *tee) {
+    if (!tee->started) {
+        return;
+    }
+
+    pthread_mutex_lock(&tee->mutex);
+    while (tee->consumed < tee->produced) {
+        pthread_cond_wait(&tee->cond, &tee->mutex);
+    }
+    pthread_mutex_unlock(&tee->mutex);
+}
+
+void tee_stop(struct Pipelog_Tee *tee) {
+    if (!tee->started) {
+        return;
+    }
+
+    // the thread reads the rest and then gets the end of file
+    close(tee->pipe[1]);
+    pthread_join(tee->thread, NULL);
+    close(tee->pipe[0]);
+
+    pthread_cond_destroy(&tee->cond);
+    pthread_mutex_destroy(&tee->mutex);
+    tee->started = false;
+}
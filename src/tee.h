@@ -0,0 +1,74 @@
+#ifndef PIPELOG_TEE_H
+#define PIPELOG_TEE_H
+#pragma once
+
+#include "pipelog.h"
+#include "sidecar.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// capacity of the private pipe, i.e. how far the sidecars may lag behind
+#define PIPELOG_TEE_PIPE_SIZE (1024 * 1024)
+
+/**
+ * Keeps the sidecars of a spliced output up to date without bringing the
+ * data into user space on the main thread. tee() duplicates the data of
+ * the input pipe into a private pipe before it is spliced to the log file,
+ * and a thread reads the private pipe and writes the sidecars. When the
+ * thread falls behind by PIPELOG_TEE_PIPE_SIZE bytes the main thread waits.
+ *
+ * While data is pending the thread owns the sidecars. The main thread has
+ * to call tee_drain() before it touches them, e.g. to rotate them.
+ */
+struct Pipelog_Tee {
+    int pipe[2];
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    uint64_t produced; //!< bytes written to the private pipe
+    uint64_t consumed; //!< bytes the thread has written to the sidecars
+    bool     started;
+    const struct Pipelog_Output *out;
+    struct Pipelog_Sidecars     *sidecars;
+    size_t       index; //!< of the output, for error messages
+    unsigned int flags; //!< flags of pipelog()
+};
+
+/**
+ * Create the private pipe and start the thread that writes sidecars.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int tee_start(struct Pipelog_Tee *tee, const struct Pipelog_Output *out, struct Pipelog_Sidecars *sidecars, size_t index, unsigned int flags);
+
+/**
+ * Duplicate the data that is available in the pipe fd into the private
+ * pipe, without consuming it. Waits if the private pipe is full.
+ *
+ * Returns the number of duplicated bytes, which now have to be spliced
+ * from fd, 0 at the end of the input, or -1 on error and sets errno. Fails
+ * with EINVAL if fd is no pipe and with EAGAIN if fd is empty.
+ */
+ssize_t tee_copy(struct Pipelog_Tee *side, int fd);
+
+/**
+ * Wait until the thread has written all duplicated data to the sidecars.
+ */
+void tee_drain(struct Pipelog_Tee *tee);
+
+/**
+ * Write the remaining data to the sidecars and stop the thread.
+ */
+void tee_stop(struct Pipelog_Tee *tee);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
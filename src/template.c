@@ -0,0 +1,818 @@
+#include "template.h"
+#include "timestamp.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#define VARIABLE "<*>"
+
+static int put_bytes(struct Pipelog_Templates *templates, const void *data, size_t size) {
+    // empty tokens have no data, and memcpy() mustn't be passed NULL
+    if (size == 0) {
+        return 0;
+    }
+
+    if (reserve(&templates->buf, &templates->capacity, templates->buf_size + size) != 0) {
+        return -1;
+    }
+
+    memcpy(templates->buf + templates->buf_size, data, size);
+    templates->buf_size += size;
+
+    return 0;
+}
+
+static size_t encode_varint(unsigned char *out, uint64_t value) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        out[size ++] = (unsigned char)value | 0x80;
+        value >>= 7;
+    }
+    out[size ++] = (unsigned char)value;
+    return size;
+}
+
+static int put_varint(struct Pipelog_Templates *templates, uint64_t value) {
+    unsigned char buf[10];
+    return put_bytes(templates, buf, encode_varint(buf, value));
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static bool has_digit(const char *token, size_t size) {
+    for (size_t index = 0; index < size; ++ index) {
+        if (token[index] >= '0' && token[index] <= '9') {
+            return true;
+        }
+    }
+    return false;
+}
+
+// only numbers that format back to the same text
+static bool parse_number(const char *token, size_t size, uint64_t *number) {
+    if (size == 0 || size > 18 || (token[0] == '0' && size > 1)) {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (size_t index = 0; index < size; ++ index) {
+        if (token[index] < '0' || token[index] > '9') {
+            return false;
+        }
+        value = value * 10 + (token[index] - '0');
+    }
+
+    *number = value;
+    return true;
+}
+
+static uint64_t hash_key(const char *key, size_t size) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t index = 0; index < size; ++ index) {
+        hash ^= (unsigned char)key[index];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+void templates_init(struct Pipelog_Templates *templates) {
+    memset(templates, 0, sizeof(*templates));
+    templates->opened = ULONG_MAX;
+}
+
+// returns the number of tokens or -1 if there are too many
+static ssize_t tokenize(struct Pipelog_Templates *templates, const char *line, size_t size) {
+    const char *end = line + size;
+    size_t count = 0;
+
+    for (;;) {
+        const char *space = memchr(line, ' ', end - line);
+        const char *token_end = space == NULL ? end : space;
+
+        if (count == PIPELOG_TEMPLATE_MAX_TOKENS) {
+            return -1;
+        }
+        templates->tokens[count] = line;
+        templates->sizes[count]  = token_end - line;
+        ++ count;
+
+        if (space == NULL) {
+            break;
+        }
+        line = space + 1;
+    }
+
+    return count;
+}
+
+static struct Pipelog_Template_Leaf *get_leaf(struct Pipelog_Templates *templates, size_t token_count) {
+    // the fixed depth part of the parse tree: token count and the first tokens
+    unsigned char varint[10];
+    size_t key_size = encode_varint(varint, token_count);
+    if (reserve(&templates->key, &templates->key_capacity, key_size + 1 + templates->shape_size) != 0) {
+        return NULL;
+    }
+    memcpy(templates->key, varint, key_size);
+    templates->key[key_size ++] = templates->shape_size;
+    memcpy(templates->key + key_size, templates->shape, templates->shape_size);
+    key_size += templates->shape_size;
+
+    for (size_t index = 0; index < token_count && index < PIPELOG_TEMPLATE_DEPTH; ++ index) {
+        const bool variable = has_digit(templates->tokens[index], templates->sizes[index]);
+        const char *token   = variable ? VARIABLE : templates->tokens[index];
+        const size_t size   = variable ? strlen(VARIABLE) : templates->sizes[index];
+        const size_t prefix = encode_varint(varint, size);
+
+        if (reserve(&templates->key, &templates->key_capacity, key_size + prefix + size) != 0) {
+            return NULL;
+        }
+        memcpy(templates->key + key_size, varint, prefix);
+        memcpy(templates->key + key_size + prefix, token, size);
+        key_size += prefix + size;
+    }
+
+    if ((templates->leaf_count + 1) * 10 > templates->leaf_capacity * 7) {
+        const size_t capacity = templates->leaf_capacity == 0 ? 256 : templates->leaf_capacity * 2;
+        struct Pipelog_Template_Leaf **leaves = calloc(capacity, sizeof(*leaves));
+        if (leaves == NULL) {
+            return NULL;
+        }
+
+        for (size_t index = 0; index < templates->leaf_capacity; ++ index) {
+            struct Pipelog_Template_Leaf *leaf = templates->leaves[index];
+            if (leaf != NULL) {
+                size_t slot = hash_key(leaf->key, leaf->key_size) & (capacity - 1);
+                while (leaves[slot] != NULL) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                leaves[slot] = leaf;
+            }
+        }
+
+        free(templates->leaves);
+        templates->leaves = leaves;
+        templates->leaf_capacity = capacity;
+    }
+
+    const size_t mask = templates->leaf_capacity - 1;
+    size_t slot = hash_key(templates->key, key_size) & mask;
+    for (;;) {
+        struct Pipelog_Template_Leaf *leaf = templates->leaves[slot];
+        if (leaf == NULL) {
+            break;
+        }
+        if (leaf->key_size == key_size && memcmp(leaf->key, templates->key, key_size) == 0) {
+            return leaf;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    struct Pipelog_Template_Leaf *leaf = calloc(1, sizeof(struct Pipelog_Template_Leaf));
+    if (leaf == NULL) {
+        return NULL;
+    }
+
+    leaf->key = malloc(key_size);
+    if (leaf->key == NULL) {
+        free(leaf);
+        return NULL;
+    }
+    memcpy(leaf->key, templates->key, key_size);
+    leaf->key_size = key_size;
+
+    templates->leaves[slot] = leaf;
+    ++ templates->leaf_count;
+
+    return leaf;
+}
+
+// adds a template made of the current tokens, with the tokens where variable[index] is true as variables
+static ssize_t add_template(struct Pipelog_Templates *templates, size_t token_count, const bool variable[]) {
+    if (templates->template_count == templates->template_capacity) {
+        const size_t capacity = templates->template_capacity == 0 ? 256 : templates->template_capacity * 2;
+
+        struct Pipelog_Template *list = realloc(templates->templates, capacity * sizeof(*list));
+        if (list == NULL) {
+            return -1;
+        }
+        templates->templates = list;
+
+        uint64_t *defined = realloc(templates->defined, capacity * sizeof(*defined));
+        if (defined == NULL) {
+            return -1;
+        }
+        templates->defined = defined;
+
+        templates->template_capacity = capacity;
+    }
+
+    struct Pipelog_Template *template = &templates->templates[templates->template_count];
+    template->shape = NULL;
+    template->shape_size = 0;
+    if (templates->shape_size > 0) {
+        template->shape = malloc(templates->shape_size);
+        if (template->shape == NULL) {
+            return -1;
+        }
+        memcpy(template->shape, templates->shape, templates->shape_size);
+        template->shape_size = templates->shape_size;
+    }
+
+    template->token_count = token_count;
+    template->tokens = calloc(token_count, sizeof(char*));
+    template->sizes  = calloc(token_count, sizeof(size_t));
+    if (token_count > 0 && (template->tokens == NULL || template->sizes == NULL)) {
+        free(template->shape);
+        free(template->tokens);
+        free(template->sizes);
+        return -1;
+    }
+
+    for (size_t index = 0; index < token_count; ++ index) {
+        if (variable[index]) {
+            continue;
+        }
+
+        const size_t size = templates->sizes[index];
+        char *token = malloc(size + 1);
+        if (token == NULL) {
+            for (size_t free_index = 0; free_index < index; ++ free_index) {
+                free(template->tokens[free_index]);
+            }
+            free(template->shape);
+            free(template->tokens);
+            free(template->sizes);
+            return -1;
+        }
+        memcpy(token, templates->tokens[index], size);
+        token[size] = 0;
+        template->tokens[index] = token;
+        template->sizes[index]  = size;
+    }
+
+    templates->defined[templates->template_count] = 0;
+
+    return templates->template_count ++;
+}
+
+// returns the id of the matching template or -1 if the line has to be written raw
+static ssize_t match_template(struct Pipelog_Templates *templates, size_t token_count) {
+    bool variable[PIPELOG_TEMPLATE_MAX_TOKENS];
+    struct Pipelog_Template_Leaf *leaf = get_leaf(templates, token_count);
+    if (leaf == NULL) {
+        return -2;
+    }
+
+    size_t best_cluster = SIZE_MAX;
+    size_t best_matches = 0;
+    for (size_t cluster = 0; cluster < leaf->cluster_count; ++ cluster) {
+        const struct Pipelog_Template *template = &templates->templates[leaf->clusters[cluster]];
+        size_t matches = 0;
+
+        for (size_t index = 0; index < token_count; ++ index) {
+            if (template->tokens[index] == NULL || (
+                    template->sizes[index] == templates->sizes[index] &&
+                    memcmp(template->tokens[index], templates->tokens[index], templates->sizes[index]) == 0)) {
+                ++ matches;
+            }
+        }
+
+        if (best_cluster == SIZE_MAX || matches > best_matches) {
+            best_cluster = cluster;
+            best_matches = matches;
+        }
+    }
+
+    if (best_cluster != SIZE_MAX && best_matches * 100 >= token_count * PIPELOG_TEMPLATE_SIMILARITY) {
+        const size_t id = leaf->clusters[best_cluster];
+        const struct Pipelog_Template *template = &templates->templates[id];
+
+        if (best_matches == token_count) {
+            return id;
+        }
+
+        // differing tokens become variables in a new version of the template
+        if (templates->template_count >= PIPELOG_TEMPLATE_MAX_TEMPLATES) {
+            return -1;
+        }
+
+        for (size_t index = 0; index < token_count; ++ index) {
+            variable[index] = template->tokens[index] == NULL ||
+                template->sizes[index] != templates->sizes[index] ||
+                memcmp(template->tokens[index], templates->tokens[index], templates->sizes[index]) != 0;
+        }
+
+        const ssize_t new_id = add_template(templates, token_count, variable);
+        if (new_id < 0) {
+            return -2;
+        }
+        leaf->clusters[best_cluster] = new_id;
+
+        return new_id;
+    }
+
+    if (leaf->cluster_count >= PIPELOG_TEMPLATE_MAX_CLUSTERS || templates->template_count >= PIPELOG_TEMPLATE_MAX_TEMPLATES) {
+        return -1;
+    }
+
+    for (size_t index = 0; index < token_count; ++ index) {
+        variable[index] = has_digit(templates->tokens[index], templates->sizes[index]);
+    }
+
+    const ssize_t id = add_template(templates, token_count, variable);
+    if (id < 0) {
+        return -2;
+    }
+    leaf->clusters[leaf->cluster_count ++] = id;
+
+    return id;
+}
+
+static int encode_line(void *context, const char *line, size_t size) {
+    struct Pipelog_Templates *templates = context;
+    const bool newline = size > 0 && line[size - 1] == '\n';
+    const unsigned char flags = newline ? 0 : PIPELOG_TEMPLATE_NO_NEWLINE;
+    int64_t delta = 0;
+    int64_t nanos;
+
+    if (newline) {
+        -- size;
+    }
+
+    const char *text = line;
+    size_t text_size = size;
+    size_t length;
+
+    templates->shape_size = 0;
+    if (parse_timestamp(line, size, &nanos, &length)) {
+        const int64_t millis = nanos / 1000000 - (nanos % 1000000 < 0);
+        delta = millis - templates->timestamp;
+        templates->timestamp = millis;
+
+        // the timestamp is restored from the delta if it formats back exactly
+        if (length < size && line[length] == ' ') {
+            ++ length;
+        }
+        timestamp_shape(line, length, templates->shape);
+        format_timestamp(templates->shape, length, millis, templates->formatted);
+        if (memcmp(templates->formatted, line, length) == 0) {
+            templates->shape_size = length;
+            text += length;
+            text_size -= length;
+        }
+    }
+
+    const ssize_t token_count = tokenize(templates, text, text_size);
+    const ssize_t id = token_count < 0 ? -1 : match_template(templates, token_count);
+
+    if (id == -2) {
+        return -1;
+    }
+
+    if (id < 0) {
+        const unsigned char type = PIPELOG_TEMPLATE_RAW | flags;
+        if (put_bytes(templates, &type, 1) != 0 ||
+            put_varint(templates, zigzag(delta)) != 0 ||
+            put_varint(templates, size) != 0 ||
+            put_bytes(templates, line, size) != 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    const struct Pipelog_Template *template = &templates->templates[id];
+
+    if (templates->defined[id] != templates->segment) {
+        const unsigned char type = PIPELOG_TEMPLATE_DEFINE;
+        if (put_bytes(templates, &type, 1) != 0 ||
+            put_varint(templates, id) != 0 ||
+            put_varint(templates, template->shape_size) != 0 ||
+            put_bytes(templates, template->shape, template->shape_size) != 0 ||
+            put_varint(templates, template->token_count) != 0) {
+            return -1;
+        }
+
+        for (size_t index = 0; index < template->token_count; ++ index) {
+            if (template->tokens[index] == NULL) {
+                if (put_varint(templates, 1) != 0) {
+                    return -1;
+                }
+            } else if (put_varint(templates, (uint64_t)template->sizes[index] << 1) != 0 ||
+                       put_bytes(templates, template->tokens[index], template->sizes[index]) != 0) {
+                return -1;
+            }
+        }
+
+        templates->defined[id] = templates->segment;
+    }
+
+    const unsigned char type = PIPELOG_TEMPLATE_RECORD | flags;
+    if (put_bytes(templates, &type, 1) != 0 ||
+        put_varint(templates, id) != 0 ||
+        put_varint(templates, zigzag(delta)) != 0) {
+        return -1;
+    }
+
+    for (size_t index = 0; index < template->token_count; ++ index) {
+        if (template->tokens[index] != NULL) {
+            continue;
+        }
+
+        uint64_t number;
+        if (parse_number(templates->tokens[index], templates->sizes[index], &number)) {
+            if (put_varint(templates, number << 1 | 1) != 0) {
+                return -1;
+            }
+        } else if (put_varint(templates, (uint64_t)templates->sizes[index] << 1) != 0 ||
+                   put_bytes(templates, templates->tokens[index], templates->sizes[index]) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+const char *encode_templates(struct Pipelog_Templates *templates, unsigned long opened, const char *data, size_t *size, bool flush) {
+    templates->buf_size = 0;
+
+    if (templates->opened != opened) {
+        // new file, start a self-contained segment
+        templates->opened = opened;
+        templates->timestamp = 0;
+        ++ templates->segment;
+
+        if (put_bytes(templates, PIPELOG_TEMPLATE_MAGIC, PIPELOG_TEMPLATE_MAGIC_SIZE) != 0) {
+            return NULL;
+        }
+    }
+
+    if (split_lines(&templates->pending, data, *size, flush, encode_line, templates) != 0) {
+        return NULL;
+    }
+
+    *size = templates->buf_size;
+    return templates->buf;
+}
+
+static void template_free(struct Pipelog_Template *template) {
+    free(template->shape);
+    template->shape = NULL;
+
+    if (template->tokens != NULL) {
+        for (size_t index = 0; index < template->token_count; ++ index) {
+            free(template->tokens[index]);
+        }
+    }
+    free(template->tokens);
+    free(template->sizes);
+    template->tokens = NULL;
+    template->sizes  = NULL;
+}
+
+void templates_free(struct Pipelog_Templates *templates) {
+    for (size_t index = 0; index < templates->template_count; ++ index) {
+        template_free(&templates->templates[index]);
+    }
+
+    for (size_t index = 0; index < templates->leaf_capacity; ++ index) {
+        struct Pipelog_Template_Leaf *leaf = templates->leaves[index];
+        if (leaf != NULL) {
+            free(leaf->key);
+            free(leaf);
+        }
+    }
+
+    free(templates->templates);
+    free(templates->defined);
+    free(templates->leaves);
+    free(templates->key);
+    free(templates->buf);
+    lines_free(&templates->pending);
+
+    templates_init(templates);
+}
+
+struct Pipelog_Template_Reader {
+    int    fd;
+    size_t pos;
+    size_t size;
+    unsigned char buf[BUFSIZ];
+};
+
+// returns the next byte, -1 at the end of the input or -2 on error
+static int read_byte(struct Pipelog_Template_Reader *reader) {
+    if (reader->pos == reader->size) {
+        ssize_t rcount;
+        do {
+            rcount = read(reader->fd, reader->buf, sizeof(reader->buf));
+        } while (rcount < 0 && errno == EINTR);
+
+        if (rcount < 0) {
+            return -2;
+        }
+        if (rcount == 0) {
+            return -1;
+        }
+        reader->pos  = 0;
+        reader->size = rcount;
+    }
+
+    return reader->buf[reader->pos ++];
+}
+
+static int read_varint(struct Pipelog_Template_Reader *reader, uint64_t *value) {
+    uint64_t result = 0;
+
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        const int byte = read_byte(reader);
+        if (byte < 0) {
+            if (byte == -1) {
+                errno = EINVAL;
+            }
+            return -1;
+        }
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static int read_bytes(struct Pipelog_Template_Reader *reader, char *data, size_t size) {
+    for (size_t index = 0; index < size; ++ index) {
+        const int byte = read_byte(reader);
+        if (byte < 0) {
+            if (byte == -1) {
+                errno = EINVAL;
+            }
+            return -1;
+        }
+        data[index] = byte;
+    }
+    return 0;
+}
+
+// reads a template definition into slot id of the dictionary
+static int read_definition(struct Pipelog_Templates *templates, struct Pipelog_Template_Reader *reader) {
+    bool variable[PIPELOG_TEMPLATE_MAX_TOKENS];
+    size_t offsets[PIPELOG_TEMPLATE_MAX_TOKENS];
+    uint64_t id, token_count;
+    char *token_data = NULL;
+    size_t token_size = 0;
+    size_t capacity = 0;
+    int status = -1;
+
+    uint64_t shape_size;
+    if (read_varint(reader, &id) != 0 || read_varint(reader, &shape_size) != 0) {
+        return -1;
+    }
+
+    if (id >= PIPELOG_TEMPLATE_MAX_TEMPLATES || shape_size > PIPELOG_TIMESTAMP_SCAN + 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (read_bytes(reader, templates->shape, shape_size) != 0 || read_varint(reader, &token_count) != 0) {
+        return -1;
+    }
+    templates->shape_size = shape_size;
+
+    if (token_count == 0 || token_count > PIPELOG_TEMPLATE_MAX_TOKENS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t index = 0; index < token_count; ++ index) {
+        uint64_t header;
+        if (read_varint(reader, &header) != 0) {
+            goto cleanup;
+        }
+
+        variable[index] = header & 1;
+        offsets[index]  = token_size;
+        templates->sizes[index] = header >> 1;
+
+        if (templates->sizes[index] > INT_MAX) {
+            errno = EINVAL;
+            goto cleanup;
+        }
+
+        if (reserve(&token_data, &capacity, token_size + templates->sizes[index]) != 0 ||
+            read_bytes(reader, token_data + token_size, templates->sizes[index]) != 0) {
+            goto cleanup;
+        }
+        token_size += templates->sizes[index];
+    }
+
+    for (size_t index = 0; index < token_count; ++ index) {
+        templates->tokens[index] = token_data + offsets[index];
+    }
+
+    // definitions are written when first used, so ids come in any order
+    while (templates->template_count <= id) {
+        const size_t shape_size = templates->shape_size;
+        templates->shape_size = 0;
+        const ssize_t added = add_template(templates, 0, variable);
+        templates->shape_size = shape_size;
+        if (added < 0) {
+            goto cleanup;
+        }
+    }
+
+    const ssize_t added = add_template(templates, token_count, variable);
+    if (added < 0) {
+        goto cleanup;
+    }
+
+    template_free(&templates->templates[id]);
+    templates->templates[id] = templates->templates[added];
+    -- templates->template_count;
+
+    status = 0;
+
+cleanup:
+    free(token_data);
+
+    return status;
+}
+
+// appends the restored text of a record to templates->buf
+static int read_record(struct Pipelog_Templates *templates, struct Pipelog_Template_Reader *reader) {
+    uint64_t id, delta;
+
+    if (read_varint(reader, &id) != 0 || read_varint(reader, &delta) != 0) {
+        return -1;
+    }
+    templates->timestamp += unzigzag(delta);
+
+    if (id >= templates->template_count || templates->templates[id].token_count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const struct Pipelog_Template *template = &templates->templates[id];
+    if (template->shape != NULL) {
+        if (reserve(&templates->buf, &templates->capacity, templates->buf_size + template->shape_size) != 0) {
+            return -1;
+        }
+        format_timestamp(template->shape, template->shape_size, templates->timestamp, templates->buf + templates->buf_size);
+        templates->buf_size += template->shape_size;
+    }
+
+    for (size_t index = 0; index < template->token_count; ++ index) {
+        if (index > 0 && put_bytes(templates, " ", 1) != 0) {
+            return -1;
+        }
+
+        if (template->tokens[index] != NULL) {
+            if (put_bytes(templates, template->tokens[index], template->sizes[index]) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        uint64_t size;
+        if (read_varint(reader, &size) != 0) {
+            return -1;
+        }
+
+        if (size & 1) {
+            char number[24];
+            const int number_size = snprintf(number, sizeof(number), "%" PRIu64, size >> 1);
+            if (put_bytes(templates, number, number_size) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        size >>= 1;
+        if (size > INT_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (reserve(&templates->buf, &templates->capacity, templates->buf_size + size) != 0 ||
+            read_bytes(reader, templates->buf + templates->buf_size, size) != 0) {
+            return -1;
+        }
+        templates->buf_size += size;
+    }
+
+    return 0;
+}
+
+static int read_raw(struct Pipelog_Templates *templates, struct Pipelog_Template_Reader *reader) {
+    uint64_t delta, size;
+
+    if (read_varint(reader, &delta) != 0 || read_varint(reader, &size) != 0) {
+        return -1;
+    }
+    templates->timestamp += unzigzag(delta);
+    if (size > INT_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (reserve(&templates->buf, &templates->capacity, templates->buf_size + size) != 0 ||
+        read_bytes(reader, templates->buf + templates->buf_size, size) != 0) {
+        return -1;
+    }
+    templates->buf_size += size;
+
+    return 0;
+}
+
+int decode_templates(int infd, int outfd) {
+    struct Pipelog_Template_Reader reader = { .fd = infd, .pos = 0, .size = 0 };
+    struct Pipelog_Templates templates;
+    char magic[PIPELOG_TEMPLATE_MAGIC_SIZE];
+    int status = -1;
+
+    // the encoder state is reused: buf collects the output, templates is the dictionary
+    templates_init(&templates);
+
+    for (;;) {
+        const int type = read_byte(&reader);
+        if (type == -1) {
+            status = 0;
+            break;
+        }
+        if (type < 0) {
+            break;
+        }
+
+        if (type == PIPELOG_TEMPLATE_MAGIC[0]) {
+            magic[0] = type;
+            if (read_bytes(&reader, magic + 1, sizeof(magic) - 1) != 0) {
+                break;
+            }
+            if (memcmp(magic, PIPELOG_TEMPLATE_MAGIC, sizeof(magic)) != 0) {
+                errno = EINVAL;
+                break;
+            }
+
+            // new segment, new dictionary
+            for (size_t index = 0; index < templates.template_count; ++ index) {
+                template_free(&templates.templates[index]);
+            }
+            templates.template_count = 0;
+            templates.timestamp = 0;
+            continue;
+        }
+
+        const int kind = type & ~PIPELOG_TEMPLATE_NO_NEWLINE;
+        if (type == PIPELOG_TEMPLATE_DEFINE) {
+            if (read_definition(&templates, &reader) != 0) {
+                break;
+            }
+            continue;
+        } else if (kind == PIPELOG_TEMPLATE_RECORD) {
+            if (read_record(&templates, &reader) != 0) {
+                break;
+            }
+        } else if (kind == PIPELOG_TEMPLATE_RAW) {
+            if (read_raw(&templates, &reader) != 0) {
+                break;
+            }
+        } else {
+            errno = EINVAL;
+            break;
+        }
+
+        if (!(type & PIPELOG_TEMPLATE_NO_NEWLINE) && put_bytes(&templates, "\n", 1) != 0) {
+            break;
+        }
+
+        if (templates.buf_size >= BUFSIZ * 8) {
+            if (write_all(outfd, templates.buf, templates.buf_size) != 0) {
+                break;
+            }
+            templates.buf_size = 0;
+        }
+    }
+
+    if (status == 0 && write_all(outfd, templates.buf, templates.buf_size) != 0) {
+        status = -1;
+    }
+
+    const int errnum = errno;
+    templates_free(&templates);
+    errno = errnum;
+
+    return status;
+}
@@ -0,0 +1,129 @@
+#ifndef PIPELOG_TEMPLATE_H
+#define PIPELOG_TEMPLATE_H
+#pragma once
+
+#include "pipelog.h"
+#include "lines.h"
+#include "timestamp.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Every file, and every time a file is re-opened, starts with this magic. It
+ * resets the template dictionary, so each segment can be decoded on its own.
+ */
+#define PIPELOG_TEMPLATE_MAGIC "PLGTPL1\n"
+#define PIPELOG_TEMPLATE_MAGIC_SIZE 8
+
+// number of leading tokens used to find the leaf of the parse tree
+#define PIPELOG_TEMPLATE_DEPTH 2
+// percentage of tokens that have to be equal to join a template
+#define PIPELOG_TEMPLATE_SIMILARITY 50
+#define PIPELOG_TEMPLATE_MAX_TOKENS 128
+#define PIPELOG_TEMPLATE_MAX_CLUSTERS 64
+#define PIPELOG_TEMPLATE_MAX_TEMPLATES 65536
+
+/**
+ * Entry types. All numbers are LEB128 varints.
+ *
+ * DEFINE: id, shape size, shape, token count,
+ *         per token: (size << 1 | is_variable), bytes
+ * RECORD: template id, zigzag timestamp delta in ms,
+ *         per variable: (size << 1), bytes or (number << 1 | 1)
+ * RAW:    zigzag timestamp delta in ms, size, bytes
+ *
+ * Records are lines with the separating spaces and the newline removed. If
+ * the template has a timestamp shape (see timestamp_shape()) the line starts
+ * with the timestamp of the record formatted like the shape, followed by the
+ * tokens. Variables that are decimal numbers without leading zeros are
+ * stored as numbers.
+ * PIPELOG_TEMPLATE_NO_NEWLINE is or-ed to the type of the last line if it
+ * has no newline.
+ */
+enum {
+    PIPELOG_TEMPLATE_DEFINE     = 0x01,
+    PIPELOG_TEMPLATE_RECORD     = 0x02,
+    PIPELOG_TEMPLATE_RAW        = 0x03,
+    PIPELOG_TEMPLATE_NO_NEWLINE = 0x10,
+};
+
+struct Pipelog_Template {
+    char   *shape; //!< timestamp at the start of the line, NULL if none
+    size_t  shape_size;
+    size_t  token_count;
+    char  **tokens; //!< NULL for variables
+    size_t *sizes;
+};
+
+struct Pipelog_Template_Leaf {
+    char   *key;      //!< token count and the first tokens
+    size_t  key_size;
+    size_t  clusters[PIPELOG_TEMPLATE_MAX_CLUSTERS]; //!< latest template id of every cluster
+    size_t  cluster_count;
+};
+
+struct Pipelog_Templates {
+    struct Pipelog_Template *templates; //!< all versions, append-only
+    size_t template_count;
+    size_t template_capacity;
+    uint64_t *defined; //!< segment in which a template was last written
+
+    struct Pipelog_Template_Leaf **leaves; //!< hash table
+    size_t leaf_count;
+    size_t leaf_capacity;
+
+    uint64_t segment;
+    unsigned long opened; //!< file the current segment was written to
+    int64_t  timestamp;   //!< ms of the last record
+
+    const char *tokens[PIPELOG_TEMPLATE_MAX_TOKENS];
+    size_t      sizes[PIPELOG_TEMPLATE_MAX_TOKENS];
+
+    char   shape[PIPELOG_TIMESTAMP_SCAN + 1]; //!< timestamp shape of the current line
+    size_t shape_size;
+    char   formatted[PIPELOG_TIMESTAMP_SCAN + 1];
+
+    char  *key; //!< key of the current line
+    size_t key_capacity;
+
+    struct Pipelog_Lines pending;
+
+    char  *buf;
+    size_t buf_size;
+    size_t capacity;
+};
+
+void templates_init(struct Pipelog_Templates *templates);
+
+/**
+ * Learn templates from the lines in data and encode them. A new segment is
+ * started whenever opened differs from the last call, which means the output
+ * file was (re-)opened in between. An incomplete last line is kept for the
+ * next call unless flush is true.
+ *
+ * Returns a pointer to an internal buffer that is valid until the next call.
+ * *size is updated to the size of the returned data. Returns NULL and sets
+ * errno on error.
+ */
+const char *encode_templates(struct Pipelog_Templates *templates, unsigned long opened, const char *data, size_t *size, bool flush);
+
+void templates_free(struct Pipelog_Templates *templates);
+
+/**
+ * Restore the original text of a template encoded stream.
+ *
+ * Returns 0 on success, -1 on error and sets errno. errno is EINVAL if the
+ * input is malformed.
+ */
+int decode_templates(int infd, int outfd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
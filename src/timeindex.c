@@ -0,0 +1,273 @@
+#include "timeindex.h"
+#include "timestamp.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int index_filename(const char *filename, char *buf, size_t size) {
+    if (snprintf(buf, size, "%s%s", filename, PIPELOG_TIME_INDEX_SUFFIX) >= (int)size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static int read_entry(int fd, uint64_t entry, int64_t *time, uint64_t *offset) {
+    unsigned char buf[PIPELOG_TIME_INDEX_ENTRY_SIZE];
+    const off_t pos = PIPELOG_TIME_INDEX_MAGIC_SIZE + entry * PIPELOG_TIME_INDEX_ENTRY_SIZE;
+
+    for (;;) {
+        const ssize_t rcount = pread(fd, buf, sizeof(buf), pos);
+        if (rcount < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rcount != sizeof(buf)) {
+            if (rcount >= 0) {
+                errno = EINVAL;
+            }
+            return -1;
+        }
+        break;
+    }
+
+    *time   = (int64_t)get_uint64(buf);
+    *offset = get_uint64(buf + 8);
+
+    return 0;
+}
+
+int time_index_open(struct Pipelog_Time_Index *index, const char *filename, uint64_t size) {
+    char buf[PATH_MAX];
+    struct stat meta;
+
+    memset(index, 0, sizeof(*index));
+    index->fd = -1;
+
+    if (index_filename(filename, buf, sizeof(buf)) != 0) {
+        return -1;
+    }
+
+    index->fd = open(buf, O_CREAT | O_RDWR | O_CLOEXEC | O_APPEND | (size == 0 ? O_TRUNC : 0), 0644);
+    if (index->fd < 0) {
+        return -1;
+    }
+
+    if (fstat(index->fd, &meta) != 0) {
+        goto error;
+    }
+
+    if (meta.st_size == 0) {
+        if (write(index->fd, PIPELOG_TIME_INDEX_MAGIC, PIPELOG_TIME_INDEX_MAGIC_SIZE) != PIPELOG_TIME_INDEX_MAGIC_SIZE) {
+            goto error;
+        }
+    } else {
+        char magic[PIPELOG_TIME_INDEX_MAGIC_SIZE];
+        if (pread(index->fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+            memcmp(magic, PIPELOG_TIME_INDEX_MAGIC, sizeof(magic)) != 0 ||
+            (meta.st_size - PIPELOG_TIME_INDEX_MAGIC_SIZE) % PIPELOG_TIME_INDEX_ENTRY_SIZE != 0) {
+            errno = EINVAL;
+            goto error;
+        }
+
+        // continue after the last entry of an earlier run
+        const uint64_t count = (meta.st_size - PIPELOG_TIME_INDEX_MAGIC_SIZE) / PIPELOG_TIME_INDEX_ENTRY_SIZE;
+        if (count > 0) {
+            if (read_entry(index->fd, count - 1, &index->last_time, &index->last_offset) != 0) {
+                goto error;
+            }
+            index->has_entry = true;
+        }
+    }
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        close(index->fd);
+        index->fd = -1;
+        errno = errnum;
+    }
+
+    return -1;
+}
+
+static int write_entries(struct Pipelog_Time_Index *index, const unsigned char *buf, size_t count) {
+    const size_t size = count * PIPELOG_TIME_INDEX_ENTRY_SIZE;
+    const ssize_t wcount = write(index->fd, buf, size);
+    if (wcount != (ssize_t)size) {
+        if (wcount >= 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+int time_index_add(struct Pipelog_Time_Index *index, uint64_t offset, const char *data, size_t size, bool line_start, int64_t now, size_t bytes, unsigned int interval) {
+    unsigned char buf[PIPELOG_TIME_INDEX_BATCH * PIPELOG_TIME_INDEX_ENTRY_SIZE];
+    size_t count = 0;
+
+    // where the next entry is due, the first line start after that gets it
+    size_t pos = 0;
+    if (index->has_entry && now - index->last_arrival < (int64_t)interval * 1000) {
+        const uint64_t due = index->last_offset + bytes;
+        if (due >= offset + size) {
+            return 0;
+        }
+        pos = due > offset ? due - offset : 0;
+    }
+
+    while (pos < size) {
+        size_t start = pos;
+        if (pos > 0 || !line_start) {
+            const size_t from = pos > 0 ? pos - 1 : 0;
+            const char *newline = memchr(data + from, '\n', size - from);
+            if (newline == NULL) {
+                // try again with the next write
+                break;
+            }
+            start = newline - data + 1;
+        }
+
+        if (start >= size) {
+            break;
+        }
+
+        int64_t time = now;
+        int64_t nanos;
+        if (parse_timestamp(data + start, size - start, &nanos, NULL)) {
+            time = nanos / 1000000 - (nanos % 1000000 < 0);
+        }
+
+        // keep the entries sorted even if the lines are not
+        if (index->has_entry && time < index->last_time) {
+            time = index->last_time;
+        }
+
+        if (count == PIPELOG_TIME_INDEX_BATCH) {
+            if (write_entries(index, buf, count) != 0) {
+                return -1;
+            }
+            count = 0;
+        }
+
+        put_uint64(buf + count * PIPELOG_TIME_INDEX_ENTRY_SIZE, (uint64_t)time);
+        put_uint64(buf + count * PIPELOG_TIME_INDEX_ENTRY_SIZE + 8, offset + start);
+        ++ count;
+
+        index->has_entry    = true;
+        index->last_time    = time;
+        index->last_offset  = offset + start;
+        index->last_arrival = now;
+
+        if (bytes == 0) {
+            break;
+        }
+        pos = start + bytes;
+    }
+
+    if (count > 0 && write_entries(index, buf, count) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void time_index_close(struct Pipelog_Time_Index *index) {
+    if (index->fd >= 0) {
+        close(index->fd);
+    }
+    memset(index, 0, sizeof(*index));
+    index->fd = -1;
+}
+
+int time_index_lookup(const char *filename, int64_t from, int64_t to, uint64_t *start, uint64_t *end) {
+    char buf[PATH_MAX];
+    struct stat meta;
+    int64_t time;
+    uint64_t offset;
+    int status = -1;
+
+    if (index_filename(filename, buf, sizeof(buf)) != 0) {
+        return -1;
+    }
+
+    const int fd = open(buf, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &meta) != 0) {
+        goto cleanup;
+    }
+
+    if (meta.st_size < PIPELOG_TIME_INDEX_MAGIC_SIZE) {
+        errno = EINVAL;
+        goto cleanup;
+    }
+
+    const uint64_t count = (meta.st_size - PIPELOG_TIME_INDEX_MAGIC_SIZE) / PIPELOG_TIME_INDEX_ENTRY_SIZE;
+
+    // lines before the first entry with a time >= from are older
+    uint64_t low = 0, high = count;
+    while (low < high) {
+        const uint64_t mid = low + (high - low) / 2;
+        if (read_entry(fd, mid, &time, &offset) != 0) {
+            goto cleanup;
+        }
+        if (time < from) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    *start = 0;
+    if (low > 0) {
+        if (read_entry(fd, low - 1, &time, &offset) != 0) {
+            goto cleanup;
+        }
+        *start = offset;
+    }
+
+    // lines after the first entry with a time > to are newer
+    high = count;
+    while (low < high) {
+        const uint64_t mid = low + (high - low) / 2;
+        if (read_entry(fd, mid, &time, &offset) != 0) {
+            goto cleanup;
+        }
+        if (time <= to) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    *end = UINT64_MAX;
+    if (low < count) {
+        if (read_entry(fd, low, &time, &offset) != 0) {
+            goto cleanup;
+        }
+        *end = offset;
+    }
+
+    status = 0;
+
+cleanup:
+    {
+        const int errnum = errno;
+        close(fd);
+        errno = errnum;
+    }
+
+    return status;
+}
@@ -0,0 +1,72 @@
+#ifndef PIPELOG_TIMEINDEX_H
+#define PIPELOG_TIMEINDEX_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELOG_TIME_INDEX_MAGIC "PLGIDX1\n"
+#define PIPELOG_TIME_INDEX_MAGIC_SIZE 8
+#define PIPELOG_TIME_INDEX_SUFFIX ".idx"
+#define PIPELOG_TIME_INDEX_ENTRY_SIZE 16
+// entries written with one write() when a chunk is many times bytes
+#define PIPELOG_TIME_INDEX_BATCH 64
+
+/**
+ * The index file is the magic followed by fixed size entries of the
+ * timestamp (milliseconds since the epoch) and the offset of a line start in
+ * the log file, both as 64 bit little endian numbers. Timestamps never
+ * decrease, so entries can be found by binary search without reading the
+ * whole file.
+ */
+struct Pipelog_Time_Index {
+    int      fd;
+    bool     has_entry;
+    int64_t  last_time;
+    uint64_t last_offset;
+    int64_t  last_arrival; //!< now of the last entry
+};
+
+/**
+ * Open or create the index of the log file filename, i.e. filename.idx.
+ * New entries are appended. If the log file is empty (size is 0) old
+ * entries are removed, since they belong to a file that was rotated away.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int time_index_open(struct Pipelog_Time_Index *index, const char *filename, uint64_t size);
+
+/**
+ * Add entries for data, which is written to the log file at offset: at the
+ * first line if interval seconds have passed since the last entry, and at
+ * the first line after every bytes bytes since the last entry, so a chunk
+ * bigger than bytes gets several. line_start tells whether data starts at
+ * the start of a line. The entry's time is the timestamp of its line, or now
+ * (milliseconds since the epoch) if it has none.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int time_index_add(struct Pipelog_Time_Index *index, uint64_t offset, const char *data, size_t size, bool line_start, int64_t now, size_t bytes, unsigned int interval);
+
+void time_index_close(struct Pipelog_Time_Index *index);
+
+/**
+ * Find the byte range of the log file that holds all lines from from to to
+ * (milliseconds since the epoch, inclusive) using its index. *end is set to
+ * UINT64_MAX if the range extends to the end of the file.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int time_index_lookup(const char *filename, int64_t from, int64_t to, uint64_t *start, uint64_t *end);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
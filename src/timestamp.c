@@ -0,0 +1,235 @@
+#include "timestamp.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// returns the number of digits parsed, at most max
+static size_t parse_digits(const char *ptr, const char *end, size_t max, int64_t *value) {
+    size_t count = 0;
+    int64_t number = 0;
+
+    while (ptr < end && count < max && *ptr >= '0' && *ptr <= '9') {
+        number = number * 10 + (*ptr - '0');
+        ++ ptr;
+        ++ count;
+    }
+
+    *value = number;
+    return count;
+}
+
+// days since 1970-01-01 of a date in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t year, int64_t month, int64_t day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const int64_t year_of_era = year - era * 400;
+    const int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+static void civil_from_days(int64_t days, int64_t *year, int64_t *month, int64_t *day) {
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const int64_t day_of_era = days - era * 146097;
+    const int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const int64_t mp = (5 * day_of_year + 2) / 153;
+    *day   = day_of_year - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year  = year_of_era + era * 400 + (*month <= 2);
+}
+
+// parses [.,]DIGITS into nanoseconds
+static const char *parse_fraction(const char *ptr, const char *end, int64_t *nanos) {
+    *nanos = 0;
+
+    if (ptr + 1 < end && (*ptr == '.' || *ptr == ',') && ptr[1] >= '0' && ptr[1] <= '9') {
+        ++ ptr;
+        int64_t scale = 100000000;
+        while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+            *nanos += (*ptr - '0') * scale;
+            scale /= 10;
+            ++ ptr;
+        }
+    }
+
+    return ptr;
+}
+
+bool parse_timestamp(const char *line, size_t size, int64_t *nanos, size_t *length) {
+    const char *ptr = line;
+    const char *end = line + (size < PIPELOG_TIMESTAMP_SCAN ? size : PIPELOG_TIMESTAMP_SCAN);
+    int64_t year, month, day, hour, minute, second, fraction;
+
+    while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '[')) {
+        ++ ptr;
+    }
+
+    const size_t digits = parse_digits(ptr, end, 19, &year);
+    if (digits >= 10) {
+        // UNIX timestamp
+        ptr = parse_fraction(ptr + digits, end, &fraction);
+        if (ptr < end && *ptr >= '0' && *ptr <= '9') {
+            return false;
+        }
+        *nanos = year * 1000000000 + fraction;
+        if (length != NULL) {
+            *length = ptr - line;
+        }
+        return true;
+    }
+
+    if (digits != 4 || ptr + 19 > end) {
+        return false;
+    }
+    ptr += 4;
+
+    if (*ptr != '-' || parse_digits(ptr + 1, end, 2, &month) != 2 ||
+        ptr[3] != '-' || parse_digits(ptr + 4, end, 2, &day) != 2 ||
+        (ptr[6] != 'T' && ptr[6] != ' ') ||
+        parse_digits(ptr + 7, end, 2, &hour) != 2 ||
+        ptr[9] != ':' || parse_digits(ptr + 10, end, 2, &minute) != 2 ||
+        ptr[12] != ':' || parse_digits(ptr + 13, end, 2, &second) != 2) {
+        return false;
+    }
+    ptr += 15;
+
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return false;
+    }
+
+    ptr = parse_fraction(ptr, end, &fraction);
+
+    int64_t offset = 0;
+    if (ptr < end && *ptr == 'Z') {
+        ++ ptr;
+    } else if (ptr < end && (*ptr == '+' || *ptr == '-')) {
+        const int sign = *ptr == '-' ? -1 : 1;
+        int64_t offset_hour, offset_minute = 0;
+        if (parse_digits(ptr + 1, end, 2, &offset_hour) == 2) {
+            const char *minutes = ptr + 3;
+            if (minutes < end && *minutes == ':') {
+                ++ minutes;
+            }
+            if (parse_digits(minutes, end, 2, &offset_minute) == 2) {
+                ptr = minutes + 2;
+            } else {
+                offset_minute = 0;
+                ptr += 3;
+            }
+            offset = sign * (offset_hour * 3600 + offset_minute * 60);
+        }
+    }
+
+    const int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset;
+    *nanos = seconds * 1000000000 + fraction;
+    if (length != NULL) {
+        *length = ptr - line;
+    }
+
+    return true;
+}
+
+void timestamp_shape(const char *text, size_t size, char *shape) {
+    bool zone = false;
+    bool time = false;
+
+    for (size_t index = 0; index < size; ++ index) {
+        const char ch = text[index];
+
+        if (ch == ':') {
+            time = true;
+        } else if (ch == 'Z' || ch == '+' || (ch == '-' && time)) {
+            zone = true;
+        }
+
+        shape[index] = !zone && ch >= '0' && ch <= '9' ? '#' : ch;
+    }
+}
+
+static int64_t floor_div(int64_t value, int64_t divisor) {
+    const int64_t result = value / divisor;
+    return value % divisor < 0 ? result - 1 : result;
+}
+
+void format_timestamp(const char *shape, size_t size, int64_t millis, char *out) {
+    char digits[32];
+    size_t digit_count = 0;
+    bool iso = false;
+    int64_t offset = 0;
+
+    for (size_t index = 0; index < size; ++ index) {
+        if (shape[index] == ':') {
+            iso = true;
+        }
+    }
+
+    if (iso) {
+        // time zone offset follows the last '#'
+        size_t index = size;
+        while (index > 0 && shape[index - 1] != '#') {
+            -- index;
+        }
+        for (; index < size; ++ index) {
+            if (shape[index] == '+' || shape[index] == '-') {
+                int64_t hour, minute = 0;
+                const char *end = shape + size;
+                if (parse_digits(shape + index + 1, end, 2, &hour) == 2) {
+                    const char *minutes = shape + index + 3;
+                    if (minutes < end && *minutes == ':') {
+                        ++ minutes;
+                    }
+                    if (parse_digits(minutes, end, 2, &minute) != 2) {
+                        minute = 0;
+                    }
+                    offset = (shape[index] == '-' ? -1 : 1) * (hour * 3600 + minute * 60);
+                }
+                break;
+            }
+        }
+
+        const int64_t local = millis + offset * 1000;
+        const int64_t days = floor_div(local, 86400000);
+        const int64_t of_day = local - days * 86400000;
+        int64_t year, month, day;
+        civil_from_days(days, &year, &month, &day);
+
+        snprintf(digits, sizeof(digits), "%04d%02d%02d%02d%02d%02d%03d",
+            (int)(year % 10000), (int)month, (int)day,
+            (int)(of_day / 3600000), (int)(of_day / 60000 % 60), (int)(of_day / 1000 % 60), (int)(of_day % 1000));
+    } else {
+        size_t hashes = 0;
+        for (size_t index = 0; index < size && shape[index] != '.' && shape[index] != ','; ++ index) {
+            if (shape[index] == '#') {
+                ++ hashes;
+            }
+        }
+
+        const int64_t seconds = floor_div(millis, 1000);
+        snprintf(digits, sizeof(digits), "%0*lld%03d", (int)(hashes < 20 ? hashes : 20), (long long)seconds, (int)(millis - seconds * 1000));
+    }
+
+    const size_t available = strlen(digits);
+    for (size_t index = 0; index < size; ++ index) {
+        if (shape[index] == '#') {
+            out[index] = digit_count < available ? digits[digit_count] : '0';
+            ++ digit_count;
+        } else {
+            out[index] = shape[index];
+        }
+    }
+}
+
+int parse_time(const char *str, int64_t *millis) {
+    const size_t size = strlen(str);
+    int64_t nanos = 0;
+    size_t length = 0;
+
+    if (!parse_timestamp(str, size, &nanos, &length) || length != size) {
+        return -1;
+    }
+
+    *millis = nanos / 1000000 - (nanos % 1000000 < 0);
+    return 0;
+}
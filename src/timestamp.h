@@ -0,0 +1,57 @@
+#ifndef PIPELOG_TIMESTAMP_H
+#define PIPELOG_TIMESTAMP_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// only look this far into a line for the timestamp
+#define PIPELOG_TIMESTAMP_SCAN 64
+
+/**
+ * Parse the timestamp at the start of a log line, optionally preceded by
+ * white space and '['. Recognized are ISO 8601 like timestamps
+ * (YYYY-MM-DD[T ]HH:MM:SS[.FRACTION][Z|+HH:MM|+HHMM]) and UNIX timestamps
+ * with at least 10 digits and an optional fraction. Timestamps without a
+ * time zone are taken as UTC.
+ *
+ * Returns true and sets *nanos to nanoseconds since the epoch if a timestamp
+ * was found. If length isn't NULL it is set to the number of bytes from the
+ * start of line to the end of the timestamp.
+ */
+bool parse_timestamp(const char *line, size_t size, int64_t *nanos, size_t *length);
+
+/**
+ * Parse str, which has to be a whole timestamp as understood by
+ * parse_timestamp(), to milliseconds since the epoch.
+ *
+ * Returns 0 on success, -1 if str isn't a timestamp.
+ */
+int parse_time(const char *str, int64_t *millis);
+
+/**
+ * Write the shape of the timestamp text to shape: the digits of the date,
+ * time and fraction are replaced by '#', everything else (including the time
+ * zone) is kept. shape has to have room for size bytes.
+ */
+void timestamp_shape(const char *text, size_t size, char *shape);
+
+/**
+ * Format millis (milliseconds since the epoch) like the timestamp the shape
+ * was made of, in the time zone of the shape. out has to have room for size
+ * bytes. Digits of the fraction beyond milliseconds are written as 0, so
+ * compare the result with the original text to know if it is exact.
+ */
+void format_timestamp(const char *shape, size_t size, int64_t millis, char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,287 @@
+#include "transform.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+static const char *filter_lines(const struct Pipelog_Output *out, struct Pipelog_Line_Filters *filters, const char *data, size_t *size, bool flush) {
+    if (out->flags & PIPELOG_OUTPUT_STRIP_ANSI) {
+        data = strip_ansi(&filters->strip_ansi, data, size);
+        if (data == NULL) {
+            return NULL;
+        }
+    }
+
+    // after strip_ansi(), because ESC would be replaced here
+    if (out->flags & PIPELOG_OUTPUT_SANITIZE) {
+        data = sanitize_utf8(&filters->sanitize, data, size, flush);
+        if (data == NULL) {
+            return NULL;
+        }
+    }
+
+    return data;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int transform_init(struct Pipelog_Transform *transform, const struct Pipelog_Output output[], size_t count, size_t threads) {
+    memset(transform, 0, sizeof(*transform));
+    transform->output = output;
+    transform->count  = count;
+
+    for (size_t index = 0; index < count; ++ index) {
+        if (output[index].flags & PIPELOG_OUTPUT_LINE_FILTERS) {
+            transform->active = true;
+            break;
+        }
+    }
+
+    // pass-through stays single threaded
+    if (!transform->active || threads < 1) {
+        threads = 1;
+    }
+    transform->threads = threads;
+
+    transform->filters           = calloc(threads * count, sizeof(struct Pipelog_Line_Filters));
+    transform->block_data        = calloc(threads, sizeof(const char*));
+    transform->block_size        = calloc(threads, sizeof(size_t));
+    transform->block_result      = calloc(threads * count, sizeof(const char*));
+    transform->block_result_size = calloc(threads * count, sizeof(size_t));
+    transform->joined            = calloc(count, sizeof(char*));
+    transform->joined_capacity   = calloc(count, sizeof(size_t));
+    transform->result            = calloc(count, sizeof(const char*));
+    transform->result_size       = calloc(count, sizeof(size_t));
+
+    if ((count > 0 && (
+            transform->filters == NULL || transform->block_result == NULL || transform->block_result_size == NULL ||
+            transform->joined == NULL || transform->joined_capacity == NULL ||
+            transform->result == NULL || transform->result_size == NULL)) ||
+        transform->block_data == NULL || transform->block_size == NULL) {
+        goto error;
+    }
+
+    if (threads > 1) {
+        transform->pool = pool_create(threads);
+        if (transform->pool == NULL) {
+            goto error;
+        }
+    }
+
+    return 0;
+
+error:
+    {
+        const int errnum = errno;
+        transform_free(transform);
+        errno = errnum;
+    }
+    return -1;
+}
+
+static void transform_block(void *context, size_t block) {
+    struct Pipelog_Transform *transform = context;
+    const size_t count = transform->count;
+
+    for (size_t index = 0; index < count; ++ index) {
+        const struct Pipelog_Output *out = &transform->output[index];
+        const size_t slot = block * count + index;
+
+        if (!(out->flags & PIPELOG_OUTPUT_LINE_FILTERS)) {
+            continue;
+        }
+
+        size_t size = transform->block_size[block];
+        const char *data = filter_lines(out, &transform->filters[slot], transform->block_data[block], &size, false);
+        if (data == NULL) {
+            __atomic_store_n(&transform->errnum, errno, __ATOMIC_RELAXED);
+            return;
+        }
+
+        transform->block_result[slot]      = data;
+        transform->block_result_size[slot] = size;
+    }
+}
+
+// split at newlines into at most transform->threads blocks of about the same size
+static void split_blocks(struct Pipelog_Transform *transform, const char *data, size_t size) {
+    size_t target = size / transform->threads;
+    if (target < PIPELOG_TRANSFORM_MIN_BLOCK) {
+        target = PIPELOG_TRANSFORM_MIN_BLOCK;
+    }
+
+    const char *end = data + size;
+    size_t block_count = 0;
+    while (data < end) {
+        const char *block_end = end;
+
+        if (block_count + 1 < transform->threads && (size_t)(end - data) > target) {
+            const char *newline = memchr(data + target, '\n', end - data - target);
+            if (newline != NULL) {
+                block_end = newline + 1;
+            }
+        }
+
+        transform->block_data[block_count] = data;
+        transform->block_size[block_count] = block_end - data;
+        ++ block_count;
+        data = block_end;
+    }
+
+    transform->block_count = block_count;
+}
+
+static int transform_parallel(struct Pipelog_Transform *transform, const char *data, size_t size) {
+    const size_t count = transform->count;
+
+    split_blocks(transform, data, size);
+
+    const size_t block_count = transform->block_count;
+    if (block_count < 2) {
+        return 1;
+    }
+
+    // blocks after the first one start after a newline, i.e. in the initial state
+    for (size_t block = 1; block < block_count; ++ block) {
+        for (size_t index = 0; index < count; ++ index) {
+            struct Pipelog_Line_Filters *filters = &transform->filters[block * count + index];
+            filters->strip_ansi.state = 0;
+            filters->sanitize.pending_size = 0;
+        }
+    }
+
+    transform->errnum = 0;
+    pool_run(transform->pool, transform_block, transform, block_count);
+
+    if (transform->errnum != 0) {
+        errno = transform->errnum;
+        return -1;
+    }
+
+    // sequencer: reassemble the blocks in order
+    const size_t last = block_count - 1;
+    for (size_t index = 0; index < count; ++ index) {
+        const struct Pipelog_Output *out = &transform->output[index];
+
+        if (!(out->flags & PIPELOG_OUTPUT_LINE_FILTERS)) {
+            transform->result[index]      = data;
+            transform->result_size[index] = size;
+            continue;
+        }
+
+        size_t joined_size = 0;
+        for (size_t block = 0; block < block_count; ++ block) {
+            joined_size += transform->block_result_size[block * count + index];
+        }
+
+        if (joined_size > transform->joined_capacity[index]) {
+            char *joined = realloc(transform->joined[index], joined_size);
+            if (joined == NULL) {
+                return -1;
+            }
+            transform->joined[index] = joined;
+            transform->joined_capacity[index] = joined_size;
+        }
+
+        char *ptr = transform->joined[index];
+        for (size_t block = 0; block < block_count; ++ block) {
+            const size_t slot = block * count + index;
+            memcpy(ptr, transform->block_result[slot], transform->block_result_size[slot]);
+            ptr += transform->block_result_size[slot];
+        }
+
+        transform->result[index]      = transform->joined[index];
+        transform->result_size[index] = joined_size;
+
+        // the next chunk continues where the last block ended
+        struct Pipelog_Line_Filters *first = &transform->filters[index];
+        const struct Pipelog_Line_Filters *tail = &transform->filters[last * count + index];
+        first->strip_ansi.state = tail->strip_ansi.state;
+        memcpy(first->sanitize.pending, tail->sanitize.pending, tail->sanitize.pending_size);
+        first->sanitize.pending_size = tail->sanitize.pending_size;
+    }
+
+    return 0;
+}
+
+int transform_run(struct Pipelog_Transform *transform, const char *data, size_t size, bool flush) {
+    const size_t count = transform->count;
+
+    if (!transform->active) {
+        for (size_t index = 0; index < count; ++ index) {
+            transform->result[index]      = data;
+            transform->result_size[index] = size;
+        }
+        return 0;
+    }
+
+    const bool measure = transform->pool == NULL ? false :
+        transform->ns_per_byte == 0.0 || transform->parallel_chunks >= PIPELOG_TRANSFORM_RESAMPLE;
+
+    if (transform->pool != NULL && !flush && !measure &&
+        size >= 2 * PIPELOG_TRANSFORM_MIN_BLOCK &&
+        transform->ns_per_byte * size >= PIPELOG_TRANSFORM_MIN_WORK_NS) {
+        const int result = transform_parallel(transform, data, size);
+        if (result <= 0) {
+            ++ transform->parallel_chunks;
+            return result;
+        }
+        // only one line, fall through
+    }
+
+    const uint64_t start = measure ? monotonic_ns() : 0;
+
+    for (size_t index = 0; index < count; ++ index) {
+        size_t out_size = size;
+        const char *out_data = filter_lines(&transform->output[index], &transform->filters[index], data, &out_size, flush);
+        if (out_data == NULL) {
+            return -1;
+        }
+        transform->result[index]      = out_data;
+        transform->result_size[index] = out_size;
+    }
+
+    // tiny chunks are dominated by call overhead and say nothing about big ones
+    if (measure && size >= PIPELOG_TRANSFORM_MIN_BLOCK) {
+        transform->ns_per_byte = (double)(monotonic_ns() - start) / size;
+        transform->parallel_chunks = 0;
+    }
+
+    return 0;
+}
+
+void transform_free(struct Pipelog_Transform *transform) {
+    pool_destroy(transform->pool);
+    transform->pool = NULL;
+
+    if (transform->filters != NULL) {
+        for (size_t slot = 0; slot < transform->threads * transform->count; ++ slot) {
+            strip_ansi_free(&transform->filters[slot].strip_ansi);
+            sanitize_utf8_free(&transform->filters[slot].sanitize);
+        }
+    }
+
+    if (transform->joined != NULL) {
+        for (size_t index = 0; index < transform->count; ++ index) {
+            free(transform->joined[index]);
+        }
+    }
+
+    free(transform->filters);
+    free(transform->block_data);
+    free(transform->block_size);
+    free(transform->block_result);
+    free(transform->block_result_size);
+    free(transform->joined);
+    free(transform->joined_capacity);
+    free(transform->result);
+    free(transform->result_size);
+
+    memset(transform, 0, sizeof(*transform));
+}
@@ -0,0 +1,95 @@
+#ifndef PIPELOG_TRANSFORM_H
+#define PIPELOG_TRANSFORM_H
+#pragma once
+
+#include "pipelog.h"
+#include "ansi.h"
+#include "utf8.h"
+#include "pool.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Output options that transform every line on its own, without looking at
+ * other lines. Data split after a newline can be transformed independently.
+ */
+#define PIPELOG_OUTPUT_LINE_FILTERS (PIPELOG_OUTPUT_STRIP_ANSI | PIPELOG_OUTPUT_SANITIZE)
+
+// don't split reads into blocks smaller than this
+#define PIPELOG_TRANSFORM_MIN_BLOCK (16 * 1024)
+
+// estimated single threaded time a chunk has to take to be worth waking up the pool
+#define PIPELOG_TRANSFORM_MIN_WORK_NS 200000
+
+// re-measure the single threaded cost after this many parallel chunks
+#define PIPELOG_TRANSFORM_RESAMPLE 32
+
+struct Pipelog_Line_Filters {
+    struct Pipelog_Strip_Ansi strip_ansi;
+    struct Pipelog_Sanitize   sanitize;
+};
+
+struct Pipelog_Transform {
+    const struct Pipelog_Output *output;
+    size_t count;
+    bool   active; //!< any output has line filters
+
+    struct Pipelog_Pool *pool; //!< NULL if single threaded
+    size_t threads;
+
+    /**
+     * filters[block * count + index]. Block 0 holds the state carried from
+     * one chunk to the next, the other blocks always start after a newline.
+     */
+    struct Pipelog_Line_Filters *filters;
+
+    const char  *data;
+    const char **block_data;  //!< [threads]
+    size_t      *block_size;  //!< [threads]
+    size_t       block_count;
+    const char **block_result; //!< [threads * count]
+    size_t      *block_result_size;
+    int          errnum;
+
+    char  **joined;            //!< [count] blocks reassembled in order
+    size_t *joined_capacity;
+
+    const char **result;      //!< [count] transformed data per output
+    size_t      *result_size;
+
+    double   ns_per_byte;     //!< measured single threaded cost
+    unsigned parallel_chunks; //!< parallel chunks since the last measurement
+};
+
+/**
+ * If threads is greater than 1 and any output has line filters a thread pool
+ * is created, otherwise everything runs in the calling thread.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int transform_init(struct Pipelog_Transform *transform, const struct Pipelog_Output output[], size_t count, size_t threads);
+
+/**
+ * Apply the line filters of every output to data. Large chunks are split into
+ * line-aligned blocks that are processed on the thread pool and reassembled
+ * in order, but only if the measured cost per byte makes it worthwhile.
+ * Outputs without line filters get data as is.
+ *
+ * Afterwards transform->result[index] and transform->result_size[index] hold
+ * the data for output index. They are valid until the next call.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int transform_run(struct Pipelog_Transform *transform, const char *data, size_t size, bool flush);
+
+void transform_free(struct Pipelog_Transform *transform);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,339 @@
+#include "utf8.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_SSSE3 1
+#endif
+
+enum {
+    UTF8_VALID,
+    UTF8_CONTROL,
+    UTF8_INVALID,
+    UTF8_INCOMPLETE,
+};
+
+static const unsigned char REPLACEMENT_CHARACTER[] = { 0xEF, 0xBF, 0xBD };
+
+/**
+ * Decode the character at ptr. *length is set to the number of bytes that
+ * belong to the character, to the maximal valid subpart in case of
+ * UTF8_INVALID, or to avail in case of UTF8_INCOMPLETE.
+ */
+static int utf8_decode(const unsigned char *ptr, size_t avail, size_t *length) {
+    const unsigned char ch = ptr[0];
+
+    if (ch < 0x80) {
+        *length = 1;
+        return ch < 0x20 && ch != '\t' && ch != '\n' ? UTF8_CONTROL : UTF8_VALID;
+    }
+
+    size_t need;
+    unsigned char lower = 0x80;
+    unsigned char upper = 0xBF;
+
+    if (ch >= 0xC2 && ch <= 0xDF) {
+        need = 2;
+    } else if (ch >= 0xE0 && ch <= 0xEF) {
+        need = 3;
+        if (ch == 0xE0) {
+            lower = 0xA0; // overlong
+        } else if (ch == 0xED) {
+            upper = 0x9F; // surrogates
+        }
+    } else if (ch >= 0xF0 && ch <= 0xF4) {
+        need = 4;
+        if (ch == 0xF0) {
+            lower = 0x90; // overlong
+        } else if (ch == 0xF4) {
+            upper = 0x8F; // > U+10FFFF
+        }
+    } else {
+        *length = 1;
+        return UTF8_INVALID;
+    }
+
+    for (size_t index = 1; index < need; ++ index) {
+        if (index >= avail) {
+            *length = index;
+            return UTF8_INCOMPLETE;
+        }
+
+        const unsigned char cont = ptr[index];
+        if (cont < lower || cont > upper) {
+            *length = index;
+            return UTF8_INVALID;
+        }
+
+        lower = 0x80;
+        upper = 0xBF;
+    }
+
+    *length = need;
+    return UTF8_VALID;
+}
+
+#ifdef HAS_SSSE3
+// Lookup table based validation as described in: John Keiser, Daniel Lemire,
+// "Validating UTF-8 In Less Than One Instruction Per Byte" (2021)
+#define TOO_SHORT      (1 << 0)
+#define TOO_LONG       (1 << 1)
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7)
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static size_t utf8_clean_blocks_ssse3(const unsigned char *data, size_t size) {
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        (char)(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4)
+    );
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        (char)(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+        (char)(CARRY | OVERLONG_2),
+        (char)CARRY,
+        (char)CARRY,
+        (char)(CARRY | TOO_LARGE),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000)
+    );
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE),
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE),
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+    );
+    // the last three bytes of a block must not start a sequence that
+    // continues in the next block
+    const __m128i incomplete_max = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1)
+    );
+    const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+    const __m128i c0_max      = _mm_set1_epi8(0x1F);
+    const __m128i tab         = _mm_set1_epi8('\t');
+    const __m128i newline     = _mm_set1_epi8('\n');
+    const __m128i zero        = _mm_setzero_si128();
+
+    __m128i prev_input      = zero;
+    __m128i prev_incomplete = zero;
+    size_t offset = 0;
+
+    for (; size - offset >= 16; offset += 16) {
+        const __m128i input = _mm_loadu_si128((const __m128i*)(data + offset));
+        const __m128i control = _mm_andnot_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(input, tab), _mm_cmpeq_epi8(input, newline)),
+            _mm_cmpeq_epi8(_mm_min_epu8(input, c0_max), input)
+        );
+        __m128i error;
+
+        if (_mm_movemask_epi8(input) == 0) {
+            error = prev_incomplete;
+            prev_incomplete = zero;
+        } else {
+            const __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+            const __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble_mask));
+            const __m128i byte_1_low  = _mm_shuffle_epi8(byte_1_low_table,  _mm_and_si128(prev1, nibble_mask));
+            const __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), nibble_mask));
+            const __m128i special_cases = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+            const __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+            const __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+            const __m128i is_third_byte  = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+            const __m128i is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80));
+            const __m128i must_be_2_3_continuation = _mm_and_si128(
+                _mm_or_si128(is_third_byte, is_fourth_byte),
+                _mm_set1_epi8((char)0x80)
+            );
+
+            error = _mm_xor_si128(must_be_2_3_continuation, special_cases);
+            prev_incomplete = _mm_subs_epu8(input, incomplete_max);
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(error, control), zero)) != 0xFFFF) {
+            break;
+        }
+
+        prev_input = input;
+    }
+
+    // don't split a character that started in the last checked block
+    for (size_t back = 1; back <= 3 && back <= offset; ++ back) {
+        const unsigned char ch = data[offset - back];
+        if ((ch & 0xC0) != 0x80) {
+            if (ch >= 0xC0) {
+                const size_t length = ch >= 0xF0 ? 4 : ch >= 0xE0 ? 3 : 2;
+                if (back < length) {
+                    offset -= back;
+                }
+            }
+            break;
+        }
+    }
+
+    return offset;
+}
+#endif
+
+size_t utf8_clean_length(const char *data, size_t size) {
+    const unsigned char *ptr = (const unsigned char*)data;
+    size_t offset = 0;
+
+#ifdef HAS_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        offset = utf8_clean_blocks_ssse3(ptr, size);
+    }
+#endif
+
+    while (offset < size) {
+        size_t length;
+        if (utf8_decode(ptr + offset, size - offset, &length) != UTF8_VALID) {
+            break;
+        }
+        offset += length;
+    }
+
+    return offset;
+}
+
+const char *sanitize_utf8(struct Pipelog_Sanitize *filter, const char *data, size_t *size, bool flush) {
+    const unsigned char *ptr = (const unsigned char*)data;
+    const unsigned char *end = ptr + *size;
+    size_t clean = 0;
+
+    if (filter->pending_size == 0) {
+        clean = utf8_clean_length(data, *size);
+        if (clean == *size) {
+            // clean chunk, pass through as is
+            return data;
+        }
+    }
+
+    // worst case every byte is replaced by U+FFFD
+    const size_t capacity = (*size + sizeof(filter->pending)) * sizeof(REPLACEMENT_CHARACTER);
+    if (filter->capacity < capacity) {
+        char *buf = realloc(filter->buf, capacity);
+        if (buf == NULL) {
+            return NULL;
+        }
+        filter->buf = buf;
+        filter->capacity = capacity;
+    }
+
+    unsigned char *out = (unsigned char*)filter->buf;
+
+    if (filter->pending_size > 0) {
+        // complete the character that was split at the end of the last chunk
+        unsigned char tmp[sizeof(filter->pending) * 2];
+        const size_t pending_size = filter->pending_size;
+        const size_t avail = *size < sizeof(filter->pending) ? *size : sizeof(filter->pending);
+        size_t length;
+
+        memcpy(tmp, filter->pending, pending_size);
+        memcpy(tmp + pending_size, ptr, avail);
+        filter->pending_size = 0;
+
+        switch (utf8_decode(tmp, pending_size + avail, &length)) {
+            case UTF8_INCOMPLETE:
+                if (flush) {
+                    memcpy(out, REPLACEMENT_CHARACTER, sizeof(REPLACEMENT_CHARACTER));
+                    *size = sizeof(REPLACEMENT_CHARACTER);
+                } else {
+                    memcpy(filter->pending, tmp, length);
+                    filter->pending_size = length;
+                    *size = 0;
+                }
+                return filter->buf;
+
+            case UTF8_VALID:
+                memcpy(out, tmp, length);
+                out += length;
+                break;
+
+            default:
+                memcpy(out, REPLACEMENT_CHARACTER, sizeof(REPLACEMENT_CHARACTER));
+                out += sizeof(REPLACEMENT_CHARACTER);
+                break;
+        }
+
+        // pending bytes are always a valid prefix, so length >= pending_size
+        ptr += length - pending_size;
+        clean = utf8_clean_length((const char*)ptr, end - ptr);
+    }
+
+    for (;;) {
+        memcpy(out, ptr, clean);
+        out += clean;
+        ptr += clean;
+
+        // handle at least one block the slow way before trying the fast path again
+        const unsigned char *stop = end - ptr > 16 ? ptr + 16 : end;
+        while (ptr < stop) {
+            size_t length;
+            switch (utf8_decode(ptr, end - ptr, &length)) {
+                case UTF8_VALID:
+                    memcpy(out, ptr, length);
+                    out += length;
+                    break;
+
+                case UTF8_INCOMPLETE:
+                    if (flush) {
+                        memcpy(out, REPLACEMENT_CHARACTER, sizeof(REPLACEMENT_CHARACTER));
+                        out += sizeof(REPLACEMENT_CHARACTER);
+                    } else {
+                        memcpy(filter->pending, ptr, length);
+                        filter->pending_size = length;
+                    }
+                    break;
+
+                default:
+                    memcpy(out, REPLACEMENT_CHARACTER, sizeof(REPLACEMENT_CHARACTER));
+                    out += sizeof(REPLACEMENT_CHARACTER);
+                    break;
+            }
+            ptr += length;
+        }
+
+        if (ptr >= end) {
+            break;
+        }
+
+        clean = utf8_clean_length((const char*)ptr, end - ptr);
+    }
+
+    *size = out - (unsigned char*)filter->buf;
+
+    return filter->buf;
+}
+
+void sanitize_utf8_free(struct Pipelog_Sanitize *filter) {
+    free(filter->buf);
+    filter->buf = NULL;
+    filter->capacity = 0;
+    filter->pending_size = 0;
+}
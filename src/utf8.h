@@ -0,0 +1,44 @@
+#ifndef PIPELOG_UTF8_H
+#define PIPELOG_UTF8_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct Pipelog_Sanitize {
+    unsigned char pending[4]; //!< incomplete UTF-8 sequence at the end of the last chunk
+    size_t pending_size;
+    char  *buf;               //!< output buffer (only used if a chunk needed changes)
+    size_t capacity;          //!< allocated size of buf
+};
+
+/**
+ * Returns the length of the longest prefix of data (rounded down to a
+ * character boundary) that is valid UTF-8 and contains no C0 control
+ * characters other than tab and newline.
+ */
+size_t utf8_clean_length(const char *data, size_t size);
+
+/**
+ * Replace invalid UTF-8 sequences and C0 control characters other than tab
+ * and newline by U+FFFD. Sequences may be split across calls. If flush is
+ * true an incomplete sequence at the end of data is replaced as well.
+ *
+ * Returns data itself if it was already clean, otherwise a pointer to an
+ * internal buffer that is valid until the next call. *size is updated to
+ * the size of the returned data. Returns NULL and sets errno on error.
+ */
+const char *sanitize_utf8(struct Pipelog_Sanitize *filter, const char *data, size_t *size, bool flush);
+
+void sanitize_utf8_free(struct Pipelog_Sanitize *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+int reserve(char **buf, size_t *capacity, size_t size) {
+    if (size <= *capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = *capacity == 0 ? BUFSIZ : *capacity;
+    while (new_capacity < size) {
+        new_capacity *= 2;
+    }
+
+    char *new_buf = realloc(*buf, new_capacity);
+    if (new_buf == NULL) {
+        return -1;
+    }
+
+    *buf = new_buf;
+    *capacity = new_capacity;
+
+    return 0;
+}
+
+int write_all(int fd, const void *data, size_t size) {
+    const char *ptr = data;
+    while (size > 0) {
+        const ssize_t wcount = write(fd, ptr, size);
+        if (wcount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        ptr  += wcount;
+        size -= wcount;
+    }
+    return 0;
+}
+
+int pwrite_all(int fd, const void *data, size_t size, uint64_t offset) {
+    const char *ptr = data;
+    while (size > 0) {
+        const ssize_t wcount = pwrite(fd, ptr, size, offset);
+        if (wcount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        ptr    += wcount;
+        size   -= wcount;
+        offset += wcount;
+    }
+    return 0;
+}
+
+int pread_all(int fd, void *data, size_t size, uint64_t offset) {
+    char *ptr = data;
+    while (size > 0) {
+        const ssize_t rcount = pread(fd, ptr, size, offset);
+        if (rcount < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (rcount == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        ptr    += rcount;
+        size   -= rcount;
+        offset += rcount;
+    }
+    return 0;
+}
+
+ssize_t read_full(int fd, void *buf, size_t size) {
+    char *ptr = buf;
+    size_t offset = 0;
+    while (offset < size) {
+        const ssize_t count = read(fd, ptr + offset, size - offset);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (count == 0) {
+            break;
+        }
+        offset += count;
+    }
+    return offset;
+}
+
+void put_uint32(unsigned char *buf, uint32_t value) {
+    for (size_t index = 0; index < 4; ++ index) {
+        buf[index] = value >> (index * 8);
+    }
+}
+
+uint32_t get_uint32(const unsigned char *buf) {
+    uint32_t value = 0;
+    for (size_t index = 0; index < 4; ++ index) {
+        value |= (uint32_t)buf[index] << (index * 8);
+    }
+    return value;
+}
+
+void put_uint64(unsigned char *buf, uint64_t value) {
+    for (size_t index = 0; index < 8; ++ index) {
+        buf[index] = value >> (index * 8);
+    }
+}
+
+uint64_t get_uint64(const unsigned char *buf) {
+    uint64_t value = 0;
+    for (size_t index = 0; index < 8; ++ index) {
+        value |= (uint64_t)buf[index] << (index * 8);
+    }
+    return value;
+}
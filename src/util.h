@@ -0,0 +1,59 @@
+#ifndef PIPELOG_UTIL_H
+#define PIPELOG_UTIL_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Small buffer, I/O and encoding helpers shared by the output modules.
+ */
+
+/**
+ * Grow *buf to hold at least size bytes, doubling its capacity (starting at
+ * BUFSIZ). Returns 0 on success, -1 on allocation errors (errno is set).
+ */
+int reserve(char **buf, size_t *capacity, size_t size);
+
+/**
+ * Write all of data, retrying on EINTR and short writes.
+ * Returns 0 on success, -1 on error (errno is set).
+ */
+int write_all(int fd, const void *data, size_t size);
+
+/**
+ * Like write_all(), but at offset, without moving the file position.
+ */
+int pwrite_all(int fd, const void *data, size_t size, uint64_t offset);
+
+/**
+ * Read exactly size bytes at offset, without moving the file position.
+ * Returns 0 on success, -1 on error (errno is set, EINVAL at end of file).
+ */
+int pread_all(int fd, void *data, size_t size, uint64_t offset);
+
+/**
+ * Read until buf is full or end of file, retrying on EINTR and short reads.
+ * Returns the number of bytes read, or -1 on error (errno is set).
+ */
+ssize_t read_full(int fd, void *buf, size_t size);
+
+// little-endian fixed-size integers, as used by all on-disk formats
+
+void put_uint32(unsigned char *buf, uint32_t value);
+uint32_t get_uint32(const unsigned char *buf);
+
+void put_uint64(unsigned char *buf, uint64_t value);
+uint64_t get_uint64(const unsigned char *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
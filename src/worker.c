@@ -0,0 +1,101 @@
+#include "worker.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+static void *worker_thread(void *arg) {
+    struct Pipelog_Worker *worker = arg;
+
+    pthread_mutex_lock(&worker->mutex);
+    for (;;) {
+        while (worker->head == NULL && !worker->stop) {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+
+        struct Pipelog_Worker_Job *job = worker->head;
+        if (job == NULL) {
+            // stopped and nothing left to do
+            break;
+        }
+
+        worker->head = job->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        pthread_mutex_unlock(&worker->mutex);
+
+        job->job(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&worker->mutex);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+
+    return NULL;
+}
+
+int worker_start(struct Pipelog_Worker *worker) {
+    memset(worker, 0, sizeof(*worker));
+    pthread_mutex_init(&worker->mutex, NULL);
+    pthread_cond_init(&worker->cond, NULL);
+
+    // signals are handled by the main thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    const int errnum = pthread_create(&worker->thread, NULL, worker_thread, worker);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (errnum != 0) {
+        pthread_cond_destroy(&worker->cond);
+        pthread_mutex_destroy(&worker->mutex);
+        errno = errnum;
+        return -1;
+    }
+
+    worker->started = true;
+
+    return 0;
+}
+
+int worker_submit(struct Pipelog_Worker *worker, Pipelog_Job job, void *arg) {
+    struct Pipelog_Worker_Job *entry = malloc(sizeof(struct Pipelog_Worker_Job));
+    if (entry == NULL) {
+        return -1;
+    }
+
+    entry->job  = job;
+    entry->arg  = arg;
+    entry->next = NULL;
+
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->tail == NULL) {
+        worker->head = entry;
+    } else {
+        worker->tail->next = entry;
+    }
+    worker->tail = entry;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+
+    return 0;
+}
+
+void worker_stop(struct Pipelog_Worker *worker) {
+    if (!worker->started) {
+        return;
+    }
+
+    pthread_mutex_lock(&worker->mutex);
+    worker->stop = true;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+
+    pthread_join(worker->thread, NULL);
+
+    pthread_cond_destroy(&worker->cond);
+    pthread_mutex_destroy(&worker->mutex);
+    worker->started = false;
+}
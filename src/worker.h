@@ -0,0 +1,61 @@
+#ifndef PIPELOG_WORKER_H
+#define PIPELOG_WORKER_H
+#pragma once
+
+#include "pipelog.h"
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*Pipelog_Job)(void *arg);
+
+struct Pipelog_Worker_Job {
+    Pipelog_Job job;
+    void *arg;
+    struct Pipelog_Worker_Job *next;
+};
+
+/**
+ * A background thread that runs jobs one after another, in the order they
+ * were submitted. Used for work that must not delay logging, like converting
+ * rotated files.
+ */
+struct Pipelog_Worker {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    pthread_t       thread;
+    struct Pipelog_Worker_Job *head;
+    struct Pipelog_Worker_Job *tail;
+    bool stop;
+    bool started;
+};
+
+/**
+ * The worker thread blocks all signals.
+ *
+ * Returns 0 on success, -1 on error and sets errno.
+ */
+int worker_start(struct Pipelog_Worker *worker);
+
+/**
+ * Queue job(arg) to be run on the worker thread. The job owns arg.
+ *
+ * Returns 0 on success, -1 on error and sets errno. On error the job is
+ * not run.
+ */
+int worker_submit(struct Pipelog_Worker *worker, Pipelog_Job job, void *arg);
+
+/**
+ * Run all queued jobs and stop the worker thread.
+ */
+void worker_stop(struct Pipelog_Worker *worker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif